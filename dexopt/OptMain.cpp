@@ -167,6 +167,13 @@ static int extractAndProcessZip(int zipFd, int cacheFd,
             default:                                            break;
             }
         }
+
+        opc = strstr(dexoptFlagStr, "t=");      /* worker threads */
+        if (opc != NULL) {
+            int threads = atoi(opc+2);
+            if (threads > 0 && threads <= DEXOPT_MAX_THREADS)
+                dexoptFlags |= threads << DEXOPT_THREADS_SHIFT;
+        }
     }
 
     /*
@@ -397,7 +404,7 @@ bail:
  *   6. filename of file being optimized (for debug messages only)
  *   7. modification date of source (goes into dependency section)
  *   8. CRC of source (goes into dependency section)
- *   9. flags (optimization level, isBootstrap)
+ *   9. flags (optimization level, isBootstrap, worker thread count)
  *  10. bootclasspath entry #1
  *  11. bootclasspath entry #2
  *   ...
@@ -26,6 +26,9 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#ifdef HAVE_PTHREADS
+# include <pthread.h>
+#endif
 
 #include <JNIHelp.h>        // TEMP_FAILURE_RETRY may or may not be in unistd
 
@@ -470,6 +473,25 @@ ZipEntry findEntryByIndex(ZipArchive* pArchive, int idx)
 }
 #endif
 
+/*
+ * Read "count" bytes at "offset" without moving the file position (where
+ * the system lets us), so that several threads can read one archive.
+ *
+ * Returns 0 on success.
+ */
+static int readAt(int fd, off_t offset, void* buf, size_t count)
+{
+    ssize_t actual;
+#ifdef HAVE_POSIX_FILEMAP
+    actual = TEMP_FAILURE_RETRY(pread(fd, buf, count, offset));
+#else
+    if (lseek(fd, offset, SEEK_SET) != offset)
+        return -1;
+    actual = TEMP_FAILURE_RETRY(read(fd, buf, count));
+#endif
+    return (actual == (ssize_t) count) ? 0 : -1;
+}
+
 /*
  * Get the useful fields from the zip entry.
  *
@@ -536,13 +558,7 @@ int dexZipGetEntryInfo(const ZipArchive* pArchive, ZipEntry entry,
         }
 
         u1 lfhBuf[kLFHLen];
-        if (lseek(pArchive->mFd, localHdrOffset, SEEK_SET) != localHdrOffset) {
-            ALOGW("Zip: failed seeking to lfh at offset %ld", localHdrOffset);
-            return -1;
-        }
-        ssize_t actual =
-            TEMP_FAILURE_RETRY(read(pArchive->mFd, lfhBuf, sizeof(lfhBuf)));
-        if (actual != sizeof(lfhBuf)) {
+        if (readAt(pArchive->mFd, localHdrOffset, lfhBuf, sizeof(lfhBuf)) != 0) {
             ALOGW("Zip: failed reading lfh from offset %ld", localHdrOffset);
             return -1;
         }
@@ -580,22 +596,110 @@ int dexZipGetEntryInfo(const ZipArchive* pArchive, ZipEntry entry,
     return 0;
 }
 
+/*
+ * Size of the buffers used for extraction.  Reads and writes this large
+ * keep the number of system calls for a multi-megabyte DEX file low.
+ */
+static const size_t kExtractBufSize = 256 * 1024;
+
+/*
+ * State of one streaming extraction.
+ *
+ * The compressed data is mapped if possible, so zlib can read it in
+ * place; otherwise it is read through "inBuf".  Uncompressed data is
+ * summed as it goes by on its way out, so nothing is read back.
+ */
+struct ExtractState {
+    int inFd;
+    off_t inOffset;
+    size_t inRemaining;
+    MemMapping inMap;
+    bool inMapped;
+    unsigned char* inBuf;
+
+    int outFd;
+    unsigned char* outBuf;
+    size_t outTotal;
+
+    u4 crc;
+    uLong adler;
+    size_t adlerSkip;
+};
+
+/*
+ * Make the next chunk of input available.  Returns 0 on success.
+ */
+static int nextInput(ExtractState* pState, const unsigned char** pData,
+    size_t* pLen)
+{
+    if (pState->inMapped) {
+        *pData = (const unsigned char*) pState->inMap.addr +
+                 (pState->inMap.length - pState->inRemaining);
+        *pLen = pState->inRemaining;
+        pState->inRemaining = 0;
+        return 0;
+    }
+
+    size_t getSize = (pState->inRemaining > kExtractBufSize) ?
+                     kExtractBufSize : pState->inRemaining;
+    if (readAt(pState->inFd, pState->inOffset, pState->inBuf, getSize) != 0) {
+        ALOGW("Zip: extract read of %zd at %ld failed", getSize,
+            (long) pState->inOffset);
+        return -1;
+    }
+    pState->inOffset += getSize;
+    pState->inRemaining -= getSize;
+    *pData = pState->inBuf;
+    *pLen = getSize;
+    return 0;
+}
+
+/*
+ * Checksum a chunk of uncompressed data and write it out.
+ */
+static int emitOutput(ExtractState* pState, const unsigned char* data,
+    size_t len)
+{
+    pState->crc = crc32(pState->crc, data, len);
+
+    size_t skip = 0;
+    if (pState->outTotal < pState->adlerSkip) {
+        skip = pState->adlerSkip - pState->outTotal;
+        if (skip > len)
+            skip = len;
+    }
+    pState->adler = adler32(pState->adler, data + skip, len - skip);
+    pState->outTotal += len;
+
+    return sysWriteFully(pState->outFd, data, len, "Zip extract");
+}
+
+/*
+ * Copy "stored" data from the archive's file to an open file descriptor.
+ */
+static int copyToFile(ExtractState* pState)
+{
+    while (pState->inRemaining != 0) {
+        const unsigned char* data;
+        size_t len;
+        if (nextInput(pState, &data, &len) != 0)
+            return -1;
+        if (emitOutput(pState, data, len) != 0)
+            return -1;
+    }
+    return 0;
+}
+
 /*
  * Uncompress "deflate" data from the archive's file to an open file
  * descriptor.
  */
-static int inflateToFile(int outFd, int inFd, size_t uncompLen, size_t compLen)
+static int inflateToFile(ExtractState* pState, size_t uncompLen)
 {
     int result = -1;
-    const size_t kBufSize = 32768;
-    unsigned char* readBuf = (unsigned char*) malloc(kBufSize);
-    unsigned char* writeBuf = (unsigned char*) malloc(kBufSize);
     z_stream zstream;
     int zerr;
 
-    if (readBuf == NULL || writeBuf == NULL)
-        goto bail;
-
     /*
      * Initialize the zlib stream struct.
      */
@@ -605,8 +709,8 @@ static int inflateToFile(int outFd, int inFd, size_t uncompLen, size_t compLen)
     zstream.opaque = Z_NULL;
     zstream.next_in = NULL;
     zstream.avail_in = 0;
-    zstream.next_out = (Bytef*) writeBuf;
-    zstream.avail_out = kBufSize;
+    zstream.next_out = (Bytef*) pState->outBuf;
+    zstream.avail_out = kExtractBufSize;
     zstream.data_type = Z_UNKNOWN;
 
     /*
@@ -621,32 +725,37 @@ static int inflateToFile(int outFd, int inFd, size_t uncompLen, size_t compLen)
         } else {
             ALOGW("Call to inflateInit2 failed (zerr=%d)", zerr);
         }
-        goto bail;
+        return -1;
     }
 
     /*
      * Loop while we have more to do.
      */
     do {
-        /* read as much as we can */
-        if (zstream.avail_in == 0) {
-            size_t getSize = (compLen > kBufSize) ? kBufSize : compLen;
-
-            ssize_t actual = TEMP_FAILURE_RETRY(read(inFd, readBuf, getSize));
-            if (actual != (ssize_t) getSize) {
-                ALOGW("Zip: inflate read failed (%d vs %zd)",
-                    (int)actual, getSize);
+        /*
+         * Get as much as we can.  Once the input is used up, keep calling
+         * inflate anyway: it may still hold output that didn't fit in the
+         * last buffer, and the end of the stream.
+         */
+        if (zstream.avail_in == 0 && pState->inRemaining != 0) {
+            const unsigned char* data;
+            size_t len;
+            if (nextInput(pState, &data, &len) != 0)
                 goto z_bail;
-            }
 
-            compLen -= getSize;
-
-            zstream.next_in = readBuf;
-            zstream.avail_in = getSize;
+            zstream.next_in = (Bytef*) data;
+            zstream.avail_in = len;
         }
 
         /* uncompress the data */
         zerr = inflate(&zstream, Z_NO_FLUSH);
+        if (zerr == Z_BUF_ERROR && zstream.avail_in == 0 &&
+            pState->inRemaining == 0)
+        {
+            /* no progress possible without more input */
+            ALOGW("Zip: inflate ran out of compressed data");
+            goto z_bail;
+        }
         if (zerr != Z_OK && zerr != Z_STREAM_END) {
             ALOGW("Zip: inflate zerr=%d (nIn=%p aIn=%u nOut=%p aOut=%u)",
                 zerr, zstream.next_in, zstream.avail_in,
@@ -656,14 +765,14 @@ static int inflateToFile(int outFd, int inFd, size_t uncompLen, size_t compLen)
 
         /* write when we're full or when we're done */
         if (zstream.avail_out == 0 ||
-            (zerr == Z_STREAM_END && zstream.avail_out != kBufSize))
+            (zerr == Z_STREAM_END && zstream.avail_out != kExtractBufSize))
         {
-            size_t writeSize = zstream.next_out - writeBuf;
-            if (sysWriteFully(outFd, writeBuf, writeSize, "Zip inflate") != 0)
+            size_t writeSize = zstream.next_out - pState->outBuf;
+            if (emitOutput(pState, pState->outBuf, writeSize) != 0)
                 goto z_bail;
 
-            zstream.next_out = writeBuf;
-            zstream.avail_out = kBufSize;
+            zstream.next_out = pState->outBuf;
+            zstream.avail_out = kExtractBufSize;
         }
     } while (zerr == Z_OK);
 
@@ -680,53 +789,188 @@ static int inflateToFile(int outFd, int inFd, size_t uncompLen, size_t compLen)
 
 z_bail:
     inflateEnd(&zstream);        /* free up any allocated structures */
-
-bail:
-    free(readBuf);
-    free(writeBuf);
     return result;
 }
 
 /*
- * Uncompress an entry, in its entirety, to an open file descriptor.
+ * Uncompress an entry, in its entirety, to an open file descriptor,
+ * computing the checksums of the data on the way.
  *
- * TODO: this doesn't verify the data's CRC, but probably should (especially
- * for uncompressed data).
+ * This doesn't touch the archive's file position, so any number of
+ * entries of one archive can be extracted at the same time.
  */
-int dexZipExtractEntryToFile(const ZipArchive* pArchive,
-    const ZipEntry entry, int fd)
+int dexZipExtractEntryToFileWithSums(const ZipArchive* pArchive,
+    const ZipEntry entry, int fd, ZipExtractSums* pSums)
 {
     int result = -1;
     int ent = entryToIndex(pArchive, entry);
     if (ent < 0) {
         ALOGW("Zip: extract can't find entry %p", entry);
-        goto bail;
+        return -1;
     }
 
     int method;
     size_t uncompLen, compLen;
     off_t dataOffset;
+    long crc32Expected;
 
     if (dexZipGetEntryInfo(pArchive, entry, &method, &uncompLen, &compLen,
-            &dataOffset, NULL, NULL) != 0)
+            &dataOffset, NULL, &crc32Expected) != 0)
     {
-        goto bail;
+        return -1;
     }
-    if (lseek(pArchive->mFd, dataOffset, SEEK_SET) != dataOffset) {
-        ALOGW("Zip: lseek to data at %ld failed", (long) dataOffset);
-        goto bail;
+
+    ExtractState state;
+    memset(&state, 0, sizeof(state));
+    state.inFd = pArchive->mFd;
+    state.inOffset = dataOffset;
+    state.inRemaining = (method == kCompressStored) ? uncompLen : compLen;
+    state.outFd = fd;
+    state.crc = crc32(0L, Z_NULL, 0);
+    state.adler = adler32(0L, Z_NULL, 0);
+    state.adlerSkip = (pSums != NULL) ? pSums->adlerSkip : 0;
+
+    /*
+     * Map the compressed data if we can; an empty entry has nothing to
+     * map.  If the map fails, fall back on reads.
+     */
+    if (state.inRemaining != 0) {
+#ifdef HAVE_POSIX_FILEMAP
+        state.inMapped = sysMapFileSegmentInShmem(pArchive->mFd, dataOffset,
+                            state.inRemaining, &state.inMap) == 0;
+#endif
+        if (!state.inMapped) {
+            state.inBuf = (unsigned char*) malloc(kExtractBufSize);
+            if (state.inBuf == NULL)
+                goto bail;
+        }
     }
 
     if (method == kCompressStored) {
-        if (sysCopyFileToFile(fd, pArchive->mFd, uncompLen) != 0)
+        if (copyToFile(&state) != 0)
             goto bail;
     } else {
-        if (inflateToFile(fd, pArchive->mFd, uncompLen, compLen) != 0)
+        state.outBuf = (unsigned char*) malloc(kExtractBufSize);
+        if (state.outBuf == NULL)
+            goto bail;
+        if (inflateToFile(&state, uncompLen) != 0)
             goto bail;
     }
 
+    if (state.crc != (u4) crc32Expected) {
+        ALOGW("Zip: CRC mismatch on extracted entry (%08x vs %08x)",
+            state.crc, (u4) crc32Expected);
+        goto bail;
+    }
+
+    if (pSums != NULL) {
+        pSums->crc32 = state.crc;
+        pSums->adler32 = state.adler;
+    }
     result = 0;
 
 bail:
+    if (state.inMapped)
+        sysReleaseShmem(&state.inMap);
+    free(state.inBuf);
+    free(state.outBuf);
     return result;
 }
+
+/*
+ * Uncompress an entry, in its entirety, to an open file descriptor.
+ */
+int dexZipExtractEntryToFile(const ZipArchive* pArchive,
+    const ZipEntry entry, int fd)
+{
+    return dexZipExtractEntryToFileWithSums(pArchive, entry, fd, NULL);
+}
+
+#ifdef HAVE_PTHREADS
+/*
+ * Entries shared out between the threads of a parallel extraction.
+ */
+struct ExtractWork {
+    const ZipArchive* pArchive;
+    const ZipEntry* entries;
+    const int* fds;
+    int count;
+
+    pthread_mutex_t lock;
+    int next;           /* next entry to hand out */
+    int failures;
+};
+
+static void* extractWorker(void* arg)
+{
+    ExtractWork* pWork = (ExtractWork*) arg;
+
+    while (true) {
+        pthread_mutex_lock(&pWork->lock);
+        int i = pWork->next++;
+        pthread_mutex_unlock(&pWork->lock);
+        if (i >= pWork->count)
+            break;
+
+        if (dexZipExtractEntryToFile(pWork->pArchive, pWork->entries[i],
+                pWork->fds[i]) != 0)
+        {
+            pthread_mutex_lock(&pWork->lock);
+            pWork->failures++;
+            pthread_mutex_unlock(&pWork->lock);
+        }
+    }
+    return NULL;
+}
+#endif
+
+/*
+ * Extract several entries of an archive at once.
+ */
+int dexZipExtractEntriesToFiles(const ZipArchive* pArchive,
+    const ZipEntry* entries, const int* fds, int count, int numThreads)
+{
+#ifdef HAVE_PTHREADS
+    if (numThreads > count)
+        numThreads = count;
+    if (numThreads > kZipMaxExtractThreads)
+        numThreads = kZipMaxExtractThreads;
+
+    if (numThreads > 1) {
+        ExtractWork work;
+        work.pArchive = pArchive;
+        work.entries = entries;
+        work.fds = fds;
+        work.count = count;
+        work.next = 0;
+        work.failures = 0;
+        pthread_mutex_init(&work.lock, NULL);
+
+        /* this thread does its share, too */
+        pthread_t threads[kZipMaxExtractThreads];
+        int numStarted = 0;
+        for (int i = 0; i < numThreads - 1; i++) {
+            int cc = pthread_create(&threads[numStarted], NULL,
+                        extractWorker, &work);
+            if (cc != 0) {
+                ALOGW("Zip: unable to start extract thread: %s",
+                    strerror(cc));
+                break;
+            }
+            numStarted++;
+        }
+        extractWorker(&work);
+        for (int i = 0; i < numStarted; i++)
+            pthread_join(threads[i], NULL);
+
+        pthread_mutex_destroy(&work.lock);
+        return (work.failures == 0) ? 0 : -1;
+    }
+#endif
+
+    for (int i = 0; i < count; i++) {
+        if (dexZipExtractEntryToFile(pArchive, entries[i], fds[i]) != 0)
+            return -1;
+    }
+    return 0;
+}
@@ -164,13 +164,43 @@ DEX_INLINE long dexGetZipEntryCrc32(const ZipArchive* pArchive,
 }
 
 /*
- * Uncompress and write an entry to a file descriptor.
+ * Uncompress and write an entry to a file descriptor, at its current
+ * position.  The data is checked against the CRC-32 in the directory.
  *
  * Returns 0 on success.
  */
 int dexZipExtractEntryToFile(const ZipArchive* pArchive,
     const ZipEntry entry, int fd);
 
+/*
+ * Checksums of an entry's uncompressed data, computed while it is
+ * extracted.  The Adler-32 leaves out the first "adlerSkip" bytes, so a
+ * skip of 12 gives the checksum stored in a DEX header.
+ */
+struct ZipExtractSums {
+    size_t  adlerSkip;      /* in */
+    u4      crc32;          /* out */
+    u4      adler32;        /* out */
+};
+
+/*
+ * Like dexZipExtractEntryToFile, but also fills in "pSums".
+ */
+int dexZipExtractEntryToFileWithSums(const ZipArchive* pArchive,
+    const ZipEntry entry, int fd, ZipExtractSums* pSums);
+
+/* Most threads dexZipExtractEntriesToFiles will use */
+#define kZipMaxExtractThreads   16
+
+/*
+ * Extract entries[i] to fds[i] for each of "count" entries, using up to
+ * "numThreads" threads.  The file descriptors must all be different.
+ *
+ * Returns 0 if every entry was extracted.
+ */
+int dexZipExtractEntriesToFiles(const ZipArchive* pArchive,
+    const ZipEntry* entries, const int* fds, int count, int numThreads);
+
 /*
  * Utility function to compute a CRC-32.
  */
@@ -44,6 +44,7 @@
 #include "UtfString.h"
 #include "Intern.h"
 #include "ReferenceTable.h"
+#include "PinTable.h"
 #include "IndirectRefTable.h"
 #include "AtomicCache.h"
 #include "Thread.h"
@@ -51,6 +52,8 @@
 #include "Hash.h"
 #include "interp/Stack.h"
 #include "oo/Class.h"
+#include "oo/ClassTable.h"
+#include "oo/MethodTables.h"
 #include "oo/Resolve.h"
 #include "oo/Array.h"
 #include "Exception.h"
@@ -101,6 +101,7 @@ LOCAL_SRC_FILES := \
 	LinearAlloc.cpp \
 	Misc.cpp \
 	Native.cpp \
+	PinTable.cpp \
 	PointerSet.cpp \
 	Profile.cpp \
 	RawDexFile.cpp \
@@ -116,6 +117,7 @@ LOCAL_SRC_FILES := \
 	alloc/HeapDebug.cpp \
 	alloc/Heap.cpp.arm \
 	alloc/DdmHeap.cpp \
+	alloc/GcWorkers.cpp \
 	alloc/Verify.cpp \
 	alloc/Visit.cpp \
 	analysis/CodeVerify.cpp \
@@ -174,6 +176,8 @@ LOCAL_SRC_FILES := \
 	oo/AccessCheck.cpp \
 	oo/Array.cpp \
 	oo/Class.cpp \
+	oo/ClassTable.cpp \
+	oo/MethodTables.cpp \
 	oo/Object.cpp \
 	oo/Resolve.cpp \
 	oo/TypeCheck.cpp \
@@ -181,8 +185,18 @@ LOCAL_SRC_FILES := \
 	reflect/Proxy.cpp \
 	reflect/Reflect.cpp \
 	test/AtomicTest.cpp.arm \
+	test/TestDexOptThreads.cpp \
 	test/TestHash.cpp \
-	test/TestIndirectRefTable.cpp
+	test/TestHotTraces.cpp \
+	test/TestIndirectRefTable.cpp \
+	test/TestClassTable.cpp \
+	test/TestInternTable.cpp \
+	test/TestJniCritical.cpp \
+	test/TestJniGlobalRefs.cpp \
+	test/TestMethodTables.cpp \
+	test/TestStacklessExceptions.cpp \
+	test/TestUtf.cpp \
+	test/TestZipExtract.cpp
 
 # TODO: this is the wrong test, but what's the right one?
 ifneq ($(filter arm mips,$(dvm_arch)),)
@@ -201,7 +215,9 @@ else
   LOCAL_SRC_FILES += \
 	alloc/DlMalloc.cpp \
 	alloc/HeapSource.cpp \
-	alloc/MarkSweep.cpp.arm
+	alloc/MarkSweep.cpp.arm \
+	alloc/SlabAlloc.cpp \
+	test/TestSlabAlloc.cpp
 endif
 
 WITH_JIT := $(strip $(WITH_JIT))
@@ -211,6 +227,7 @@ ifeq ($(WITH_JIT),true)
   LOCAL_SRC_FILES += \
 	compiler/Compiler.cpp \
 	compiler/Frontend.cpp \
+	compiler/HotTraces.cpp \
 	compiler/Utility.cpp \
 	compiler/InlineTransformation.cpp \
 	compiler/IntermediateRep.cpp \
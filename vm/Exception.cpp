@@ -612,16 +612,15 @@ static int findCatchInMethod(Thread* self, const Method* method, int relPc,
         dvmComputeExactFrameDepth(self->interpSave.curFrame));
 
     DvmDex* pDvmDex = method->clazz->pDvmDex;
-    const DexCode* pCode = dvmGetMethodCode(method);
-    DexCatchIterator iterator;
+    const MethodCatchTable* pTable = dvmGetMethodCatchTable(method);
+    const CatchTableRange* pRange = dvmCatchTableLookup(pTable, relPc);
 
-    if (dexFindCatchHandler(&iterator, pCode, relPc)) {
-        for (;;) {
-            DexCatchHandler* handler = dexCatchIteratorNext(&iterator);
+    if (pRange != NULL) {
+        const CatchTableHandler* handlers =
+            &pTable->handlers[pRange->firstHandler];
 
-            if (handler == NULL) {
-                break;
-            }
+        for (u4 i = 0; i < pRange->handlerCount; i++) {
+            const CatchTableHandler* handler = &handlers[i];
 
             if (handler->typeIdx == kDexNoIndex) {
                 /* catch-all */
@@ -801,10 +800,32 @@ int dvmFindCatchBlock(Thread* self, int relPc, Object* exception,
     return catchAddr;
 }
 
+/*
+ * The per-thread capture buffer is kept between calls unless a very deep
+ * stack made it grow past this many ints.
+ */
+#define kMaxKeptStackTraceInts  (2 * 1024)
+
+/*
+ * Returns "true" if -Xstacklessexceptions names "clazz" or a superclass.
+ */
+static bool isStacklessException(const ClassObject* clazz)
+{
+    for (; clazz != NULL; clazz = clazz->super) {
+        for (size_t i = 0; i < gDvm.numStacklessExceptions; i++) {
+            if (strcmp(clazz->descriptor, gDvm.stacklessExceptions[i]) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
 /*
  * We have to carry the exception's stack trace around, but in many cases
  * it will never be examined.  It makes sense to keep it in a compact,
  * VM-specific object, rather than an array of Objects with strings.
+ * StackTraceElements are only created if somebody asks for them (see
+ * dvmGetStackTrace).
  *
  * Pass in the thread whose stack we're interested in.  If "thread" is
  * not self, the thread must be suspended.  This implies that the thread
@@ -817,34 +838,45 @@ int dvmFindCatchBlock(Thread* self, int relPc, Object* exception,
  * presently an array of integers, but could become something else in the
  * future.  If "wantObject" is false, return plain malloc data.
  *
+ * The stack is walked once, into a scratch buffer owned by the calling
+ * thread, and the result is copied out at its exact size.
+ *
+ * If the exception being constructed is one of the -Xstacklessexceptions
+ * classes, the stack isn't walked at all and the Object is an empty array.
+ *
  * NOTE: if we support class unloading, we will need to scan the class
  * object references out of these arrays.
  */
 void* dvmFillInStackTraceInternal(Thread* thread, bool wantObject, size_t* pCount)
 {
+    Thread* self = dvmThreadSelf();
     ArrayObject* stackData = NULL;
     int* simpleData = NULL;
+    const ClassObject* excepClass = NULL;
+    bool stackless = false;
     void* fp;
-    void* startFp;
     size_t stackDepth;
-    int* intPtr;
 
     if (pCount != NULL)
         *pCount = 0;
     fp = thread->interpSave.curFrame;
 
-    assert(thread == dvmThreadSelf() || dvmIsSuspended(thread));
+    assert(thread == self || dvmIsSuspended(thread));
 
     /*
      * We're looking at a stack frame for code running below a Throwable
      * constructor.  We want to remove the Throwable methods and the
      * superclass initializations so the user doesn't see them when they
-     * read the stack dump.
+     * read the stack dump.  The class being instantiated is the one whose
+     * constructor ends the run of <init> frames that chain up from
+     * Throwable; Throwable methods past that (a factory, or the
+     * constructor of an unrelated exception) don't count.
      *
      * TODO: this just scrapes off the top layers of Throwable.  Might not do
      * the right thing if we create an exception object or cause a VM
      * exception while in a Throwable method.
      */
+    bool inInits = true;
     while (fp != NULL) {
         const StackSaveArea* saveArea = SAVEAREA_FROM_FP(fp);
         const Method* method = saveArea->method;
@@ -855,83 +887,106 @@ void* dvmFillInStackTraceInternal(Thread* thread, bool wantObject, size_t* pCoun
             break;
         //ALOGD("EXCEP: ignoring %s.%s",
         //         method->clazz->descriptor, method->name);
+        if (inInits) {
+            if (strcmp(method->name, "<init>") == 0 &&
+                (excepClass == NULL ||
+                 dvmInstanceof(method->clazz, excepClass)))
+            {
+                excepClass = method->clazz;
+            } else if (excepClass != NULL) {
+                inInits = false;
+            }
+        }
         fp = saveArea->prevFrame;
     }
-    startFp = fp;
+
+    if (wantObject && gDvm.numStacklessExceptions != 0 &&
+        excepClass != NULL && isStacklessException(excepClass))
+    {
+        stackless = true;
+        fp = NULL;
+    }
 
     /*
-     * Compute the stack depth.
+     * We need to store a pointer to the Method and the program counter.
+     * We have 4-byte pointers, so we use pairs of ints.
      */
+    assert(sizeof(Method*) == sizeof(int));
     stackDepth = 0;
     while (fp != NULL) {
         const StackSaveArea* saveArea = SAVEAREA_FROM_FP(fp);
+        const Method* method = saveArea->method;
+
+        if (!dvmIsBreakFrame((u4*)fp)) {
+            //ALOGD("EXCEP keeping %s.%s", method->clazz->descriptor,
+            //         method->name);
 
-        if (!dvmIsBreakFrame((u4*)fp))
+            if (stackDepth * 2 == self->stackTraceBufLen) {
+                size_t newLen = (self->stackTraceBufLen == 0) ?
+                    64 : self->stackTraceBufLen * 2;
+                int* newBuf = (int*) realloc(self->stackTraceBuf,
+                    newLen * sizeof(int));
+                if (newBuf == NULL)
+                    goto bail;
+                self->stackTraceBuf = newBuf;
+                self->stackTraceBufLen = newLen;
+            }
+
+            int* intPtr = &self->stackTraceBuf[stackDepth * 2];
+            intPtr[0] = (int) method;
+            if (dvmIsNativeMethod(method)) {
+                intPtr[1] = 0;      /* no saved PC for native methods */
+            } else {
+                assert(saveArea->xtra.currentPc >= method->insns &&
+                        saveArea->xtra.currentPc <
+                        method->insns + dvmGetMethodInsnsSize(method));
+                intPtr[1] = (int) (saveArea->xtra.currentPc - method->insns);
+            }
             stackDepth++;
+        }
 
         assert(fp != saveArea->prevFrame);
         fp = saveArea->prevFrame;
     }
     //ALOGD("EXCEP: stack depth is %d", stackDepth);
 
-    if (!stackDepth)
+    if (!stackDepth && !stackless)
         goto bail;
 
     /*
-     * We need to store a pointer to the Method and the program counter.
-     * We have 4-byte pointers, so we use '[I'.
+     * The allocation can only re-enter this function by throwing, and then
+     * it fails and the scratch buffer isn't read.
      */
     if (wantObject) {
-        assert(sizeof(Method*) == 4);
         stackData = dvmAllocPrimitiveArray('I', stackDepth*2, ALLOC_DEFAULT);
         if (stackData == NULL) {
-            assert(dvmCheckException(dvmThreadSelf()));
+            assert(dvmCheckException(self));
             goto bail;
         }
-        intPtr = (int*)(void*)stackData->contents;
+        if (stackDepth != 0) {
+            memcpy(stackData->contents, self->stackTraceBuf,
+                stackDepth * 2 * sizeof(int));
+        }
     } else {
-        /* array of ints; first entry is stack depth */
-        assert(sizeof(Method*) == sizeof(int));
         simpleData = (int*) malloc(sizeof(int) * stackDepth*2);
         if (simpleData == NULL)
             goto bail;
 
         assert(pCount != NULL);
-        intPtr = simpleData;
+        memcpy(simpleData, self->stackTraceBuf,
+            stackDepth * 2 * sizeof(int));
     }
     if (pCount != NULL)
         *pCount = stackDepth;
 
-    fp = startFp;
-    while (fp != NULL) {
-        const StackSaveArea* saveArea = SAVEAREA_FROM_FP(fp);
-        const Method* method = saveArea->method;
-
-        if (!dvmIsBreakFrame((u4*)fp)) {
-            //ALOGD("EXCEP keeping %s.%s", method->clazz->descriptor,
-            //         method->name);
-
-            *intPtr++ = (int) method;
-            if (dvmIsNativeMethod(method)) {
-                *intPtr++ = 0;      /* no saved PC for native methods */
-            } else {
-                assert(saveArea->xtra.currentPc >= method->insns &&
-                        saveArea->xtra.currentPc <
-                        method->insns + dvmGetMethodInsnsSize(method));
-                *intPtr++ = (int) (saveArea->xtra.currentPc - method->insns);
-            }
-
-            stackDepth--;       // for verification
-        }
-
-        assert(fp != saveArea->prevFrame);
-        fp = saveArea->prevFrame;
-    }
-    assert(stackDepth == 0);
-
 bail:
+    if (self->stackTraceBufLen > kMaxKeptStackTraceInts) {
+        free(self->stackTraceBuf);
+        self->stackTraceBuf = NULL;
+        self->stackTraceBufLen = 0;
+    }
     if (wantObject) {
-        dvmReleaseTrackedAlloc((Object*) stackData, dvmThreadSelf());
+        dvmReleaseTrackedAlloc((Object*) stackData, self);
         return stackData;
     } else {
         return simpleData;
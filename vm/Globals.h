@@ -128,6 +128,13 @@ struct DvmGlobals {
     bool        verifyDexChecksum;
     char*       stackTraceFile;     // for SIGQUIT-inspired output
 
+    /*
+     * Exceptions of these classes, or their subclasses, are created with
+     * an empty stack trace (-Xstacklessexceptions).  Descriptors.
+     */
+    char**      stacklessExceptions;
+    size_t      numStacklessExceptions;
+
     bool        logStdio;
 
     DexOptimizerMode    dexOptMode;
@@ -140,6 +147,9 @@ struct DvmGlobals {
 
     bool        dexOptForSmp;
 
+    /* number of threads dexopt verifies and optimizes classes with */
+    int         dexOptThreads;
+
     /*
      * GC option flags.
      */
@@ -149,6 +159,11 @@ struct DvmGlobals {
     bool        concurrentMarkSweep;
     bool        verifyCardTable;
     bool        disableExplicitGc;
+    size_t      gcParallelThreads;  // threads used by parallel GC phases
+    bool        useTlabs;           // thread-local allocation buffers
+    bool        useSlabAllocator;   // size-class runs for small objects
+    bool        generationalGc;     // collect young objects on their own
+    size_t      youngGenSize;       // bytes allocated between young GCs
 
     int         assertionCtrlCount;
     AssertionControl*   assertionCtrl;
@@ -185,6 +200,12 @@ struct DvmGlobals {
      */
     HashTable*  loadedClasses;
 
+    /*
+     * Per-loader tables of the classes each loader can see by name.
+     * These are what dvmLookupClass() searches.
+     */
+    ClassTableSet* classTables;
+
     /*
      * Value for the next class serial number to be assigned.  This is
      * incremented as we load classes.  Failed loads and races may result
@@ -204,15 +225,7 @@ struct DvmGlobals {
     /*
      * Interned strings.
      */
-
-    /* A mutex that guards access to the interned string tables. */
-    pthread_mutex_t internLock;
-
-    /* Hash table of strings interned by the user. */
-    HashTable*  internedStrings;
-
-    /* Hash table of strings interned by the class loader. */
-    HashTable*  literalStrings;
+    InternTableStripe internTable[INTERN_TABLE_STRIPES];
 
     /*
      * Classes constructed directly by the vm.
@@ -387,6 +400,9 @@ struct DvmGlobals {
     /* method pointers - java.lang.ref.FinalizerReference */
     Method* methJavaLangRefFinalizerReferenceAdd;
 
+    /* method pointers - java.lang.System */
+    Method* methJavaLangSystem_arraycopy;
+
     /* constructor method pointers; no vtable involved, so use Method* */
     Method*     methJavaLangStackTraceElement_init;
     Method*     methJavaLangReflectConstructor_init;
@@ -516,7 +532,9 @@ struct DvmGlobals {
     HashTable*  userDexFiles;
 
     /*
-     * JNI global reference table.
+     * JNI global reference table.  Globals are added and removed without
+     * a lock (see IndirectRefTable::addConcurrent); jniGlobalRefLock now
+     * only guards the usage-tracking marks.  Weak globals keep their lock.
      */
     IndirectRefTable jniGlobalRefTable;
     IndirectRefTable jniWeakGlobalRefTable;
@@ -528,9 +546,16 @@ struct DvmGlobals {
     /*
      * JNI pinned object table (used for primitive arrays).
      */
-    ReferenceTable  jniPinRefTable;
+    PinTable        jniPinTable;
     pthread_mutex_t jniPinRefLock;
 
+    /*
+     * Modified UTF-8 forms of recently converted strings, for
+     * GetStringUTFChars.
+     */
+    struct JniUtfCacheEntry* jniUtfCache;
+    pthread_mutex_t jniUtfCacheLock;
+
     /*
      * Native shared library table.
      */
@@ -761,24 +786,22 @@ enum NoChainExits {
  */
 struct DvmJitGlobals {
     /*
-     * Guards writes to Dalvik PC (dPC), translated code address (codeAddr) and
-     * chain fields within the JIT hash table.  Note carefully the access
-     * mechanism.
-     * Only writes are guarded, and the guarded fields must be updated in a
-     * specific order using atomic operations.  Further, once a field is
-     * written it cannot be changed without halting all threads.
+     * Guards writes to the translated code address (codeAddr) and the
+     * packed info word of existing JIT hash table entries, and the
+     * replacement of the table by a resize.  New entries are added without
+     * it, by claiming the dPC of an empty slot with a CAS.
+     * Once codeAddr is written it cannot be changed without halting all
+     * threads.
      *
-     * The write order is:
-     *    1) codeAddr
-     *    2) dPC
-     *    3) chain [if necessary]
-     *
-     * This mutex also guards both read and write of curJitTableEntries.
+     * This mutex also guards full scans of the table.
      */
     pthread_mutex_t tableLock;
 
-    /* The JIT hash table.  Note that for access speed, copies of this pointer
-     * are stored in each thread. */
+    /*
+     * The JIT hash table.  Readers load the pointer once per lookup; a
+     * resize publishes a new table and frees the old one at a later safe
+     * point.
+     */
     struct JitEntry *pJitEntryTable;
 
     /* Array of compilation trigger threshold counters */
@@ -797,7 +820,16 @@ struct DvmJitGlobals {
     unsigned int jitTableMask;
 
     /* How many entries in the JitEntryTable are in use */
-    unsigned int jitTableEntriesUsed;
+    volatile int32_t jitTableEntriesUsed;
+
+    /*
+     * JitTable stats: resizes done, new entries that lost their slot to
+     * another thread and probed again, and entries not added because the
+     * table was full.
+     */
+    int jitTableResizes;
+    volatile int32_t jitTableInsertRaces;
+    volatile int32_t jitTableInsertsFailed;
 
     /* Bytes allocated for the code cache */
     unsigned int codeCacheSize;
@@ -810,22 +842,41 @@ struct DvmJitGlobals {
     bool               blockingMode;
     bool               methodTraceSupport;
     bool               genSuspendPoll;
-    Thread*            compilerThread;
-    pthread_t          compilerHandle;
+    int                numCompilerThreads;
+    int                numCompilerThreadsStarted;
+    Thread*            compilerThreads[COMPILER_MAX_THREADS];
+    /*
+     * JitTable epochs.  Every resize bumps jitTableEpoch.  Compiler threads
+     * are never suspended, so each one copies the epoch into its slot
+     * between work orders, or sets it to JIT_TABLE_EPOCH_IDLE while it
+     * waits for work, and a retired table is only freed once every slot
+     * has caught up with its retirement.
+     */
+    volatile int32_t   jitTableEpoch;
+    volatile int32_t   compilerTableEpoch[COMPILER_MAX_THREADS];
+    pthread_t          compilerHandles[COMPILER_MAX_THREADS];
     pthread_mutex_t    compilerLock;
     pthread_mutex_t    compilerICPatchLock;
     pthread_cond_t     compilerQueueActivity;
     pthread_cond_t     compilerQueueEmpty;
     volatile int       compilerQueueLength;
+    int                compilerWorkInFlight;
     int                compilerHighWater;
-    int                compilerWorkEnqueueIndex;
-    int                compilerWorkDequeueIndex;
+    u4                 compilerWorkSequence;
     int                compilerICPatchIndex;
 
     /* JIT internal stats */
     int                compilerMaxQueued;
     int                translationChains;
 
+    /*
+     * Compiler arena stats: blocks allocated (in use or pooled), blocks
+     * waiting in the pool, and the most bytes one compilation has used.
+     */
+    volatile int32_t   arenaBlocks;
+    int                arenaPooledBlocks;
+    volatile int32_t   arenaHighWater;
+
     /* Compiled code cache */
     void* codeCache;
 
@@ -836,9 +887,10 @@ struct DvmJitGlobals {
      * guarantee whether GC has happened before the code address has been
      * installed to the JIT table. Because of that, this field can only
      * been cleared/overwritten by the compiler thread if it is in the
-     * THREAD_RUNNING state or in a safe point.
+     * THREAD_RUNNING state or in a safe point.  Each compiler thread has
+     * its own entry.
      */
-    void *inflightBaseAddr;
+    void *inflightBaseAddr[COMPILER_MAX_THREADS];
 
     /* Translation cache version (protected by compilerLock */
     int cacheVersion;
@@ -855,6 +907,16 @@ struct DvmJitGlobals {
     /* Flag to indicate that the code cache is full */
     bool codeCacheFull;
 
+    /*
+     * Code cache segments (protected by compilerLock).  A segment is
+     * evicted at the next safe point when codeCacheEvictPending is set.
+     */
+    JitCodeCacheSegment codeCacheSegments[JIT_CODE_CACHE_MAX_SEGMENTS];
+    int numCodeCacheSegments;
+    int codeCacheSegment;
+    u4 codeCacheSegmentFills;
+    bool codeCacheEvictPending;
+
     /* Page size  - 1 */
     unsigned int pageSizeMask;
 
@@ -867,6 +929,10 @@ struct DvmJitGlobals {
     /* Number of times that the code cache reset request has been delayed */
     int numCodeCacheResetDelayed;
 
+    /* Number of code cache segments evicted, and evictions delayed */
+    int numCodeCacheEvictions;
+    int numCodeCacheEvictionsDelayed;
+
     /* true/false: compile/reject opcodes specified in the -Xjitop list */
     bool includeSelectedOp;
 
@@ -904,6 +970,12 @@ struct DvmJitGlobals {
     /* Periodic trace profiling countdown timer */
     int profileCountdown;
 
+    /* File the hot traces are saved to and preloaded from, or NULL */
+    char* hotTraceFile;
+
+    /* Translations installed since the hot traces were last saved */
+    int numTracesSinceHotTraceSave;
+
     /* Vector to disable selected optimizations */
     int disableOpt;
 
@@ -950,6 +1022,9 @@ struct DvmJitGlobals {
     int                invokeMonoSetterInlined;
     int                invokePolyGetterInlined;
     int                invokePolySetterInlined;
+    int                invokeMonoSimpleInlined;
+    int                invokePolySimpleInlined;
+    int                invokeInlineTooBig;
     int                returnOp;
     int                icPatchInit;
     int                icPatchLockFree;
@@ -970,9 +1045,12 @@ struct DvmJitGlobals {
 
     /* Place arrays at the end to ease the display in gdb sessions */
 
-    /* Work order queue for compilations */
+    /* Work order queue for compilations, kept as a heap by priority */
     CompilerWorkOrder compilerWorkQueue[COMPILER_WORK_QUEUE_SIZE];
 
+    /* Queue position of each work order, hashed by Dalvik PC */
+    CompilerWorkSlot compilerWorkSlots[COMPILER_WORK_HASH_SIZE];
+
     /* Work order queue for predicted chain patching */
     ICPatchWorkOrder compilerICPatchQueue[COMPILER_IC_PATCH_QUEUE_SIZE];
 };
@@ -19,6 +19,17 @@
  */
 #include "Dalvik.h"
 
+#include <sys/mman.h>
+
+/* free list terminator; concurrent tables hold fewer entries than this */
+#define kNoFreeSlot 0xffff
+
+/* Bytes reserved for the free list of a concurrent table */
+static inline size_t freeListSize(size_t maxCount)
+{
+    return offsetof(IndirectRefFreeList, next) + maxCount * sizeof(u2);
+}
+
 static void abortMaybe() {
     // If CheckJNI is on, it'll give a more detailed error before aborting.
     // Otherwise, we want to abort rather than hand back a bad reference.
@@ -44,6 +55,41 @@ bool IndirectRefTable::init(size_t initialCount,
     alloc_entries_ = initialCount;
     max_entries_ = maxCount;
     kind_ = desiredKind;
+    freeList_ = NULL;
+
+    return true;
+}
+
+bool IndirectRefTable::initConcurrent(size_t maxCount,
+        IndirectRefKind desiredKind)
+{
+    assert(maxCount > 0);
+    assert(maxCount < kNoFreeSlot);
+    assert(desiredKind != kIndirectKindInvalid);
+
+    /*
+     * Reserve the whole table now so that it never moves.  Pages are
+     * only committed as slots are handed out.  Zeroed slots read as
+     * unused.
+     */
+    table_ = (IndirectRefSlot*) dvmAllocRegion(maxCount * sizeof(IndirectRefSlot),
+            PROT_READ | PROT_WRITE, "dalvik-indirect-ref-table");
+    if (table_ == NULL) {
+        return false;
+    }
+    freeList_ = (IndirectRefFreeList*) dvmAllocRegion(freeListSize(maxCount),
+            PROT_READ | PROT_WRITE, "dalvik-indirect-ref-free-list");
+    if (freeList_ == NULL) {
+        munmap(table_, maxCount * sizeof(IndirectRefSlot));
+        table_ = NULL;
+        return false;
+    }
+
+    segmentState.all = IRT_FIRST_SEGMENT;
+    alloc_entries_ = maxCount;
+    max_entries_ = maxCount;
+    kind_ = desiredKind;
+    freeList_->head = kNoFreeSlot;
 
     return true;
 }
@@ -53,7 +99,13 @@ bool IndirectRefTable::init(size_t initialCount,
  */
 void IndirectRefTable::destroy()
 {
-    free(table_);
+    if (freeList_ != NULL) {
+        munmap(table_, max_entries_ * sizeof(IndirectRefSlot));
+        munmap(freeList_, freeListSize(max_entries_));
+        freeList_ = NULL;
+    } else {
+        free(table_);
+    }
     table_ = NULL;
     alloc_entries_ = max_entries_ = -1;
 }
@@ -294,6 +346,194 @@ bool IndirectRefTable::remove(u4 cookie, IndirectRef iref)
     return true;
 }
 
+/*
+ * Returns the free list head that follows "head" with "index" first.
+ */
+static inline int64_t nextFreeHead(int64_t head, u4 index)
+{
+    u8 tag = ((u8) head >> 32) + 1;
+    return (int64_t) ((tag << 32) | index);
+}
+
+/*
+ * Pushes a run of free slot indices onto the shared free list of a
+ * concurrent table with a single compare-and-swap.  The 32-bit tag in
+ * the head changes on every update, so a pop that read a stale head
+ * cannot succeed.
+ */
+void IndirectRefTable::pushFreeSlots(const u2* slots, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    u2* next = freeList_->next;
+    for (size_t i = 0; i + 1 < count; i++) {
+        next[slots[i]] = slots[i + 1];
+    }
+    u2 last = slots[count - 1];
+    for (;;) {
+        int64_t head = dvmQuasiAtomicRead64(&freeList_->head);
+        next[last] = (u4) head & 0xffff;
+        /* the links must be visible before the slots are */
+        ANDROID_MEMBAR_STORE();
+        if (dvmQuasiAtomicCas64(head, nextFreeHead(head, slots[0]),
+                &freeList_->head) == 0) {
+            return;
+        }
+    }
+}
+
+/*
+ * Refills an empty thread cache, first from the shared free list and
+ * then from never-used slots above topIndex.  Returns "false" if the
+ * table is full.
+ */
+bool IndirectRefTable::reserveSlots(IndirectRefCache* cache)
+{
+    const size_t want = IRT_THREAD_CACHE_SIZE / 2;
+
+    assert(cache->count == 0);
+    while (cache->count < want) {
+        int64_t head = dvmQuasiAtomicRead64(&freeList_->head);
+        u4 index = (u4) head & 0xffff;
+        if (index == kNoFreeSlot) {
+            break;
+        }
+        ANDROID_MEMBAR_FULL();
+        int64_t newHead = nextFreeHead(head, freeList_->next[index]);
+        if (dvmQuasiAtomicCas64(head, newHead, &freeList_->head) == 0) {
+            cache->slots[cache->count++] = index;
+        }
+    }
+    if (cache->count > 0) {
+        return true;
+    }
+
+    for (;;) {
+        IRTSegmentState oldState, newState;
+        oldState.all = android_atomic_acquire_load((int32_t*) &segmentState.all);
+        u4 topIndex = oldState.parts.topIndex;
+        if (topIndex == max_entries_) {
+            ALOGE("JNI ERROR (app bug): %s reference table overflow (max=%d)",
+                    indirectRefKindToString(kind_), max_entries_);
+            return false;
+        }
+        u4 count = MIN(want, max_entries_ - topIndex);
+        newState.all = oldState.all;
+        newState.parts.topIndex = topIndex + count;
+        if (android_atomic_release_cas(oldState.all, newState.all,
+                (int32_t*) &segmentState.all) == 0) {
+            for (u4 i = 0; i < count; i++) {
+                cache->slots[cache->count++] = topIndex + count - 1 - i;
+            }
+            return true;
+        }
+    }
+}
+
+IndirectRef IndirectRefTable::addConcurrent(Object* obj, IndirectRefCache* cache)
+{
+    assert(obj != NULL);
+    assert(dvmIsHeapAddress(obj));
+    assert(freeList_ != NULL);
+
+    if (cache->count == 0 && !reserveSlots(cache)) {
+        return NULL;
+    }
+    IndirectRefSlot* slot = &table_[cache->slots[--cache->count]];
+    assert(slot->obj == NULL);
+    slot->serial = nextSerial(slot->serial);
+    /* publish the serial before the object, for lock-free get() */
+    android_atomic_release_store((int32_t) obj, (int32_t*) &slot->obj);
+
+    IndirectRef result = toIndirectRef(slot - table_, slot->serial, kind_);
+    assert(result != NULL);
+    return result;
+}
+
+/*
+ * Finds the slot index of an entry in a concurrent table, checking the
+ * reference the same way remove() does.
+ */
+bool IndirectRefTable::findConcurrentIndex(IndirectRef iref, u4* pIndex) const
+{
+    u4 topIndex = segmentState.parts.topIndex;
+    IndirectRefKind kind = indirectRefKind(iref);
+    if (kind == kind_) {
+        u4 index = extractIndex(iref);
+        if (index >= topIndex) {
+            ALOGD("Attempt to remove invalid index %ud (top=%ud)",
+                    index, topIndex);
+            return false;
+        }
+        if (table_[index].obj == NULL) {
+            ALOGD("Attempt to remove cleared %s reference %p",
+                    indirectRefKindToString(kind_), iref);
+            return false;
+        }
+        if (table_[index].serial != extractSerial(iref)) {
+            ALOGD("Attempt to remove stale %s reference %p",
+                    indirectRefKindToString(kind_), iref);
+            return false;
+        }
+        *pIndex = index;
+        return true;
+    } else if (kind == kIndirectKindInvalid && gDvmJni.workAroundAppJniBugs) {
+        // reference looks like a pointer, scan the table to find the index
+        int i = findObject(reinterpret_cast<Object*>(iref), 0, topIndex, table_);
+        if (i < 0) {
+            ALOGW("trying to work around app JNI bugs, but didn't find %p in table!", iref);
+            return false;
+        }
+        *pIndex = i;
+        return true;
+    }
+    // References of the requested kind cannot appear within this table.
+    return false;
+}
+
+bool IndirectRefTable::removeConcurrent(IndirectRef iref, IndirectRefCache* cache)
+{
+    assert(freeList_ != NULL);
+
+    u4 index;
+    if (!findConcurrentIndex(iref, &index)) {
+        return false;
+    }
+
+    /*
+     * Clear the slot with a compare-and-swap so that of two threads
+     * deleting the same reference, only one frees the slot.
+     */
+    IndirectRefSlot* slot = &table_[index];
+    int32_t obj = android_atomic_acquire_load((int32_t*) &slot->obj);
+    if (obj == 0 ||
+        (indirectRefKind(iref) == kind_ && slot->serial != extractSerial(iref)) ||
+        android_atomic_release_cas(obj, 0, (int32_t*) &slot->obj) != 0) {
+        ALOGD("Attempt to remove cleared %s reference %p",
+                indirectRefKindToString(kind_), iref);
+        return false;
+    }
+
+    if (cache->count == IRT_THREAD_CACHE_SIZE) {
+        /* keep half for upcoming adds, give back the oldest half */
+        const size_t half = IRT_THREAD_CACHE_SIZE / 2;
+        pushFreeSlots(cache->slots, half);
+        memmove(cache->slots, cache->slots + half, half * sizeof(u2));
+        cache->count = half;
+    }
+    cache->slots[cache->count++] = index;
+    return true;
+}
+
+void IndirectRefTable::flushCache(IndirectRefCache* cache)
+{
+    if (freeList_ != NULL) {
+        pushFreeSlots(cache->slots, cache->count);
+    }
+    cache->count = 0;
+}
+
 const char* indirectRefKindToString(IndirectRefKind kind)
 {
     switch (kind) {
@@ -307,10 +547,22 @@ const char* indirectRefKindToString(IndirectRefKind kind)
 
 void IndirectRefTable::dump(const char* descr) const
 {
-    size_t count = capacity();
+    /*
+     * Other threads may be adding and removing entries of a concurrent
+     * table, so read each slot once, atomically.  The copy is a snapshot
+     * of the slots at the time each was read.
+     */
+    bool concurrent = (freeList_ != NULL);
+    IRTSegmentState state;
+    state.all = concurrent ?
+            android_atomic_acquire_load((int32_t*) &segmentState.all) :
+            segmentState.all;
+    size_t count = state.parts.topIndex;
     Object** copy = new Object*[count];
     for (size_t i = 0; i < count; i++) {
-        copy[i] = table_[i].obj;
+        copy[i] = concurrent ?
+                (Object*) android_atomic_acquire_load((int32_t*) &table_[i].obj) :
+                table_[i].obj;
     }
     dvmDumpReferenceTableContents(copy, count, descr);
     delete[] copy;
@@ -57,7 +57,8 @@
  * To make everything fit nicely in 32-bit integers, the maximum size of
  * the table is capped at 64K.
  *
- * None of the table functions are synchronized.
+ * None of the table functions are synchronized, apart from the concurrent
+ * entry points used for JNI globals (see below).
  */
 
 /*
@@ -124,6 +125,31 @@ struct IndirectRefSlot {
 /* use as initial value for "cookie", and when table has only one segment */
 #define IRT_FIRST_SEGMENT   0
 
+/* #of free slots a thread keeps on hand for a concurrent table */
+#define IRT_THREAD_CACHE_SIZE   32
+
+/*
+ * Per-thread cache of free slot indices for a concurrent table.  Threads
+ * take slots from here and return deleted slots here, and only touch the
+ * shared free list when the cache runs dry or fills up.
+ */
+struct IndirectRefCache {
+    u4      count;
+    u2      slots[IRT_THREAD_CACHE_SIZE];
+};
+
+/*
+ * Shared free list of a concurrent table.  "head" is (tag << 32) | index
+ * of the first free slot, and the tag changes on every update so that a
+ * pop working from a stale head cannot succeed.  It is kept out of line
+ * so that the table itself stays small and its layout doesn't depend on
+ * 64-bit alignment.
+ */
+struct IndirectRefFreeList {
+    volatile int64_t head;
+    u2      next[1];            /* next free index, for each free slot */
+};
+
 /*
  * Table definition.
  *
@@ -185,11 +211,15 @@ struct IndirectRefSlot {
  * and local refs to improve performance.  A large circular buffer might
  * reduce the amortized cost of adding global references.
  *
- * TODO: if we can guarantee that the underlying storage doesn't move,
- * e.g. by using oversized mmap regions to handle expanding tables, we may
- * be able to avoid having to synchronize lookups.  Might make sense to
- * add a "synchronized lookup" call that takes the mutex as an argument,
- * and either locks or doesn't lock based on internal details.
+ * A table set up with initConcurrent() is used differently, for JNI
+ * globals.  It has a single segment and reserves its full size up front
+ * in an mmap region, so the storage never moves and lookups need no
+ * lock.  Free slots are kept on a lock-free list, "freeList_", and on
+ * per-thread IndirectRefCaches in front of it; once
+ * handed out, topIndex only grows.  Slots are claimed and released with
+ * atomic operations, so addConcurrent() and removeConcurrent() may be
+ * called from many threads at once.  The GC still scans the table
+ * straight through, skipping free slots, which hold NULL.
  */
 union IRTSegmentState {
     u4          all;
@@ -259,6 +289,8 @@ public:
     size_t          alloc_entries_;
     /* max #of entries allowed */
     size_t          max_entries_;
+    /* concurrent tables: shared free list; NULL otherwise */
+    IndirectRefFreeList* freeList_;
 
     // TODO: want hole-filling stats (#of holes filled, total entries scanned)
     //       for performance evaluation.
@@ -308,6 +340,37 @@ public:
      */
     bool init(size_t initialCount, size_t maxCount, IndirectRefKind kind);
 
+    /*
+     * Initialize a fixed-size IndirectRefTable of "maxCount" entries for
+     * use with addConcurrent() and removeConcurrent().
+     *
+     * Returns "false" if table allocation fails.
+     */
+    bool initConcurrent(size_t maxCount, IndirectRefKind kind);
+
+    /*
+     * Add a new entry to a concurrent table, taking the slot from "cache"
+     * when it has one.  Safe to call from several threads at once, each
+     * with its own cache.
+     *
+     * Returns NULL if the table is full.
+     */
+    IndirectRef addConcurrent(Object* obj, IndirectRefCache* cache);
+
+    /*
+     * Remove an existing entry from a concurrent table, keeping the slot
+     * in "cache" for reuse.  Safe to call from several threads at once.
+     *
+     * Returns "false" if nothing was removed.
+     */
+    bool removeConcurrent(IndirectRef iref, IndirectRefCache* cache);
+
+    /*
+     * Return the free slots held in "cache" to the table's free list,
+     * e.g. when the owning thread exits.
+     */
+    void flushCache(IndirectRefCache* cache);
+
     /*
      * Clear out the contents, freeing allocated storage.
      *
@@ -344,6 +407,10 @@ public:
     }
 
 private:
+    bool findConcurrentIndex(IndirectRef iref, u4* pIndex) const;
+    bool reserveSlots(IndirectRefCache* cache);
+    void pushFreeSlots(const u2* slots, size_t count);
+
     static inline u4 extractIndex(IndirectRef iref) {
         u4 uref = (u4) iref;
         return (uref >> 2) & 0xffff;
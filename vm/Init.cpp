@@ -30,6 +30,7 @@
 #include "test/Test.h"
 #include "mterp/Mterp.h"
 #include "Hash.h"
+#include "alloc/GcWorkers.h"
 
 #if defined(WITH_JIT)
 #include "compiler/codegen/Optimizer.h"
@@ -113,17 +114,26 @@ static void usage(const char* progName)
     dvmFprintf(stderr, "These are unique to Dalvik:\n");
     dvmFprintf(stderr, "  -Xzygote\n");
     dvmFprintf(stderr, "  -Xdexopt:{none,verified,all,full}\n");
+    dvmFprintf(stderr, "  -Xdexoptthreads:N  (1 to %d, default 1)\n",
+        DEXOPT_MAX_THREADS);
     dvmFprintf(stderr, "  -Xnoquithandler\n");
     dvmFprintf(stderr,
                 "  -Xjnigreflimit:N  (must be multiple of 100, >= 200)\n");
     dvmFprintf(stderr, "  -Xjniopts:{warnonly,forcecopy}\n");
     dvmFprintf(stderr, "  -Xjnitrace:substring (eg NativeClass or nativeMethod)\n");
     dvmFprintf(stderr, "  -Xstacktracefile:<filename>\n");
+    dvmFprintf(stderr, "  -Xstacklessexceptions:<classname>[,<classname>]*\n");
     dvmFprintf(stderr, "  -Xgc:[no]precise\n");
     dvmFprintf(stderr, "  -Xgc:[no]preverify\n");
     dvmFprintf(stderr, "  -Xgc:[no]postverify\n");
     dvmFprintf(stderr, "  -Xgc:[no]concurrent\n");
     dvmFprintf(stderr, "  -Xgc:[no]verifycardtable\n");
+    dvmFprintf(stderr, "  -Xgc:[no]tlab\n");
+    dvmFprintf(stderr, "  -Xgc:[no]slab\n");
+    dvmFprintf(stderr, "  -Xgc:[no]generational\n");
+    dvmFprintf(stderr, "  -XX:YoungGenSize=N  (bytes allocated between young GCs)\n");
+    dvmFprintf(stderr, "  -Xgc:parallelthreads=N  (1 to %d, default 1)\n",
+        GC_WORKERS_MAX);
     dvmFprintf(stderr, "  -XX:+DisableExplicitGC\n");
     dvmFprintf(stderr, "  -X[no]genregmap\n");
     dvmFprintf(stderr, "  -Xverifyopt:[no]checkmon\n");
@@ -134,6 +144,8 @@ static void usage(const char* progName)
                        "[,hexopvalue[-endvalue]]*\n");
     dvmFprintf(stderr, "  -Xincludeselectedmethod\n");
     dvmFprintf(stderr, "  -Xjitthreshold:decimalvalue\n");
+    dvmFprintf(stderr, "  -Xjitthreads:N  (1 to %d, default half the CPUs)\n",
+        COMPILER_MAX_THREADS);
     dvmFprintf(stderr, "  -Xjitblocking\n");
     dvmFprintf(stderr, "  -Xjitmethod:signature[,signature]* "
                        "(eg Ljava/lang/String\\;replace)\n");
@@ -143,6 +155,7 @@ static void usage(const char* progName)
     dvmFprintf(stderr, "  -Xjitcheckcg\n");
     dvmFprintf(stderr, "  -Xjitverbose\n");
     dvmFprintf(stderr, "  -Xjitprofile\n");
+    dvmFprintf(stderr, "  -Xjittracefile:filename\n");
     dvmFprintf(stderr, "  -Xjitdisableopt\n");
     dvmFprintf(stderr, "  -Xjitsuspendpoll\n");
 #endif
@@ -554,6 +567,59 @@ static void freeAssertionCtrl()
     free(gDvm.assertionCtrl);
 }
 
+/*
+ * Parse -Xstacklessexceptions, a comma-separated list of exception class
+ * names.  They are kept as descriptors.
+ */
+static bool processXstacklessexceptions(const char* opt)
+{
+    size_t count = 1;
+    for (const char* cp = opt; *cp != '\0'; cp++) {
+        if (*cp == ',')
+            count++;
+    }
+
+    char** descriptors = (char**) realloc(gDvm.stacklessExceptions,
+        (gDvm.numStacklessExceptions + count) * sizeof(char*));
+    if (descriptors == NULL)
+        return false;
+    gDvm.stacklessExceptions = descriptors;
+
+    char* buf = strdup(opt);
+    char* start = buf;
+    char* end;
+    do {
+        end = strchr(start, ',');
+        if (end != NULL)
+            *end = '\0';
+
+        if (*start != '\0') {
+            char* descriptor = dvmDotToDescriptor(start);
+            if (descriptor == NULL) {
+                free(buf);
+                return false;
+            }
+            descriptors[gDvm.numStacklessExceptions++] = descriptor;
+        }
+        if (end != NULL)
+            start = end + 1;
+    } while (end != NULL);
+    free(buf);
+    return true;
+}
+
+/*
+ * Release the -Xstacklessexceptions list.
+ */
+static void freeStacklessExceptions()
+{
+    for (size_t i = 0; i < gDvm.numStacklessExceptions; i++)
+        free(gDvm.stacklessExceptions[i]);
+    free(gDvm.stacklessExceptions);
+    gDvm.stacklessExceptions = NULL;
+    gDvm.numStacklessExceptions = 0;
+}
+
 #if defined(WITH_JIT)
 /* Parse -Xjitop to selectively turn on/off certain opcodes for JIT */
 static void processXjitop(const char* opt)
@@ -918,6 +984,14 @@ static int processOptions(int argc, const char* const argv[],
                 dvmFprintf(stderr, "Invalid -XX:HeapGrowthLimit option '%s'\n", argv[i]);
                 return -1;
             }
+        } else if (strncmp(argv[i], "-XX:YoungGenSize=", 17) == 0) {
+            size_t val = parseMemOption(argv[i] + 17, 1024);
+            if (val != 0) {
+                gDvm.youngGenSize = val;
+            } else {
+                dvmFprintf(stderr, "Invalid -XX:YoungGenSize option '%s'\n", argv[i]);
+                return -1;
+            }
         } else if (strncmp(argv[i], "-Xss", 4) == 0) {
             size_t val = parseMemOption(argv[i]+4, 1);
             if (val != 0) {
@@ -1027,6 +1101,14 @@ static int processOptions(int argc, const char* const argv[],
                 dvmFprintf(stderr, "Unrecognized dexopt option '%s'\n",argv[i]);
                 return -1;
             }
+        } else if (strncmp(argv[i], "-Xdexoptthreads:", 16) == 0) {
+            char* end;
+            long val = strtol(argv[i] + 16, &end, 10);
+            if (*end != '\0' || val < 1 || val > DEXOPT_MAX_THREADS) {
+                dvmFprintf(stderr, "Bad value for -Xdexoptthreads\n");
+                return -1;
+            }
+            gDvm.dexOptThreads = val;
         } else if (strncmp(argv[i], "-Xverify:", 9) == 0) {
             if (strcmp(argv[i] + 9, "none") == 0)
                 gDvm.classVerifyMode = VERIFY_MODE_NONE;
@@ -1089,6 +1171,14 @@ static int processOptions(int argc, const char* const argv[],
           gDvmJit.blockingMode = true;
         } else if (strncmp(argv[i], "-Xjitthreshold:", 15) == 0) {
           gDvmJit.threshold = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "-Xjitthreads:", 13) == 0) {
+          char* end;
+          long val = strtol(argv[i] + 13, &end, 10);
+          if (*end != '\0' || val < 1 || val > COMPILER_MAX_THREADS) {
+              dvmFprintf(stderr, "Bad value for -Xjitthreads\n");
+              return -1;
+          }
+          gDvmJit.numCompilerThreads = val;
         } else if (strncmp(argv[i], "-Xincludeselectedop", 19) == 0) {
           gDvmJit.includeSelectedOp = true;
         } else if (strncmp(argv[i], "-Xincludeselectedmethod", 23) == 0) {
@@ -1101,6 +1191,8 @@ static int processOptions(int argc, const char* const argv[],
           gDvmJit.printBinary = true;
         } else if (strncmp(argv[i], "-Xjitverbose", 12) == 0) {
           gDvmJit.printMe = true;
+        } else if (strncmp(argv[i], "-Xjittracefile:", 15) == 0) {
+          gDvmJit.hotTraceFile = strdup(argv[i] + 15);
         } else if (strncmp(argv[i], "-Xjitprofile", 12) == 0) {
           gDvmJit.profileMode = kTraceProfilingContinuous;
         } else if (strncmp(argv[i], "-Xjitdisableopt", 15) == 0) {
@@ -1117,6 +1209,11 @@ static int processOptions(int argc, const char* const argv[],
 
         } else if (strncmp(argv[i], "-Xstacktracefile:", 17) == 0) {
             gDvm.stackTraceFile = strdup(argv[i]+17);
+        } else if (strncmp(argv[i], "-Xstacklessexceptions:", 22) == 0) {
+            if (!processXstacklessexceptions(argv[i] + 22)) {
+                dvmFprintf(stderr, "Unable to process '%s'\n", argv[i]);
+                return -1;
+            }
 
         } else if (strcmp(argv[i], "-Xgenregmap") == 0) {
             gDvm.generateRegisterMaps = true;
@@ -1149,7 +1246,27 @@ static int processOptions(int argc, const char* const argv[],
                 gDvm.verifyCardTable = true;
             else if (strcmp(argv[i] + 5, "noverifycardtable") == 0)
                 gDvm.verifyCardTable = false;
-            else {
+            else if (strcmp(argv[i] + 5, "tlab") == 0)
+                gDvm.useTlabs = true;
+            else if (strcmp(argv[i] + 5, "notlab") == 0)
+                gDvm.useTlabs = false;
+            else if (strcmp(argv[i] + 5, "slab") == 0)
+                gDvm.useSlabAllocator = true;
+            else if (strcmp(argv[i] + 5, "noslab") == 0)
+                gDvm.useSlabAllocator = false;
+            else if (strcmp(argv[i] + 5, "generational") == 0)
+                gDvm.generationalGc = true;
+            else if (strcmp(argv[i] + 5, "nogenerational") == 0)
+                gDvm.generationalGc = false;
+            else if (strncmp(argv[i] + 5, "parallelthreads=", 16) == 0) {
+                char* end;
+                long val = strtol(argv[i] + 21, &end, 10);
+                if (*end != '\0' || val < 1 || val > GC_WORKERS_MAX) {
+                    dvmFprintf(stderr, "Bad value for -Xgc:parallelthreads\n");
+                    return -1;
+                }
+                gDvm.gcParallelThreads = val;
+            } else {
                 dvmFprintf(stderr, "Bad value for -Xgc");
                 return -1;
             }
@@ -1208,6 +1325,11 @@ static void setCommandLineDefaults()
     gDvm.mainThreadStackSize = kDefaultStackSize;
 
     gDvm.concurrentMarkSweep = true;
+    gDvm.gcParallelThreads = 1;
+    gDvm.useTlabs = true;
+    gDvm.useSlabAllocator = false;
+    gDvm.generationalGc = false;
+    gDvm.youngGenSize = 2 * 1024 * 1024;
 
     /* gDvm.jdwpSuspend = true; */
 
@@ -1248,6 +1370,7 @@ static void setCommandLineDefaults()
      * dexopt target a differently-configured device.
      */
     gDvm.dexOptForSmp = (ANDROID_SMP != 0);
+    gDvm.dexOptThreads = 1;
 
     /*
      * Default profiler configuration.
@@ -1537,6 +1660,32 @@ std::string dvmStartup(int argc, const char* const argv[],
         ALOGE("dvmTestHash FAILED");
     if (false /*noisy!*/ && !dvmTestIndirectRefTable())
         ALOGE("dvmTestIndirectRefTable FAILED");
+    if (false /*slow*/ && !dvmTestInternTable())
+        ALOGE("dvmTestInternTable FAILED");
+    if (false /*slow*/ && !dvmTestClassTable())
+        ALOGE("dvmTestClassTable FAILED");
+    if (false /*slow*/ && !dvmTestMethodTables())
+        ALOGE("dvmTestMethodTables FAILED");
+    if (false /*slow*/ && !dvmTestZipExtract())
+        ALOGE("dvmTestZipExtract FAILED");
+    if (false /*slow*/ && !dvmTestDexOptThreads())
+        ALOGE("dvmTestDexOptThreads FAILED");
+    if (false /*slow*/ && !dvmTestUtf())
+        ALOGE("dvmTestUtf FAILED");
+    if (false /*slow*/ && !dvmTestJniGlobalRefs())
+        ALOGE("dvmTestJniGlobalRefs FAILED");
+    if (!dvmTestJniCritical())
+        ALOGE("dvmTestJniCritical FAILED");
+    if (false /*slow*/ && !dvmTestStacklessExceptions())
+        ALOGE("dvmTestStacklessExceptions FAILED");
+#if defined(WITH_JIT)
+    if (false /*slow*/ && !dvmTestHotTraces())
+        ALOGE("dvmTestHotTraces FAILED");
+#endif
+#ifndef WITH_COPYING_GC
+    if (false /*slow*/ && !dvmTestSlabAllocSpeed())
+        ALOGE("dvmTestSlabAllocSpeed FAILED");
+#endif
 #endif
 
     if (dvmCheckException(dvmThreadSelf())) {
@@ -1767,6 +1916,12 @@ int dvmPrepForDexOpt(const char* bootClassPath, DexOptimizerMode dexOptMode,
     } else {
         gDvm.dexOptForSmp = (ANDROID_SMP != 0);
     }
+    gDvm.dexOptThreads =
+        (dexoptFlags >> DEXOPT_THREADS_SHIFT) & DEXOPT_THREADS_MASK;
+    if (gDvm.dexOptThreads < 1)
+        gDvm.dexOptThreads = 1;
+    else if (gDvm.dexOptThreads > DEXOPT_MAX_THREADS)
+        gDvm.dexOptThreads = DEXOPT_MAX_THREADS;
 
     /*
      * Initialize the heap, some basic thread control mutexes, and
@@ -1838,6 +1993,7 @@ void dvmShutdown()
     gDvm.jniTrace = NULL;
     free(gDvm.stackTraceFile);
     gDvm.stackTraceFile = NULL;
+    freeStacklessExceptions();
 
     /* tell signal catcher to shut down if it was started */
     dvmSignalCatcherShutdown();
@@ -377,6 +377,8 @@ static bool initDirectMethodReferences() {
           "Lorg/apache/harmony/dalvik/ddmc/DdmServer;", "broadcast", "(I)V" },
         { &gDvm.methJavaLangRefReferenceQueueAdd,
           "Ljava/lang/ref/ReferenceQueue;", "add", "(Ljava/lang/ref/Reference;)V" },
+        { &gDvm.methJavaLangSystem_arraycopy, "Ljava/lang/System;", "arraycopy",
+          "(Ljava/lang/Object;ILjava/lang/Object;II)V" },
         { NULL, NULL, NULL, NULL }
     };
 
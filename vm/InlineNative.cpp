@@ -30,6 +30,18 @@
 extern "C" u4 __memcmp16(const u2* s0, const u2* s1, size_t count);
 #endif
 
+/*
+ * Compare and search UTF-16 data 8 chars at a time where the CPU has the
+ * vector instructions for it.  These take priority over __memcmp16.
+ */
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define STRING_SIMD
+#elif defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define STRING_SIMD
+#endif
+
 /*
  * Some notes on "inline" functions.
  *
@@ -121,6 +133,88 @@ static bool org_apache_harmony_dalvik_NativeTestTarget_emptyInlineMethod(
  * ===========================================================================
  */
 
+#ifdef STRING_SIMD
+#define kStringBlockChars   8
+
+#if defined(__SSE2__)
+/*
+ * Returns true if the 8 chars at "chars0" and "chars1" are the same.
+ */
+static inline bool sameCharBlock(const u2* chars0, const u2* chars1)
+{
+    __m128i block0 = _mm_loadu_si128((const __m128i*) chars0);
+    __m128i block1 = _mm_loadu_si128((const __m128i*) chars1);
+    return _mm_movemask_epi8(_mm_cmpeq_epi16(block0, block1)) == 0xffff;
+}
+
+/*
+ * Returns true if any of the 8 chars at "chars" is "ch".
+ */
+static inline bool charBlockHas(const u2* chars, u2 ch)
+{
+    __m128i block = _mm_loadu_si128((const __m128i*) chars);
+    __m128i match = _mm_cmpeq_epi16(block, _mm_set1_epi16(ch));
+    return _mm_movemask_epi8(match) != 0;
+}
+#elif defined(__ARM_NEON__)
+static inline u8 foldLanes(uint16x8_t lanes)
+{
+    uint16x4_t folded = vand_u16(vget_low_u16(lanes), vget_high_u16(lanes));
+    return vget_lane_u64(vreinterpret_u64_u16(folded), 0);
+}
+
+static inline bool sameCharBlock(const u2* chars0, const u2* chars1)
+{
+    uint16x8_t same = vceqq_u16(vld1q_u16(chars0), vld1q_u16(chars1));
+    return foldLanes(same) == ~0ULL;
+}
+
+static inline bool charBlockHas(const u2* chars, u2 ch)
+{
+    uint16x8_t match = vceqq_u16(vld1q_u16(chars), vdupq_n_u16(ch));
+    uint16x4_t folded = vorr_u16(vget_low_u16(match), vget_high_u16(match));
+    return vget_lane_u64(vreinterpret_u64_u16(folded), 0) != 0;
+}
+#endif
+#endif /*STRING_SIMD*/
+
+/*
+ * Return the index of the first char that differs between "chars0" and
+ * "chars1", or "count" if they're the same.
+ */
+static inline int firstMismatch(const u2* chars0, const u2* chars1, int count)
+{
+    int i = 0;
+#ifdef STRING_SIMD
+    while (i + kStringBlockChars <= count &&
+           sameCharBlock(chars0 + i, chars1 + i))
+    {
+        i += kStringBlockChars;
+    }
+#endif
+    while (i < count && chars0[i] == chars1[i])
+        i++;
+    return i;
+}
+
+/*
+ * Return the index of the first "ch" in chars[start..count), or -1.
+ */
+static inline int findChar(const u2* chars, u2 ch, int start, int count)
+{
+    int i = start;
+#ifdef STRING_SIMD
+    while (i + kStringBlockChars <= count && !charBlockHas(chars + i, ch))
+        i += kStringBlockChars;
+#endif
+    while (i < count) {
+        if (chars[i] == ch)
+            return i;
+        i++;
+    }
+    return -1;
+}
+
 /*
  * public char charAt(int index)
  */
@@ -241,7 +335,13 @@ bool javaLangString_compareTo(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
     thisChars = ((const u2*)(void*)thisArray->contents) + thisOffset;
     compChars = ((const u2*)(void*)compArray->contents) + compOffset;
 
-#ifdef HAVE__MEMCMP16
+#if defined(STRING_SIMD)
+    int i = firstMismatch(thisChars, compChars, minCount);
+    if (i < minCount) {
+        pResult->i = (s4) thisChars[i] - (s4) compChars[i];
+        return true;
+    }
+#elif defined(HAVE__MEMCMP16)
     /*
      * Use assembly version, which returns the difference between the
      * characters.  The annoying part here is that 0x00e9 - 0xffff != 0x00ea,
@@ -362,7 +462,9 @@ bool javaLangString_equals(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
     thisChars = ((const u2*)(void*)thisArray->contents) + thisOffset;
     compChars = ((const u2*)(void*)compArray->contents) + compOffset;
 
-#ifdef HAVE__MEMCMP16
+#if defined(STRING_SIMD)
+    pResult->i = (firstMismatch(thisChars, compChars, thisCount) == thisCount);
+#elif defined(HAVE__MEMCMP16)
     pResult->i = (__memcmp16(thisChars, compChars, thisCount) == 0);
 # ifdef CHECK_MEMCMP16
     int otherRes = (memcmp(thisChars, compChars, thisCount * 2) == 0);
@@ -466,7 +568,12 @@ static inline int indexOfCommon(Object* strObj, int ch, int start)
     else if (start > count)
         start = count;
 
-#if 0
+#if defined(STRING_SIMD)
+    /* no char can match a value that doesn't fit in 16 bits */
+    if ((u4) ch > 0xffff)
+        return -1;
+    return findChar(chars, (u2) ch, start, count);
+#elif 0
     /* 16-bit loop, simple */
     while (start < count) {
         if (chars[start] == ch)
@@ -506,6 +613,99 @@ bool javaLangString_fastIndexOf_II(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
     return true;
 }
 
+/*
+ * public int indexOf(String string)
+ *
+ * Find the first char of "string" with findChar(), then compare the rest
+ * of it in place.  An empty string is found at index 0.
+ */
+bool javaLangString_indexOf_String(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    /* null reference check on "this" and the argument */
+    if ((Object*) arg0 == NULL || (Object*) arg1 == NULL) {
+        dvmThrowNullPointerException(NULL);
+        return false;
+    }
+
+    const StringObject* strObj = (const StringObject*) arg0;
+    const StringObject* subObj = (const StringObject*) arg1;
+    int count = strObj->length();
+    int subCount = subObj->length();
+    if (subCount == 0) {
+        pResult->i = 0;
+        return true;
+    }
+
+    const u2* chars = strObj->chars();
+    const u2* subChars = subObj->chars();
+    int last = count - subCount;
+    int start = 0;
+    while (start <= last) {
+        start = findChar(chars, subChars[0], start, last + 1);
+        if (start < 0)
+            break;
+        if (firstMismatch(chars + start + 1, subChars + 1, subCount - 1) ==
+                subCount - 1)
+        {
+            pResult->i = start;
+            return true;
+        }
+        start++;
+    }
+    pResult->i = -1;
+    return true;
+}
+
+/*
+ * public boolean startsWith(String prefix, int start)
+ *
+ * This is regionMatches(start, prefix, 0, prefix.length()), which itself
+ * has too many arguments to be an inline op.
+ */
+bool javaLangString_startsWith_StringI(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    /* null reference check on "this" and the argument */
+    if ((Object*) arg0 == NULL || (Object*) arg1 == NULL) {
+        dvmThrowNullPointerException(NULL);
+        return false;
+    }
+
+    const StringObject* strObj = (const StringObject*) arg0;
+    const StringObject* prefixObj = (const StringObject*) arg1;
+    int start = (s4) arg2;
+    int count = strObj->length();
+    int prefixCount = prefixObj->length();
+    if (start < 0 || count - start < prefixCount) {
+        pResult->i = false;
+        return true;
+    }
+
+    pResult->i = (firstMismatch(strObj->chars() + start, prefixObj->chars(),
+                                prefixCount) == prefixCount);
+    return true;
+}
+
+/*
+ * public int hashCode()
+ *
+ * Uses the hash cached in the String if there is one, and caches the one
+ * it computes, just like the Java version.
+ */
+bool javaLangString_hashCode(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+    JValue* pResult)
+{
+    /* null reference check on "this" */
+    if ((Object*) arg0 == NULL) {
+        dvmThrowNullPointerException(NULL);
+        return false;
+    }
+
+    pResult->i = dvmComputeStringHash((StringObject*) arg0);
+    return true;
+}
+
 
 /*
  * ===========================================================================
@@ -767,6 +967,10 @@ const InlineOperation gDvmInlineOpsTable[] = {
     { javaLangMath_min_int, "Ljava/lang/StrictMath;", "min", "(II)I" },
     { javaLangMath_max_int, "Ljava/lang/StrictMath;", "max", "(II)I" },
     { javaLangMath_sqrt, "Ljava/lang/StrictMath;", "sqrt", "(D)D" },
+
+    { javaLangString_indexOf_String, "Ljava/lang/String;", "indexOf", "(Ljava/lang/String;)I" },
+    { javaLangString_startsWith_StringI, "Ljava/lang/String;", "startsWith", "(Ljava/lang/String;I)Z" },
+    { javaLangString_hashCode, "Ljava/lang/String;", "hashCode", "()I" },
 };
 
 /*
@@ -87,6 +87,9 @@ enum NativeInlineOps {
     INLINE_STRICT_MATH_MIN_INT = 26,
     INLINE_STRICT_MATH_MAX_INT = 27,
     INLINE_STRICT_MATH_SQRT = 28,
+    INLINE_STRING_INDEXOF_STRING = 29,
+    INLINE_STRING_STARTSWITH_STRINGI = 30,
+    INLINE_STRING_HASHCODE = 31,
 };
 
 /*
@@ -149,6 +152,15 @@ bool javaLangString_isEmpty(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
 bool javaLangString_fastIndexOf_II(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
                                    JValue* pResult);
 
+bool javaLangString_indexOf_String(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                                   JValue* pResult);
+
+bool javaLangString_startsWith_StringI(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                                       JValue* pResult);
+
+bool javaLangString_hashCode(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
+                             JValue* pResult);
+
 bool javaLangMath_abs_int(u4 arg0, u4 arg1, u4 arg2, u4 arg3,
                           JValue* pResult);
 
@@ -25,13 +25,16 @@
  */
 bool dvmStringInternStartup()
 {
-    dvmInitMutex(&gDvm.internLock);
-    gDvm.internedStrings = dvmHashTableCreate(256, NULL);
-    if (gDvm.internedStrings == NULL)
-        return false;
-    gDvm.literalStrings = dvmHashTableCreate(256, NULL);
-    if (gDvm.literalStrings == NULL)
-        return false;
+    for (int i = 0; i < INTERN_TABLE_STRIPES; i++) {
+        InternTableStripe* stripe = &gDvm.internTable[i];
+        dvmInitMutex(&stripe->lock);
+        stripe->internedStrings = dvmHashTableCreate(32, NULL);
+        if (stripe->internedStrings == NULL)
+            return false;
+        stripe->literalStrings = dvmHashTableCreate(32, NULL);
+        if (stripe->literalStrings == NULL)
+            return false;
+    }
     return true;
 }
 
@@ -42,13 +45,26 @@ bool dvmStringInternStartup()
  */
 void dvmStringInternShutdown()
 {
-    if (gDvm.internedStrings != NULL || gDvm.literalStrings != NULL) {
-        dvmDestroyMutex(&gDvm.internLock);
+    for (int i = 0; i < INTERN_TABLE_STRIPES; i++) {
+        InternTableStripe* stripe = &gDvm.internTable[i];
+        if (stripe->internedStrings != NULL || stripe->literalStrings != NULL) {
+            dvmDestroyMutex(&stripe->lock);
+        }
+        dvmHashTableFree(stripe->internedStrings);
+        stripe->internedStrings = NULL;
+        dvmHashTableFree(stripe->literalStrings);
+        stripe->literalStrings = NULL;
     }
-    dvmHashTableFree(gDvm.internedStrings);
-    gDvm.internedStrings = NULL;
-    dvmHashTableFree(gDvm.literalStrings);
-    gDvm.literalStrings = NULL;
+}
+
+/*
+ * Select the stripe for a string hash.  The tables of a stripe pick their
+ * buckets with the low bits of the hash, so take the stripe from the
+ * high bits of a scrambled copy.
+ */
+static InternTableStripe* stripeForKey(u4 key)
+{
+    return &gDvm.internTable[(key * 0x9e3779b1) >> 27];
 }
 
 static StringObject* lookupString(HashTable* table, u4 key, StringObject* value)
@@ -60,69 +76,78 @@ static StringObject* lookupString(HashTable* table, u4 key, StringObject* value)
 
 static StringObject* insertString(HashTable* table, u4 key, StringObject* value)
 {
-    if (dvmIsNonMovingObject(value) == false) {
-        value = (StringObject*)dvmCloneObject(value, ALLOC_NON_MOVING);
-    }
+    assert(dvmIsNonMovingObject(value));
     void* entry = dvmHashTableLookup(table, key, (void*)value,
                                      dvmHashcmpStrings, true);
     return (StringObject*)entry;
 }
 
-static StringObject* lookupInternedString(StringObject* strObj, bool isLiteral)
+/*
+ * Look for a string in both tables of a stripe, moving it to the literal
+ * table if <isLiteral> is set.  Returns NULL if it is in neither.
+ */
+static StringObject* findInStripe(InternTableStripe* stripe, u4 key,
+                                  StringObject* strObj, bool isLiteral)
 {
-    StringObject* found;
+    /*
+     * Check the literal table for a match.
+     */
+    StringObject* found = lookupString(stripe->literalStrings, key, strObj);
+    if (found != NULL) {
+        return found;
+    }
+    found = lookupString(stripe->internedStrings, key, strObj);
+    if (found != NULL && isLiteral) {
+        /*
+         * A match was found in the interned table.  Move the
+         * matching string to the literal table.
+         */
+        dvmHashTableRemove(stripe->internedStrings, key, found);
+        StringObject* literal =
+            insertString(stripe->literalStrings, key, found);
+        assert(literal == found);
+    }
+    return found;
+}
 
+static StringObject* lookupInternedString(StringObject* strObj, bool isLiteral)
+{
     assert(strObj != NULL);
     u4 key = dvmComputeStringHash(strObj);
-    dvmLockMutex(&gDvm.internLock);
-    if (isLiteral) {
-        /*
-         * Check the literal table for a match.
-         */
-        StringObject* literal = lookupString(gDvm.literalStrings, key, strObj);
-        if (literal != NULL) {
-            /*
-             * A match was found in the literal table, the easy case.
-             */
-            found = literal;
-        } else {
-            /*
-             * There is no match in the literal table, check the
-             * interned string table.
-             */
-            StringObject* interned = lookupString(gDvm.internedStrings, key, strObj);
-            if (interned != NULL) {
-                /*
-                 * A match was found in the interned table.  Move the
-                 * matching string to the literal table.
-                 */
-                dvmHashTableRemove(gDvm.internedStrings, key, interned);
-                found = insertString(gDvm.literalStrings, key, interned);
-                assert(found == interned);
-            } else {
-                /*
-                 * No match in the literal table or the interned
-                 * table.  Insert into the literal table.
-                 */
-                found = insertString(gDvm.literalStrings, key, strObj);
-                assert(found == strObj);
-            }
-        }
-    } else {
-        /*
-         * Check the literal table for a match.
-         */
-        found = lookupString(gDvm.literalStrings, key, strObj);
-        if (found == NULL) {
-            /*
-             * No match was found in the literal table.  Insert into
-             * the intern table if it does not already exist.
-             */
-            found = insertString(gDvm.internedStrings, key, strObj);
+    InternTableStripe* stripe = stripeForKey(key);
+
+    dvmLockMutex(&stripe->lock);
+    StringObject* found = findInStripe(stripe, key, strObj, isLiteral);
+    dvmUnlockMutex(&stripe->lock);
+    if (found != NULL) {
+        return found;
+    }
+
+    /*
+     * No match in the literal table or the interned table.  Strings in
+     * the tables must not move, so copy the string if need be; this may
+     * allocate, and so is done without the lock.  Another thread may
+     * have added the same string in the meantime, so look again.
+     */
+    StringObject* candidate = strObj;
+    if (!dvmIsNonMovingObject(candidate)) {
+        candidate = (StringObject*)dvmCloneObject(candidate, ALLOC_NON_MOVING);
+        if (candidate == NULL) {
+            return NULL;
         }
     }
-    assert(found != NULL);
-    dvmUnlockMutex(&gDvm.internLock);
+    dvmLockMutex(&stripe->lock);
+    found = findInStripe(stripe, key, candidate, isLiteral);
+    if (found == NULL) {
+        HashTable* table = isLiteral ? stripe->literalStrings
+                                     : stripe->internedStrings;
+        found = insertString(table, key, candidate);
+        assert(found == candidate);
+    }
+    dvmUnlockMutex(&stripe->lock);
+    if (candidate != strObj) {
+        dvmReleaseTrackedAlloc((Object*)candidate, NULL);
+    }
     return found;
 }
 
@@ -153,13 +178,14 @@ StringObject* dvmLookupImmortalInternedString(StringObject* strObj)
 bool dvmIsWeakInternedString(StringObject* strObj)
 {
     assert(strObj != NULL);
-    if (gDvm.internedStrings == NULL) {
+    u4 key = dvmComputeStringHash(strObj);
+    InternTableStripe* stripe = stripeForKey(key);
+    if (stripe->internedStrings == NULL) {
         return false;
     }
-    dvmLockMutex(&gDvm.internLock);
-    u4 key = dvmComputeStringHash(strObj);
-    StringObject* found = lookupString(gDvm.internedStrings, key, strObj);
-    dvmUnlockMutex(&gDvm.internLock);
+    dvmLockMutex(&stripe->lock);
+    StringObject* found = lookupString(stripe->internedStrings, key, strObj);
+    dvmUnlockMutex(&stripe->lock);
     return found == strObj;
 }
 
@@ -171,9 +197,46 @@ void dvmGcDetachDeadInternedStrings(int (*isUnmarkedObject)(void *))
     /* It's possible for a GC to happen before dvmStringInternStartup()
      * is called.
      */
-    if (gDvm.internedStrings != NULL) {
-        dvmLockMutex(&gDvm.internLock);
-        dvmHashForeachRemove(gDvm.internedStrings, isUnmarkedObject);
-        dvmUnlockMutex(&gDvm.internLock);
+    for (int i = 0; i < INTERN_TABLE_STRIPES; i++) {
+        InternTableStripe* stripe = &gDvm.internTable[i];
+        if (stripe->internedStrings != NULL) {
+            dvmLockMutex(&stripe->lock);
+            dvmHashForeachRemove(stripe->internedStrings, isUnmarkedObject);
+            dvmUnlockMutex(&stripe->lock);
+        }
+    }
+}
+
+#ifdef WITH_COPYING_GC
+/*
+ * Point the intern table at the new addresses of surviving strings and
+ * clear the strings that died.  Entries are keyed by the string hash,
+ * which does not depend on the address.
+ */
+void dvmGcUpdateInternedStrings(Object* (*forwardObject)(Object*))
+{
+    for (int s = 0; s < INTERN_TABLE_STRIPES; s++) {
+        InternTableStripe* stripe = &gDvm.internTable[s];
+        HashTable* table = stripe->internedStrings;
+        if (table == NULL) {
+            continue;
+        }
+        dvmLockMutex(&stripe->lock);
+        for (int i = 0; i < table->tableSize; ++i) {
+            HashEntry* entry = &table->pEntries[i];
+            if (entry->data == NULL || entry->data == HASH_TOMBSTONE) {
+                continue;
+            }
+            Object* obj = (*forwardObject)((Object*)entry->data);
+            if (obj != NULL) {
+                entry->data = obj;
+            } else {
+                entry->data = HASH_TOMBSTONE;
+                table->numEntries--;
+                table->numDeadEntries++;
+            }
+        }
+        dvmUnlockMutex(&stripe->lock);
     }
 }
+#endif
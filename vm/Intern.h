@@ -19,11 +19,33 @@
 #ifndef DALVIK_INTERN_H_
 #define DALVIK_INTERN_H_
 
+/*
+ * The intern tables are split by string hash into stripes, each with a
+ * lock of its own, so that threads interning different strings rarely
+ * wait for each other.  A string is always in the stripe for its hash,
+ * in at most one of the two tables there.
+ */
+#define INTERN_TABLE_STRIPES 32
+
+struct InternTableStripe {
+    /* Guards both tables of the stripe. */
+    pthread_mutex_t lock;
+
+    /* Hash table of strings interned by the user. */
+    struct HashTable* internedStrings;
+
+    /* Hash table of strings interned by the class loader. */
+    struct HashTable* literalStrings;
+};
+
 bool dvmStringInternStartup(void);
 void dvmStringInternShutdown(void);
 StringObject* dvmLookupInternedString(StringObject* strObj);
 StringObject* dvmLookupImmortalInternedString(StringObject* strObj);
 bool dvmIsWeakInternedString(StringObject* strObj);
 void dvmGcDetachDeadInternedStrings(int (*isUnmarkedObject)(void *));
+#ifdef WITH_COPYING_GC
+void dvmGcUpdateInternedStrings(Object* (*forwardObject)(Object*));
+#endif
 
 #endif  // DALVIK_INTERN_H_
@@ -240,20 +240,64 @@ private:
     void operator=(const ScopedJniThreadState&);
 };
 
-#define kGlobalRefsTableInitialSize 512
 #define kGlobalRefsTableMaxSize     51200       /* arbitrary, must be < 64K */
 #define kGrefWaterInterval          100
 #define kTrackGrefUsage             true
 
 #define kWeakGlobalRefsTableInitialSize 16
 
-#define kPinTableInitialSize        16
 #define kPinTableMaxSize            1024
 #define kPinComplainThreshold       10
 
+#define kUtfCacheSize               256         /* must be a power of 2 */
+#define kUtfCacheMaxChars           256
+
+/*
+ * Every buffer handed out by GetStringUTFChars starts with this header.
+ * Buffers for short strings are also kept in a small cache keyed on the
+ * string object; strings are immutable, so the next call for the same
+ * string returns the same bytes without converting them again.  A buffer
+ * is freed once it is out of the cache and nobody holds it.  Both fields
+ * are guarded by jniUtfCacheLock.
+ */
+struct JniUtfBuffer {
+    u4      refs;           /* #of outstanding GetStringUTFChars results */
+    bool    cached;         /* still referenced from gDvm.jniUtfCache */
+};
+
+struct JniUtfCacheEntry {
+    StringObject*   str;
+    JniUtfBuffer*   utf;
+};
+
+static inline char* utfBufferChars(JniUtfBuffer* buf) {
+    return (char*) (buf + 1);
+}
+
+static inline JniUtfBuffer* utfBufferFromChars(const char* chars) {
+    return ((JniUtfBuffer*) chars) - 1;
+}
+
+static inline JniUtfCacheEntry* utfCacheEntryFor(const StringObject* strObj) {
+    return &gDvm.jniUtfCache[((u4) strObj >> 3) & (kUtfCacheSize - 1)];
+}
+
+/*
+ * Drop the cache's hold on an entry's buffer.  Caller holds the lock.
+ */
+static void evictUtfCacheEntry(JniUtfCacheEntry* entry) {
+    if (entry->utf != NULL) {
+        entry->utf->cached = false;
+        if (entry->utf->refs == 0) {
+            free(entry->utf);
+        }
+    }
+    entry->str = NULL;
+    entry->utf = NULL;
+}
+
 bool dvmJniStartup() {
-    if (!gDvm.jniGlobalRefTable.init(kGlobalRefsTableInitialSize,
-                                 kGlobalRefsTableMaxSize,
+    if (!gDvm.jniGlobalRefTable.initConcurrent(kGlobalRefsTableMaxSize,
                                  kIndirectKindGlobal)) {
         return false;
     }
@@ -268,19 +312,33 @@ bool dvmJniStartup() {
     gDvm.jniGlobalRefLoMark = 0;
     gDvm.jniGlobalRefHiMark = kGrefWaterInterval * 2;
 
-    if (!dvmInitReferenceTable(&gDvm.jniPinRefTable, kPinTableInitialSize, kPinTableMaxSize)) {
+    if (!dvmInitPinTable(&gDvm.jniPinTable, kPinTableMaxSize)) {
         return false;
     }
 
     dvmInitMutex(&gDvm.jniPinRefLock);
 
+    gDvm.jniUtfCache = (JniUtfCacheEntry*) calloc(kUtfCacheSize,
+            sizeof(JniUtfCacheEntry));
+    if (gDvm.jniUtfCache == NULL) {
+        return false;
+    }
+    dvmInitMutex(&gDvm.jniUtfCacheLock);
+
     return true;
 }
 
 void dvmJniShutdown() {
     gDvm.jniGlobalRefTable.destroy();
     gDvm.jniWeakGlobalRefTable.destroy();
-    dvmClearReferenceTable(&gDvm.jniPinRefTable);
+    dvmClearPinTable(&gDvm.jniPinTable);
+    if (gDvm.jniUtfCache != NULL) {
+        for (int i = 0; i < kUtfCacheSize; i++) {
+            evictUtfCacheEntry(&gDvm.jniUtfCache[i]);
+        }
+        free(gDvm.jniUtfCache);
+        gDvm.jniUtfCache = NULL;
+    }
 }
 
 /*
@@ -324,9 +382,8 @@ Object* dvmDecodeIndirectRef(Thread* self, jobject jobj) {
         }
     case kIndirectKindGlobal:
         {
-            // TODO: find a way to avoid the mutex activity here
+            // The global table never moves, so no lock is needed here.
             IndirectRefTable* pRefTable = &gDvm.jniGlobalRefTable;
-            ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
             Object* result = pRefTable->get(jobj);
             if (UNLIKELY(result == NULL)) {
                 ALOGE("JNI ERROR (app bug): use of deleted global reference (%p)", jobj);
@@ -433,8 +490,11 @@ static void deleteLocalReference(Thread* self, jobject jobj) {
  *
  * We may add the same object more than once.  Add/remove calls are paired,
  * so it needs to appear on the list multiple times.
+ *
+ * The slot comes from the calling thread's cache, so no lock is taken
+ * unless GREF usage tracking is on.
  */
-static jobject addGlobalReference(Object* obj) {
+static jobject addGlobalReference(Thread* self, Object* obj) {
     if (obj == NULL) {
         return NULL;
     }
@@ -470,8 +530,6 @@ static jobject addGlobalReference(Object* obj) {
         }
     }
 
-    ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
-
     /*
      * Throwing an exception on failure is problematic, because JNI code
      * may not be expecting an exception, and things sort of cascade.  We
@@ -481,9 +539,13 @@ static jobject addGlobalReference(Object* obj) {
      * we're either leaking global ref table entries or we're going to
      * run out of space in the GC heap.
      */
-    jobject jobj = (jobject) gDvm.jniGlobalRefTable.add(IRT_FIRST_SEGMENT, obj);
+    jobject jobj = (jobject) gDvm.jniGlobalRefTable.addConcurrent(obj,
+            &self->jniGlobalRefCache);
     if (jobj == NULL) {
-        gDvm.jniGlobalRefTable.dump("JNI global");
+        {
+            ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
+            gDvm.jniGlobalRefTable.dump("JNI global");
+        }
         ALOGE("Failed adding to JNI global ref table (%zd entries)",
                 gDvm.jniGlobalRefTable.capacity());
         dvmAbort();
@@ -495,6 +557,7 @@ static jobject addGlobalReference(Object* obj) {
 
     /* GREF usage tracking; should probably be disabled for production env */
     if (kTrackGrefUsage && gDvm.jniGrefLimit != 0) {
+        ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
         int count = gDvm.jniGlobalRefTable.capacity();
         // TODO: adjust for "holes"
         if (count > gDvm.jniGlobalRefHiMark) {
@@ -546,24 +609,21 @@ static void deleteWeakGlobalReference(jobject jobj) {
 }
 
 /*
- * Remove a global reference.  In most cases it's the entry most recently
- * added, which makes this pretty quick.
- *
- * Thought: if it's not the most recent entry, just null it out.  When we
- * fill up, do a compaction pass before we expand the list.
+ * Remove a global reference.  The freed slot goes back to the calling
+ * thread's cache, where the next addGlobalReference() will find it.
  */
-static void deleteGlobalReference(jobject jobj) {
+static void deleteGlobalReference(Thread* self, jobject jobj) {
     if (jobj == NULL) {
         return;
     }
 
-    ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
-    if (!gDvm.jniGlobalRefTable.remove(IRT_FIRST_SEGMENT, jobj)) {
+    if (!gDvm.jniGlobalRefTable.removeConcurrent(jobj, &self->jniGlobalRefCache)) {
         ALOGW("JNI: DeleteGlobalRef(%p) failed to find entry", jobj);
         return;
     }
 
     if (kTrackGrefUsage && gDvm.jniGrefLimit != 0) {
+        ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
         int count = gDvm.jniGlobalRefTable.capacity();
         // TODO: not quite right, need to subtract holes
         if (count < gDvm.jniGlobalRefLoMark) {
@@ -574,11 +634,26 @@ static void deleteGlobalReference(jobject jobj) {
     }
 }
 
+/*
+ * Returns true if native code can be handed a pointer straight into
+ * "obj" without pinning it.  The copying collector moves any object that
+ * isn't pinned, so there we always pin.
+ */
+static bool isZeroCopyObject(const Object* obj) {
+#ifdef WITH_COPYING_GC
+    return false;
+#else
+    return dvmIsNonMovingObject(obj);
+#endif
+}
+
 /*
  * Objects don't currently move, so we just need to create a reference
  * that will ensure the array object isn't collected.
  *
- * We use a separate reference table, which is part of the GC root set.
+ * We use a separate pin table, which is part of the GC root set.  It keeps
+ * a count per array, so pins and unpins are constant time however many
+ * arrays are pinned and in whatever order they are released.
  */
 static void pinPrimitiveArray(ArrayObject* arrayObj) {
     if (arrayObj == NULL) {
@@ -587,10 +662,11 @@ static void pinPrimitiveArray(ArrayObject* arrayObj) {
 
     ScopedPthreadMutexLock lock(&gDvm.jniPinRefLock);
 
-    if (!dvmAddToReferenceTable(&gDvm.jniPinRefTable, (Object*)arrayObj)) {
-        dvmDumpReferenceTable(&gDvm.jniPinRefTable, "JNI pinned array");
-        ALOGE("Failed adding to JNI pinned array ref table (%d entries)",
-           (int) dvmReferenceTableEntries(&gDvm.jniPinRefTable));
+    u4 count = dvmPinTableAdd(&gDvm.jniPinTable, (Object*)arrayObj);
+    if (count == 0) {
+        dvmDumpPinTable(&gDvm.jniPinTable, "JNI pinned array");
+        ALOGE("Failed adding to JNI pinned array table (%d entries)",
+           (int) dvmPinTableEntries(&gDvm.jniPinTable));
         dvmDumpThread(dvmThreadSelf(), false);
         dvmAbort();
     }
@@ -604,13 +680,6 @@ static void pinPrimitiveArray(ArrayObject* arrayObj) {
      * not being called.
      */
     if (kTrackGrefUsage && gDvm.jniGrefLimit != 0) {
-        int count = 0;
-        Object** ppObj = gDvm.jniPinRefTable.table;
-        while (ppObj < gDvm.jniPinRefTable.nextEntry) {
-            if (*ppObj++ == (Object*) arrayObj)
-                count++;
-        }
-
         if (count > kPinComplainThreshold) {
             ALOGW("JNI: pin count on array %p (%s) is now %d",
                 arrayObj, arrayObj->clazz->descriptor, count);
@@ -629,9 +698,7 @@ static void unpinPrimitiveArray(ArrayObject* arrayObj) {
     }
 
     ScopedPthreadMutexLock lock(&gDvm.jniPinRefLock);
-    if (!dvmRemoveFromReferenceTable(&gDvm.jniPinRefTable,
-            gDvm.jniPinRefTable.table, (Object*) arrayObj))
-    {
+    if (!dvmPinTableRemove(&gDvm.jniPinTable, (Object*) arrayObj)) {
         ALOGW("JNI: unpinPrimitiveArray(%p) failed to find entry (valid=%d)",
             arrayObj, dvmIsHeapAddress((Object*) arrayObj));
         return;
@@ -646,8 +713,14 @@ static void unpinPrimitiveArray(ArrayObject* arrayObj) {
 void dvmDumpJniReferenceTables() {
     Thread* self = dvmThreadSelf();
     self->jniLocalRefTable.dump("JNI local");
-    gDvm.jniGlobalRefTable.dump("JNI global");
-    dvmDumpReferenceTable(&gDvm.jniPinRefTable, "JNI pinned array");
+    {
+        ScopedPthreadMutexLock lock(&gDvm.jniGlobalRefLock);
+        gDvm.jniGlobalRefTable.dump("JNI global");
+    }
+    {
+        ScopedPthreadMutexLock lock(&gDvm.jniPinRefLock);
+        dvmDumpPinTable(&gDvm.jniPinTable, "JNI pinned array");
+    }
 }
 
 /*
@@ -1445,7 +1518,7 @@ static jobject PopLocalFrame(JNIEnv* env, jobject jresult) {
 static jobject NewGlobalRef(JNIEnv* env, jobject jobj) {
     ScopedJniThreadState ts(env);
     Object* obj = dvmDecodeIndirectRef(ts.self(), jobj);
-    return addGlobalReference(obj);
+    return addGlobalReference(ts.self(), obj);
 }
 
 /*
@@ -1453,7 +1526,7 @@ static jobject NewGlobalRef(JNIEnv* env, jobject jobj) {
  */
 static void DeleteGlobalRef(JNIEnv* env, jobject jglobalRef) {
     ScopedJniThreadState ts(env);
-    deleteGlobalReference(jglobalRef);
+    deleteGlobalReference(ts.self(), jglobalRef);
 }
 
 
@@ -2121,7 +2194,8 @@ static jsize GetStringLength(JNIEnv* env, jstring jstr) {
  * Get a string's character data.
  *
  * The result is guaranteed to be valid until ReleaseStringChars is
- * called, which means we have to pin it or return a copy.
+ * called, which means we have to pin it or return a copy.  Arrays that
+ * can't move need neither.
  */
 static const jchar* GetStringChars(JNIEnv* env, jstring jstr, jboolean* isCopy) {
     ScopedJniThreadState ts(env);
@@ -2129,7 +2203,9 @@ static const jchar* GetStringChars(JNIEnv* env, jstring jstr, jboolean* isCopy)
     StringObject* strObj = (StringObject*) dvmDecodeIndirectRef(ts.self(), jstr);
     ArrayObject* strChars = strObj->array();
 
-    pinPrimitiveArray(strChars);
+    if (!isZeroCopyObject((Object*) strChars)) {
+        pinPrimitiveArray(strChars);
+    }
 
     const u2* data = strObj->chars();
     if (isCopy != NULL) {
@@ -2145,7 +2221,9 @@ static void ReleaseStringChars(JNIEnv* env, jstring jstr, const jchar* chars) {
     ScopedJniThreadState ts(env);
     StringObject* strObj = (StringObject*) dvmDecodeIndirectRef(ts.self(), jstr);
     ArrayObject* strChars = strObj->array();
-    unpinPrimitiveArray(strChars);
+    if (!isZeroCopyObject((Object*) strChars)) {
+        unpinPrimitiveArray(strChars);
+    }
 }
 
 /*
@@ -2178,6 +2256,40 @@ static jsize GetStringUTFLength(JNIEnv* env, jstring jstr) {
     return strObj->utfLength();
 }
 
+/*
+ * Forget strings that did not survive the collection, so that the cache
+ * never matches a new string allocated at a dead one's address.
+ */
+void dvmSweepJniUtfCache(int (*isUnmarkedObject)(void*)) {
+    if (gDvm.jniUtfCache == NULL) {
+        return;
+    }
+    ScopedPthreadMutexLock lock(&gDvm.jniUtfCacheLock);
+    for (int i = 0; i < kUtfCacheSize; i++) {
+        JniUtfCacheEntry* entry = &gDvm.jniUtfCache[i];
+        if (entry->str != NULL && isUnmarkedObject(entry->str)) {
+            evictUtfCacheEntry(entry);
+        }
+    }
+}
+
+#ifdef WITH_COPYING_GC
+/*
+ * Entries are keyed on the string address, so rather than rehash the
+ * survivors after a copying collection we simply start over.
+ */
+void dvmUpdateJniUtfCache(Object* (*forwardObject)(Object*)) {
+    UNUSED_PARAMETER(forwardObject);
+    if (gDvm.jniUtfCache == NULL) {
+        return;
+    }
+    ScopedPthreadMutexLock lock(&gDvm.jniUtfCacheLock);
+    for (int i = 0; i < kUtfCacheSize; i++) {
+        evictUtfCacheEntry(&gDvm.jniUtfCache[i]);
+    }
+}
+#endif
+
 /*
  * Convert "string" to modified UTF-8 and return a pointer.  The returned
  * value must be released with ReleaseStringUTFChars.
@@ -2202,12 +2314,41 @@ static const char* GetStringUTFChars(JNIEnv* env, jstring jstr, jboolean* isCopy
         *isCopy = JNI_TRUE;
     }
     StringObject* strObj = (StringObject*) dvmDecodeIndirectRef(ts.self(), jstr);
-    char* newStr = dvmCreateCstrFromString(strObj);
-    if (newStr == NULL) {
+    int len = strObj->length();
+    bool cacheable = (len <= kUtfCacheMaxChars);
+
+    if (cacheable) {
+        ScopedPthreadMutexLock lock(&gDvm.jniUtfCacheLock);
+        JniUtfCacheEntry* entry = utfCacheEntryFor(strObj);
+        if (entry->str == strObj) {
+            entry->utf->refs++;
+            return utfBufferChars(entry->utf);
+        }
+    }
+
+    const u2* data = strObj->chars();
+    int byteLen = dvmUtf16Utf8ByteLen(data, len);
+    JniUtfBuffer* buf = (JniUtfBuffer*) malloc(sizeof(JniUtfBuffer) + byteLen + 1);
+    if (buf == NULL) {
         /* assume memory failure */
         dvmThrowOutOfMemoryError("native heap string alloc failed");
+        return NULL;
     }
-    return newStr;
+    dvmConvertUtf16ToUtf8(utfBufferChars(buf), data, len);
+    buf->refs = 1;
+    buf->cached = false;
+
+    if (cacheable) {
+        ScopedPthreadMutexLock lock(&gDvm.jniUtfCacheLock);
+        JniUtfCacheEntry* entry = utfCacheEntryFor(strObj);
+        if (entry->str != strObj) {
+            evictUtfCacheEntry(entry);
+            entry->str = strObj;
+            entry->utf = buf;
+            buf->cached = true;
+        }
+    }
+    return utfBufferChars(buf);
 }
 
 /*
@@ -2215,7 +2356,15 @@ static const char* GetStringUTFChars(JNIEnv* env, jstring jstr, jboolean* isCopy
  */
 static void ReleaseStringUTFChars(JNIEnv* env, jstring jstr, const char* utf) {
     ScopedJniThreadState ts(env);
-    free((char*) utf);
+    if (utf == NULL) {
+        return;
+    }
+    JniUtfBuffer* buf = utfBufferFromChars(utf);
+    ScopedPthreadMutexLock lock(&gDvm.jniUtfCacheLock);
+    assert(buf->refs > 0);
+    if (--buf->refs == 0 && !buf->cached) {
+        free(buf);
+    }
 }
 
 /*
@@ -2346,7 +2495,8 @@ NEW_PRIMITIVE_ARRAY(jdoubleArray, Double, 'D');
  * In a compacting GC, we either need to return a copy of the elements or
  * "pin" the memory.  Otherwise we run the risk of native code using the
  * buffer as the destination of e.g. a blocking read() call that wakes up
- * during a GC.
+ * during a GC.  Arrays that can't move are handed out directly, with no
+ * trip through the pin table; the caller's reference keeps them alive.
  */
 #define GET_PRIMITIVE_ARRAY_ELEMENTS(_ctype, _jname) \
     static _ctype* Get##_jname##ArrayElements(JNIEnv* env, \
@@ -2354,7 +2504,9 @@ NEW_PRIMITIVE_ARRAY(jdoubleArray, Double, 'D');
     { \
         ScopedJniThreadState ts(env); \
         ArrayObject* arrayObj = (ArrayObject*) dvmDecodeIndirectRef(ts.self(), jarr); \
-        pinPrimitiveArray(arrayObj); \
+        if (!isZeroCopyObject((Object*) arrayObj)) { \
+            pinPrimitiveArray(arrayObj); \
+        } \
         _ctype* data = (_ctype*) (void*) arrayObj->contents; \
         if (isCopy != NULL) { \
             *isCopy = JNI_FALSE; \
@@ -2377,7 +2529,9 @@ NEW_PRIMITIVE_ARRAY(jdoubleArray, Double, 'D');
         if (mode != JNI_COMMIT) {                                           \
             ScopedJniThreadState ts(env);                                   \
             ArrayObject* arrayObj = (ArrayObject*) dvmDecodeIndirectRef(ts.self(), jarr); \
-            unpinPrimitiveArray(arrayObj);                                  \
+            if (!isZeroCopyObject((Object*) arrayObj)) {                    \
+                unpinPrimitiveArray(arrayObj);                              \
+            }                                                               \
         }                                                                   \
     }
 
@@ -2583,18 +2737,73 @@ static void GetStringUTFRegion(JNIEnv* env, jstring jstr, jsize start, jsize len
     dvmGetStringUtfRegion(strObj, start, len, buf);
 }
 
+/*
+ * Enter a JNI critical region on "arrayObj".
+ *
+ * Rather than block the GC for the length of the region, we keep the
+ * array where the GC can see it.  Arrays that can't move just bump the
+ * thread's depth counter.  Movable ones are recorded in the thread's
+ * own critical table, which is visited (and so pinned) along with the
+ * thread's other roots; no lock is needed since only this thread writes
+ * it.  Only when a thread holds more than kJniCriticalRefMax movable
+ * arrays at once do we fall back on the global pin table.
+ */
+static void enterCritical(Thread* self, ArrayObject* arrayObj) {
+    self->jniCriticalDepth++;
+    if (isZeroCopyObject((Object*) arrayObj)) {
+        return;
+    }
+    if (self->jniCriticalRefCount < kJniCriticalRefMax) {
+        self->jniCriticalRefs[self->jniCriticalRefCount++] = (Object*) arrayObj;
+    } else {
+        pinPrimitiveArray(arrayObj);
+    }
+}
+
+/*
+ * Leave the critical region entered on "arrayObj".  Regions are usually
+ * left in reverse order, so search the thread's table from the top.
+ */
+static void exitCritical(Thread* self, ArrayObject* arrayObj) {
+    if (self->jniCriticalDepth == 0) {
+        ALOGW("JNI: critical release of %p without a matching get", arrayObj);
+        return;
+    }
+    self->jniCriticalDepth--;
+    if (!isZeroCopyObject((Object*) arrayObj)) {
+        int i;
+        for (i = self->jniCriticalRefCount - 1; i >= 0; i--) {
+            if (self->jniCriticalRefs[i] == (Object*) arrayObj) {
+                self->jniCriticalRefs[i] =
+                        self->jniCriticalRefs[--self->jniCriticalRefCount];
+                break;
+            }
+        }
+        if (i < 0) {
+            unpinPrimitiveArray(arrayObj);
+        }
+    }
+    /*
+     * After mismatched releases native code may still hold arrays left
+     * in the table, so keep them; the GC visits the table regardless of
+     * the depth.
+     */
+    if (self->jniCriticalDepth == 0 && self->jniCriticalRefCount != 0) {
+        ALOGW("JNI: %d critical array(s) never released",
+            self->jniCriticalRefCount);
+    }
+}
+
 /*
  * Get a raw pointer to array data.
  *
  * The caller is expected to call "release" before doing any JNI calls
  * or blocking I/O operations.
- *
- * We need to pin the memory or block GC.
  */
 static void* GetPrimitiveArrayCritical(JNIEnv* env, jarray jarr, jboolean* isCopy) {
     ScopedJniThreadState ts(env);
     ArrayObject* arrayObj = (ArrayObject*) dvmDecodeIndirectRef(ts.self(), jarr);
-    pinPrimitiveArray(arrayObj);
+    enterCritical(ts.self(), arrayObj);
     void* data = arrayObj->contents;
     if (UNLIKELY(isCopy != NULL)) {
         *isCopy = JNI_FALSE;
@@ -2609,7 +2818,39 @@ static void ReleasePrimitiveArrayCritical(JNIEnv* env, jarray jarr, void* carray
     if (mode != JNI_COMMIT) {
         ScopedJniThreadState ts(env);
         ArrayObject* arrayObj = (ArrayObject*) dvmDecodeIndirectRef(ts.self(), jarr);
-        unpinPrimitiveArray(arrayObj);
+        exitCritical(ts.self(), arrayObj);
+    }
+}
+
+/*
+ * Get raw pointers to the data of "count" arrays with one transition
+ * into the VM, for native code that works on several buffers together
+ * (e.g. the input and output of a compressor).  The same rules apply as
+ * for GetPrimitiveArrayCritical.
+ */
+static void GetPrimitiveArraysCritical(JNIEnv* env, jsize count,
+    const jarray* arrays, void** elems)
+{
+    ScopedJniThreadState ts(env);
+    for (jsize i = 0; i < count; i++) {
+        ArrayObject* arrayObj = (ArrayObject*) dvmDecodeIndirectRef(ts.self(), arrays[i]);
+        enterCritical(ts.self(), arrayObj);
+        elems[i] = arrayObj->contents;
+    }
+}
+
+/*
+ * Release arrays obtained with GetPrimitiveArraysCritical.
+ */
+static void ReleasePrimitiveArraysCritical(JNIEnv* env, jsize count,
+    const jarray* arrays, void** elems, jint mode)
+{
+    if (mode != JNI_COMMIT) {
+        ScopedJniThreadState ts(env);
+        for (jsize i = count - 1; i >= 0; i--) {
+            ArrayObject* arrayObj = (ArrayObject*) dvmDecodeIndirectRef(ts.self(), arrays[i]);
+            exitCritical(ts.self(), arrayObj);
+        }
     }
 }
 
@@ -2622,7 +2863,7 @@ static const jchar* GetStringCritical(JNIEnv* env, jstring jstr, jboolean* isCop
     StringObject* strObj = (StringObject*) dvmDecodeIndirectRef(ts.self(), jstr);
     ArrayObject* strChars = strObj->array();
 
-    pinPrimitiveArray(strChars);
+    enterCritical(ts.self(), strChars);
 
     const u2* data = strObj->chars();
     if (isCopy != NULL) {
@@ -2638,7 +2879,7 @@ static void ReleaseStringCritical(JNIEnv* env, jstring jstr, const jchar* carray
     ScopedJniThreadState ts(env);
     StringObject* strObj = (StringObject*) dvmDecodeIndirectRef(ts.self(), jstr);
     ArrayObject* strChars = strObj->array();
-    unpinPrimitiveArray(strChars);
+    exitCritical(ts.self(), strChars);
 }
 
 /*
@@ -3373,6 +3614,37 @@ void dvmLateEnableCheckedJni() {
     }
 }
 
+/*
+ * Batch forms of Get/ReleasePrimitiveArrayCritical, exported from libdvm
+ * for native code that has no JNIEnv slot to call them through.  When
+ * CheckJNI is on for this env, each array goes through the checked
+ * single-array functions so it gets the usual argument, critical-region
+ * and guarded-copy checks.
+ */
+void dvmGetPrimitiveArraysCritical(JNIEnv* env, jsize count,
+    const jarray* arrays, void** elems)
+{
+    if (((JNIEnvExt*) env)->funcTable != &gNativeInterface) {
+        for (jsize i = 0; i < count; i++) {
+            elems[i] = env->GetPrimitiveArrayCritical(arrays[i], NULL);
+        }
+        return;
+    }
+    GetPrimitiveArraysCritical(env, count, arrays, elems);
+}
+
+void dvmReleasePrimitiveArraysCritical(JNIEnv* env, jsize count,
+    const jarray* arrays, void** elems, jint mode)
+{
+    if (((JNIEnvExt*) env)->funcTable != &gNativeInterface) {
+        for (jsize i = count - 1; i >= 0; i--) {
+            env->ReleasePrimitiveArrayCritical(arrays[i], elems[i], mode);
+        }
+        return;
+    }
+    ReleasePrimitiveArraysCritical(env, count, arrays, elems, mode);
+}
+
 /*
  * Not supported.
  */
@@ -149,6 +149,26 @@ void dvmDestroyJNIEnv(JNIEnv* env);
  */
 JNIEnvExt* dvmGetJNIEnvForThread(void);
 
+/*
+ * Batch forms of Get/ReleasePrimitiveArrayCritical, which enter or leave
+ * critical regions on "count" arrays with a single VM transition.  These
+ * are exported for native code; "elems" on release must be the pointers
+ * returned by the get.  Both honor CheckJNI.
+ */
+extern "C" void dvmGetPrimitiveArraysCritical(JNIEnv* env, jsize count,
+    const jarray* arrays, void** elems);
+extern "C" void dvmReleasePrimitiveArraysCritical(JNIEnv* env, jsize count,
+    const jarray* arrays, void** elems, jint mode);
+
+/*
+ * Drop cached GetStringUTFChars results for strings that died in the
+ * last collection.
+ */
+void dvmSweepJniUtfCache(int (*isUnmarkedObject)(void*));
+#ifdef WITH_COPYING_GC
+void dvmUpdateJniUtfCache(Object* (*forwardObject)(Object*));
+#endif
+
 /*
  * Release all MonitorEnter-acquired locks that are still held.  Called at
  * DetachCurrentThread time.
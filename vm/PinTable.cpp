@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Pinned object table management.
+ */
+#include "Dalvik.h"
+
+/*
+ * Objects are 8-byte aligned, so drop the low bits before mixing.
+ */
+static inline u4 pinHash(const Object* obj)
+{
+    return ((u4) obj >> 3) * 0x9e3779b1;
+}
+
+/*
+ * Initialize a PinTable structure.  The table is kept at most half full.
+ */
+bool dvmInitPinTable(PinTable* pTab, int maxCount)
+{
+    assert(maxCount > 0);
+
+    u4 capacity = 16;
+    while (capacity < (u4) maxCount * 2) {
+        capacity <<= 1;
+    }
+
+    pTab->entries = (PinTableEntry*) calloc(capacity, sizeof(PinTableEntry));
+    if (pTab->entries == NULL)
+        return false;
+    pTab->capacity = capacity;
+    pTab->numEntries = 0;
+    pTab->maxEntries = maxCount;
+
+    return true;
+}
+
+/*
+ * Clears out the contents of a PinTable, freeing allocated storage.
+ */
+void dvmClearPinTable(PinTable* pTab)
+{
+    free(pTab->entries);
+    pTab->entries = NULL;
+    pTab->capacity = pTab->numEntries = pTab->maxEntries = 0;
+}
+
+/*
+ * Add one pin on "obj" to "pTab".
+ */
+u4 dvmPinTableAdd(PinTable* pTab, Object* obj)
+{
+    assert(obj != NULL);
+    assert(dvmIsHeapAddress(obj));
+    assert(pTab->entries != NULL);
+
+    u4 mask = pTab->capacity - 1;
+    for (u4 i = pinHash(obj) & mask; ; i = (i + 1) & mask) {
+        PinTableEntry* entry = &pTab->entries[i];
+        if (entry->obj == obj) {
+            return ++entry->count;
+        }
+        if (entry->obj == NULL) {
+            if (pTab->numEntries == pTab->maxEntries) {
+                ALOGW("PinTable overflow (max=%d)", pTab->maxEntries);
+                return 0;
+            }
+            entry->obj = obj;
+            entry->count = 1;
+            pTab->numEntries++;
+            return 1;
+        }
+    }
+}
+
+/*
+ * Drop one pin on "obj".  When the last one goes, close the gap in the
+ * probe run by moving back any later entry whose home slot is at or
+ * before the gap.
+ */
+bool dvmPinTableRemove(PinTable* pTab, Object* obj)
+{
+    assert(pTab->entries != NULL);
+
+    u4 mask = pTab->capacity - 1;
+    u4 i = pinHash(obj) & mask;
+    while (pTab->entries[i].obj != obj) {
+        if (pTab->entries[i].obj == NULL) {
+            return false;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (--pTab->entries[i].count != 0) {
+        return true;
+    }
+
+    u4 hole = i;
+    for (u4 j = (i + 1) & mask; pTab->entries[j].obj != NULL; j = (j + 1) & mask) {
+        u4 home = pinHash(pTab->entries[j].obj) & mask;
+        /* move it if "home" does not lie cyclically in (hole, j] */
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            pTab->entries[hole] = pTab->entries[j];
+            hole = j;
+        }
+    }
+    pTab->entries[hole].obj = NULL;
+    pTab->entries[hole].count = 0;
+    pTab->numEntries--;
+    return true;
+}
+
+/*
+ * Dump the contents of a PinTable to the log.  Each object is listed
+ * once per pin, so the summary shows how often it is pinned.
+ */
+void dvmDumpPinTable(const PinTable* pTab, const char* descr)
+{
+    size_t total = 0;
+    for (u4 i = 0; i < pTab->capacity; i++) {
+        total += pTab->entries[i].count;
+    }
+
+    if (total == 0) {
+        dvmDumpReferenceTableContents(NULL, 0, descr);
+        return;
+    }
+    Object** refs = (Object**) malloc(total * sizeof(Object*));
+    if (refs == NULL) {
+        ALOGW("%s pin table dump skipped (%zd pins)", descr, total);
+        return;
+    }
+    size_t count = 0;
+    for (u4 i = 0; i < pTab->capacity; i++) {
+        for (u4 n = 0; n < pTab->entries[i].count; n++) {
+            refs[count++] = pTab->entries[i].obj;
+        }
+    }
+    dvmDumpReferenceTableContents(refs, count, descr);
+    free(refs);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2008 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Maintain a counted set of pinned objects.  Used for JNI pinned array
+ * references, where the same array may be pinned many times over and
+ * unpins arrive in no particular order.
+ *
+ * None of the table functions are synchronized.
+ */
+#ifndef DALVIK_PINTABLE_H_
+#define DALVIK_PINTABLE_H_
+
+/*
+ * One distinct pinned object and the #of times it is currently pinned.
+ * An entry with a NULL object is empty.
+ */
+struct PinTableEntry {
+    Object*         obj;
+    u4              count;
+};
+
+/*
+ * Table definition.
+ *
+ * This is an open-addressed hash table keyed on the object address, with
+ * linear probing.  Removing an object's last pin shifts later entries of
+ * the probe run back, so there are no tombstones and lookups stay short
+ * however long the table has been in use.  The table never moves, so the
+ * GC can visit "entries[i].obj" directly.
+ */
+struct PinTable {
+    PinTableEntry*  entries;
+    u4              capacity;           /* #of slots, a power of two */
+    u4              numEntries;         /* #of distinct objects */
+    u4              maxEntries;         /* max #of distinct objects */
+};
+
+/*
+ * Initialize a PinTable that can hold up to "maxCount" distinct objects.
+ *
+ * Returns "false" if table allocation fails.
+ */
+bool dvmInitPinTable(PinTable* pTab, int maxCount);
+
+/*
+ * Clears out the contents of a PinTable, freeing allocated storage.
+ * Does not free "pTab".
+ */
+void dvmClearPinTable(PinTable* pTab);
+
+/*
+ * Return the #of distinct objects currently pinned.
+ */
+INLINE size_t dvmPinTableEntries(const PinTable* pTab)
+{
+    return pTab->numEntries;
+}
+
+/*
+ * Pin "obj" once more.
+ *
+ * Returns the new pin count for "obj", or 0 if the table is full.
+ */
+u4 dvmPinTableAdd(PinTable* pTab, Object* obj);
+
+/*
+ * Drop one pin on "obj", removing it when the count reaches zero.
+ *
+ * Returns "false" if "obj" was not pinned.
+ */
+bool dvmPinTableRemove(PinTable* pTab, Object* obj);
+
+/*
+ * Dump the contents of a pin table to the log file.
+ *
+ * The caller should lock any external sync before calling.
+ */
+void dvmDumpPinTable(const PinTable* pTab, const char* descr);
+
+#endif  // DALVIK_PINTABLE_H_
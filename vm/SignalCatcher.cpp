@@ -224,8 +224,8 @@ void printAllClass(void *ptr)
 }
 
 /*
- * Respond to a SIGUSR2 by dumping some JIT stats and possibly resetting
- * the code cache.
+ * Respond to a SIGUSR2 by dumping some JIT stats, saving the hot traces
+ * and possibly resetting the code cache.
  */
 static void handleSigUsr2()
 {
@@ -237,6 +237,7 @@ static void handleSigUsr2()
         gDvmJit.codeCacheFull = true;
     } else {
         dvmCompilerDumpStats();
+        dvmCompilerSaveHotTraces();
         /* Stress-test unchain all */
         dvmJitUnchainAll();
         ALOGD("Send %d more signals to reset the code cache",
@@ -244,6 +244,36 @@ void dvmSweepMonitorList(Monitor** mon, int (*isUnmarkedObject)(void*))
     *mon = handle.next;
 }
 
+#ifdef WITH_COPYING_GC
+void dvmUpdateMonitorList(Monitor** mon, Object* (*forwardObject)(Object*))
+{
+    Monitor handle;
+    Monitor *prev, *curr;
+    Object *obj;
+
+    assert(mon != NULL);
+    assert(forwardObject != NULL);
+    prev = &handle;
+    prev->next = curr = *mon;
+    while (curr != NULL) {
+        obj = curr->obj;
+        if (obj != NULL) {
+            obj = (*forwardObject)(obj);
+        }
+        if (curr->obj != NULL && obj == NULL) {
+            prev->next = curr->next;
+            freeMonitor(curr);
+            curr = prev->next;
+        } else {
+            curr->obj = obj;
+            prev = curr;
+            curr = curr->next;
+        }
+    }
+    *mon = handle.next;
+}
+#endif
+
 static char *logWriteInt(char *dst, int value)
 {
     *dst++ = EVENT_TYPE_INT;
@@ -1260,7 +1290,7 @@ retry:
         assert(!dvmIsClassObject(obj));
         if (IS_CLASS_FLAG_SET(obj->clazz, CLASS_ISARRAY)) {
             size = dvmArrayObjectSize((ArrayObject *)obj);
-            size = (size + 2) & ~2;
+            size = (size + 3) & ~3;
         } else {
             size = obj->clazz->objectSize;
         }
@@ -117,6 +117,15 @@ Monitor* dvmCreateMonitor(Object* obj);
  */
 void dvmSweepMonitorList(Monitor** mon, int (*isUnmarkedObject)(void*));
 
+#ifdef WITH_COPYING_GC
+/*
+ * Points each monitor at the new address of its object, as returned by
+ * the given callback, and frees the monitors whose objects are dead.
+ * The callback returns NULL for a dead object.
+ */
+void dvmUpdateMonitorList(Monitor** mon, Object* (*forwardObject)(Object*));
+#endif
+
 /* free monitor list */
 void dvmFreeMonitorList(void);
 
@@ -18,6 +18,7 @@
  * Thread support.
  */
 #include "Dalvik.h"
+#include "alloc/HeapSource.h"
 #include "os/os.h"
 
 #include <stdlib.h>
@@ -990,6 +991,7 @@ static void freeThread(Thread* thread)
     }
 
     thread->jniLocalRefTable.destroy();
+    gDvm.jniGlobalRefTable.flushCache(&thread->jniGlobalRefCache);
     dvmClearReferenceTable(&thread->internalLocalRefTable);
     if (&thread->jniMonitorRefTable.table != NULL)
         dvmClearReferenceTable(&thread->jniMonitorRefTable);
@@ -997,6 +999,8 @@ static void freeThread(Thread* thread)
 #if defined(WITH_SELF_VERIFICATION)
     dvmSelfVerificationShadowSpaceFree(thread);
 #endif
+    free(thread->tlab);
+    free(thread->stackTraceBuf);
     free(thread);
 }
 
@@ -2036,6 +2040,10 @@ void dvmDetachCurrentThread()
      * calls.
      */
     dvmReleaseJniMonitors(self);
+    if (self->jniCriticalDepth != 0) {
+        ALOGW("threadid=%d: detaching inside %d JNI critical region(s)",
+            self->threadId, self->jniCriticalDepth);
+    }
 
     /*
      * Do some thread-exit uncaught exception processing if necessary.
@@ -2089,6 +2097,14 @@ void dvmDetachCurrentThread()
     dvmReleaseTrackedAlloc(vmThread, self);
     vmThread = NULL;
 
+    /*
+     * Give the unused part of our allocation buffer back to the heap.
+     * This must happen while we still hold off the GC.
+     */
+    dvmLockHeap();
+    dvmHeapSourceReleaseTlab(self);
+    dvmUnlockHeap();
+
     /*
      * We're done manipulating objects, so it's okay if the GC runs in
      * parallel with us from here out.  It's important to do this if
@@ -2165,6 +2181,61 @@ void dvmDetachCurrentThread()
     freeThread(self);
 }
 
+/*
+ * Attach the current thread to the VM with no Thread object.  This is
+ * only done in dexopt, where nothing else needs to find us by object.
+ */
+bool dvmAttachOptimizerThread()
+{
+    assert(gDvm.optimizing);
+
+    Thread* self = allocThread(gDvm.stackSize);
+    if (self == NULL)
+        return false;
+    setThreadSelf(self);
+
+    dvmLockThreadList(self);
+    if (!prepareThread(self)) {
+        dvmUnlockThreadList();
+        setThreadSelf(NULL);
+        freeThread(self);
+        return false;
+    }
+    self->next = gDvm.threadList->next;
+    if (self->next != NULL)
+        self->next->prev = self;
+    self->prev = gDvm.threadList;
+    gDvm.threadList->next = self;
+    dvmUnlockThreadList();
+
+    /* wait out a GC that started before we were on the list */
+    assert(self->status == THREAD_INITIALIZING);
+    dvmChangeStatus(self, THREAD_VMWAIT);
+    dvmLockMutex(&gDvm.gcHeapLock);
+    dvmUnlockMutex(&gDvm.gcHeapLock);
+    dvmChangeStatus(self, THREAD_RUNNING);
+    return true;
+}
+
+/*
+ * Detach a thread attached with dvmAttachOptimizerThread().
+ */
+void dvmDetachOptimizerThread()
+{
+    Thread* self = dvmThreadSelf();
+    assert(self->threadObj == NULL);
+
+    dvmChangeStatus(self, THREAD_VMWAIT);
+    dvmLockThreadList(self);
+    self->status = THREAD_ZOMBIE;
+    unlinkThread(self);
+    releaseThreadId(self);
+    dvmUnlockThreadList();
+
+    setThreadSelf(NULL);
+    freeThread(self);
+}
+
 
 /*
  * Suspend a single thread.  Do not use to suspend yourself.
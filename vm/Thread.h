@@ -74,6 +74,7 @@ void dvmSlayDaemons(void);
 #define kJniLocalRefMax         512     /* arbitrary; should be plenty */
 #define kInternalRefDefault     32      /* equally arbitrary */
 #define kInternalRefMax         4096    /* mainly a sanity check */
+#define kJniCriticalRefMax      8       /* more than this go to the pin table */
 
 #define kMinStackSize       (512 + STACK_OVERFLOW_RESERVE)
 #define kDefaultStackSize   (16*1024)   /* four 4K pages */
@@ -246,6 +247,18 @@ struct Thread {
     /* JNI native monitor reference tracking (initialized on first use) */
     ReferenceTable  jniMonitorRefTable;
 
+    /*
+     * JNI critical regions: how deep we are, and the movable arrays held
+     * in them.  Only the owning thread changes these, and only while
+     * THREAD_RUNNING, so the GC can read them without a lock.  The GC
+     * pins the arrays instead of waiting for the regions to end.  The
+     * table can outlive the regions after mismatched releases, so it is
+     * visited whenever it is non-empty.
+     */
+    int             jniCriticalDepth;
+    int             jniCriticalRefCount;
+    Object*         jniCriticalRefs[kJniCriticalRefMax];
+
     /* hack to make JNI_OnLoad work right */
     Object*     classLoaderOverride;
 
@@ -290,6 +303,16 @@ struct Thread {
     /* memory allocation profiling state */
     AllocProfState allocProf;
 
+    /* thread-local allocation buffer; allocated on first use */
+    struct HeapTlab* tlab;
+
+    /* free JNI global reference slots kept for this thread */
+    IndirectRefCache jniGlobalRefCache;
+
+    /* scratch {Method*, pc} pairs for stack trace capture; grown on demand */
+    int*        stackTraceBuf;
+    size_t      stackTraceBufLen;       /* in ints */
+
 #ifdef WITH_JNI_STACK_CHECK
     u4          stackCrc;
 #endif
@@ -502,6 +525,15 @@ bool dvmCreateInternalThread(pthread_t* pHandle, const char* name,
 bool dvmAttachCurrentThread(const JavaVMAttachArgs* pArgs, bool isDaemon);
 void dvmDetachCurrentThread(void);
 
+/*
+ * Attach or detach the current thread without a java.lang.Thread object,
+ * which is how the main thread runs in dexopt.  Such a thread can load
+ * classes and see exceptions, but can't run interpreted code.  Only for
+ * use while optimizing.
+ */
+bool dvmAttachOptimizerThread(void);
+void dvmDetachOptimizerThread(void);
+
 /*
  * Get the "main" or "system" thread group.
  */
@@ -73,6 +73,153 @@ static StringObject* makeStringObject(u4 charsLength, ArrayObject** pChars)
     return (StringObject*) result;
 }
 
+/*
+ * Vector helpers for the conversion loops below.  Each one looks at a
+ * 16-byte block: 16 bytes of modified UTF-8, or 8 UTF-16 chars.  The
+ * loops take a block at a time while the text is plain ASCII, which is
+ * nearly all of it in practice, and drop back to a char at a time
+ * around anything else.
+ *
+ * Blocks of '\0'-terminated UTF-8 are only loaded from 16-byte aligned
+ * addresses, so a load can't cross into an unmapped page past the end of
+ * the string, even though it may read a few bytes past the terminator.
+ */
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define UTF_SIMD
+#elif defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define UTF_SIMD
+#endif
+
+#ifdef UTF_SIMD
+#define kUtfBlockBytes  16
+#define kUtfBlockChars  8
+
+static inline bool isBlockAligned(const char* utf8Str)
+{
+    return ((uintptr_t) utf8Str & (kUtfBlockBytes - 1)) == 0;
+}
+
+#if defined(__SSE2__)
+/*
+ * Returns true if none of the 16 bytes at aligned "utf8Str" is '\0'.
+ */
+static inline bool hasNoNulBlock(const char* utf8Str)
+{
+    __m128i bytes = _mm_load_si128((const __m128i*) utf8Str);
+    __m128i nul = _mm_cmpeq_epi8(bytes, _mm_setzero_si128());
+    return _mm_movemask_epi8(nul) == 0;
+}
+
+/*
+ * Returns true if the 16 bytes at aligned "utf8Str" are all in
+ * 0x01-0x7f, i.e. 16 one-byte chars with no terminator.
+ */
+static inline bool isAsciiBlock(const char* utf8Str)
+{
+    __m128i bytes = _mm_load_si128((const __m128i*) utf8Str);
+    __m128i nul = _mm_cmpeq_epi8(bytes, _mm_setzero_si128());
+    return (_mm_movemask_epi8(bytes) | _mm_movemask_epi8(nul)) == 0;
+}
+
+/*
+ * Zero-extend the 16 ASCII bytes at aligned "utf8Str" to UTF-16.
+ */
+static inline void widenAsciiBlock(u2* utf16Str, const char* utf8Str)
+{
+    __m128i bytes = _mm_load_si128((const __m128i*) utf8Str);
+    __m128i zero = _mm_setzero_si128();
+    _mm_storeu_si128((__m128i*) utf16Str, _mm_unpacklo_epi8(bytes, zero));
+    _mm_storeu_si128((__m128i*) (utf16Str + 8),
+        _mm_unpackhi_epi8(bytes, zero));
+}
+
+/*
+ * Get bit masks, two bits per char, of the 8 chars at "utf16Str" that
+ * need two or more bytes in modified UTF-8 (0x0000 and 0x0080-0xffff)
+ * and of the ones that need three (0x0800-0xffff).
+ */
+static inline void utf8WidthMasks(const u2* utf16Str, int* pTwoUp,
+    int* pThree)
+{
+    __m128i chars = _mm_loadu_si128((const __m128i*) utf16Str);
+    __m128i zero = _mm_setzero_si128();
+    int upTo7f = _mm_movemask_epi8(_mm_cmpeq_epi16(
+            _mm_subs_epu16(chars, _mm_set1_epi16(0x7f)), zero));
+    int upTo7ff = _mm_movemask_epi8(_mm_cmpeq_epi16(
+            _mm_subs_epu16(chars, _mm_set1_epi16(0x7ff)), zero));
+    int nul = _mm_movemask_epi8(_mm_cmpeq_epi16(chars, zero));
+    *pTwoUp = (~upTo7f | nul) & 0xffff;
+    *pThree = ~upTo7ff & 0xffff;
+}
+
+/*
+ * Narrow the 8 ASCII chars at "utf16Str" to bytes.
+ */
+static inline void narrowAsciiBlock(char* utf8Str, const u2* utf16Str)
+{
+    __m128i chars = _mm_loadu_si128((const __m128i*) utf16Str);
+    _mm_storel_epi64((__m128i*) utf8Str, _mm_packus_epi16(chars, chars));
+}
+#elif defined(__ARM_NEON__)
+static inline bool anyLaneSet(uint8x16_t mask)
+{
+    uint8x8_t folded = vorr_u8(vget_low_u8(mask), vget_high_u8(mask));
+    return vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0;
+}
+
+static inline bool hasNoNulBlock(const char* utf8Str)
+{
+    uint8x16_t bytes = vld1q_u8((const uint8_t*) utf8Str);
+    return !anyLaneSet(vceqq_u8(bytes, vdupq_n_u8(0)));
+}
+
+static inline bool isAsciiBlock(const char* utf8Str)
+{
+    /* 0x01-0x7f become 0x00-0x7e; '\0' wraps around to 0xff */
+    uint8x16_t bytes = vld1q_u8((const uint8_t*) utf8Str);
+    uint8x16_t biased = vsubq_u8(bytes, vdupq_n_u8(1));
+    return !anyLaneSet(vcgtq_u8(biased, vdupq_n_u8(0x7e)));
+}
+
+static inline void widenAsciiBlock(u2* utf16Str, const char* utf8Str)
+{
+    uint8x16_t bytes = vld1q_u8((const uint8_t*) utf8Str);
+    vst1q_u16(utf16Str, vmovl_u8(vget_low_u8(bytes)));
+    vst1q_u16(utf16Str + 8, vmovl_u8(vget_high_u8(bytes)));
+}
+
+static inline void utf8WidthMasks(const u2* utf16Str, int* pTwoUp,
+    int* pThree)
+{
+    uint16x8_t chars = vld1q_u16(utf16Str);
+    uint16x8_t twoUp = vorrq_u16(vcgtq_u16(chars, vdupq_n_u16(0x7f)),
+                                 vceqq_u16(chars, vdupq_n_u16(0)));
+    uint16x8_t three = vcgtq_u16(chars, vdupq_n_u16(0x7ff));
+
+    /* collapse each lane to one bit, then bit i to bits 2i and 2i+1 */
+    static const uint16_t kLaneBits[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint16x8_t bits = vld1q_u16(kLaneBits);
+    uint32x4_t sumTwoUp = vpaddlq_u16(vandq_u16(twoUp, bits));
+    uint32x4_t sumThree = vpaddlq_u16(vandq_u16(three, bits));
+    uint64x2_t pairTwoUp = vpaddlq_u32(sumTwoUp);
+    uint64x2_t pairThree = vpaddlq_u32(sumThree);
+    int twoUpBits = (int) (vgetq_lane_u64(pairTwoUp, 0) |
+                           vgetq_lane_u64(pairTwoUp, 1));
+    int threeBits = (int) (vgetq_lane_u64(pairThree, 0) |
+                           vgetq_lane_u64(pairThree, 1));
+    *pTwoUp = twoUpBits | (twoUpBits << 8);
+    *pThree = threeBits | (threeBits << 8);
+}
+
+static inline void narrowAsciiBlock(char* utf8Str, const u2* utf16Str)
+{
+    vst1_u8((uint8_t*) utf8Str, vmovn_u16(vld1q_u16(utf16Str)));
+}
+#endif
+#endif /*UTF_SIMD*/
+
 /*
  * Compute a hash code on a UTF-8 string, for use with internal hash tables.
  *
@@ -89,8 +236,30 @@ u4 dvmComputeUtf8Hash(const char* utf8Str)
 {
     u4 hash = 1;
 
-    while (*utf8Str != '\0')
+    while (true) {
+#ifdef UTF_SIMD
+        /*
+         * Hash blocks with no terminator four chars at a time, folding
+         * in powers of 31 so the multiplies don't wait on each other.
+         * The sum comes out the same as one char at a time.
+         */
+        if (isBlockAligned(utf8Str)) {
+            while (hasNoNulBlock(utf8Str)) {
+                for (int i = 0; i < kUtfBlockBytes; i += 4) {
+                    hash = hash * (31 * 31 * 31 * 31) +
+                           (u4) utf8Str[i] * (31 * 31 * 31) +
+                           (u4) utf8Str[i + 1] * (31 * 31) +
+                           (u4) utf8Str[i + 2] * 31 +
+                           (u4) utf8Str[i + 3];
+                }
+                utf8Str += kUtfBlockBytes;
+            }
+        }
+#endif
+        if (*utf8Str == '\0')
+            break;
         hash = hash * 31 + *utf8Str++;
+    }
 
     return hash;
 }
@@ -100,16 +269,23 @@ u4 dvmComputeUtf8Hash(const char* utf8Str)
  *
  * The value returned is the number of characters, which may or may not
  * be the same as the number of bytes.
- *
- * (If this needs optimizing, try: mask against 0xa0, shift right 5,
- * get increment {1-3} from table of 8 values.)
  */
 size_t dvmUtf8Len(const char* utf8Str)
 {
     size_t len = 0;
     int ic;
 
-    while ((ic = *utf8Str++) != '\0') {
+    while (true) {
+#ifdef UTF_SIMD
+        if (isBlockAligned(utf8Str)) {
+            while (isAsciiBlock(utf8Str)) {
+                utf8Str += kUtfBlockBytes;
+                len += kUtfBlockBytes;
+            }
+        }
+#endif
+        if ((ic = *utf8Str++) == '\0')
+            break;
         len++;
         if ((ic & 0x80) != 0) {
             /* two- or three-byte encoding */
@@ -129,18 +305,45 @@ size_t dvmUtf8Len(const char* utf8Str)
  */
 void dvmConvertUtf8ToUtf16(u2* utf16Str, const char* utf8Str)
 {
-    while (*utf8Str != '\0')
+    while (true) {
+#ifdef UTF_SIMD
+        if (isBlockAligned(utf8Str)) {
+            while (isAsciiBlock(utf8Str)) {
+                widenAsciiBlock(utf16Str, utf8Str);
+                utf8Str += kUtfBlockBytes;
+                utf16Str += kUtfBlockBytes;
+            }
+        }
+#endif
+        if (*utf8Str == '\0')
+            break;
         *utf16Str++ = dexGetUtf16FromUtf8(&utf8Str);
+    }
 }
 
 /*
  * Given a UTF-16 string, compute the length of the corresponding UTF-8
  * string in bytes.
  */
-static int utf16_utf8ByteLen(const u2* utf16Str, int len)
+int dvmUtf16Utf8ByteLen(const u2* utf16Str, int len)
 {
     int utf8Len = 0;
 
+#ifdef UTF_SIMD
+    while (len >= kUtfBlockChars) {
+        int twoUp, three;
+        utf8WidthMasks(utf16Str, &twoUp, &three);
+        utf8Len += kUtfBlockChars;
+        if (twoUp != 0) {
+            /* two mask bits per char */
+            utf8Len += (__builtin_popcount(twoUp) +
+                        __builtin_popcount(three)) / 2;
+        }
+        utf16Str += kUtfBlockChars;
+        len -= kUtfBlockChars;
+    }
+#endif
+
     while (len--) {
         unsigned int uic = *utf16Str++;
 
@@ -161,15 +364,29 @@ static int utf16_utf8ByteLen(const u2* utf16Str, int len)
 /*
  * Convert a UTF-16 string to UTF-8.
  *
- * Make sure you allocate "utf8Str" with the result of utf16_utf8ByteLen(),
+ * Make sure you allocate "utf8Str" with the result of dvmUtf16Utf8ByteLen(),
  * not just "len".
  */
-static void convertUtf16ToUtf8(char* utf8Str, const u2* utf16Str, int len)
+void dvmConvertUtf16ToUtf8(char* utf8Str, const u2* utf16Str, int len)
 {
     assert(len >= 0);
 
-    while (len--) {
+    while (len > 0) {
+#ifdef UTF_SIMD
+        if (len >= kUtfBlockChars) {
+            int twoUp, three;
+            utf8WidthMasks(utf16Str, &twoUp, &three);
+            if (twoUp == 0) {
+                narrowAsciiBlock(utf8Str, utf16Str);
+                utf8Str += kUtfBlockChars;
+                utf16Str += kUtfBlockChars;
+                len -= kUtfBlockChars;
+                continue;
+            }
+        }
+#endif
         unsigned int uic = *utf16Str++;
+        len--;
 
         /*
          * The most common case is (uic > 0 && uic <= 0x7f).
@@ -194,10 +411,23 @@ static void convertUtf16ToUtf8(char* utf8Str, const u2* utf16Str, int len)
 /*
  * Use the java/lang/String.computeHashCode() algorithm.
  */
-static inline u4 computeUtf16Hash(const u2* utf16Str, size_t len)
+u4 dvmComputeUtf16Hash(const u2* utf16Str, size_t len)
 {
     u4 hash = 0;
 
+    /*
+     * Four chars at a time, folding in powers of 31 so the multiplies
+     * don't wait on each other.
+     */
+    while (len >= 4) {
+        hash = hash * (31 * 31 * 31 * 31) +
+               (u4) utf16Str[0] * (31 * 31 * 31) +
+               (u4) utf16Str[1] * (31 * 31) +
+               (u4) utf16Str[2] * 31 +
+               (u4) utf16Str[3];
+        utf16Str += 4;
+        len -= 4;
+    }
     while (len--)
         hash = hash * 31 + *utf16Str++;
 
@@ -213,7 +443,7 @@ u4 dvmComputeStringHash(StringObject* strObj) {
     int offset = dvmGetFieldInt(strObj, STRING_FIELDOFF_OFFSET);
     ArrayObject* chars =
             (ArrayObject*) dvmGetFieldObject(strObj, STRING_FIELDOFF_VALUE);
-    hashCode = computeUtf16Hash((u2*)(void*)chars->contents + offset, len);
+    hashCode = dvmComputeUtf16Hash((u2*)(void*)chars->contents + offset, len);
     dvmSetFieldInt(strObj, STRING_FIELDOFF_HASHCODE, hashCode);
     return hashCode;
 }
@@ -248,7 +478,8 @@ StringObject* dvmCreateStringFromCstrAndLength(const char* utf8Str,
 
     dvmConvertUtf8ToUtf16((u2*)(void*)chars->contents, utf8Str);
 
-    u4 hashCode = computeUtf16Hash((u2*)(void*)chars->contents, utf16Length);
+    u4 hashCode = dvmComputeUtf16Hash((u2*)(void*)chars->contents,
+                                      utf16Length);
     dvmSetFieldInt((Object*) newObj, STRING_FIELDOFF_HASHCODE, hashCode);
 
     return newObj;
@@ -270,7 +501,7 @@ StringObject* dvmCreateStringFromUnicode(const u2* unichars, int len)
 
     if (len > 0) memcpy(chars->contents, unichars, len * sizeof(u2));
 
-    u4 hashCode = computeUtf16Hash((u2*)(void*)chars->contents, len);
+    u4 hashCode = dvmComputeUtf16Hash((u2*)(void*)chars->contents, len);
     dvmSetFieldInt((Object*)newObj, STRING_FIELDOFF_HASHCODE, hashCode);
 
     return newObj;
@@ -295,12 +526,12 @@ char* dvmCreateCstrFromString(const StringObject* jstr)
     const u2* data = (const u2*)(void*)chars->contents + offset;
     assert(offset + len <= (int) chars->length);
 
-    int byteLen = utf16_utf8ByteLen(data, len);
+    int byteLen = dvmUtf16Utf8ByteLen(data, len);
     char* newStr = (char*) malloc(byteLen+1);
     if (newStr == NULL) {
         return NULL;
     }
-    convertUtf16ToUtf8(newStr, data, len);
+    dvmConvertUtf16ToUtf8(newStr, data, len);
 
     return newStr;
 }
@@ -309,7 +540,7 @@ void dvmGetStringUtfRegion(const StringObject* jstr,
         int start, int len, char* buf)
 {
     const u2* data = jstr->chars() + start;
-    convertUtf16ToUtf8(buf, data, len);
+    dvmConvertUtf16ToUtf8(buf, data, len);
 }
 
 int StringObject::utfLength() const
@@ -323,7 +554,7 @@ int StringObject::utfLength() const
     const u2* data = (const u2*)(void*)chars->contents + offset;
     assert(offset + len <= (int) chars->length);
 
-    return utf16_utf8ByteLen(data, len);
+    return dvmUtf16Utf8ByteLen(data, len);
 }
 
 int StringObject::length() const
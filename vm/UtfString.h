@@ -110,6 +110,23 @@ size_t dvmUtf8Len(const char* utf8Str);
  */
 void dvmConvertUtf8ToUtf16(u2* utf16Str, const char* utf8Str);
 
+/*
+ * Compute the number of bytes needed to hold "len" UTF-16 chars as
+ * "modified" UTF-8, not counting the terminating '\0'.
+ */
+int dvmUtf16Utf8ByteLen(const u2* utf16Str, int len);
+
+/*
+ * Convert "len" UTF-16 chars to "modified" UTF-8, adding a '\0'.
+ * "utf8Str" must have room for dvmUtf16Utf8ByteLen() + 1 bytes.
+ */
+void dvmConvertUtf16ToUtf8(char* utf8Str, const u2* utf16Str, int len);
+
+/*
+ * Hash UTF-16 chars the way java/lang/String.hashCode() does.
+ */
+u4 dvmComputeUtf16Hash(const u2* utf16Str, size_t len);
+
 /*
  * Create a java/lang/String from a Unicode string.
  *
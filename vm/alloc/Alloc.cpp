@@ -62,10 +62,17 @@ void dvmGcShutdown()
 
 /*
  * Do any last-minute preparation before we call fork() for the first time.
+ *
+ * The zygote's other threads have been stopped by now, and the heap lock
+ * covers the rest of what dvmHeapSourceReleaseAllTlabs() requires.
  */
 bool dvmGcPreZygoteFork()
 {
-    return dvmHeapSourceStartupBeforeFork();
+    dvmLockHeap();
+    dvmWaitForConcurrentGcToComplete();
+    bool result = dvmHeapSourceStartupBeforeFork();
+    dvmUnlockHeap();
+    return result;
 }
 
 bool dvmGcStartupClasses()
@@ -195,6 +195,17 @@ void dvmMarkCard(const void *addr)
     *cardAddr = GC_CARD_DIRTY;
 }
 
+/*
+ * Dirties the cards for the given address range.
+ */
+void dvmMarkCardRange(const void *start, const void *end)
+{
+    assert(start < end);
+    u1 *first = dvmCardFromAddr(start);
+    u1 *last = dvmCardFromAddr((const u1 *)end - 1);
+    memset(first, GC_CARD_DIRTY, last - first + 1);
+}
+
 /*
  * Returns true if the object is on a dirty card.
  */
@@ -203,6 +214,13 @@ static bool isObjectDirty(const Object *obj)
     assert(obj != NULL);
     assert(dvmIsValidObject(obj));
     u1 *card = dvmCardFromAddr(obj);
+    if (IS_CLASS_FLAG_SET(obj->clazz, CLASS_ISOBJECTARRAY)) {
+        /* Stores into object arrays dirty the cards of the elements. */
+        const u1 *end = (const u1 *)obj +
+                        dvmArrayObjectSize((const ArrayObject *)obj);
+        u1 *last = dvmCardFromAddr(end - 1);
+        return memchr(card, GC_CARD_DIRTY, last - card + 1) != NULL;
+    }
     return *card == GC_CARD_DIRTY;
 }
 
@@ -65,6 +65,12 @@ bool dvmIsValidCard(const u1 *card);
  */
 void dvmMarkCard(const void *addr);
 
+/*
+ * Set the cards associated with the address range [start, end) to
+ * GC_CARD_DIRTY.
+ */
+void dvmMarkCardRange(const void *start, const void *end);
+
 /*
  * Verifies that all gray objects are on a dirty card.
  */
@@ -21,17 +21,17 @@
 #include "Dalvik.h"
 #include "alloc/Heap.h"
 #include "alloc/HeapBitmap.h"
+#include "alloc/HeapBitmapInlines.h"
 #include "alloc/HeapInternal.h"
 #include "alloc/HeapSource.h"
-#include "alloc/Verify.h"
+#include "alloc/MarkSweep.h"
+#include "alloc/Visit.h"
 
 /*
- * A "mostly copying", generational, garbage collector.
+ * A "mostly copying" garbage collector.
  *
- * TODO: we allocate our own contiguous tract of page frames to back
- * object allocations.  To cooperate with other heaps active in the
- * virtual machine we need to move the responsibility of allocating
- * pages someplace outside of this code.
+ * We reserve our own contiguous tract of page frames to back object
+ * allocations.  The reservation is divided into fixed-size blocks.
  *
  * The other major data structures that maintain the state of the heap
  * are the block space table and the block queue.
@@ -44,10 +44,6 @@
  * - If the block holds part of a large object allocation, whether the
  *   block is the initial or a continued block of the allocation.
  *
- * - Whether the block is pinned, that is to say whether at least one
- *   object in the block must remain stationary.  Only needed during a
- *   GC.
- *
  * - Which space the object belongs to.  At present this means
  *   from-space or to-space.
  *
@@ -57,20 +53,15 @@
  * The block queue exists to thread lists of blocks from the various
  * spaces together.
  *
- * Additionally, we record the free space frontier of the heap, as
- * well as the address of the first object within a block, which is
- * required to copy objects following a large object (not currently
- * implemented).  This is stored in the heap source structure.  This
- * should be moved elsewhere to support in-line allocations from Java
- * threads.
- *
  * Allocation requests are satisfied by reserving storage from one or
  * more contiguous blocks.  Objects that are small enough to fit
  * inside a block are packed together within a block.  Objects that
  * are larger than a block are allocated from contiguous sequences of
- * blocks.  When half the available blocks are filled, a garbage
- * collection occurs.  We "flip" spaces (exchange from- and to-space),
- * copy live objects into to space, and perform pointer adjustment.
+ * blocks.  When the soft limit on allocated blocks is reached, a
+ * garbage collection occurs.  We "flip" spaces (exchange from- and
+ * to-space), copy live objects into to space, and perform pointer
+ * adjustment.  The soft limit never exceeds half of the blocks, so
+ * there is always room to copy every live object.
  *
  * Copying is made more complicated by the requirement that some
  * objects must not be moved.  This property is known as "pinning".
@@ -78,24 +69,30 @@
  * scheme; blocks containing such objects are grayed (promoted) at the
  * start of a garbage collection.  By virtue of this trick, tracing
  * from the roots proceeds as usual but all objects on those pages are
- * considered promoted and therefore not moved.
+ * considered promoted and therefore not moved.  Objects are pinned
+ * when they are referenced from somewhere the collector cannot
+ * update: native method arguments, conservatively scanned frames,
+ * JNI and VM internal reference tables, and class objects, which
+ * are referenced by raw pointers throughout the VM.
+ *
+ * Large objects are never copied.  The span holding a reachable large
+ * object is promoted in place, just like a pinned block.
+ *
+ * Blocks freed by a collection are zeroed and their pages returned to
+ * the system whenever a whole page of blocks is free.  A long-running
+ * process therefore keeps a footprint proportional to its live data
+ * instead of the fragmentation left behind by earlier allocations.
  *
  * TODO: there is sufficient information within the garbage collector
  * to implement Attardi's scheme for evacuating unpinned objects from
  * a page that is otherwise pinned.  This would eliminate false
  * retention caused by the large pinning granularity.
  *
- * We need a scheme for medium and large objects.  Ignore that for
- * now, we can return to this later.
- *
  * Eventually we need to worry about promoting objects out of the
  * copy-collected heap (tenuring) into a less volatile space.  Copying
  * may not always be the best policy for such spaces.  We should
  * consider a variant of mark, sweep, compact.
  *
- * The block scheme allows us to use VM page faults to maintain a
- * write barrier.  Consider having a special leaf state for a page.
- *
  * Bibliography:
  *
  * C. J. Cheney. 1970. A non-recursive list compacting
@@ -120,8 +117,6 @@
  *
  */
 
-#define ARRAYSIZE(x) (sizeof(x) / sizeof(x[0]))
-
 #if 0
 #define LOG_ALLOC ALOGI
 #define LOG_PIN ALOGI
@@ -129,7 +124,6 @@
 #define LOG_REF ALOGI
 #define LOG_SCAV ALOGI
 #define LOG_TRAN ALOGI
-#define LOG_VER ALOGI
 #else
 #define LOG_ALLOC(...) ((void)0)
 #define LOG_PIN(...) ((void)0)
@@ -137,14 +131,9 @@
 #define LOG_REF(...) ((void)0)
 #define LOG_SCAV(...) ((void)0)
 #define LOG_TRAN(...) ((void)0)
-#define LOG_VER(...) ((void)0)
 #endif
 
-static void enqueueBlock(HeapSource *heapSource, size_t block);
 static void scavengeReference(Object **obj);
-static bool toSpaceContains(const void *addr);
-static bool fromSpaceContains(const void *addr);
-static size_t sumHeapBitmap(const HeapBitmap *bitmap);
 static size_t objectSize(const Object *obj);
 static void scavengeDataObject(Object *obj);
 static void scavengeBlockQueue();
@@ -155,6 +144,12 @@ static void scavengeBlockQueue();
 enum { BLOCK_SHIFT = 9 };
 enum { BLOCK_SIZE = 1 << BLOCK_SHIFT };
 
+/*
+ * Number of blocks sharing a page.  Free pages are returned to the
+ * system a page at a time.
+ */
+#define BLOCKS_PER_PAGE (SYSTEM_PAGE_SIZE / BLOCK_SIZE)
+
 /*
  * Space identifiers, stored into the blockSpace array.
  */
@@ -175,15 +170,38 @@ enum { ALLOC_ALIGNMENT = 8 };
  */
 #define QUEUE_TAIL (~(size_t)0)
 
+/*
+ * Growth policy, see dvmHeapSourceGrowForUtilization().
+ */
+#define HEAP_UTILIZATION_MAX        1024
+#define DEFAULT_HEAP_UTILIZATION    512     // Range 1..HEAP_UTILIZATION_MAX
+#define HEAP_IDEAL_FREE             (2 * 1024 * 1024)
+#define HEAP_MIN_FREE               (HEAP_IDEAL_FREE / 4)
+
 struct HeapSource {
 
     /* The base address of backing store. */
     u1 *blockBase;
 
-    /* Total number of blocks available for allocation. */
+    /* Total number of blocks in the backing store. */
     size_t totalBlocks;
+
+    /* Number of blocks in to-space. */
     size_t allocBlocks;
 
+    /*
+     * Number of blocks that may be allocated before a collection is
+     * needed.  Adjusted after every collection.
+     */
+    size_t limitBlocks;
+
+    /* Bounds of limitBlocks. */
+    size_t minimumBlocks;
+    size_t growthLimitBlocks;
+
+    /* Where the search for a run of free blocks starts. */
+    size_t nextFreeBlock;
+
     /*
      * The scavenger work queue.  Implemented as an array of index
      * values into the queue.
@@ -193,8 +211,7 @@ struct HeapSource {
     /*
      * Base and limit blocks.  Basically the shifted start address of
      * the block.  We convert blocks to a relative number when
-     * indexing in the block queue.  TODO: make the block queue base
-     * relative rather than the index into the block queue.
+     * indexing in the block queue.
      */
     size_t baseBlock, limitBlock;
 
@@ -202,7 +219,7 @@ struct HeapSource {
     size_t queueTail;
     size_t queueSize;
 
-    /* The space of the current block 0 (free), 1 or 2. */
+    /* The space of each block, one of the BLOCK_* values. */
     char *blockSpace;
 
     /* Start of free space in the current block. */
@@ -210,29 +227,36 @@ struct HeapSource {
     /* Exclusive limit of free space in the current block. */
     u1 *allocLimit;
 
-    HeapBitmap allocBits;
-
     /*
-     * The starting size of the heap.  This value is the same as the
-     * value provided to the -Xms flag.
+     * True if the current block is on the block queue.  Only
+     * meaningful during a collection.
      */
-    size_t minimumSize;
+    bool allocBlockQueued;
+
+    /* True from the flip until the end of the collection. */
+    bool collecting;
+
+    HeapBitmap allocBits;
 
     /*
-     * The maximum size of the heap.  This value is the same as the
-     * -Xmx flag.
+     * The size of the reservation.  This value is the same as the
+     * value provided to the -Xmx flag.
      */
     size_t maximumSize;
 
-    /*
-     * The current, committed size of the heap.  At present, this is
-     * equivalent to the maximumSize.
-     */
-    size_t currentSize;
+    /* Target ratio of live to allocated blocks, out of HEAP_UTILIZATION_MAX. */
+    size_t targetUtilization;
 
     size_t bytesAllocated;
+    size_t objectsAllocated;
+
+    /* Allocation totals at the time of the flip. */
+    size_t bytesBeforeFlip;
+    size_t objectsBeforeFlip;
 };
 
+static HeapSource *gHs = NULL;
+
 static unsigned long alignDown(unsigned long x, unsigned long n)
 {
     return x & -n;
@@ -243,41 +267,6 @@ static unsigned long alignUp(unsigned long x, unsigned long n)
     return alignDown(x + (n - 1), n);
 }
 
-static void describeBlocks(const HeapSource *heapSource)
-{
-    for (size_t i = 0; i < heapSource->totalBlocks; ++i) {
-        if ((i % 32) == 0) putchar('\n');
-        printf("%d ", heapSource->blockSpace[i]);
-    }
-    putchar('\n');
-}
-
-/*
- * Virtual memory interface.
- */
-
-static void *virtualAlloc(size_t length)
-{
-    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-    int prot = PROT_READ | PROT_WRITE;
-    void *addr = mmap(NULL, length, prot, flags, -1, 0);
-    if (addr == MAP_FAILED) {
-        LOGE_HEAP("mmap: %s", strerror(errno));
-        addr = NULL;
-    }
-    return addr;
-}
-
-static void virtualFree(void *addr, size_t length)
-{
-    assert(addr != NULL);
-    assert((uintptr_t)addr % SYSTEM_PAGE_SIZE == 0);
-    int res = munmap(addr, length);
-    if (res == -1) {
-        LOGE_HEAP("munmap: %s", strerror(errno));
-    }
-}
-
 #ifndef NDEBUG
 static int isValidAddress(const HeapSource *heapSource, const u1 *addr)
 {
@@ -289,67 +278,11 @@ static int isValidAddress(const HeapSource *heapSource, const u1 *addr)
 }
 #endif
 
-/*
- * Iterate over the block map looking for a contiguous run of free
- * blocks.
- */
-static void *allocateBlocks(HeapSource *heapSource, size_t blocks)
-{
-    size_t allocBlocks = heapSource->allocBlocks;
-    size_t totalBlocks = heapSource->totalBlocks;
-    /* Check underflow. */
-    assert(blocks != 0);
-    /* Check overflow. */
-    if (allocBlocks + blocks > totalBlocks / 2) {
-        return NULL;
-    }
-    /* Scan block map. */
-    for (size_t i = 0; i < totalBlocks; ++i) {
-        /* Check fit. */
-        for (size_t j = 0; j < blocks; ++j) { /* runs over totalBlocks */
-            if (heapSource->blockSpace[i+j] != BLOCK_FREE) {
-                break;
-            }
-        }
-        /* No fit? */
-        if (j != blocks) {
-            i += j;
-            continue;
-        }
-        /* Fit, allocate. */
-        heapSource->blockSpace[i] = BLOCK_TO_SPACE; /* why to-space? */
-        for (size_t j = 1; j < blocks; ++j) {
-            heapSource->blockSpace[i+j] = BLOCK_CONTINUED;
-        }
-        heapSource->allocBlocks += blocks;
-        void *addr = &heapSource->blockBase[i*BLOCK_SIZE];
-        memset(addr, 0, blocks*BLOCK_SIZE);
-        /* Collecting? */
-        if (heapSource->queueHead != QUEUE_TAIL) {
-            LOG_ALLOC("allocateBlocks allocBlocks=%zu,block#=%zu", heapSource->allocBlocks, i);
-            /*
-             * This allocated was on behalf of the transporter when it
-             * shaded a white object gray.  We enqueue the block so
-             * the scavenger can further shade the gray objects black.
-             */
-            enqueueBlock(heapSource, i);
-        }
-
-        return addr;
-    }
-    /* Insufficient space, fail. */
-    ALOGE("Insufficient space, %zu blocks, %zu blocks allocated and %zu bytes allocated",
-         heapSource->totalBlocks,
-         heapSource->allocBlocks,
-         heapSource->bytesAllocated);
-    return NULL;
-}
-
 /* Converts an absolute address to a relative block number. */
 static size_t addressToBlock(const HeapSource *heapSource, const void *addr)
 {
     assert(heapSource != NULL);
-    assert(isValidAddress(heapSource, addr));
+    assert(isValidAddress(heapSource, (const u1 *)addr));
     return (((uintptr_t)addr) >> BLOCK_SHIFT) - heapSource->baseBlock;
 }
 
@@ -363,40 +296,128 @@ static u1 *blockToAddress(const HeapSource *heapSource, size_t block)
     return addr;
 }
 
-static void clearBlock(HeapSource *heapSource, size_t block)
+/*
+ * Searches the block map for a contiguous run of free blocks, starting
+ * where the last search succeeded.  Outside of a collection the soft
+ * limit applies; while collecting, to-space may use every block.
+ */
+static void *allocateBlocks(HeapSource *heapSource, size_t blocks)
 {
-    assert(heapSource != NULL);
-    assert(block < heapSource->totalBlocks);
-    u1 *addr = heapSource->blockBase + block*BLOCK_SIZE;
-    memset(addr, 0xCC, BLOCK_SIZE);
-    for (size_t i = 0; i < BLOCK_SIZE; i += 8) {
-        dvmHeapBitmapClearObjectBit(&heapSource->allocBits, addr + i);
+    size_t totalBlocks = heapSource->totalBlocks;
+    size_t limit = heapSource->collecting ? totalBlocks
+                                          : heapSource->limitBlocks;
+    assert(blocks != 0);
+    if (heapSource->allocBlocks + blocks > limit) {
+        return NULL;
+    }
+    size_t start = heapSource->nextFreeBlock;
+    for (size_t pass = 0; pass < 2; ++pass) {
+        size_t i = pass == 0 ? start : 0;
+        size_t end = pass == 0 ? totalBlocks : MIN(start + blocks, totalBlocks);
+        while (i + blocks <= end) {
+            /* Check fit. */
+            size_t j;
+            for (j = 0; j < blocks; ++j) {
+                if (heapSource->blockSpace[i+j] != BLOCK_FREE) {
+                    break;
+                }
+            }
+            /* No fit? */
+            if (j != blocks) {
+                i += j + 1;
+                continue;
+            }
+            /* Fit, allocate. */
+            heapSource->blockSpace[i] = BLOCK_TO_SPACE;
+            for (j = 1; j < blocks; ++j) {
+                heapSource->blockSpace[i+j] = BLOCK_CONTINUED;
+            }
+            heapSource->allocBlocks += blocks;
+            heapSource->nextFreeBlock = i + blocks;
+            u1 *addr = blockToAddress(heapSource, i);
+            memset(addr, 0, blocks * BLOCK_SIZE);
+            LOG_ALLOC("allocateBlocks allocBlocks=%zu,block#=%zu",
+                      heapSource->allocBlocks, i);
+            return addr;
+        }
+    }
+    /* Insufficient contiguous space, fail. */
+    LOGV_HEAP("No run of %zu free blocks, %zu of %zu blocks allocated",
+              blocks, heapSource->allocBlocks, totalBlocks);
+    return NULL;
+}
+
+/*
+ * Returns the pages lying entirely within free blocks of the range
+ * [firstBlock, endBlock) to the system.  The range is widened to the
+ * neighbouring blocks that share its first and last pages.
+ */
+static size_t releaseFreePages(HeapSource *heapSource,
+                               size_t firstBlock, size_t endBlock)
+{
+    size_t start = alignDown(firstBlock, BLOCKS_PER_PAGE);
+    for (size_t i = start; i < firstBlock; ++i) {
+        if (heapSource->blockSpace[i] != BLOCK_FREE) {
+            start = alignUp(firstBlock, BLOCKS_PER_PAGE);
+            break;
+        }
+    }
+    size_t end = MIN(alignUp(endBlock, BLOCKS_PER_PAGE),
+                     heapSource->totalBlocks);
+    for (size_t i = endBlock; i < end; ++i) {
+        if (heapSource->blockSpace[i] != BLOCK_FREE) {
+            end = alignDown(endBlock, BLOCKS_PER_PAGE);
+            break;
+        }
     }
+    if (end <= start) {
+        return 0;
+    }
+    u1 *addr = blockToAddress(heapSource, start);
+    size_t length = (end - start) * BLOCK_SIZE;
+    if (madvise(addr, length, MADV_DONTNEED) == -1) {
+        LOGW_HEAP("madvise(%p, %zu) failed: %s", addr, length, strerror(errno));
+        return 0;
+    }
+    return length;
 }
 
+/*
+ * Frees the blocks left in from-space after a collection.
+ */
 static void clearFromSpace(HeapSource *heapSource)
 {
     assert(heapSource != NULL);
     size_t i = 0;
     size_t count = 0;
+    size_t released = 0;
     while (i < heapSource->totalBlocks) {
         if (heapSource->blockSpace[i] != BLOCK_FROM_SPACE) {
             ++i;
             continue;
         }
-        heapSource->blockSpace[i] = BLOCK_FREE;
-        clearBlock(heapSource, i);
-        ++i;
-        ++count;
-        while (i < heapSource->totalBlocks &&
-               heapSource->blockSpace[i] == BLOCK_CONTINUED) {
+        size_t first = i;
+        do {
             heapSource->blockSpace[i] = BLOCK_FREE;
-            clearBlock(heapSource, i);
             ++i;
-            ++count;
+        } while (i < heapSource->totalBlocks &&
+                 (heapSource->blockSpace[i] == BLOCK_CONTINUED ||
+                  heapSource->blockSpace[i] == BLOCK_FROM_SPACE));
+        u1 *addr = blockToAddress(heapSource, first);
+        size_t length = (i - first) * BLOCK_SIZE;
+#ifndef NDEBUG
+        /* Make stale references to freed objects stand out. */
+        memset(addr, 0xCC, length);
+#endif
+        for (size_t off = 0; off < length; off += ALLOC_ALIGNMENT) {
+            dvmHeapBitmapClearObjectBit(&heapSource->allocBits, addr + off);
         }
+        released += releaseFreePages(heapSource, first, i);
+        count += i - first;
     }
-    LOG_SCAV("freed %zu blocks (%zu bytes)", count, count*BLOCK_SIZE);
+    heapSource->nextFreeBlock = 0;
+    LOGV_HEAP("freed %zu blocks (%zu bytes), released %zu bytes",
+              count, count * BLOCK_SIZE, released);
 }
 
 /*
@@ -418,86 +439,102 @@ static void enqueueBlock(HeapSource *heapSource, size_t block)
 }
 
 /*
- * Grays all objects within the block corresponding to the given
- * address.
+ * Grays all objects within the block or span of blocks corresponding
+ * to the given address.  The objects are accounted as allocated in
+ * to-space.
  */
 static void promoteBlockByAddr(HeapSource *heapSource, const void *addr)
 {
-    size_t block;
-
-    block = addressToBlock(heapSource, (const u1 *)addr);
-    if (heapSource->blockSpace[block] != BLOCK_TO_SPACE) {
-        // LOG_PROM("promoting block %zu %d @ %p", block, heapSource->blockSpace[block], obj);
-        heapSource->blockSpace[block] = BLOCK_TO_SPACE;
-        enqueueBlock(heapSource, block);
-        /* TODO(cshapiro): count continued blocks?*/
-        heapSource->allocBlocks += 1;
-    } else {
-        // LOG_PROM("NOT promoting block %zu %d @ %p", block, heapSource->blockSpace[block], obj);
+    size_t block = addressToBlock(heapSource, addr);
+    assert(heapSource->blockSpace[block] != BLOCK_CONTINUED);
+    assert(heapSource->blockSpace[block] != BLOCK_FREE);
+    if (heapSource->blockSpace[block] != BLOCK_FROM_SPACE) {
+        return;
+    }
+    LOG_PROM("promoting block %zu @ %p", block, addr);
+    heapSource->blockSpace[block] = BLOCK_TO_SPACE;
+    enqueueBlock(heapSource, block);
+    size_t span = 1;
+    while (block + span < heapSource->totalBlocks &&
+           heapSource->blockSpace[block + span] == BLOCK_CONTINUED) {
+        ++span;
+    }
+    heapSource->allocBlocks += span;
+    /* No object in a from-space block has been forwarded yet. */
+    u1 *cursor = blockToAddress(heapSource, block);
+    u1 *end = cursor + BLOCK_SIZE;
+    while (cursor < end && *(u4 *)cursor != 0) {
+        size_t size = alignUp(objectSize((Object *)cursor), ALLOC_ALIGNMENT);
+        heapSource->bytesAllocated += size;
+        heapSource->objectsAllocated += 1;
+        cursor += size;
     }
 }
 
-GcHeap *dvmHeapSourceStartup(size_t startSize, size_t absoluteMaxSize)
+GcHeap *dvmHeapSourceStartup(size_t startingSize, size_t maximumSize,
+                             size_t growthLimit)
 {
-    GcHeap* gcHeap;
-    HeapSource *heapSource;
-
-    assert(startSize <= absoluteMaxSize);
-
-    heapSource = calloc(1, sizeof(*heapSource));
-    assert(heapSource != NULL);
-
-    heapSource->minimumSize = alignUp(startSize, BLOCK_SIZE);
-    heapSource->maximumSize = alignUp(absoluteMaxSize, BLOCK_SIZE);
-
-    heapSource->currentSize = heapSource->maximumSize;
-
-    /* Allocate underlying storage for blocks. */
-    heapSource->blockBase = virtualAlloc(heapSource->maximumSize);
-    assert(heapSource->blockBase != NULL);
-    heapSource->baseBlock = (uintptr_t) heapSource->blockBase >> BLOCK_SHIFT;
-    heapSource->limitBlock = ((uintptr_t) heapSource->blockBase + heapSource->maximumSize) >> BLOCK_SHIFT;
-
-    heapSource->allocBlocks = 0;
-    heapSource->totalBlocks = (heapSource->limitBlock - heapSource->baseBlock);
-
-    assert(heapSource->totalBlocks = heapSource->maximumSize / BLOCK_SIZE);
+    assert(startingSize <= maximumSize);
+    assert(growthLimit <= maximumSize);
 
-    {
-        size_t size = sizeof(heapSource->blockQueue[0]);
-        heapSource->blockQueue = malloc(heapSource->totalBlocks*size);
-        assert(heapSource->blockQueue != NULL);
-        memset(heapSource->blockQueue, 0xCC, heapSource->totalBlocks*size);
-        heapSource->queueHead = QUEUE_TAIL;
+    size_t length = alignUp(maximumSize, SYSTEM_PAGE_SIZE);
+    u1 *base = (u1 *)dvmAllocRegion(length, PROT_READ | PROT_WRITE,
+                                    "dalvik-heap");
+    if (base == NULL) {
+        return NULL;
     }
-
-    /* Byte indicating space residence or free status of block. */
-    {
-        size_t size = sizeof(heapSource->blockSpace[0]);
-        heapSource->blockSpace = calloc(1, heapSource->totalBlocks*size);
-        assert(heapSource->blockSpace != NULL);
+    HeapSource *heapSource = (HeapSource *)calloc(1, sizeof(*heapSource));
+    GcHeap *gcHeap = (GcHeap *)calloc(1, sizeof(*gcHeap));
+    if (heapSource == NULL || gcHeap == NULL) {
+        LOGE_HEAP("Can't allocate heap descriptor");
+        goto fail;
+    }
+    heapSource->blockBase = base;
+    heapSource->maximumSize = length;
+    heapSource->totalBlocks = length / BLOCK_SIZE;
+    heapSource->baseBlock = (uintptr_t)base >> BLOCK_SHIFT;
+    heapSource->limitBlock = heapSource->baseBlock + heapSource->totalBlocks;
+    heapSource->blockQueue =
+        (size_t *)malloc(heapSource->totalBlocks * sizeof(size_t));
+    heapSource->blockSpace = (char *)calloc(heapSource->totalBlocks, 1);
+    if (heapSource->blockQueue == NULL || heapSource->blockSpace == NULL) {
+        LOGE_HEAP("Can't allocate block tables");
+        goto fail;
     }
-
-    dvmHeapBitmapInit(&heapSource->allocBits,
-                      heapSource->blockBase,
-                      heapSource->maximumSize,
-                      "blockBase");
-
-    /* Initialize allocation pointers. */
-    heapSource->allocPtr = allocateBlocks(heapSource, 1);
-    heapSource->allocLimit = heapSource->allocPtr + BLOCK_SIZE;
-
-    gcHeap = calloc(1, sizeof(*gcHeap));
-    assert(gcHeap != NULL);
+    heapSource->queueHead = QUEUE_TAIL;
+    if (!dvmHeapBitmapInit(&heapSource->allocBits, base, length,
+                           "dalvik-bitmap-1")) {
+        LOGE_HEAP("Can't create allocation bitmap");
+        goto fail;
+    }
+    /* Half of the blocks are held back to copy into. */
+    heapSource->growthLimitBlocks =
+        MIN(alignUp(growthLimit, BLOCK_SIZE) / BLOCK_SIZE,
+            heapSource->totalBlocks) / 2;
+    heapSource->minimumBlocks =
+        MIN(alignUp(startingSize, BLOCK_SIZE) / BLOCK_SIZE,
+            heapSource->growthLimitBlocks);
+    heapSource->limitBlocks = heapSource->minimumBlocks;
+    heapSource->targetUtilization = DEFAULT_HEAP_UTILIZATION;
     gcHeap->heapSource = heapSource;
-
+    gHs = heapSource;
     return gcHeap;
+
+fail:
+    if (heapSource != NULL) {
+        free(heapSource->blockQueue);
+        free(heapSource->blockSpace);
+        free(heapSource);
+    }
+    free(gcHeap);
+    munmap(base, length);
+    return NULL;
 }
 
 /*
  * Perform any required heap initializations after forking from the
- * zygote process.  This is a no-op for the time being.  Eventually
- * this will demarcate the shared region of the heap.
+ * zygote process.  The zygote's objects are not shared; the first
+ * collection copies them like any other object.
  */
 bool dvmHeapSourceStartupAfterZygote()
 {
@@ -506,44 +543,56 @@ bool dvmHeapSourceStartupAfterZygote()
 
 bool dvmHeapSourceStartupBeforeFork()
 {
-    assert(!"implemented");
-    return false;
+    return true;
+}
+
+void dvmHeapSourceThreadShutdown()
+{
+    /* do nothing */
 }
 
 void dvmHeapSourceShutdown(GcHeap **gcHeap)
 {
     if (*gcHeap == NULL || (*gcHeap)->heapSource == NULL)
         return;
-    free((*gcHeap)->heapSource->blockQueue);
-    free((*gcHeap)->heapSource->blockSpace);
-    virtualFree((*gcHeap)->heapSource->blockBase,
-                (*gcHeap)->heapSource->maximumSize);
-    free((*gcHeap)->heapSource);
-    (*gcHeap)->heapSource = NULL;
+    HeapSource *heapSource = (*gcHeap)->heapSource;
+    dvmHeapBitmapDelete(&heapSource->allocBits);
+    free(heapSource->blockQueue);
+    free(heapSource->blockSpace);
+    munmap(heapSource->blockBase, heapSource->maximumSize);
+    free(heapSource);
+    gHs = NULL;
     free(*gcHeap);
     *gcHeap = NULL;
 }
 
+void *dvmHeapSourceGetBase()
+{
+    return gHs->blockBase;
+}
+
+size_t dvmHeapSourceGetMaximumSize()
+{
+    return gHs->growthLimitBlocks * BLOCK_SIZE;
+}
+
 size_t dvmHeapSourceGetValue(HeapSourceValueSpec spec,
                              size_t perHeapStats[],
                              size_t arrayLen)
 {
-    HeapSource *heapSource;
+    HeapSource *heapSource = gHs;
     size_t value;
 
-    heapSource = gDvm.gcHeap->heapSource;
     switch (spec) {
     case HS_FOOTPRINT:
-        value = heapSource->maximumSize;
-        break;
     case HS_ALLOWED_FOOTPRINT:
-        value = heapSource->maximumSize;
+        value = heapSource->limitBlocks * BLOCK_SIZE;
         break;
     case HS_BYTES_ALLOCATED:
         value = heapSource->bytesAllocated;
         break;
     case HS_OBJECTS_ALLOCATED:
-        value = sumHeapBitmap(&heapSource->allocBits);
+        value = heapSource->objectsAllocated;
         break;
     default:
         assert(!"implemented");
@@ -555,19 +604,9 @@ size_t dvmHeapSourceGetValue(HeapSourceValueSpec spec,
     return value;
 }
 
-/*
- * Performs a shallow copy of the allocation bitmap into the given
- * vector of heap bitmaps.
- */
-void dvmHeapSourceGetObjectBitmaps(HeapBitmap objBits[], HeapBitmap markBits[],
-                                   size_t numHeaps)
-{
-    assert(!"implemented");
-}
-
 HeapBitmap *dvmHeapSourceGetLiveBits()
 {
-    return &gDvm.gcHeap->heapSource->allocBits;
+    return &gHs->allocBits;
 }
 
 /*
@@ -582,86 +621,125 @@ HeapBitmap *dvmHeapSourceGetLiveBits()
  */
 void *dvmHeapSourceAlloc(size_t length)
 {
-    HeapSource *heapSource;
-    unsigned char *addr;
+    HeapSource *heapSource = gHs;
+    u1 *addr;
     size_t aligned, available, blocks;
 
-    heapSource = gDvm.gcHeap->heapSource;
     assert(heapSource != NULL);
-    assert(heapSource->allocPtr != NULL);
-    assert(heapSource->allocLimit != NULL);
 
     aligned = alignUp(length, ALLOC_ALIGNMENT);
     available = heapSource->allocLimit - heapSource->allocPtr;
 
-    /* Try allocating inside the current block. */
     if (aligned <= available) {
+        /* Allocate inside the current block. */
         addr = heapSource->allocPtr;
         heapSource->allocPtr += aligned;
-        heapSource->bytesAllocated += aligned;
-        dvmHeapBitmapSetObjectBit(&heapSource->allocBits, addr);
-        return addr;
-    }
-
-    /* Try allocating in a new block. */
-    if (aligned <= BLOCK_SIZE) {
-        addr =  allocateBlocks(heapSource, 1);
-        if (addr != NULL) {
-            heapSource->allocLimit = addr + BLOCK_SIZE;
-            heapSource->allocPtr = addr + aligned;
-            heapSource->bytesAllocated += aligned;
-            dvmHeapBitmapSetObjectBit(&heapSource->allocBits, addr);
-            /* TODO(cshapiro): pad out the current block. */
+    } else if (aligned <= BLOCK_SIZE) {
+        /* Abandon the rest of the current block and start a new one. */
+        addr = (u1 *)allocateBlocks(heapSource, 1);
+        if (addr == NULL) {
+            return NULL;
+        }
+        heapSource->allocLimit = addr + BLOCK_SIZE;
+        heapSource->allocPtr = addr + aligned;
+    } else {
+        /* Allocate a span of blocks. */
+        blocks = alignUp(aligned, BLOCK_SIZE) / BLOCK_SIZE;
+        addr = (u1 *)allocateBlocks(heapSource, blocks);
+        if (addr == NULL) {
+            return NULL;
         }
-        return addr;
-    }
-
-    /* Try allocating in a span of blocks. */
-    blocks = alignUp(aligned, BLOCK_SIZE) / BLOCK_SIZE;
-
-    addr = allocateBlocks(heapSource, blocks);
-    /* Propagate failure upward. */
-    if (addr != NULL) {
-        heapSource->bytesAllocated += aligned;
-        dvmHeapBitmapSetObjectBit(&heapSource->allocBits, addr);
-        /* TODO(cshapiro): pad out free space in the last block. */
     }
+    heapSource->bytesAllocated += aligned;
+    heapSource->objectsAllocated += 1;
+    dvmHeapBitmapSetObjectBit(&heapSource->allocBits, addr);
     return addr;
 }
 
+/*
+ * Raises the soft limit as far as the growth limit allows and retries
+ * the allocation.
+ */
 void *dvmHeapSourceAllocAndGrow(size_t size)
 {
-    return dvmHeapSourceAlloc(size);
+    HeapSource *heapSource = gHs;
+    void *ptr = dvmHeapSourceAlloc(size);
+    if (ptr != NULL) {
+        return ptr;
+    }
+    size_t oldLimit = heapSource->limitBlocks;
+    heapSource->limitBlocks = heapSource->growthLimitBlocks;
+    ptr = dvmHeapSourceAlloc(size);
+    if (ptr != NULL) {
+        heapSource->limitBlocks = MAX(oldLimit, heapSource->allocBlocks);
+        LOGI_HEAP("Grow heap to %zu.%03zuMB for %zu-byte allocation",
+                  FRACTIONAL_MB(heapSource->limitBlocks * BLOCK_SIZE), size);
+    } else {
+        heapSource->limitBlocks = oldLimit;
+    }
+    return ptr;
 }
 
-/* TODO: refactor along with dvmHeapSourceAlloc */
-void *allocateGray(size_t size)
+/*
+ * Allocation is already a pointer bump into the current block, so
+ * there are no thread-local buffers; callers fall back to the shared
+ * allocator.
+ */
+void *dvmHeapSourceAllocFromTlab(Thread *self, size_t n)
 {
-    HeapSource *heapSource;
-    void *addr;
-    size_t block;
+    return NULL;
+}
 
-    /* TODO: add a check that we are in a GC. */
-    heapSource = gDvm.gcHeap->heapSource;
-    addr = dvmHeapSourceAlloc(size);
-    assert(addr != NULL);
-    block = addressToBlock(heapSource, (const u1 *)addr);
-    if (heapSource->queueHead == QUEUE_TAIL) {
+void *dvmHeapSourceRefillTlab(Thread *self, size_t n)
+{
+    return NULL;
+}
+
+void dvmHeapSourceReleaseTlab(Thread *thread)
+{
+    /* do nothing */
+}
+
+void dvmHeapSourceReleaseAllTlabs()
+{
+    /* do nothing */
+}
+
+/*
+ * Allocates to-space storage for a copy of an object.  The block
+ * holding the copy must be on the block queue so that the scavenger
+ * gets to the copy.
+ */
+static Object *allocateGray(size_t size)
+{
+    HeapSource *heapSource = gHs;
+    const u1 *prevLimit = heapSource->allocLimit;
+
+    assert(heapSource->collecting);
+    assert(size <= BLOCK_SIZE);
+    u1 *addr = (u1 *)dvmHeapSourceAlloc(size);
+    if (addr == NULL) {
+        LOGE_HEAP("Out of to-space copying a %zu-byte object", size);
+        dvmAbort();
+    }
+    if (heapSource->allocLimit != prevLimit) {
+        /* The copy went into a fresh block. */
+        heapSource->allocBlockQueued = false;
+    }
+    if (!heapSource->allocBlockQueued) {
         /*
-         * Forcibly append the underlying block to the queue.  This
-         * condition occurs when referents are transported following
-         * the initial trace.
+         * Either the block is new or the scavenger has already
+         * finished with it.  Scanning a block twice is harmless.
          */
-        enqueueBlock(heapSource, block);
-        LOG_PROM("forced promoting block %zu %d @ %p", block, heapSource->blockSpace[block], addr);
+        enqueueBlock(heapSource, addressToBlock(heapSource, addr));
+        heapSource->allocBlockQueued = true;
     }
-    return addr;
+    return (Object *)addr;
 }
 
 bool dvmHeapSourceContainsAddress(const void *ptr)
 {
-    HeapSource *heapSource = gDvm.gcHeap->heapSource;
-    return dvmHeapBitmapCoversAddress(&heapSource->allocBits, ptr);
+    return dvmHeapBitmapCoversAddress(&gHs->allocBits, ptr);
 }
 
 /*
@@ -670,11 +748,7 @@ bool dvmHeapSourceContainsAddress(const void *ptr)
  */
 bool dvmHeapSourceContains(const void *addr)
 {
-    HeapSource *heapSource;
-    HeapBitmap *bitmap;
-
-    heapSource = gDvm.gcHeap->heapSource;
-    bitmap = &heapSource->allocBits;
+    HeapBitmap *bitmap = &gHs->allocBits;
     if (!dvmHeapBitmapCoversAddress(bitmap, addr)) {
         return false;
     } else {
@@ -682,60 +756,121 @@ bool dvmHeapSourceContains(const void *addr)
     }
 }
 
-bool dvmHeapSourceGetPtrFlag(const void *ptr, HeapSourcePtrFlag flag)
+/*
+ * Objects are never shared with the zygote.
+ */
+bool dvmIsZygoteObject(const Object* obj)
 {
-    assert(!"implemented");
     return false;
 }
 
 size_t dvmHeapSourceChunkSize(const void *ptr)
 {
-    assert(!"implemented");
-    return 0;
+    if (!dvmHeapSourceContains(ptr)) {
+        return 0;
+    }
+    return alignUp(objectSize((const Object *)ptr), ALLOC_ALIGNMENT);
 }
 
+/*
+ * Returns the number of bytes of to-space.  Free blocks are not
+ * backed by memory.
+ */
 size_t dvmHeapSourceFootprint()
 {
-    assert(!"implemented");
-    return 0;
+    return gHs->allocBlocks * BLOCK_SIZE;
 }
 
 /*
- * Returns the "ideal footprint" which appears to be the number of
- * bytes currently committed to the heap.  This starts out at the
- * start size of the heap and grows toward the maximum size.
+ * Returns the number of bytes that may be allocated before the next
+ * collection.
  */
 size_t dvmHeapSourceGetIdealFootprint()
 {
-    return gDvm.gcHeap->heapSource->currentSize;
+    return gHs->limitBlocks * BLOCK_SIZE;
 }
 
 float dvmGetTargetHeapUtilization()
 {
-    return 0.5f;
+    return (float)gHs->targetUtilization / (float)HEAP_UTILIZATION_MAX;
 }
 
 void dvmSetTargetHeapUtilization(float newTarget)
 {
-    assert(newTarget > 0.0f && newTarget < 1.0f);
+    /* Clamp it to a reasonable range.
+     */
+    if (newTarget < 0.2) {
+        newTarget = 0.2;
+    } else if (newTarget > 0.8) {
+        newTarget = 0.8;
+    }
+    gHs->targetUtilization =
+            (size_t)(newTarget * (float)HEAP_UTILIZATION_MAX);
+}
+
+/*
+ * Removes any growth limits.  Allows the user to allocate up to half
+ * of the maximum heap size.
+ */
+void dvmClearGrowthLimit()
+{
+    dvmLockHeap();
+    dvmWaitForConcurrentGcToComplete();
+    gDvm.gcHeap->cardTableLength = gDvm.gcHeap->cardTableMaxLength;
+    gHs->growthLimitBlocks = gHs->totalBlocks / 2;
+    dvmUnlockHeap();
 }
 
 /*
- * Expands the size of the heap after a collection.  At present we
- * commit the pages for maximum size of the heap so this routine is
- * just a no-op.  Eventually, we will either allocate or commit pages
- * on an as-need basis.
+ * Sets the soft limit so that the survivors of the last collection
+ * fill the target fraction of it.  Pages of free blocks were already
+ * returned to the system, so the limit only bounds how far the heap
+ * may grow before the next collection.
  */
 void dvmHeapSourceGrowForUtilization()
+{
+    HeapSource *heapSource = gHs;
+    size_t liveSize = heapSource->allocBlocks * BLOCK_SIZE;
+    size_t targetSize = (liveSize / heapSource->targetUtilization) *
+            HEAP_UTILIZATION_MAX;
+    if (targetSize > liveSize + HEAP_IDEAL_FREE) {
+        targetSize = liveSize + HEAP_IDEAL_FREE;
+    } else if (targetSize < liveSize + HEAP_MIN_FREE) {
+        targetSize = liveSize + HEAP_MIN_FREE;
+    }
+    size_t limit = alignUp(targetSize, BLOCK_SIZE) / BLOCK_SIZE;
+    limit = MAX(limit, heapSource->minimumBlocks);
+    limit = MIN(limit, heapSource->growthLimitBlocks);
+    heapSource->limitBlocks = limit;
+    LOGV_HEAP("Soft limit %zu blocks, %zu live", limit, heapSource->allocBlocks);
+}
+
+void dvmHeapSourceResetYoungStart()
 {
     /* do nothing */
 }
 
+/*
+ * Walks over every object in to-space.
+ */
 void dvmHeapSourceWalk(void(*callback)(void* start, void* end,
                                        size_t used_bytes, void* arg),
                        void *arg)
 {
-    assert(!"implemented");
+    HeapSource *heapSource = gHs;
+    for (size_t i = 0; i < heapSource->totalBlocks; ++i) {
+        if (heapSource->blockSpace[i] != BLOCK_TO_SPACE) {
+            continue;
+        }
+        u1 *cursor = blockToAddress(heapSource, i);
+        u1 *end = cursor + BLOCK_SIZE;
+        while (cursor < end && *(u4 *)cursor != 0) {
+            size_t size = alignUp(objectSize((Object *)cursor), ALLOC_ALIGNMENT);
+            callback(cursor, cursor + size, size, arg);
+            cursor += size;
+        }
+    }
+    callback(NULL, NULL, 0, arg);  // Indicate end of a heap.
 }
 
 size_t dvmHeapSourceGetNumHeaps()
@@ -743,38 +878,38 @@ size_t dvmHeapSourceGetNumHeaps()
     return 1;
 }
 
-bool dvmTrackExternalAllocation(size_t n)
-{
-    /* do nothing */
-    return true;
-}
-
-void dvmTrackExternalFree(size_t n)
-{
-    /* do nothing */
-}
-
-size_t dvmGetExternalBytesAllocated()
+/*
+ * Called once the survivors have been copied.  There is only one
+ * bitmap; releasing from-space clears the bits of every object that
+ * died.
+ */
+void dvmHeapSourceSwapBitmaps()
 {
-    assert(!"implemented");
-    return 0;
+    clearFromSpace(gHs);
 }
 
-void dvmHeapSourceFlip()
+/*
+ * Whitens all allocated blocks and resets the allocation state so
+ * that the survivors are copied into fresh blocks.
+ */
+static void flip(HeapSource *heapSource)
 {
-    HeapSource *heapSource = gDvm.gcHeap->heapSource;
+    heapSource->bytesBeforeFlip = heapSource->bytesAllocated;
+    heapSource->objectsBeforeFlip = heapSource->objectsAllocated;
+    heapSource->bytesAllocated = 0;
+    heapSource->objectsAllocated = 0;
 
     /* Reset the block queue. */
     heapSource->allocBlocks = 0;
     heapSource->queueSize = 0;
     heapSource->queueHead = QUEUE_TAIL;
 
-    /* TODO(cshapiro): pad the current (prev) block. */
-
     heapSource->allocPtr = NULL;
     heapSource->allocLimit = NULL;
+    heapSource->allocBlockQueued = false;
+    heapSource->nextFreeBlock = 0;
+    heapSource->collecting = true;
 
-    /* Whiten all allocated blocks. */
     for (size_t i = 0; i < heapSource->totalBlocks; ++i) {
         if (heapSource->blockSpace[i] == BLOCK_TO_SPACE) {
             heapSource->blockSpace[i] = BLOCK_FROM_SPACE;
@@ -782,39 +917,24 @@ void dvmHeapSourceFlip()
     }
 }
 
-static void room(size_t *alloc, size_t *avail, size_t *total)
-{
-    HeapSource *heapSource = gDvm.gcHeap->heapSource;
-    *total = heapSource->totalBlocks*BLOCK_SIZE;
-    *alloc = heapSource->allocBlocks*BLOCK_SIZE;
-    *avail = *total - *alloc;
-}
-
-static bool isSpaceInternal(u1 *addr, int space)
+static bool isSpaceInternal(const void *addr, int space)
 {
-    HeapSource *heapSource;
-    u1 *base, *limit;
-    size_t offset;
-    char space2;
-
-    heapSource = gDvm.gcHeap->heapSource;
-    base = heapSource->blockBase;
-    assert(addr >= base);
-    limit = heapSource->blockBase + heapSource->maximumSize;
-    assert(addr < limit);
-    offset = addr - base;
-    space2 = heapSource->blockSpace[offset >> BLOCK_SHIFT];
-    return space == space2;
+    HeapSource *heapSource = gHs;
+    const u1 *base = heapSource->blockBase;
+    assert((const u1 *)addr >= base);
+    assert((const u1 *)addr < base + heapSource->maximumSize);
+    size_t offset = (const u1 *)addr - base;
+    return heapSource->blockSpace[offset >> BLOCK_SHIFT] == space;
 }
 
 static bool fromSpaceContains(const void *addr)
 {
-    return isSpaceInternal((u1 *)addr, BLOCK_FROM_SPACE);
+    return isSpaceInternal(addr, BLOCK_FROM_SPACE);
 }
 
 static bool toSpaceContains(const void *addr)
 {
-    return isSpaceInternal((u1 *)addr, BLOCK_TO_SPACE);
+    return isSpaceInternal(addr, BLOCK_TO_SPACE);
 }
 
 /*
@@ -823,16 +943,7 @@ static bool toSpaceContains(const void *addr)
  */
 static void pinObject(const Object *obj)
 {
-    promoteBlockByAddr(gDvm.gcHeap->heapSource, obj);
-}
-
-static size_t sumHeapBitmap(const HeapBitmap *bitmap)
-{
-    size_t sum = 0;
-    for (size_t i = 0; i < bitmap->bitsLen >> 2; ++i) {
-        sum += CLZ(bitmap->bits[i]);
-    }
-    return sum;
+    promoteBlockByAddr(gHs, obj);
 }
 
 /*
@@ -846,7 +957,7 @@ static int isForward(const void *addr)
 
 static void setForward(const void *toObj, void *fromObj)
 {
-    *(unsigned long *)fromObj = (uintptr_t)toObj | 0x1;
+    *(uintptr_t *)fromObj = (uintptr_t)toObj | 0x1;
 }
 
 static void* getForward(const void *fromObj)
@@ -854,17 +965,37 @@ static void* getForward(const void *fromObj)
     return (void *)((uintptr_t)fromObj & ~0x1);
 }
 
-/* Beware, uses the same encoding as a forwarding pointers! */
-static int isPermanentString(const StringObject *obj) {
-    return (uintptr_t)obj & 0x1;
+/*
+ * Returns true if the referenced object has survived so far.  A
+ * reference to an object that has been copied is snapped to the copy.
+ */
+static bool isBlack(Object **ref)
+{
+    Object *obj = *ref;
+    assert(obj != NULL);
+    if (toSpaceContains(obj)) {
+        return true;
+    }
+    assert(fromSpaceContains(obj));
+    if (isForward(obj->clazz)) {
+        *ref = (Object *)getForward(obj->clazz);
+        return true;
+    }
+    return false;
 }
 
-static void* getPermanentString(const StringObject *obj)
+/*
+ * Returns the new address of a surviving object, or NULL if the object
+ * did not survive.
+ */
+static Object *forwardObject(Object *obj)
 {
-    return (void *)((uintptr_t)obj & ~0x1);
+    if (obj == NULL || !dvmHeapSourceContainsAddress(obj)) {
+        return obj;
+    }
+    return isBlack(&obj) ? obj : NULL;
 }
 
-
 /*
  * Scavenging and transporting routines follow.  A transporter grays
  * an object.  A scavenger blackens an object.  We define these
@@ -879,365 +1010,160 @@ static void scavengeClassObject(ClassObject *obj)
 {
     LOG_SCAV("scavengeClassObject(obj=%p)", obj);
     assert(obj != NULL);
-    assert(obj->obj.clazz != NULL);
-    assert(obj->obj.clazz->descriptor != NULL);
-    assert(!strcmp(obj->obj.clazz->descriptor, "Ljava/lang/Class;"));
+    assert(obj->clazz != NULL);
+    assert(obj->clazz->descriptor != NULL);
+    assert(!strcmp(obj->clazz->descriptor, "Ljava/lang/Class;"));
     assert(obj->descriptor != NULL);
-    LOG_SCAV("scavengeClassObject: descriptor='%s',vtableCount=%zu",
-             obj->descriptor, obj->vtableCount);
     /* Delegate class object and instance field scavenging. */
     scavengeDataObject((Object *)obj);
     /* Scavenge the array element class object. */
     if (IS_CLASS_FLAG_SET(obj, CLASS_ISARRAY)) {
         scavengeReference((Object **)(void *)&obj->elementClass);
     }
-    /* Scavenge the superclass. */
-    scavengeReference((Object **)(void *)&obj->super);
+    /* Do super and the interfaces contain Objects and not dex idx values? */
+    if (obj->status > CLASS_IDX) {
+        scavengeReference((Object **)(void *)&obj->super);
+    }
     /* Scavenge the class loader. */
     scavengeReference(&obj->classLoader);
     /* Scavenge static fields. */
     for (int i = 0; i < obj->sfieldCount; ++i) {
-        char ch = obj->sfields[i].field.signature[0];
+        char ch = obj->sfields[i].signature[0];
         if (ch == '[' || ch == 'L') {
             scavengeReference((Object **)(void *)&obj->sfields[i].value.l);
         }
     }
     /* Scavenge interface class objects. */
-    for (int i = 0; i < obj->interfaceCount; ++i) {
-        scavengeReference((Object **) &obj->interfaces[i]);
+    if (obj->status > CLASS_IDX) {
+        for (int i = 0; i < obj->interfaceCount; ++i) {
+            scavengeReference((Object **) &obj->interfaces[i]);
+        }
     }
 }
 
 /*
  * Array object scavenging.
  */
-static size_t scavengeArrayObject(ArrayObject *array)
+static void scavengeArrayObject(ArrayObject *array)
 {
     LOG_SCAV("scavengeArrayObject(array=%p)", array);
-    /* Scavenge the class object. */
-    assert(toSpaceContains(array));
     assert(array != NULL);
-    assert(array->obj.clazz != NULL);
+    assert(toSpaceContains(array));
+    assert(array->clazz != NULL);
+    /* Scavenge the class object. */
     scavengeReference((Object **) array);
-    size_t length = dvmArrayObjectSize(array);
     /* Scavenge the array contents. */
-    if (IS_CLASS_FLAG_SET(array->obj.clazz, CLASS_ISOBJECTARRAY)) {
-        Object **contents = (Object **)array->contents;
+    if (IS_CLASS_FLAG_SET(array->clazz, CLASS_ISOBJECTARRAY)) {
+        Object **contents = (Object **)(void *)array->contents;
         for (size_t i = 0; i < array->length; ++i) {
             scavengeReference(&contents[i]);
         }
     }
-    return length;
 }
 
 /*
  * Reference object scavenging.
  */
 
-static int getReferenceFlags(const Object *obj)
+static int referenceClassFlags(const Object *obj)
 {
-    int flags;
-
-    flags = CLASS_ISREFERENCE |
-            CLASS_ISWEAKREFERENCE |
-            CLASS_ISPHANTOMREFERENCE;
+    int flags = CLASS_ISREFERENCE |
+                CLASS_ISWEAKREFERENCE |
+                CLASS_ISFINALIZERREFERENCE |
+                CLASS_ISPHANTOMREFERENCE;
     return GET_CLASS_FLAG_GROUP(obj->clazz, flags);
 }
 
-static int isSoftReference(const Object *obj)
+static bool isSoftReference(const Object *obj)
 {
-    return getReferenceFlags(obj) == CLASS_ISREFERENCE;
+    return referenceClassFlags(obj) == CLASS_ISREFERENCE;
 }
 
-static int isWeakReference(const Object *obj)
+static bool isWeakReference(const Object *obj)
 {
-    return getReferenceFlags(obj) & CLASS_ISWEAKREFERENCE;
+    return referenceClassFlags(obj) & CLASS_ISWEAKREFERENCE;
+}
+
+static bool isFinalizerReference(const Object *obj)
+{
+    return referenceClassFlags(obj) & CLASS_ISFINALIZERREFERENCE;
 }
 
-#ifndef NDEBUG
 static bool isPhantomReference(const Object *obj)
 {
-    return getReferenceFlags(obj) & CLASS_ISPHANTOMREFERENCE;
+    return referenceClassFlags(obj) & CLASS_ISPHANTOMREFERENCE;
 }
-#endif
 
 /*
- * Returns true if the reference was registered with a reference queue
- * but has not yet been appended to it.
+ * Adds a reference to the tail of a circular queue of references.
  */
-static bool isReferenceEnqueuable(const Object *ref)
-{
-    Object *queue, *queueNext;
-
-    queue = dvmGetFieldObject(ref, gDvm.offJavaLangRefReference_queue);
-    queueNext = dvmGetFieldObject(ref, gDvm.offJavaLangRefReference_queueNext);
-    if (queue == NULL || queueNext != NULL) {
-        /*
-         * There is no queue, or the reference has already
-         * been enqueued.  The Reference.enqueue() method
-         * will do nothing even if we call it.
-         */
-        return false;
-    }
-
-    /*
-     * We need to call enqueue(), but if we called it from
-     * here we'd probably deadlock.  Schedule a call.
-     */
-    return true;
-}
-
-/*
- * Schedules a reference to be appended to its reference queue.
- */
-static void enqueueReference(Object *ref)
+static void enqueuePendingReference(Object *ref, Object **list)
 {
     assert(ref != NULL);
-    assert(dvmGetFieldObject(ref, gDvm.offJavaLangRefReference_queue) != NULL);
-    assert(dvmGetFieldObject(ref, gDvm.offJavaLangRefReference_queueNext) == NULL);
-    if (!dvmHeapAddRefToLargeTable(&gDvm.gcHeap->referenceOperations, ref)) {
-        ALOGE("no room for any more reference operations");
-        dvmAbort();
-    }
-}
-
-/*
- * Sets the referent field of a reference object to NULL.
- */
-static void clearReference(Object *obj)
-{
-    dvmSetFieldObject(obj, gDvm.offJavaLangRefReference_referent, NULL);
-}
-
-/*
- * Clears reference objects with white referents.
- */
-void clearWhiteReferences(Object **list)
-{
-    size_t referentOffset, queueNextOffset;
-    bool doSignal;
-
-    queueNextOffset = gDvm.offJavaLangRefReference_queueNext;
-    referentOffset = gDvm.offJavaLangRefReference_referent;
-    doSignal = false;
-    while (*list != NULL) {
-        Object *ref = *list;
-        JValue *field = dvmFieldPtr(ref, referentOffset);
-        Object *referent = field->l;
-        *list = dvmGetFieldObject(ref, queueNextOffset);
-        dvmSetFieldObject(ref, queueNextOffset, NULL);
-        assert(referent != NULL);
-        if (isForward(referent->clazz)) {
-            field->l = referent = getForward(referent->clazz);
-            continue;
-        }
-        if (fromSpaceContains(referent)) {
-            /* Referent is white, clear it. */
-            clearReference(ref);
-            if (isReferenceEnqueuable(ref)) {
-                enqueueReference(ref);
-                doSignal = true;
-            }
-        }
-    }
-    /*
-     * If we cleared a reference with a reference queue we must notify
-     * the heap worker to append the reference.
-     */
-    if (doSignal) {
-        dvmSignalHeapWorker(false);
+    assert(list != NULL);
+    size_t offset = gDvm.offJavaLangRefReference_pendingNext;
+    if (*list == NULL) {
+        dvmSetFieldObject(ref, offset, ref);
+        *list = ref;
+    } else {
+        Object *head = dvmGetFieldObject(*list, offset);
+        dvmSetFieldObject(ref, offset, head);
+        dvmSetFieldObject(*list, offset, ref);
     }
-    assert(*list == NULL);
 }
 
 /*
- * Blackens referents subject to the soft reference preservation
- * policy.
+ * Removes the reference at the head of a circular queue of
+ * references.
  */
-void preserveSoftReferences(Object **list)
+static Object *dequeuePendingReference(Object **list)
 {
+    assert(list != NULL);
+    assert(*list != NULL);
+    size_t offset = gDvm.offJavaLangRefReference_pendingNext;
+    Object *head = dvmGetFieldObject(*list, offset);
     Object *ref;
-    Object *prev, *next;
-    size_t referentOffset, queueNextOffset;
-    unsigned counter;
-    bool white;
-
-    queueNextOffset = gDvm.offJavaLangRefReference_queueNext;
-    referentOffset = gDvm.offJavaLangRefReference_referent;
-    counter = 0;
-    prev = next = NULL;
-    ref = *list;
-    while (ref != NULL) {
-        JValue *field = dvmFieldPtr(ref, referentOffset);
-        Object *referent = field->l;
-        next = dvmGetFieldObject(ref, queueNextOffset);
-        assert(referent != NULL);
-        if (isForward(referent->clazz)) {
-            /* Referent is black. */
-            field->l = referent = getForward(referent->clazz);
-            white = false;
-        } else {
-            white = fromSpaceContains(referent);
-        }
-        if (!white && ((++counter) & 1)) {
-            /* Referent is white and biased toward saving, gray it. */
-            scavengeReference((Object **)(void *)&field->l);
-            white = true;
-        }
-        if (white) {
-            /* Referent is black, unlink it. */
-            if (prev != NULL) {
-                dvmSetFieldObject(ref, queueNextOffset, NULL);
-                dvmSetFieldObject(prev, queueNextOffset, next);
-            }
-        } else {
-            /* Referent is white, skip over it. */
-            prev = ref;
-        }
-        ref = next;
-    }
-    /*
-     * Restart the trace with the newly gray references added to the
-     * root set.
-     */
-    scavengeBlockQueue();
-}
-
-void processFinalizableReferences()
-{
-    HeapRefTable newPendingRefs;
-    LargeHeapRefTable *finRefs = gDvm.gcHeap->finalizableRefs;
-    Object **ref;
-    Object **lastRef;
-    size_t totalPendCount;
-
-    /*
-     * All strongly, reachable objects are black.
-     * Any white finalizable objects need to be finalized.
-     */
-
-    /* Create a table that the new pending refs will
-     * be added to.
-     */
-    if (!dvmHeapInitHeapRefTable(&newPendingRefs)) {
-        //TODO: mark all finalizable refs and hope that
-        //      we can schedule them next time.  Watch out,
-        //      because we may be expecting to free up space
-        //      by calling finalizers.
-        LOG_REF("no room for pending finalizations");
-        dvmAbort();
-    }
-
-    /*
-     * Walk through finalizableRefs and move any white references to
-     * the list of new pending refs.
-     */
-    totalPendCount = 0;
-    while (finRefs != NULL) {
-        Object **gapRef;
-        size_t newPendCount = 0;
-
-        gapRef = ref = finRefs->refs.table;
-        lastRef = finRefs->refs.nextEntry;
-        while (ref < lastRef) {
-            if (fromSpaceContains(*ref)) {
-                if (!dvmHeapAddToHeapRefTable(&newPendingRefs, *ref)) {
-                    //TODO: add the current table and allocate
-                    //      a new, smaller one.
-                    LOG_REF("no room for any more pending finalizations: %zd",
-                            dvmHeapNumHeapRefTableEntries(&newPendingRefs));
-                    dvmAbort();
-                }
-                newPendCount++;
-            } else {
-                /* This ref is black, so will remain on finalizableRefs.
-                 */
-                if (newPendCount > 0) {
-                    /* Copy it up to fill the holes.
-                     */
-                    *gapRef++ = *ref;
-                } else {
-                    /* No holes yet; don't bother copying.
-                     */
-                    gapRef++;
-                }
-            }
-            ref++;
-        }
-        finRefs->refs.nextEntry = gapRef;
-        //TODO: if the table is empty when we're done, free it.
-        totalPendCount += newPendCount;
-        finRefs = finRefs->next;
-    }
-    LOG_REF("%zd finalizers triggered.", totalPendCount);
-    if (totalPendCount == 0) {
-        /* No objects required finalization.
-         * Free the empty temporary table.
-         */
-        dvmClearReferenceTable(&newPendingRefs);
-        return;
-    }
-
-    /* Add the new pending refs to the main list.
-     */
-    if (!dvmHeapAddTableToLargeTable(&gDvm.gcHeap->pendingFinalizationRefs,
-                &newPendingRefs))
-    {
-        LOG_REF("can't insert new pending finalizations");
-        dvmAbort();
+    if (*list == head) {
+        ref = *list;
+        *list = NULL;
+    } else {
+        Object *next = dvmGetFieldObject(head, offset);
+        dvmSetFieldObject(*list, offset, next);
+        ref = head;
     }
-
-    //TODO: try compacting the main list with a memcpy loop
-
-    /* Blacken the refs we just moved; we don't want them or their
-     * children to get swept yet.
-     */
-    ref = newPendingRefs.table;
-    lastRef = newPendingRefs.nextEntry;
-    assert(ref < lastRef);
-    HPROF_SET_GC_SCAN_STATE(HPROF_ROOT_FINALIZING, 0);
-    while (ref < lastRef) {
-        scavengeReference(ref);
-        ref++;
-    }
-    HPROF_CLEAR_GC_SCAN_STATE();
-    scavengeBlockQueue();
-    dvmSignalHeapWorker(false);
+    dvmSetFieldObject(ref, offset, NULL);
+    return ref;
 }
 
 /*
- * If a reference points to from-space and has been forwarded, we snap
- * the pointer to its new to-space address.  If the reference points
- * to an unforwarded from-space address we must enqueue the reference
- * for later processing.  TODO: implement proper reference processing
- * and move the referent scavenging elsewhere.
+ * Scavenges the fields of a reference object except for its referent.
+ * A referent that has already been copied is snapped to the copy.  A
+ * white referent is left alone and the reference is queued on the
+ * list for its strength, for processing once the trace completes.
  */
 static void scavengeReferenceObject(Object *obj)
 {
-    Object *referent;
-    Object **queue;
-    size_t referentOffset, queueNextOffset;
-
     assert(obj != NULL);
     LOG_SCAV("scavengeReferenceObject(obj=%p),'%s'", obj, obj->clazz->descriptor);
     scavengeDataObject(obj);
-    referentOffset = gDvm.offJavaLangRefReference_referent;
-    referent = dvmGetFieldObject(obj, referentOffset);
-    if (referent == NULL || toSpaceContains(referent)) {
-        return;
-    }
-    if (isSoftReference(obj)) {
-        queue = &gDvm.gcHeap->softReferences;
-    } else if (isWeakReference(obj)) {
-        queue = &gDvm.gcHeap->weakReferences;
-    } else {
-        assert(isPhantomReference(obj));
-        queue = &gDvm.gcHeap->phantomReferences;
+    GcHeap *gcHeap = gDvm.gcHeap;
+    size_t pendingNextOffset = gDvm.offJavaLangRefReference_pendingNext;
+    JValue *field = dvmFieldPtr(obj, gDvm.offJavaLangRefReference_referent);
+    Object *pending = dvmGetFieldObject(obj, pendingNextOffset);
+    if (pending == NULL && field->l != NULL && !isBlack(&field->l)) {
+        Object **list = NULL;
+        if (isSoftReference(obj)) {
+            list = &gcHeap->softReferences;
+        } else if (isWeakReference(obj)) {
+            list = &gcHeap->weakReferences;
+        } else if (isFinalizerReference(obj)) {
+            list = &gcHeap->finalizerReferences;
+        } else if (isPhantomReference(obj)) {
+            list = &gcHeap->phantomReferences;
+        }
+        assert(list != NULL);
+        enqueuePendingReference(obj, list);
     }
-    queueNextOffset = gDvm.offJavaLangRefReference_queueNext;
-    dvmSetFieldObject(obj, queueNextOffset, *queue);
-    *queue = obj;
-    LOG_SCAV("scavengeReferenceObject: enqueueing %p", obj);
 }
 
 /*
@@ -1245,7 +1171,6 @@ static void scavengeReferenceObject(Object *obj)
  */
 static void scavengeDataObject(Object *obj)
 {
-    // LOG_SCAV("scavengeDataObject(obj=%p)", obj);
     assert(obj != NULL);
     assert(obj->clazz != NULL);
     assert(obj->clazz->objectSize != 0);
@@ -1275,68 +1200,71 @@ static void scavengeDataObject(Object *obj)
     }
 }
 
+/*
+ * Returns the offset of the hash code word appended to an object that
+ * was moved after its identity hash code was taken.  This must agree
+ * with dvmIdentityHashCode().
+ */
+static size_t hashCodeOffset(const Object *obj)
+{
+    size_t size;
+    if (IS_CLASS_FLAG_SET(obj->clazz, CLASS_ISARRAY)) {
+        size = dvmArrayObjectSize((ArrayObject *)obj);
+        size = (size + 3) & ~3;
+    } else {
+        size = obj->clazz->objectSize;
+    }
+    return size;
+}
+
+/*
+ * Returns the number of bytes needed for a copy of the object,
+ * including room for its hash code.
+ */
+static size_t copySize(const Object *obj)
+{
+    if (LW_HASH_STATE(obj->lock) == LW_HASH_STATE_HASHED) {
+        return hashCodeOffset(obj) + sizeof(u4);
+    }
+    return objectSize(obj);
+}
+
 static Object *transportObject(const Object *fromObj)
 {
     Object *toObj;
-    size_t allocSize, copySize;
+    size_t allocSize, size;
 
-    LOG_TRAN("transportObject(fromObj=%p) allocBlocks=%zu",
-                  fromObj,
-                  gDvm.gcHeap->heapSource->allocBlocks);
     assert(fromObj != NULL);
     assert(fromSpaceContains(fromObj));
-    allocSize = copySize = objectSize(fromObj);
-    if (LW_HASH_STATE(fromObj->lock) != LW_HASH_STATE_UNHASHED) {
-        /*
-         * The object has been hashed or hashed and moved.  We must
-         * reserve an additional word for a hash code.
-         */
-        allocSize += sizeof(u4);
-    }
-    if (LW_HASH_STATE(fromObj->lock) == LW_HASH_STATE_HASHED_AND_MOVED) {
-        /*
-         * The object has its hash code allocated.  Ensure the hash
-         * code is copied along with the instance data.
-         */
-        copySize += sizeof(u4);
-    }
-    /* TODO(cshapiro): don't copy, re-map large data objects. */
-    assert(copySize <= allocSize);
+    /* Classes are always pinned. */
+    assert(!dvmIsClassObject(fromObj));
+    size = objectSize(fromObj);
+    allocSize = copySize(fromObj);
+    assert(size <= allocSize);
     toObj = allocateGray(allocSize);
-    assert(toObj != NULL);
     assert(toSpaceContains(toObj));
-    memcpy(toObj, fromObj, copySize);
+    memcpy(toObj, fromObj, size);
     if (LW_HASH_STATE(fromObj->lock) == LW_HASH_STATE_HASHED) {
         /*
          * The object has had its hash code exposed.  Append it to the
          * instance and set a bit so we know to look for it there.
          */
-        *(u4 *)(((char *)toObj) + copySize) = (u4)fromObj >> 3;
+        *(u4 *)(((char *)toObj) + hashCodeOffset(fromObj)) = (u4)fromObj >> 3;
         toObj->lock |= LW_HASH_STATE_HASHED_AND_MOVED << LW_HASH_STATE_SHIFT;
     }
-    LOG_TRAN("transportObject: from %p/%zu to %p/%zu (%zu,%zu) %s",
-             fromObj, addressToBlock(gDvm.gcHeap->heapSource,fromObj),
-             toObj, addressToBlock(gDvm.gcHeap->heapSource,toObj),
-             copySize, allocSize, copySize < allocSize ? "DIFFERENT" : "");
+    LOG_TRAN("transportObject: from %p/%zu to %p/%zu (%zu,%zu)",
+             fromObj, addressToBlock(gHs, fromObj),
+             toObj, addressToBlock(gHs, toObj),
+             size, allocSize);
     return toObj;
 }
 
-/*
- * Generic reference scavenging.
- */
-
-/*
- * Given a reference to an object, the scavenge routine will gray the
- * reference.  Any objects pointed to by the scavenger object will be
- * transported to new space and a forwarding pointer will be installed
- * in the header of the object.
- */
-
 /*
  * Blacken the given pointer.  If the pointer is in from space, it is
  * transported to new space.  If the object has a forwarding pointer
  * installed it has already been transported and the referent is
- * snapped to the new address.
+ * snapped to the new address.  Objects too large to share a block are
+ * not copied; their span is promoted instead.
  */
 static void scavengeReference(Object **obj)
 {
@@ -1347,32 +1275,27 @@ static void scavengeReference(Object **obj)
 
     if (*obj == NULL) return;
 
-    assert(dvmIsValidObject(*obj));
-
     /* The entire block is black. */
     if (toSpaceContains(*obj)) {
-        LOG_SCAV("scavengeReference skipping pinned object @ %p", *obj);
         return;
     }
-    LOG_SCAV("scavengeReference(*obj=%p)", *obj);
 
     assert(fromSpaceContains(*obj));
 
     clazz = (*obj)->clazz;
 
     if (isForward(clazz)) {
-        // LOG_SCAV("forwarding %p @ %p to %p", *obj, obj, (void *)((uintptr_t)clazz & ~0x1));
         *obj = (Object *)getForward(clazz);
         return;
     }
     fromObj = *obj;
-    if (clazz == NULL) {
-        // LOG_SCAV("scavangeReference %p has a NULL class object", fromObj);
-        assert(!"implemented");
-        toObj = NULL;
-    } else {
-        toObj = transportObject(fromObj);
+    assert(clazz != NULL);
+    if (copySize(fromObj) > BLOCK_SIZE) {
+        /* Alone in its block or span, so promoting it moves nothing. */
+        promoteBlockByAddr(gHs, fromObj);
+        return;
     }
+    toObj = transportObject(fromObj);
     setForward(toObj, fromObj);
     *obj = (Object *)toObj;
 }
@@ -1400,340 +1323,47 @@ static void scavengeObject(Object *obj)
 }
 
 /*
- * External root scavenging routines.
+ * External root pinning routines.
  */
 
-static void pinHashTableEntries(HashTable *table)
-{
-    LOG_PIN(">>> pinHashTableEntries(table=%p)", table);
-    if (table == NULL) {
-        return;
-    }
-    dvmHashTableLock(table);
-    for (int i = 0; i < table->tableSize; ++i) {
-        HashEntry *entry = &table->pEntries[i];
-        void *obj = entry->data;
-        if (obj == NULL || obj == HASH_TOMBSTONE) {
-            continue;
-        }
-        pinObject(entry->data);
-    }
-    dvmHashTableUnlock(table);
-    LOG_PIN("<<< pinHashTableEntries(table=%p)", table);
-}
-
-static void pinPrimitiveClasses()
+static void pinPossibleObject(const Object *obj)
 {
-    size_t length = ARRAYSIZE(gDvm.primitiveClass);
-    for (size_t i = 0; i < length; i++) {
-        if (gDvm.primitiveClass[i] != NULL) {
-            pinObject((Object *)gDvm.primitiveClass[i]);
-        }
+    if (obj != NULL && dvmIsValidObject(obj)) {
+        pinObject(obj);
     }
 }
 
 /*
- * Scavenge interned strings.  Permanent interned strings will have
- * been pinned and are therefore ignored.  Non-permanent strings that
- * have been forwarded are snapped.  All other entries are removed.
+ * Pins every class object along with the loaders that appear in its
+ * initiating loader list, which is not visible to the scavenger.
  */
-static void scavengeInternedStrings()
+static void pinLoadedClasses()
 {
-    HashTable *table = gDvm.internedStrings;
+    HashTable *table = gDvm.loadedClasses;
     if (table == NULL) {
         return;
     }
     dvmHashTableLock(table);
     for (int i = 0; i < table->tableSize; ++i) {
-        HashEntry *entry = &table->pEntries[i];
-        Object *obj = (Object *)entry->data;
-        if (obj == NULL || obj == HASH_TOMBSTONE) {
+        ClassObject *clazz = (ClassObject *)table->pEntries[i].data;
+        if (clazz == NULL || clazz == HASH_TOMBSTONE) {
             continue;
-        } else if (!isPermanentString((StringObject *)obj)) {
-            // LOG_SCAV("entry->data=%p", entry->data);
-            LOG_SCAV(">>> string obj=%p", entry->data);
-            /* TODO(cshapiro): detach white string objects */
-            scavengeReference((Object **)(void *)&entry->data);
-            LOG_SCAV("<<< string obj=%p", entry->data);
         }
-    }
-    dvmHashTableUnlock(table);
-}
-
-static void pinInternedStrings()
-{
-    HashTable *table = gDvm.internedStrings;
-    if (table == NULL) {
-        return;
-    }
-    dvmHashTableLock(table);
-    for (int i = 0; i < table->tableSize; ++i) {
-        HashEntry *entry = &table->pEntries[i];
-        Object *obj = (Object *)entry->data;
-        if (obj == NULL || obj == HASH_TOMBSTONE) {
-            continue;
-        } else if (isPermanentString((StringObject *)obj)) {
-            obj = (Object *)getPermanentString((StringObject*)obj);
-            LOG_PROM(">>> pin string obj=%p", obj);
-            pinObject(obj);
-            LOG_PROM("<<< pin string obj=%p", obj);
+        pinObject((Object *)clazz);
+        pinPossibleObject(clazz->classLoader);
+        InitiatingLoaderList *loaders = dvmGetInitiatingLoaderList(clazz);
+        for (int j = 0; j < loaders->initiatingLoaderCount; ++j) {
+            pinPossibleObject(loaders->initiatingLoaders[j]);
         }
-     }
+    }
     dvmHashTableUnlock(table);
 }
 
 /*
- * At present, reference tables contain references that must not be
- * moved by the collector.  Instead of scavenging each reference in
- * the table we pin each referenced object.
+ * Pins the arguments of native methods, whose values native code may
+ * hold directly, and every plausible reference in frames that have no
+ * register map.
  */
-static void pinReferenceTable(const ReferenceTable *table)
-{
-    assert(table != NULL);
-    assert(table->table != NULL);
-    assert(table->nextEntry != NULL);
-    for (Object **entry = table->table; entry < table->nextEntry; ++entry) {
-        assert(entry != NULL);
-        assert(!isForward(*entry));
-        pinObject(*entry);
-    }
-}
-
-static void scavengeLargeHeapRefTable(LargeHeapRefTable *table)
-{
-    for (; table != NULL; table = table->next) {
-        Object **ref = table->refs.table;
-        for (; ref < table->refs.nextEntry; ++ref) {
-            scavengeReference(ref);
-        }
-    }
-}
-
-/* This code was copied from Thread.c */
-static void scavengeThreadStack(Thread *thread)
-{
-    const u4 *framePtr;
-#if WITH_EXTRA_GC_CHECKS > 1
-    bool first = true;
-#endif
-
-    framePtr = (const u4 *)thread->interpSave.curFrame;
-    while (framePtr != NULL) {
-        const StackSaveArea *saveArea;
-        const Method *method;
-
-        saveArea = SAVEAREA_FROM_FP(framePtr);
-        method = saveArea->method;
-        if (method != NULL && !dvmIsNativeMethod(method)) {
-#ifdef COUNT_PRECISE_METHODS
-            /* the GC is running, so no lock required */
-            if (dvmPointerSetAddEntry(gDvm.preciseMethods, method))
-                LOG_SCAV("PGC: added %s.%s %p",
-                             method->clazz->descriptor, method->name, method);
-#endif
-#if WITH_EXTRA_GC_CHECKS > 1
-            /*
-             * May also want to enable the memset() in the "invokeMethod"
-             * goto target in the portable interpreter.  That sets the stack
-             * to a pattern that makes referring to uninitialized data
-             * very obvious.
-             */
-
-            if (first) {
-                /*
-                 * First frame, isn't native, check the "alternate" saved PC
-                 * as a sanity check.
-                 *
-                 * It seems like we could check the second frame if the first
-                 * is native, since the PCs should be the same.  It turns out
-                 * this doesn't always work.  The problem is that we could
-                 * have calls in the sequence:
-                 *   interp method #2
-                 *   native method
-                 *   interp method #1
-                 *
-                 * and then GC while in the native method after returning
-                 * from interp method #2.  The currentPc on the stack is
-                 * for interp method #1, but thread->currentPc2 is still
-                 * set for the last thing interp method #2 did.
-                 *
-                 * This can also happen in normal execution:
-                 * - sget-object on not-yet-loaded class
-                 * - class init updates currentPc2
-                 * - static field init is handled by parsing annotations;
-                 *   static String init requires creation of a String object,
-                 *   which can cause a GC
-                 *
-                 * Essentially, any pattern that involves executing
-                 * interpreted code and then causes an allocation without
-                 * executing instructions in the original method will hit
-                 * this.  These are rare enough that the test still has
-                 * some value.
-                 */
-                if (saveArea->xtra.currentPc != thread->currentPc2) {
-                    ALOGW("PGC: savedPC(%p) != current PC(%p), %s.%s ins=%p",
-                        saveArea->xtra.currentPc, thread->currentPc2,
-                        method->clazz->descriptor, method->name, method->insns);
-                    if (saveArea->xtra.currentPc != NULL)
-                        ALOGE("  pc inst = 0x%04x", *saveArea->xtra.currentPc);
-                    if (thread->currentPc2 != NULL)
-                        ALOGE("  pc2 inst = 0x%04x", *thread->currentPc2);
-                    dvmDumpThread(thread, false);
-                }
-            } else {
-                /*
-                 * It's unusual, but not impossible, for a non-first frame
-                 * to be at something other than a method invocation.  For
-                 * example, if we do a new-instance on a nonexistent class,
-                 * we'll have a lot of class loader activity on the stack
-                 * above the frame with the "new" operation.  Could also
-                 * happen while we initialize a Throwable when an instruction
-                 * fails.
-                 *
-                 * So there's not much we can do here to verify the PC,
-                 * except to verify that it's a GC point.
-                 */
-            }
-            assert(saveArea->xtra.currentPc != NULL);
-#endif
-
-            const RegisterMap* pMap;
-            const u1* regVector;
-
-            Method* nonConstMethod = (Method*) method;  // quiet gcc
-            pMap = dvmGetExpandedRegisterMap(nonConstMethod);
-
-            //LOG_SCAV("PGC: %s.%s", method->clazz->descriptor, method->name);
-
-            if (pMap != NULL) {
-                /* found map, get registers for this address */
-                int addr = saveArea->xtra.currentPc - method->insns;
-                regVector = dvmRegisterMapGetLine(pMap, addr);
-                /*
-                if (regVector == NULL) {
-                    LOG_SCAV("PGC: map but no entry for %s.%s addr=0x%04x",
-                                 method->clazz->descriptor, method->name, addr);
-                } else {
-                    LOG_SCAV("PGC: found map for %s.%s 0x%04x (t=%d)",
-                                 method->clazz->descriptor, method->name, addr,
-                                 thread->threadId);
-                }
-                */
-            } else {
-                /*
-                 * No map found.  If precise GC is disabled this is
-                 * expected -- we don't create pointers to the map data even
-                 * if it's present -- but if it's enabled it means we're
-                 * unexpectedly falling back on a conservative scan, so it's
-                 * worth yelling a little.
-                 */
-                if (gDvm.preciseGc) {
-                    LOG_SCAV("PGC: no map for %s.%s", method->clazz->descriptor, method->name);
-                }
-                regVector = NULL;
-            }
-            if (regVector == NULL) {
-                /*
-                 * There are no roots to scavenge.  Skip over the entire frame.
-                 */
-                framePtr += method->registersSize;
-            } else {
-                /*
-                 * Precise scan.  v0 is at the lowest address on the
-                 * interpreted stack, and is the first bit in the register
-                 * vector, so we can walk through the register map and
-                 * memory in the same direction.
-                 *
-                 * A '1' bit indicates a live reference.
-                 */
-                u2 bits = 1 << 1;
-                for (int i = method->registersSize - 1; i >= 0; i--) {
-                    u4 rval = *framePtr;
-
-                    bits >>= 1;
-                    if (bits == 1) {
-                        /* set bit 9 so we can tell when we're empty */
-                        bits = *regVector++ | 0x0100;
-                    }
-
-                    if (rval != 0 && (bits & 0x01) != 0) {
-                        /*
-                         * Non-null, register marked as live reference.  This
-                         * should always be a valid object.
-                         */
-#if WITH_EXTRA_GC_CHECKS > 0
-                        if ((rval & 0x3) != 0 || !dvmIsValidObject((Object*) rval)) {
-                            /* this is very bad */
-                            ALOGE("PGC: invalid ref in reg %d: 0x%08x",
-                                method->registersSize-1 - i, rval);
-                        } else
-#endif
-                        {
-
-                            // LOG_SCAV("stack reference %u@%p", *framePtr, framePtr);
-                            /* dvmMarkObjectNonNull((Object *)rval); */
-                            scavengeReference((Object **) framePtr);
-                        }
-                    } else {
-                        /*
-                         * Null or non-reference, do nothing at all.
-                         */
-#if WITH_EXTRA_GC_CHECKS > 1
-                        if (dvmIsValidObject((Object*) rval)) {
-                            /* this is normal, but we feel chatty */
-                            ALOGD("PGC: ignoring valid ref in reg %d: 0x%08x",
-                                 method->registersSize-1 - i, rval);
-                        }
-#endif
-                    }
-                    ++framePtr;
-                }
-                dvmReleaseRegisterMapLine(pMap, regVector);
-            }
-        }
-        /* else this is a break frame and there is nothing to gray, or
-         * this is a native method and the registers are just the "ins",
-         * copied from various registers in the caller's set.
-         */
-
-#if WITH_EXTRA_GC_CHECKS > 1
-        first = false;
-#endif
-
-        /* Don't fall into an infinite loop if things get corrupted.
-         */
-        assert((uintptr_t)saveArea->prevFrame > (uintptr_t)framePtr ||
-               saveArea->prevFrame == NULL);
-        framePtr = saveArea->prevFrame;
-    }
-}
-
-static void scavengeThread(Thread *thread)
-{
-    // LOG_SCAV("scavengeThread(thread=%p)", thread);
-
-    // LOG_SCAV("Scavenging threadObj=%p", thread->threadObj);
-    scavengeReference(&thread->threadObj);
-
-    // LOG_SCAV("Scavenging exception=%p", thread->exception);
-    scavengeReference(&thread->exception);
-
-    scavengeThreadStack(thread);
-}
-
-static void scavengeThreadList()
-{
-    Thread *thread;
-
-    dvmLockThreadList(dvmThreadSelf());
-    thread = gDvm.threadList;
-    while (thread) {
-        scavengeThread(thread);
-        thread = thread->next;
-    }
-    dvmUnlockThreadList();
-}
-
 static void pinThreadStack(const Thread *thread)
 {
     const u4 *framePtr;
@@ -1744,48 +1374,33 @@ static void pinThreadStack(const Thread *thread)
 
     saveArea = NULL;
     framePtr = (const u4 *)thread->interpSave.curFrame;
-    for (; framePtr != NULL; framePtr = saveArea->prevFrame) {
+    for (; framePtr != NULL; framePtr = (const u4 *)saveArea->prevFrame) {
         saveArea = SAVEAREA_FROM_FP(framePtr);
         method = (Method *)saveArea->method;
         if (method != NULL && dvmIsNativeMethod(method)) {
             /*
-             * This is native method, pin its arguments.
-             *
-             * For purposes of graying references, we don't need to do
-             * anything here, because all of the native "ins" were copied
-             * from registers in the caller's stack frame and won't be
-             * changed (an interpreted method can freely use registers
-             * with parameters like any other register, but natives don't
-             * work that way).
-             *
-             * However, we need to ensure that references visible to
-             * native methods don't move around.  We can do a precise scan
-             * of the arguments by examining the method signature.
+             * All of the native "ins" were copied from registers in
+             * the caller's frame, so the scavenger updates the
+             * originals, but the copies passed to native code must
+             * not move.  We can do a precise scan of the arguments by
+             * examining the method signature.
              */
             LOG_PIN("+++ native scan %s.%s",
                     method->clazz->descriptor, method->name);
             assert(method->registersSize == method->insSize);
+            const u4 *ins = framePtr;
             if (!dvmIsStaticMethod(method)) {
-                /* grab the "this" pointer */
-                obj = (Object *)*framePtr++;
-                if (obj == NULL) {
-                    /*
-                     * This can happen for the "fake" entry frame inserted
-                     * for threads created outside the VM.  There's no actual
-                     * call so there's no object.  If we changed the fake
-                     * entry method to be declared "static" then this
-                     * situation should never occur.
-                     */
-                } else {
-                    assert(dvmIsValidObject(obj));
-                    pinObject(obj);
-                }
+                /*
+                 * Grab the "this" pointer.  It is NULL in the fake
+                 * entry frame of threads created outside the VM.
+                 */
+                pinPossibleObject((Object *)*ins++);
             }
             shorty = method->shorty+1;      // skip return value
-            for (int i = method->registersSize - 1; i >= 0; i--, framePtr++) {
-                switch (*shorty++) {
+            for (; *shorty != '\0'; ++shorty, ++ins) {
+                switch (*shorty) {
                 case 'L':
-                    obj = (Object *)*framePtr;
+                    obj = (Object *)*ins;
                     if (obj != NULL) {
                         assert(dvmIsValidObject(obj));
                         pinObject(obj);
@@ -1793,24 +1408,17 @@ static void pinThreadStack(const Thread *thread)
                     break;
                 case 'D':
                 case 'J':
-                    framePtr++;
+                    ++ins;
                     break;
                 default:
                     /* 32-bit non-reference value */
-                    obj = (Object *)*framePtr;          // debug, remove
-                    if (dvmIsValidObject(obj)) {        // debug, remove
-                        /* if we see a lot of these, our scan might be off */
-                        LOG_PIN("+++ did NOT pin obj %p", obj);
-                    }
                     break;
                 }
             }
-        } else if (method != NULL && !dvmIsNativeMethod(method)) {
+        } else if (method != NULL) {
             const RegisterMap* pMap = dvmGetExpandedRegisterMap(method);
             const u1* regVector = NULL;
 
-            ALOGI("conservative : %s.%s", method->clazz->descriptor, method->name);
-
             if (pMap != NULL) {
                 int addr = saveArea->xtra.currentPc - method->insns;
                 regVector = dvmRegisterMapGetLine(pMap, addr);
@@ -1819,12 +1427,13 @@ static void pinThreadStack(const Thread *thread)
                 /*
                  * No register info for this frame, conservatively pin.
                  */
-                for (int i = 0; i < method->registersSize; ++i) {
-                    u4 regValue = framePtr[i];
-                    if (regValue != 0 && (regValue & 0x3) == 0 && dvmIsValidObject((Object *)regValue)) {
-                        pinObject((Object *)regValue);
-                    }
+                LOG_PIN("conservative : %s.%s",
+                        method->clazz->descriptor, method->name);
+                for (size_t i = 0; i < method->registersSize; ++i) {
+                    pinPossibleObject((Object *)framePtr[i]);
                 }
+            } else {
+                dvmReleaseRegisterMapLine(pMap, regVector);
             }
         }
         /*
@@ -1835,38 +1444,35 @@ static void pinThreadStack(const Thread *thread)
     }
 }
 
-static void pinThread(const Thread *thread)
+static void pinThreadList()
 {
-    assert(thread != NULL);
-    LOG_PIN("pinThread(thread=%p)", thread);
-
-    LOG_PIN("Pin native method arguments");
-    pinThreadStack(thread);
-
-    LOG_PIN("Pin internalLocalRefTable");
-    pinReferenceTable(&thread->internalLocalRefTable);
-
-    LOG_PIN("Pin jniLocalRefTable");
-    pinReferenceTable(&thread->jniLocalRefTable);
-
-    /* Can the check be pushed into the promote routine? */
-    if (thread->jniMonitorRefTable.table) {
-        LOG_PIN("Pin jniMonitorRefTable");
-        pinReferenceTable(&thread->jniMonitorRefTable);
+    dvmLockThreadList(dvmThreadSelf());
+    for (Thread *thread = gDvm.threadList; thread; thread = thread->next) {
+        LOG_PIN("pinThread(thread=%p)", thread);
+        pinThreadStack(thread);
+        pinPossibleObject(thread->classLoaderOverride);
     }
+    dvmUnlockThreadList();
 }
 
-static void pinThreadList()
+/*
+ * Pins roots held in places the VM reads without going through the
+ * root visitor again.  Interpreted frames and thread objects are
+ * always reached through their slots, so they may move.
+ */
+static void pinRootVisitor(void *addr, u4 threadId, RootType type, void *arg)
 {
-    Thread *thread;
-
-    dvmLockThreadList(dvmThreadSelf());
-    thread = gDvm.threadList;
-    while (thread) {
-        pinThread(thread);
-        thread = thread->next;
+    assert(addr != NULL);
+    if (type != ROOT_JAVA_FRAME && type != ROOT_THREAD_OBJECT) {
+        pinPossibleObject(*(Object **)addr);
     }
-    dvmUnlockThreadList();
+}
+
+static void scavengeRootVisitor(void *addr, u4 threadId, RootType type,
+                                void *arg)
+{
+    assert(addr != NULL);
+    scavengeReference((Object **)addr);
 }
 
 /*
@@ -1882,7 +1488,6 @@ static void scavengeBlock(HeapSource *heapSource, size_t block)
 {
     u1 *cursor;
     u1 *end;
-    size_t size;
 
     LOG_SCAV("scavengeBlock(heapSource=%p,block=%zu)", heapSource, block);
 
@@ -1892,17 +1497,13 @@ static void scavengeBlock(HeapSource *heapSource, size_t block)
 
     cursor = blockToAddress(heapSource, block);
     end = cursor + BLOCK_SIZE;
-    LOG_SCAV("scavengeBlock start=%p, end=%p", cursor, end);
 
     /* Parse and scavenge the current block. */
-    size = 0;
     while (cursor < end) {
         u4 word = *(u4 *)cursor;
         if (word != 0) {
             scavengeObject((Object *)cursor);
-            size = objectSize((Object *)cursor);
-            size = alignUp(size, ALLOC_ALIGNMENT);
-            cursor += size;
+            cursor += alignUp(objectSize((Object *)cursor), ALLOC_ALIGNMENT);
         } else {
             /* Check for padding. */
             while (*(u4 *)cursor == 0) {
@@ -1930,306 +1531,343 @@ static size_t objectSize(const Object *obj)
         size = obj->clazz->objectSize;
     }
     if (LW_HASH_STATE(obj->lock) == LW_HASH_STATE_HASHED_AND_MOVED) {
-        size += sizeof(u4);
+        size = hashCodeOffset(obj) + sizeof(u4);
     }
     return size;
 }
 
-static void verifyBlock(HeapSource *heapSource, size_t block)
-{
-    u1 *cursor;
-    u1 *end;
-    size_t size;
-
-    // LOG_VER("verifyBlock(heapSource=%p,block=%zu)", heapSource, block);
-
-    assert(heapSource != NULL);
-    assert(block < heapSource->totalBlocks);
-    assert(heapSource->blockSpace[block] == BLOCK_TO_SPACE);
-
-    cursor = blockToAddress(heapSource, block);
-    end = cursor + BLOCK_SIZE;
-    // LOG_VER("verifyBlock start=%p, end=%p", cursor, end);
-
-    /* Parse and scavenge the current block. */
-    size = 0;
-    while (cursor < end) {
-        u4 word = *(u4 *)cursor;
-        if (word != 0) {
-            dvmVerifyObject((Object *)cursor);
-            size = objectSize((Object *)cursor);
-            size = alignUp(size, ALLOC_ALIGNMENT);
-            cursor += size;
-        } else {
-            /* Check for padding. */
-            while (*(unsigned long *)cursor == 0) {
-                cursor += 4;
-                if (cursor == end) break;
-            }
-            /* Punt if something went wrong. */
-            assert(cursor == end);
-        }
-    }
-}
-
-static void describeBlockQueue(const HeapSource *heapSource)
-{
-    size_t block, count;
-    char space;
-
-    block = heapSource->queueHead;
-    count = 0;
-    LOG_SCAV(">>> describeBlockQueue(heapSource=%p)", heapSource);
-    /* Count the number of blocks enqueued. */
-    while (block != QUEUE_TAIL) {
-        block = heapSource->blockQueue[block];
-        ++count;
-    }
-    LOG_SCAV("blockQueue %zu elements, enqueued %zu",
-                 count, heapSource->queueSize);
-    block = heapSource->queueHead;
-    while (block != QUEUE_TAIL) {
-        space = heapSource->blockSpace[block];
-        LOG_SCAV("block=%zu@%p,space=%zu", block, blockToAddress(heapSource,block), space);
-        block = heapSource->blockQueue[block];
-    }
-
-    LOG_SCAV("<<< describeBlockQueue(heapSource=%p)", heapSource);
-}
-
 /*
  * Blackens promoted objects.
  */
 static void scavengeBlockQueue()
 {
-    HeapSource *heapSource;
+    HeapSource *heapSource = gHs;
     size_t block;
 
-    LOG_SCAV(">>> scavengeBlockQueue()");
-    heapSource = gDvm.gcHeap->heapSource;
-    describeBlockQueue(heapSource);
+    LOG_SCAV(">>> scavengeBlockQueue() %zu blocks", heapSource->queueSize);
     while (heapSource->queueHead != QUEUE_TAIL) {
         block = heapSource->queueHead;
-        LOG_SCAV("Dequeueing block %zu", block);
         scavengeBlock(heapSource, block);
         heapSource->queueHead = heapSource->blockQueue[block];
-        LOG_SCAV("New queue head is %zu", heapSource->queueHead);
-    }
-    LOG_SCAV("<<< scavengeBlockQueue()");
-}
-
-/*
- * Scan the block list and verify all blocks that are marked as being
- * in new space.  This should be parametrized so we can invoke this
- * routine outside of the context of a collection.
- */
-static void verifyNewSpace()
-{
-    HeapSource *heapSource = gDvm.gcHeap->heapSource;
-    size_t c0 = 0, c1 = 0, c2 = 0, c7 = 0;
-    for (size_t i = 0; i < heapSource->totalBlocks; ++i) {
-        switch (heapSource->blockSpace[i]) {
-        case BLOCK_FREE: ++c0; break;
-        case BLOCK_TO_SPACE: ++c1; break;
-        case BLOCK_FROM_SPACE: ++c2; break;
-        case BLOCK_CONTINUED: ++c7; break;
-        default: assert(!"reached");
+        if (heapSource->allocPtr != NULL &&
+            block == addressToBlock(heapSource, heapSource->allocPtr - 1)) {
+            /* Later copies into this block need another scan. */
+            heapSource->allocBlockQueued = false;
         }
     }
-    LOG_VER("Block Demographics: "
-            "Free=%zu,ToSpace=%zu,FromSpace=%zu,Continued=%zu",
-            c0, c1, c2, c7);
-    for (size_t i = 0; i < heapSource->totalBlocks; ++i) {
-        if (heapSource->blockSpace[i] != BLOCK_TO_SPACE) {
-            continue;
-        }
-        verifyBlock(heapSource, i);
-    }
-}
-
-void describeHeap()
-{
-    HeapSource *heapSource = gDvm.gcHeap->heapSource;
-    describeBlocks(heapSource);
+    LOG_SCAV("<<< scavengeBlockQueue()");
 }
 
 /*
  * The collection interface.  Collection has a few distinct phases.
  * The first is flipping AKA condemning AKA whitening the heap.  The
  * second is to promote all objects which are pointed to by pinned or
- * ambiguous references.  The third phase is tracing from the stacks,
- * registers and various globals.  Lastly, a verification of the heap
- * is performed.  The last phase should be optional.
+ * ambiguous references.  The third phase is tracing from the roots.
+ * Reference objects and system weaks are processed after the trace,
+ * and from-space is released once nothing refers to it.
  */
-void dvmScavengeRoots()  /* Needs a new name badly */
-{
-    GcHeap *gcHeap;
 
-    {
-        size_t alloc, unused, total;
+bool dvmHeapBeginMarkStep(bool isPartial, bool isYoung)
+{
+    /* Every collection copies the whole heap. */
+    return true;
+}
 
-        room(&alloc, &unused, &total);
-        LOG_SCAV("BEFORE GC: %zu alloc, %zu free, %zu total.",
-                     alloc, unused, total);
-    }
+void dvmHeapMarkRootSet()
+{
+    HeapSource *heapSource = gHs;
 
-    gcHeap = gDvm.gcHeap;
-    dvmHeapSourceFlip();
+    LOGV_HEAP("Before GC: %zu of %zu blocks allocated",
+              heapSource->allocBlocks, heapSource->totalBlocks);
+    flip(heapSource);
 
     /*
      * Promote blocks with stationary objects.
      */
     pinThreadList();
-    pinReferenceTable(&gDvm.jniGlobalRefTable);
-    pinReferenceTable(&gDvm.jniPinRefTable);
-    pinHashTableEntries(gDvm.loadedClasses);
-    pinHashTableEntries(gDvm.dbgRegistry);
-    pinPrimitiveClasses();
-    pinInternedStrings();
-
-    // describeBlocks(gcHeap->heapSource);
-
-    /*
-     * Create first, open new-space page right here.
-     */
+    pinLoadedClasses();
+    dvmVisitRoots(pinRootVisitor, NULL);
 
-    /* Reset allocation to an unallocated block. */
-    gDvm.gcHeap->heapSource->allocPtr = allocateBlocks(gDvm.gcHeap->heapSource, 1);
-    gDvm.gcHeap->heapSource->allocLimit = gDvm.gcHeap->heapSource->allocPtr + BLOCK_SIZE;
     /*
-     * Hack: promote the empty block allocated above.  If the
-     * promotions that occurred above did not actually gray any
-     * objects, the block queue may be empty.  We must force a
-     * promotion to be safe.
+     * Scavenge the roots.  Pinned objects are already in to-space,
+     * every other root is copied and snapped.
      */
-    promoteBlockByAddr(gDvm.gcHeap->heapSource, gDvm.gcHeap->heapSource->allocPtr);
-
-    /*
-     * Scavenge blocks and relocate movable objects.
-     */
-
-    LOG_SCAV("Scavenging gDvm.threadList");
-    scavengeThreadList();
-
-    LOG_SCAV("Scavenging gDvm.gcHeap->referenceOperations");
-    scavengeLargeHeapRefTable(gcHeap->referenceOperations);
-
-    LOG_SCAV("Scavenging gDvm.gcHeap->pendingFinalizationRefs");
-    scavengeLargeHeapRefTable(gcHeap->pendingFinalizationRefs);
-
-    LOG_SCAV("Scavenging random global stuff");
-    scavengeReference(&gDvm.outOfMemoryObj);
-    scavengeReference(&gDvm.internalErrorObj);
-    scavengeReference(&gDvm.noClassDefFoundErrorObj);
-
-    // LOG_SCAV("Scavenging gDvm.internedString");
-    scavengeInternedStrings();
+    dvmVisitRoots(scavengeRootVisitor, NULL);
+}
 
-    LOG_SCAV("Root scavenge has completed.");
+void dvmHeapReMarkRootSet()
+{
+    dvmVisitRoots(scavengeRootVisitor, NULL);
+}
 
+void dvmHeapScanMarkedObjects()
+{
     scavengeBlockQueue();
+}
 
-    // LOG_SCAV("Re-snap global class pointers.");
-    // scavengeGlobals();
-
-    LOG_SCAV("New space scavenge has completed.");
-
-    /*
-     * Process reference objects in strength order.
-     */
-
-    LOG_REF("Processing soft references...");
-    preserveSoftReferences(&gDvm.gcHeap->softReferences);
-    clearWhiteReferences(&gDvm.gcHeap->softReferences);
-
-    LOG_REF("Processing weak references...");
-    clearWhiteReferences(&gDvm.gcHeap->weakReferences);
-
-    LOG_REF("Finding finalizations...");
-    processFinalizableReferences();
+void dvmHeapReScanMarkedObjects()
+{
+    scavengeBlockQueue();
+}
 
-    LOG_REF("Processing f-reachable soft references...");
-    clearWhiteReferences(&gDvm.gcHeap->softReferences);
+/*
+ * Clears the referent field.
+ */
+static void clearReference(Object *reference)
+{
+    size_t offset = gDvm.offJavaLangRefReference_referent;
+    dvmSetFieldObject(reference, offset, NULL);
+}
 
-    LOG_REF("Processing f-reachable weak references...");
-    clearWhiteReferences(&gDvm.gcHeap->weakReferences);
+/*
+ * Returns true if the reference was registered with a reference queue
+ * and has not yet been enqueued.
+ */
+static bool isEnqueuable(const Object *reference)
+{
+    assert(reference != NULL);
+    Object *queue = dvmGetFieldObject(reference,
+            gDvm.offJavaLangRefReference_queue);
+    Object *queueNext = dvmGetFieldObject(reference,
+            gDvm.offJavaLangRefReference_queueNext);
+    return queue != NULL && queueNext == NULL;
+}
 
-    LOG_REF("Processing phantom references...");
-    clearWhiteReferences(&gDvm.gcHeap->phantomReferences);
+/*
+ * Schedules a reference to be appended to its reference queue.
+ */
+static void enqueueReference(Object *ref)
+{
+    assert(ref != NULL);
+    assert(dvmGetFieldObject(ref, gDvm.offJavaLangRefReference_queue) != NULL);
+    assert(dvmGetFieldObject(ref, gDvm.offJavaLangRefReference_queueNext) == NULL);
+    enqueuePendingReference(ref, &gDvm.gcHeap->clearedReferences);
+}
 
+/*
+ * Walks the reference list copying any referents subject to the
+ * reference clearing policy.  References with a black referent are
+ * removed from the list.  References with white referents biased
+ * toward saving are blackened and also removed from the list.
+ */
+static void preserveSomeSoftReferences(Object **list)
+{
+    assert(list != NULL);
+    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    Object *clear = NULL;
+    size_t counter = 0;
+    while (*list != NULL) {
+        Object *ref = dequeuePendingReference(list);
+        JValue *field = dvmFieldPtr(ref, referentOffset);
+        if (field->l == NULL) {
+            /* Referent was cleared by the user during marking. */
+            continue;
+        }
+        bool black = isBlack(&field->l);
+        if (!black && ((++counter) & 1)) {
+            /* Referent is white and biased toward saving, gray it. */
+            scavengeReference(&field->l);
+            black = true;
+        }
+        if (!black) {
+            /* Referent is white, queue it for clearing. */
+            enqueuePendingReference(ref, &clear);
+        }
+    }
+    *list = clear;
     /*
-     * Verify the stack and heap.
+     * Restart the trace with the newly gray references added to the
+     * root set.
      */
-    dvmVerifyRoots();
-    verifyNewSpace();
-
-    //describeBlocks(gcHeap->heapSource);
-
-    clearFromSpace(gcHeap->heapSource);
-
-    {
-        size_t alloc, rem, total;
-
-        room(&alloc, &rem, &total);
-        LOG_SCAV("AFTER GC: %zu alloc, %zu free, %zu total.", alloc, rem, total);
-    }
+    scavengeBlockQueue();
 }
 
 /*
- * Interface compatibility routines.
+ * Unlink the reference list clearing references objects with white
+ * referents.  Cleared references registered to a reference queue are
+ * scheduled for appending by the heap worker thread.
  */
-
-void dvmClearWhiteRefs(Object **list)
+static void clearWhiteReferences(Object **list)
 {
-    /* do nothing */
+    assert(list != NULL);
+    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    while (*list != NULL) {
+        Object *ref = dequeuePendingReference(list);
+        JValue *field = dvmFieldPtr(ref, referentOffset);
+        if (field->l != NULL && !isBlack(&field->l)) {
+            /* Referent is white, clear it. */
+            clearReference(ref);
+            if (isEnqueuable(ref)) {
+                enqueueReference(ref);
+            }
+        }
+    }
     assert(*list == NULL);
 }
 
-void dvmHandleSoftRefs(Object **list)
+/*
+ * Enqueues finalizer references with white referents.  White
+ * referents are copied, moved to the zombie field, and the referent
+ * field is cleared.
+ */
+static void enqueueFinalizerReferences(Object **list)
 {
-    /* do nothing */
+    assert(list != NULL);
+    size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    size_t zombieOffset = gDvm.offJavaLangRefFinalizerReference_zombie;
+    bool hasEnqueued = false;
+    while (*list != NULL) {
+        Object *ref = dequeuePendingReference(list);
+        JValue *field = dvmFieldPtr(ref, referentOffset);
+        if (field->l != NULL && !isBlack(&field->l)) {
+            scavengeReference(&field->l);
+            /* If the referent is non-null the reference must queuable. */
+            assert(isEnqueuable(ref));
+            dvmSetFieldObject(ref, zombieOffset, field->l);
+            clearReference(ref);
+            enqueueReference(ref);
+            hasEnqueued = true;
+        }
+    }
+    if (hasEnqueued) {
+        scavengeBlockQueue();
+    }
     assert(*list == NULL);
 }
 
-bool dvmHeapBeginMarkStep(GcMode mode)
-{
-    /* do nothing */
-    return true;
-}
-
-void dvmHeapFinishMarkStep()
+/*
+ * This object is an instance of a class that overrides finalize().  Mark
+ * it as finalizable.
+ *
+ * This is called when Object.<init> completes normally.  It's also
+ * called for clones of finalizable objects.
+ */
+void dvmSetFinalizable(Object *obj)
 {
-    /* do nothing */
+    assert(obj != NULL);
+    Thread *self = dvmThreadSelf();
+    assert(self != NULL);
+    Method *meth = gDvm.methJavaLangRefFinalizerReferenceAdd;
+    assert(meth != NULL);
+    JValue unusedResult;
+    dvmCallMethod(self, meth, NULL, &unusedResult, obj);
 }
 
-void dvmHeapMarkRootSet()
-{
-    /* do nothing */
+/*
+ * Process reference class instances and schedule finalizations.
+ */
+void dvmHeapProcessReferences(Object **softReferences, bool clearSoftRefs,
+                              Object **weakReferences,
+                              Object **finalizerReferences,
+                              Object **phantomReferences)
+{
+    assert(softReferences != NULL);
+    assert(weakReferences != NULL);
+    assert(finalizerReferences != NULL);
+    assert(phantomReferences != NULL);
+    /*
+     * Unless we are in the zygote or required to clear soft
+     * references with white references, preserve some white
+     * referents.
+     */
+    if (!gDvm.zygote && !clearSoftRefs) {
+        preserveSomeSoftReferences(softReferences);
+    }
+    /*
+     * Clear all remaining soft and weak references with white
+     * referents.
+     */
+    clearWhiteReferences(softReferences);
+    clearWhiteReferences(weakReferences);
+    /*
+     * Preserve all white objects with finalize methods and schedule
+     * them for finalization.
+     */
+    enqueueFinalizerReferences(finalizerReferences);
+    /*
+     * Clear all f-reachable soft and weak references with white
+     * referents.
+     */
+    clearWhiteReferences(softReferences);
+    clearWhiteReferences(weakReferences);
+    /*
+     * Clear all phantom references with white referents.
+     */
+    clearWhiteReferences(phantomReferences);
+    /*
+     * At this point all reference lists should be empty.
+     */
+    assert(*softReferences == NULL);
+    assert(*weakReferences == NULL);
+    assert(*finalizerReferences == NULL);
+    assert(*phantomReferences == NULL);
 }
 
-void dvmHeapScanMarkedObjects()
+/*
+ * Pushes a list of cleared references out to the managed heap.
+ */
+void dvmEnqueueClearedReferences(Object **cleared)
 {
-    dvmScavengeRoots();
+    assert(cleared != NULL);
+    if (*cleared != NULL) {
+        Thread *self = dvmThreadSelf();
+        assert(self != NULL);
+        Method *meth = gDvm.methJavaLangRefReferenceQueueAdd;
+        assert(meth != NULL);
+        JValue unused;
+        Object *reference = *cleared;
+        dvmCallMethod(self, meth, NULL, &unused, reference);
+        *cleared = NULL;
+    }
 }
 
-void dvmHeapScheduleFinalizations()
+static void sweepWeakJniGlobals()
 {
-    /* do nothing */
+    IndirectRefTable* table = &gDvm.jniWeakGlobalRefTable;
+    typedef IndirectRefTable::iterator It; // TODO: C++0x auto
+    for (It it = table->begin(), end = table->end(); it != end; ++it) {
+        Object** entry = *it;
+        Object* obj = forwardObject(*entry);
+        *entry = obj != NULL ? obj : kClearedJniWeakGlobal;
+    }
 }
 
-void dvmHeapSweepUnmarkedObjects(GcMode mode, int *numFreed, size_t *sizeFreed)
+/*
+ * Process all the internal system structures that behave like
+ * weakly-held objects.  Survivors are snapped to their copies.
+ */
+void dvmHeapSweepSystemWeaks()
 {
-    *numFreed = 0;
-    *sizeFreed = 0;
-    /* do nothing */
+    dvmGcUpdateInternedStrings(forwardObject);
+    dvmUpdateMonitorList(&gDvm.monitorList, forwardObject);
+    sweepWeakJniGlobals();
+    dvmUpdateJniUtfCache(forwardObject);
 }
 
-void dvmMarkDirtyObjects()
+/*
+ * Nothing is left to sweep by now; dvmHeapSourceSwapBitmaps() has
+ * already released from-space.  Reports what the collection freed.
+ */
+void dvmHeapSweepUnmarkedObjects(bool isPartial, bool isConcurrent,
+                                 size_t *numObjects, size_t *numBytes)
 {
-    assert(!"implemented");
+    HeapSource *heapSource = gHs;
+    *numObjects = 0;
+    *numBytes = 0;
+    if (heapSource->objectsBeforeFlip > heapSource->objectsAllocated) {
+        *numObjects = heapSource->objectsBeforeFlip -
+                      heapSource->objectsAllocated;
+    }
+    if (heapSource->bytesBeforeFlip > heapSource->bytesAllocated) {
+        *numBytes = heapSource->bytesBeforeFlip - heapSource->bytesAllocated;
+    }
 }
 
-void dvmHeapSourceThreadShutdown()
+void dvmHeapFinishMarkStep()
 {
-    /* do nothing */
+    HeapSource *heapSource = gHs;
+    assert(heapSource->queueHead == QUEUE_TAIL);
+    heapSource->collecting = false;
+    LOGV_HEAP("After GC: %zu of %zu blocks allocated",
+              heapSource->allocBlocks, heapSource->totalBlocks);
 }
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "alloc/GcWorkers.h"
+#include "alloc/HeapInternal.h"
+
+/*
+ * The helper threads are plain pthreads rather than VM threads.  They
+ * only ever touch heap memory while the collector is running, never
+ * call into the interpreter and so never need to be suspended.
+ */
+struct GcWorkers {
+    /* Helper threads; there are count - 1 of them. */
+    pthread_t *threads;
+
+    /* Number of participants in a task, including the caller. */
+    size_t count;
+
+    /* Guards every field below. */
+    pthread_mutex_t lock;
+
+    /* Signaled when a new task is published or on shutdown. */
+    pthread_cond_t startCond;
+
+    /* Signaled when the last helper finishes its share of a task. */
+    pthread_cond_t doneCond;
+
+    /* Incremented for every published task. */
+    u4 generation;
+
+    /* Number of helpers that have yet to finish the current task. */
+    size_t pending;
+
+    bool shutdown;
+
+    GcWorkerTask *task;
+    void *arg;
+};
+
+static GcWorkers gWorkers = { NULL, 1 };
+
+static void *gcWorkerThreadStart(void *arg)
+{
+    GcWorkers *w = &gWorkers;
+    size_t index = (size_t)arg;
+    u4 seen = 0;
+
+    dvmLockMutex(&w->lock);
+    for (;;) {
+        while (!w->shutdown && w->generation == seen) {
+            dvmWaitCond(&w->startCond, &w->lock);
+        }
+        if (w->shutdown) {
+            break;
+        }
+        seen = w->generation;
+        GcWorkerTask *task = w->task;
+        void *taskArg = w->arg;
+        dvmUnlockMutex(&w->lock);
+
+        (*task)(index, w->count, taskArg);
+
+        dvmLockMutex(&w->lock);
+        assert(w->pending > 0);
+        if (--w->pending == 0) {
+            dvmSignalCond(&w->doneCond);
+        }
+    }
+    dvmUnlockMutex(&w->lock);
+    return NULL;
+}
+
+bool dvmGcWorkersStartup(size_t numThreads)
+{
+    GcWorkers *w = &gWorkers;
+
+    assert(w->threads == NULL);
+    if (numThreads <= 1) {
+        w->count = 1;
+        return true;
+    }
+    if (numThreads > GC_WORKERS_MAX) {
+        numThreads = GC_WORKERS_MAX;
+    }
+    dvmInitMutex(&w->lock);
+    pthread_cond_init(&w->startCond, NULL);
+    pthread_cond_init(&w->doneCond, NULL);
+    w->generation = 0;
+    w->pending = 0;
+    w->shutdown = false;
+    w->threads = (pthread_t *)calloc(numThreads - 1, sizeof(pthread_t));
+    if (w->threads == NULL) {
+        LOGE_HEAP("Can't allocate GC worker table");
+        return false;
+    }
+    w->count = numThreads;
+    for (size_t i = 1; i < numThreads; ++i) {
+        if (pthread_create(&w->threads[i - 1], NULL, gcWorkerThreadStart,
+                           (void *)i) != 0) {
+            LOGE_HEAP("Can't create GC worker thread %zd", i);
+            /* Keep the threads that did start. */
+            w->count = i;
+            break;
+        }
+    }
+    LOGD_HEAP("Started %zd GC worker threads", w->count - 1);
+    return true;
+}
+
+void dvmGcWorkersShutdown()
+{
+    GcWorkers *w = &gWorkers;
+
+    if (w->threads == NULL) {
+        return;
+    }
+    dvmLockMutex(&w->lock);
+    w->shutdown = true;
+    dvmBroadcastCond(&w->startCond);
+    dvmUnlockMutex(&w->lock);
+    for (size_t i = 1; i < w->count; ++i) {
+        pthread_join(w->threads[i - 1], NULL);
+    }
+    free(w->threads);
+    w->threads = NULL;
+    w->count = 1;
+}
+
+size_t dvmGcWorkersCount()
+{
+    return gWorkers.count;
+}
+
+void dvmGcWorkersRun(GcWorkerTask *task, void *arg)
+{
+    GcWorkers *w = &gWorkers;
+
+    assert(task != NULL);
+    if (w->count <= 1) {
+        (*task)(0, 1, arg);
+        return;
+    }
+    dvmLockMutex(&w->lock);
+    assert(w->pending == 0);
+    w->task = task;
+    w->arg = arg;
+    w->pending = w->count - 1;
+    w->generation++;
+    dvmBroadcastCond(&w->startCond);
+    dvmUnlockMutex(&w->lock);
+
+    (*task)(0, w->count, arg);
+
+    dvmLockMutex(&w->lock);
+    while (w->pending > 0) {
+        dvmWaitCond(&w->doneCond, &w->lock);
+    }
+    dvmUnlockMutex(&w->lock);
+}
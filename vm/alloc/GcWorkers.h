@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A small pool of native threads used to run the parallel phases of
+ * the garbage collector.  The pool is sized by -Xgc:parallelthreads
+ * and is only started after the zygote has forked.
+ */
+
+#ifndef DALVIK_ALLOC_GC_WORKERS_H_
+#define DALVIK_ALLOC_GC_WORKERS_H_
+
+/* Upper bound on the number of threads participating in a GC task. */
+#define GC_WORKERS_MAX 32
+
+/*
+ * A task run by every participating GC thread.  The index is in the
+ * range [0, count).  Index 0 is always the thread that called
+ * dvmGcWorkersRun().
+ */
+typedef void GcWorkerTask(size_t index, size_t count, void *arg);
+
+/*
+ * Starts numThreads - 1 helper threads.  The calling thread of
+ * dvmGcWorkersRun() is always the first participant, so a count of 1
+ * starts no threads and runs every task serially.
+ */
+bool dvmGcWorkersStartup(size_t numThreads);
+
+/*
+ * Stops and joins the helper threads.
+ */
+void dvmGcWorkersShutdown(void);
+
+/*
+ * Returns the number of threads that will participate in a task.
+ * This is 1 until the pool has been started.
+ */
+size_t dvmGcWorkersCount(void);
+
+/*
+ * Runs the task on every participating thread and returns when all of
+ * them have finished.  Tasks must not call dvmGcWorkersRun() themselves.
+ */
+void dvmGcWorkersRun(GcWorkerTask *task, void *arg);
+
+#endif  // DALVIK_ALLOC_GC_WORKERS_H_
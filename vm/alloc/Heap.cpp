@@ -22,6 +22,7 @@
 #include "alloc/Heap.h"
 #include "alloc/HeapInternal.h"
 #include "alloc/DdmHeap.h"
+#include "alloc/GcWorkers.h"
 #include "alloc/HeapSource.h"
 #include "alloc/MarkSweep.h"
 #include "os/os.h"
@@ -35,6 +36,7 @@ static const GcSpec kGcForMallocSpec = {
     true,  /* isPartial */
     false,  /* isConcurrent */
     true,  /* doPreserve */
+    false,  /* isYoung */
     "GC_FOR_ALLOC"
 };
 
@@ -44,6 +46,7 @@ static const GcSpec kGcConcurrentSpec  = {
     true,  /* isPartial */
     true,  /* isConcurrent */
     true,  /* doPreserve */
+    false,  /* isYoung */
     "GC_CONCURRENT"
 };
 
@@ -53,6 +56,7 @@ static const GcSpec kGcExplicitSpec = {
     false,  /* isPartial */
     true,  /* isConcurrent */
     true,  /* doPreserve */
+    false,  /* isYoung */
     "GC_EXPLICIT"
 };
 
@@ -62,11 +66,32 @@ static const GcSpec kGcBeforeOomSpec = {
     false,  /* isPartial */
     false,  /* isConcurrent */
     false,  /* doPreserve */
+    false,  /* isYoung */
     "GC_BEFORE_OOM"
 };
 
 const GcSpec *GC_BEFORE_OOM = &kGcBeforeOomSpec;
 
+static const GcSpec kGcYoungSpec = {
+    true,  /* isPartial */
+    true,  /* isConcurrent */
+    true,  /* doPreserve */
+    true,  /* isYoung */
+    "GC_YOUNG"
+};
+
+const GcSpec *GC_YOUNG = &kGcYoungSpec;
+
+static const GcSpec kGcYoungForMallocSpec = {
+    true,  /* isPartial */
+    false,  /* isConcurrent */
+    true,  /* doPreserve */
+    true,  /* isYoung */
+    "GC_YOUNG_FOR_ALLOC"
+};
+
+const GcSpec *GC_YOUNG_FOR_MALLOC = &kGcYoungForMallocSpec;
+
 /*
  * Initialize the GC heap.
  *
@@ -91,6 +116,7 @@ bool dvmHeapStartup()
     gcHeap->ddmHpsgWhat = 0;
     gcHeap->ddmNhsgWhen = 0;
     gcHeap->ddmNhsgWhat = 0;
+    dvmInitMutex(&gcHeap->parallelMark.lock);
     gDvm.gcHeap = gcHeap;
 
     /* Set up the lists we'll use for cleared reference objects.
@@ -107,6 +133,13 @@ bool dvmHeapStartup()
 
 bool dvmHeapStartupAfterZygote()
 {
+    /*
+     * The zygote must not have any threads running when it forks, so
+     * the GC worker threads are only started afterwards.
+     */
+    if (!dvmGcWorkersStartup(gDvm.gcParallelThreads)) {
+        return false;
+    }
     return dvmHeapSourceStartupAfterZygote();
 }
 
@@ -129,6 +162,7 @@ void dvmHeapShutdown()
 void dvmHeapThreadShutdown()
 {
     dvmHeapSourceThreadShutdown();
+    dvmGcWorkersShutdown();
 }
 
 /*
@@ -173,6 +207,25 @@ static void gcForMalloc(bool clearSoftReferences)
     dvmCollectGarbageInternal(spec);
 }
 
+/* Collects the young generation in the foreground.  Returns false if
+ * no young collection could be run.
+ */
+static bool gcYoungForMalloc()
+{
+    if (!gDvm.generationalGc || !gDvm.gcHeap->survivorsMarked) {
+        return false;
+    }
+    if (gDvm.allocProf.enabled) {
+        Thread* self = dvmThreadSelf();
+        gDvm.allocProf.gcCount++;
+        if (self != NULL) {
+            self->allocProf.gcCount++;
+        }
+    }
+    dvmCollectGarbageInternal(GC_YOUNG_FOR_MALLOC);
+    return true;
+}
+
 /* Try as hard as possible to allocate some memory.
  */
 static void *tryMalloc(size_t size)
@@ -207,7 +260,15 @@ static void *tryMalloc(size_t size)
     } else {
       /*
        * Try a foreground GC since a concurrent GC is not currently running.
+       * Most short-lived garbage is young, so try collecting only the
+       * young generation first.
        */
+      if (gcYoungForMalloc()) {
+          ptr = dvmHeapSourceAlloc(size);
+          if (ptr != NULL) {
+              return ptr;
+          }
+      }
       gcForMalloc(false);
     }
 
@@ -332,13 +393,34 @@ static void throwOOME()
  */
 void* dvmMalloc(size_t size, int flags)
 {
-    void *ptr;
+    void *ptr = NULL;
+
+    /* Small requests are served from the thread's allocation buffer
+     * when possible, without taking the heap lock.  Allocation
+     * profiling needs to see every request, so it disables the buffers.
+     */
+    Thread* self = dvmThreadSelf();
+    bool useTlab = gDvm.useTlabs && !gDvm.allocProf.enabled &&
+            self != NULL && self->status == THREAD_RUNNING &&
+            size - 1 < HEAP_TLAB_MAX_SIZE;
+    if (useTlab) {
+        ptr = dvmHeapSourceAllocFromTlab(self, size);
+        if (ptr != NULL) {
+            goto done;
+        }
+    }
 
     dvmLockHeap();
 
+    if (useTlab) {
+        ptr = dvmHeapSourceRefillTlab(self, size);
+    }
+
     /* Try as hard as possible to allocate some memory.
      */
-    ptr = tryMalloc(size);
+    if (ptr == NULL) {
+        ptr = tryMalloc(size);
+    }
     if (ptr != NULL) {
         /* We've got the memory.
          */
@@ -368,6 +450,7 @@ void* dvmMalloc(size_t size, int flags)
 
     dvmUnlockHeap();
 
+done:
     if (ptr != NULL) {
         /*
          * If caller hasn't asked us not to track it, add it to the
@@ -456,6 +539,23 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
         return;
     }
 
+    if (spec->isYoung && !gcHeap->survivorsMarked) {
+        /* Nothing is known to be old yet; collect everything. */
+        spec = spec->isConcurrent ? GC_CONCURRENT : GC_FOR_MALLOC;
+    }
+
+#ifdef WITH_COPYING_GC
+    /* Objects move while they are traced, so the mutators must stay
+     * suspended for the whole collection.
+     */
+    GcSpec stopTheWorld;
+    if (spec->isConcurrent) {
+        stopTheWorld = *spec;
+        stopTheWorld.isConcurrent = false;
+        spec = &stopTheWorld;
+    }
+#endif
+
     gcHeap->gcRunning = true;
 
     rootStart = dvmGetRelativeTimeMsec();
@@ -468,6 +568,11 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
     if (!spec->isConcurrent) {
         oldThreadPriority = os_raiseThreadPriority();
     }
+    /*
+     * Return the unused chunks of every thread's allocation buffer so
+     * that they can be coalesced with whatever this collection frees.
+     */
+    dvmHeapSourceReleaseAllTlabs();
     if (gDvm.preVerify) {
         LOGV_HEAP("Verifying roots and heap before GC");
         verifyRootsAndHeap();
@@ -477,7 +582,7 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
 
     /* Set up the marking context.
      */
-    if (!dvmHeapBeginMarkStep(spec->isPartial)) {
+    if (!dvmHeapBeginMarkStep(spec->isPartial, spec->isYoung)) {
         LOGE_HEAP("dvmHeapBeginMarkStep failed; aborting");
         dvmAbort();
     }
@@ -487,6 +592,14 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
     LOGD_HEAP("Marking...");
     dvmHeapMarkRootSet();
 
+    if (gDvm.generationalGc && !spec->isConcurrent) {
+        /*
+         * The next young collection needs the cards dirtied from here
+         * on.  A concurrent collection clears them below.
+         */
+        dvmClearCardTable();
+    }
+
     /* dvmHeapScanMarkedObjects() will build the lists of known
      * instances of the Reference classes.
      */
@@ -599,8 +712,14 @@ void dvmCollectGarbageInternal(const GcSpec* spec)
      *
      * This doesn't actually resize any memory;
      * it just lets the heap grow more when necessary.
+     *
+     * A young collection leaves old garbage behind, so it says
+     * nothing about utilization.
      */
-    dvmHeapSourceGrowForUtilization();
+    if (!spec->isYoung) {
+        dvmHeapSourceGrowForUtilization();
+    }
+    dvmHeapSourceResetYoungStart();
 
     currAllocated = dvmHeapSourceGetValue(HS_BYTES_ALLOCATED, NULL, 0);
     currFootprint = dvmHeapSourceGetValue(HS_FOOTPRINT, NULL, 0);
@@ -26,6 +26,8 @@ struct GcSpec {
   bool isConcurrent;
   /* Toggles for the soft reference clearing policy. */
   bool doPreserve;
+  /* If true, only objects allocated since the last GC are threatened. */
+  bool isYoung;
   /* A name for this garbage collection mode. */
   const char *reason;
 };
@@ -42,6 +44,14 @@ extern const GcSpec *GC_EXPLICIT;
 /* Final attempt to reclaim memory before throwing an OOM. */
 extern const GcSpec *GC_BEFORE_OOM;
 
+/* Concurrent collection of the young generation, triggered by
+ * allocating -XX:YoungGenSize bytes since the last GC.
+ */
+extern const GcSpec *GC_YOUNG;
+
+/* Collection of the young generation before a GC_FOR_MALLOC. */
+extern const GcSpec *GC_YOUNG_FOR_MALLOC;
+
 /*
  * Initialize the GC heap.
  *
@@ -90,6 +90,39 @@ bool dvmHeapBitmapCoversAddress(const HeapBitmap *hb, const void *obj)
     return false;
 }
 
+/*
+ * Searches backwards from <addr> for the nearest set bit.  Used to
+ * find the object that a card begins in the middle of.
+ */
+Object *dvmHeapBitmapFindPrevObject(const HeapBitmap *hb, const void *addr)
+{
+    assert(hb != NULL);
+    assert(hb->bits != NULL);
+    if ((uintptr_t)addr <= hb->base || hb->max < hb->base) {
+        return NULL;
+    }
+    uintptr_t offset = (uintptr_t)addr - hb->base;
+    if ((uintptr_t)addr > hb->max) {
+        offset = hb->max - hb->base + HB_OBJECT_ALIGNMENT;
+    }
+    uintptr_t i = HB_OFFSET_TO_INDEX(offset);
+    const unsigned long mask = HB_OFFSET_TO_MASK(offset);
+    /* Keep the bits of lower addresses; those are the higher bits. */
+    unsigned long word = (i < hb->bitsLen / sizeof(*hb->bits)) ?
+                         hb->bits[i] & ~(mask | (mask - 1)) : 0;
+    for (;;) {
+        if (word != 0) {
+            const int shift = HB_BITS_PER_WORD - 1 - __builtin_ctzl(word);
+            uintptr_t ptrBase = HB_INDEX_TO_OFFSET(i) + hb->base;
+            return (Object *)(ptrBase + shift * HB_OBJECT_ALIGNMENT);
+        }
+        if (i == 0) {
+            return NULL;
+        }
+        word = hb->bits[--i];
+    }
+}
+
 /*
  * Visits set bits in address order.  The callback is not permitted to
  * change the bitmap bits or max during the traversal.
@@ -157,10 +190,12 @@ void dvmHeapBitmapScanWalk(HeapBitmap *bitmap,
  * Walk through the bitmaps in increasing address order, and find the
  * object pointers that correspond to garbage objects.  Call
  * <callback> zero or more times with lists of these object pointers.
+ * The garbage bits are cleared from <liveHb> as they are found, so that
+ * over the swept range it is left holding the survivors.
  *
  * The callback is not permitted to increase the max of either bitmap.
  */
-void dvmHeapBitmapSweepWalk(const HeapBitmap *liveHb, const HeapBitmap *markHb,
+void dvmHeapBitmapSweepWalk(HeapBitmap *liveHb, const HeapBitmap *markHb,
                             uintptr_t base, uintptr_t max,
                             BitmapSweepCallback *callback, void *callbackArg)
 {
@@ -188,6 +223,7 @@ void dvmHeapBitmapSweepWalk(const HeapBitmap *liveHb, const HeapBitmap *markHb,
     for (size_t i = start; i <= end; i++) {
         unsigned long garbage = live[i] & ~mark[i];
         if (UNLIKELY(garbage != 0)) {
+            live[i] &= ~garbage;
             unsigned long highBit = 1 << (HB_BITS_PER_WORD - 1);
             uintptr_t ptrBase = HB_INDEX_TO_OFFSET(i) + liveHb->base;
             while (garbage != 0) {
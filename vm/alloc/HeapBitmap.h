@@ -102,6 +102,12 @@ void dvmHeapBitmapZero(HeapBitmap *hb);
  */
 bool dvmHeapBitmapCoversAddress(const HeapBitmap *hb, const void *obj);
 
+/*
+ * Returns the highest set address in the bitmap that is below <addr>,
+ * or NULL if there is none.
+ */
+Object *dvmHeapBitmapFindPrevObject(const HeapBitmap *hb, const void *addr);
+
 /*
  * Applies the callback function to each set address in the bitmap.
  */
@@ -119,10 +125,12 @@ void dvmHeapBitmapScanWalk(HeapBitmap *bitmap,
  * Walk through the bitmaps in increasing address order, and find the
  * object pointers that correspond to garbage objects.  Call
  * <callback> zero or more times with lists of these object pointers.
+ * The garbage bits are cleared from <liveHb> as they are found, so that
+ * over the swept range it is left holding the survivors.
  *
  * The callback is not permitted to increase the max of either bitmap.
  */
-void dvmHeapBitmapSweepWalk(const HeapBitmap *liveHb, const HeapBitmap *markHb,
+void dvmHeapBitmapSweepWalk(HeapBitmap *liveHb, const HeapBitmap *markHb,
                             uintptr_t base, uintptr_t max,
                             BitmapSweepCallback *callback, void *callbackArg);
 
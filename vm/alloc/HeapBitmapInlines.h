@@ -18,8 +18,10 @@
 #define DALVIK_HEAP_BITMAPINLINES_H_
 
 static unsigned long dvmHeapBitmapSetAndReturnObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
+static unsigned long dvmHeapBitmapAtomicSetAndReturnObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
 static void dvmHeapBitmapSetObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
 static void dvmHeapBitmapClearObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
+static void dvmHeapBitmapAtomicClearObjectBit(HeapBitmap *hb, const void *obj) __attribute__((used));
 
 /*
  * Internal function; do not call directly.
@@ -66,6 +68,40 @@ static unsigned long dvmHeapBitmapSetAndReturnObjectBit(HeapBitmap *hb,
     return _heapBitmapModifyObjectBit(hb, obj, true, true);
 }
 
+/*
+ * Like dvmHeapBitmapSetAndReturnObjectBit, but may be called by
+ * several threads setting bits in the same bitmap at once.  Exactly
+ * one of the threads racing to set a clear bit sees a zero result.
+ */
+static unsigned long dvmHeapBitmapAtomicSetAndReturnObjectBit(HeapBitmap *hb,
+                                                              const void *obj)
+{
+    const uintptr_t offset = (uintptr_t)obj - hb->base;
+    const size_t index = HB_OFFSET_TO_INDEX(offset);
+    const unsigned long mask = HB_OFFSET_TO_MASK(offset);
+
+    assert(hb->bits != NULL);
+    assert((uintptr_t)obj >= hb->base);
+    assert(index < hb->bitsLen / sizeof(*hb->bits));
+    assert(sizeof(hb->bits[0]) == sizeof(int32_t));
+    for (;;) {
+        uintptr_t max = hb->max;
+        if ((uintptr_t)obj <= max) {
+            break;
+        }
+        if (android_atomic_release_cas((int32_t)max, (int32_t)obj,
+                                       (volatile int32_t *)&hb->max) == 0) {
+            break;
+        }
+    }
+    volatile int32_t *p = (volatile int32_t *)(hb->bits + index);
+    if ((*p & mask) != 0) {
+        /* Already set; avoid the atomic operation. */
+        return mask;
+    }
+    return android_atomic_or((int32_t)mask, p) & mask;
+}
+
 /*
  * Sets the bit corresponding to <obj>, and widens the range of seen
  * pointers if necessary.  Does no range checking.
@@ -83,6 +119,23 @@ static void dvmHeapBitmapClearObjectBit(HeapBitmap *hb, const void *obj)
     _heapBitmapModifyObjectBit(hb, obj, false, false);
 }
 
+/*
+ * Like dvmHeapBitmapClearObjectBit, but safe against other threads
+ * setting neighboring bits of the same word at the same time.
+ */
+static void dvmHeapBitmapAtomicClearObjectBit(HeapBitmap *hb, const void *obj)
+{
+    const uintptr_t offset = (uintptr_t)obj - hb->base;
+    const size_t index = HB_OFFSET_TO_INDEX(offset);
+    const unsigned long mask = HB_OFFSET_TO_MASK(offset);
+
+    assert(hb->bits != NULL);
+    assert((uintptr_t)obj >= hb->base);
+    assert(index < hb->bitsLen / sizeof(*hb->bits));
+    assert(sizeof(hb->bits[0]) == sizeof(int32_t));
+    android_atomic_and((int32_t)~mask, (volatile int32_t *)(hb->bits + index));
+}
+
 /*
  * Returns the current value of the bit corresponding to <obj>,
  * as zero or non-zero.  Does no range checking.
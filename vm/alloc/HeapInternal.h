@@ -45,6 +45,11 @@ struct GcHeap {
      */
     GcMarkContext markContext;
 
+    /* Parallel marking state.  Only used during a GC, and only when
+     * more than one GC worker thread has been configured.
+     */
+    GcParallelMark parallelMark;
+
     /* GC's card table */
     u1* cardTableBase;
     size_t cardTableLength;
@@ -55,6 +60,12 @@ struct GcHeap {
      */
     bool gcRunning;
 
+    /* True when, between collections, the mark bitmap holds the
+     * objects that survived the last GC.  A young collection treats
+     * them as already marked.
+     */
+    bool survivorsMarked;
+
     /*
      * Debug control values
      */
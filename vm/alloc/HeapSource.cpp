@@ -27,6 +27,7 @@
 #include "alloc/HeapSource.h"
 #include "alloc/HeapBitmap.h"
 #include "alloc/HeapBitmapInlines.h"
+#include "alloc/SlabAlloc.h"
 
 static void snapIdealFootprint();
 static void setIdealFootprint(size_t max);
@@ -80,6 +81,12 @@ struct Heap {
      */
     size_t concurrentStartBytes;
 
+    /* Number of bytes allocated from this mspace at which a young
+     * collection will be started.  Only used by the generational
+     * collector.
+     */
+    size_t youngStartBytes;
+
     /* Number of objects currently allocated from this mspace.
      */
     size_t objectsAllocated;
@@ -99,6 +106,11 @@ struct Heap {
      * allocations requested via dvmHeapSourceMorecore.
      */
     char *brk;
+
+    /*
+     * Runs of small objects, when the slab allocator is enabled.
+     */
+    SlabSpace slabs;
 };
 
 struct HeapSource {
@@ -167,6 +179,12 @@ struct HeapSource {
      */
     HeapBitmap markBits;
 
+    /*
+     * Which pages of the reservation hold slab runs.  Left empty
+     * unless the slab allocator is enabled.
+     */
+    SlabRunMap slabMap;
+
     /*
      * State for the GC daemon.
      */
@@ -256,30 +274,46 @@ static Heap *ptr2heap(const HeapSource *hs, const void *ptr)
  *
  * These aren't exact, and should not be treated as such.
  */
+static size_t chunkFootprint(const HeapSource *hs, const void *ptr)
+{
+    /* Slab slots have no per-object header. */
+    size_t slotSize = dvmSlabChunkSize(&hs->slabMap, ptr);
+    if (slotSize != 0) {
+        return slotSize;
+    }
+    return mspace_usable_size(ptr) + HEAP_SOURCE_CHUNK_OVERHEAD;
+}
+
 static void countAllocation(Heap *heap, const void *ptr)
 {
     assert(heap->bytesAllocated < mspace_footprint(heap->msp));
 
-    heap->bytesAllocated += mspace_usable_size(ptr) +
-            HEAP_SOURCE_CHUNK_OVERHEAD;
-    heap->objectsAllocated++;
     HeapSource* hs = gDvm.gcHeap->heapSource;
-    dvmHeapBitmapSetObjectBit(&hs->liveBits, ptr);
+    heap->bytesAllocated += chunkFootprint(hs, ptr);
+    heap->objectsAllocated++;
+    /* Threads set live bits from their allocation buffers without
+     * holding the heap lock.
+     */
+    dvmHeapBitmapAtomicSetAndReturnObjectBit(&hs->liveBits, ptr);
 
     assert(heap->bytesAllocated < mspace_footprint(heap->msp));
 }
 
 static void countFree(Heap *heap, const void *ptr, size_t *numBytes)
 {
-    size_t delta = mspace_usable_size(ptr) + HEAP_SOURCE_CHUNK_OVERHEAD;
+    HeapSource* hs = gDvm.gcHeap->heapSource;
+    size_t delta = chunkFootprint(hs, ptr);
     assert(delta > 0);
     if (delta < heap->bytesAllocated) {
         heap->bytesAllocated -= delta;
     } else {
         heap->bytesAllocated = 0;
     }
-    HeapSource* hs = gDvm.gcHeap->heapSource;
-    dvmHeapBitmapClearObjectBit(&hs->liveBits, ptr);
+    dvmHeapBitmapAtomicClearObjectBit(&hs->liveBits, ptr);
+    if (gDvm.gcHeap->survivorsMarked) {
+        /* Don't let a later object at this address pass for a survivor. */
+        dvmHeapBitmapAtomicClearObjectBit(&hs->markBits, ptr);
+    }
     if (heap->objectsAllocated > 0) {
         heap->objectsAllocated--;
     }
@@ -360,9 +394,11 @@ static bool addInitialHeap(HeapSource *hs, mspace msp, size_t maximumSize)
     hs->heaps[0].msp = msp;
     hs->heaps[0].maximumSize = maximumSize;
     hs->heaps[0].concurrentStartBytes = SIZE_MAX;
+    hs->heaps[0].youngStartBytes = SIZE_MAX;
     hs->heaps[0].base = hs->heapBase;
     hs->heaps[0].limit = hs->heapBase + maximumSize;
     hs->heaps[0].brk = hs->heapBase + kInitialMorecoreStart;
+    dvmSlabInitSpace(&hs->heaps[0].slabs, msp, &hs->slabMap);
     hs->numHeaps = 1;
     return true;
 }
@@ -402,6 +438,7 @@ static bool addNewHeap(HeapSource *hs)
     size_t morecoreStart = SYSTEM_PAGE_SIZE;
     heap.maximumSize = hs->growthLimit - overhead;
     heap.concurrentStartBytes = HEAP_MIN_FREE - CONCURRENT_START;
+    heap.youngStartBytes = SIZE_MAX;
     heap.base = base;
     heap.limit = heap.base + heap.maximumSize;
     heap.brk = heap.base + morecoreStart;
@@ -409,6 +446,7 @@ static bool addNewHeap(HeapSource *hs)
     if (heap.msp == NULL) {
         return false;
     }
+    dvmSlabInitSpace(&heap.slabs, heap.msp, &hs->slabMap);
 
     /* Don't let the soon-to-be-old heap grow any further.
      */
@@ -460,7 +498,15 @@ static void *gcDaemonThread(void* arg)
                 trimHeaps();
                 gHs->gcThreadTrimNeeded = false;
             } else {
-                dvmCollectGarbageInternal(GC_CONCURRENT);
+                /*
+                 * Collect only the young generation unless the heap
+                 * as a whole is close to its limit.
+                 */
+                Heap *heap = hs2heap(gHs);
+                bool young = gDvm.generationalGc &&
+                        gDvm.gcHeap->survivorsMarked &&
+                        heap->bytesAllocated <= heap->concurrentStartBytes;
+                dvmCollectGarbageInternal(young ? GC_YOUNG : GC_CONCURRENT);
                 gHs->gcThreadTrimNeeded = true;
             }
             dvmChangeStatus(NULL, THREAD_VMWAIT);
@@ -504,8 +550,10 @@ static bool allocMarkStack(GcMarkStack *stack, size_t maximumSize)
     void *addr;
 
     assert(stack != NULL);
+    /* Slab slots have no chunk header, so objects pack more densely. */
+    size_t overhead = gDvm.useSlabAllocator ? 0 : HEAP_SOURCE_CHUNK_OVERHEAD;
     stack->length = maximumSize * sizeof(Object*) /
-        (sizeof(Object) + HEAP_SOURCE_CHUNK_OVERHEAD);
+        (sizeof(Object) + overhead);
     addr = dvmAllocRegion(stack->length, PROT_READ | PROT_WRITE, name);
     if (addr == NULL) {
         return false;
@@ -588,6 +636,11 @@ GcHeap* dvmHeapSourceStartup(size_t startSize, size_t maximumSize,
     hs->hasGcThread = false;
     hs->heapBase = (char *)base;
     hs->heapLength = length;
+    if (gDvm.useSlabAllocator &&
+            !dvmSlabRunMapInit(&hs->slabMap, base, length)) {
+        LOGE_HEAP("Can't create slab run map");
+        goto fail;
+    }
     if (!addInitialHeap(hs, msp, growthLimit)) {
         LOGE_HEAP("Can't add initial heap");
         goto fail;
@@ -639,6 +692,12 @@ bool dvmHeapSourceStartupBeforeFork()
     assert(gDvm.zygote);
 
     if (!gDvm.newZygoteHeapAllocated) {
+        /* Give back the zygote's allocation buffers so that their
+         * chunks stay in the shared heap instead of being handed out
+         * after the fork.  The caller holds the heap lock, and the
+         * zygote is single-threaded here.
+         */
+        dvmHeapSourceReleaseAllTlabs();
        /* Ensure heaps are trimmed to minimize footprint pre-fork.
         */
         trimHeaps();
@@ -671,6 +730,7 @@ void dvmHeapSourceShutdown(GcHeap **gcHeap)
         HeapSource *hs = (*gcHeap)->heapSource;
         dvmHeapBitmapDelete(&hs->liveBits);
         dvmHeapBitmapDelete(&hs->markBits);
+        dvmSlabRunMapDelete(&hs->slabMap);
         freeMarkStack(&(*gcHeap)->markContext.stack);
         munmap(hs->heapBase, hs->heapLength);
         free(hs);
@@ -836,6 +896,30 @@ void dvmMarkImmuneObjects(const char *immuneLimit)
     }
 }
 
+/*
+ * Wakes up the concurrent collector if the active heap has crossed its
+ * allocation threshold, or allocated a full young generation since the
+ * last collection.
+ */
+static void checkConcurrentStart(HeapSource *hs, Heap *heap)
+{
+    if (gDvm.gcHeap->gcRunning || !hs->hasGcThread) {
+        /*
+         * The garbage collector thread is already running or has yet
+         * to be started.  Do nothing.
+         */
+        return;
+    }
+    if (heap->bytesAllocated > heap->concurrentStartBytes ||
+        (gDvm.generationalGc && heap->bytesAllocated > heap->youngStartBytes)) {
+        /*
+         * We have exceeded the allocation threshold.  Wake up the
+         * garbage collector.
+         */
+        dvmSignalCond(&hs->gcThreadCond);
+    }
+}
+
 /*
  * Allocates <n> bytes of zeroed data.
  */
@@ -854,31 +938,168 @@ void* dvmHeapSourceAlloc(size_t n)
                   FRACTIONAL_MB(hs->softLimit), n);
         return NULL;
     }
-    void* ptr = mspace_calloc(heap->msp, 1, n);
+    void* ptr;
+    if (gDvm.useSlabAllocator && n - 1 < SLAB_MAX_SIZE) {
+        ptr = dvmSlabAlloc(&heap->slabs, n);
+    } else {
+        ptr = mspace_calloc(heap->msp, 1, n);
+    }
     if (ptr == NULL) {
         return NULL;
     }
     countAllocation(heap, ptr);
-    /*
-     * Check to see if a concurrent GC should be initiated.
-     */
-    if (gDvm.gcHeap->gcRunning || !hs->hasGcThread) {
-        /*
-         * The garbage collector thread is already running or has yet
-         * to be started.  Do nothing.
-         */
-        return ptr;
+    checkConcurrentStart(hs, heap);
+    return ptr;
+}
+
+/*
+ * Thread-local allocation buffers.
+ *
+ * A refill takes a batch of same-sized, zeroed chunks from the active
+ * heap: slab slots when the slab allocator is enabled, and otherwise a
+ * contiguous run of dlmalloc chunks from mspace_independent_calloc().
+ * The chunks are counted as allocated when the batch is taken, but
+ * their live bits are only set as they are handed out, so a chunk still
+ * sitting in a buffer is invisible to the collector.  Buffered chunks
+ * are linked through their first word, which is cleared on the way out.
+ */
+
+/* Roughly how many bytes to take from the heap in one refill. */
+#define HEAP_TLAB_REFILL_BYTES 1024
+
+/* Bounds on the number of chunks taken in one refill. */
+#define HEAP_TLAB_MIN_CHUNKS 4
+#define HEAP_TLAB_MAX_CHUNKS 32
+
+static size_t tlabClassIndex(size_t n)
+{
+    assert(n > 0 && n <= HEAP_TLAB_MAX_SIZE);
+    return (n - 1) / HB_OBJECT_ALIGNMENT;
+}
+
+static void *tlabTake(HeapTlabClass *cls)
+{
+    void *ptr = cls->head;
+    if (ptr != NULL) {
+        cls->head = *(void **)ptr;
+        *(void **)ptr = NULL;
+        dvmHeapBitmapAtomicSetAndReturnObjectBit(&gHs->liveBits, ptr);
     }
-    if (heap->bytesAllocated > heap->concurrentStartBytes) {
-        /*
-         * We have exceeded the allocation threshold.  Wake up the
-         * garbage collector.
+    return ptr;
+}
+
+void *dvmHeapSourceAllocFromTlab(Thread *self, size_t n)
+{
+    HeapTlab *tlab = self->tlab;
+    if (tlab == NULL) {
+        return NULL;
+    }
+    return tlabTake(&tlab->classes[tlabClassIndex(n)]);
+}
+
+void *dvmHeapSourceRefillTlab(Thread *self, size_t n)
+{
+    HS_BOILERPLATE();
+
+    HeapSource *hs = gHs;
+    Heap *heap = hs2heap(hs);
+    HeapTlab *tlab = self->tlab;
+    if (tlab == NULL) {
+        tlab = (HeapTlab *)calloc(1, sizeof(*tlab));
+        if (tlab == NULL) {
+            return NULL;
+        }
+        self->tlab = tlab;
+    }
+    size_t index = tlabClassIndex(n);
+    HeapTlabClass *cls = &tlab->classes[index];
+    if (cls->head != NULL) {
+        /* Another path refilled this class since the caller looked. */
+        return tlabTake(cls);
+    }
+    size_t elemSize = (index + 1) * HB_OBJECT_ALIGNMENT;
+    size_t count = HEAP_TLAB_REFILL_BYTES / elemSize;
+    if (count < HEAP_TLAB_MIN_CHUNKS) {
+        count = HEAP_TLAB_MIN_CHUNKS;
+    } else if (count > HEAP_TLAB_MAX_CHUNKS) {
+        count = HEAP_TLAB_MAX_CHUNKS;
+    }
+    if (heap->bytesAllocated +
+            count * (elemSize + HEAP_SOURCE_CHUNK_OVERHEAD) > hs->softLimit) {
+        /* Leave the last few bytes under the soft limit to the regular
+         * allocation path, which knows how to collect and retry.
          */
-        dvmSignalCond(&gHs->gcThreadCond);
+        return NULL;
+    }
+    void *chunks[HEAP_TLAB_MAX_CHUNKS];
+    if (gDvm.useSlabAllocator && elemSize <= SLAB_MAX_SIZE) {
+        count = dvmSlabAllocBatch(&heap->slabs, elemSize, count, chunks);
+        if (count == 0) {
+            return NULL;
+        }
+    } else if (mspace_independent_calloc(heap->msp, count, elemSize,
+                                         chunks) == NULL) {
+        return NULL;
     }
+    for (size_t i = 0; i < count; ++i) {
+        heap->bytesAllocated += chunkFootprint(hs, chunks[i]);
+        heap->objectsAllocated++;
+        *(void **)chunks[i] = (i + 1 < count) ? chunks[i + 1] : NULL;
+    }
+    cls->head = chunks[0];
+    void *ptr = tlabTake(cls);
+    checkConcurrentStart(hs, heap);
     return ptr;
 }
 
+/*
+ * Frees the chunks remaining in a thread-local allocation buffer.  The
+ * chunks were never handed out, so their live bits are already clear.
+ */
+static void releaseTlab(HeapSource *hs, HeapTlab *tlab)
+{
+    for (size_t i = 0; i < HEAP_TLAB_NUM_CLASSES; ++i) {
+        HeapTlabClass *cls = &tlab->classes[i];
+        while (cls->head != NULL) {
+            void *ptr = cls->head;
+            cls->head = *(void **)ptr;
+            /* The chunk may predate the creation of the active heap. */
+            Heap *heap = ptr2heap(hs, ptr);
+            assert(heap != NULL);
+            size_t numBytes = 0;
+            countFree(heap, ptr, &numBytes);
+            if (dvmSlabChunkSize(&hs->slabMap, ptr) != 0) {
+                dvmSlabFree(&heap->slabs, ptr);
+            } else {
+                mspace_free(heap->msp, ptr);
+            }
+        }
+    }
+}
+
+void dvmHeapSourceReleaseTlab(Thread *thread)
+{
+    HS_BOILERPLATE();
+
+    if (thread->tlab != NULL) {
+        releaseTlab(gHs, thread->tlab);
+    }
+}
+
+void dvmHeapSourceReleaseAllTlabs()
+{
+    HS_BOILERPLATE();
+
+    dvmLockThreadList(dvmThreadSelf());
+    for (Thread *thread = gDvm.threadList; thread != NULL;
+         thread = thread->next) {
+        if (thread->tlab != NULL) {
+            releaseTlab(gHs, thread->tlab);
+        }
+    }
+    dvmUnlockThreadList();
+}
+
 /* Remove any hard limits, try to allocate, and shrink back down.
  * Last resort when trying to allocate an object.
  */
@@ -975,14 +1196,22 @@ size_t dvmHeapSourceFreeList(size_t numPtrs, void **ptrs)
         // mspace_free, but on the other heaps we only do some
         // accounting.
         if (heap == gHs->heaps) {
-            // Count freed objects.
+            // Count freed objects.  Slab slots go back to their runs
+            // right away; the rest are compacted to the front of the
+            // list, keeping their order, for the bulk free.
+            size_t numChunks = 0;
             for (size_t i = 0; i < numPtrs; i++) {
                 assert(ptrs[i] != NULL);
                 assert(ptr2heap(gHs, ptrs[i]) == heap);
                 countFree(heap, ptrs[i], &numBytes);
+                if (dvmSlabChunkSize(&gHs->slabMap, ptrs[i]) != 0) {
+                    dvmSlabFree(&heap->slabs, ptrs[i]);
+                } else {
+                    ptrs[numChunks++] = ptrs[i];
+                }
             }
             // Bulk free ptrs.
-            mspace_bulk_free(msp, ptrs, numPtrs);
+            mspace_bulk_free(msp, ptrs, numChunks);
         } else {
             // This is not an 'active heap'. Only do the accounting.
             for (size_t i = 0; i < numPtrs; i++) {
@@ -1049,7 +1278,8 @@ size_t dvmHeapSourceChunkSize(const void *ptr)
 
     Heap* heap = ptr2heap(gHs, ptr);
     if (heap != NULL) {
-        return mspace_usable_size(ptr);
+        size_t slotSize = dvmSlabChunkSize(&gHs->slabMap, ptr);
+        return slotSize != 0 ? slotSize : mspace_usable_size(ptr);
     }
     return 0;
 }
@@ -1305,6 +1535,23 @@ void dvmHeapSourceGrowForUtilization()
     }
 }
 
+/*
+ * Sets the point at which the next young collection is started,
+ * relative to what is allocated now.
+ */
+void dvmHeapSourceResetYoungStart()
+{
+    HS_BOILERPLATE();
+
+    Heap *heap = hs2heap(gHs);
+    if (gDvm.generationalGc &&
+        heap->bytesAllocated < SIZE_MAX - gDvm.youngGenSize) {
+        heap->youngStartBytes = heap->bytesAllocated + gDvm.youngGenSize;
+    } else {
+        heap->youngStartBytes = SIZE_MAX;
+    }
+}
+
 /*
  * Return free pages to the system.
  * TODO: move this somewhere else, especially the native heap part.
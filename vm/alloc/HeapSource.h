@@ -27,6 +27,34 @@
  */
 #define HEAP_SOURCE_MAX_HEAP_COUNT 2
 
+/* The largest request, in bytes, that is served from a thread-local
+ * allocation buffer.
+ */
+#define HEAP_TLAB_MAX_SIZE 128
+
+/* Thread-local allocation buffers have one size class per object
+ * alignment step.
+ */
+#define HEAP_TLAB_NUM_CLASSES (HEAP_TLAB_MAX_SIZE / HB_OBJECT_ALIGNMENT)
+
+/*
+ * The unused chunks of one size class, linked through their first word.
+ * Apart from that word, the chunks are zeroed.
+ */
+struct HeapTlabClass {
+    void *head;
+};
+
+/*
+ * A thread-local allocation buffer.  Small allocations are satisfied
+ * from the calling thread's buffer without taking the heap lock.  Every
+ * chunk is an ordinary heap chunk, so objects handed out from a buffer
+ * are swept and freed like any other.
+ */
+struct HeapTlab {
+    HeapTlabClass classes[HEAP_TLAB_NUM_CLASSES];
+};
+
 enum HeapSourceValueSpec {
     HS_FOOTPRINT,
     HS_ALLOWED_FOOTPRINT,
@@ -55,6 +83,7 @@ bool dvmHeapSourceStartupAfterZygote(void);
  * will create an additional zygote heap before the first fork().
  * Having a separate heap should reduce the number of shared
  * pages subsequently touched by the zygote process.
+ * Called with the heap lock held.
  */
 bool dvmHeapSourceStartupBeforeFork(void);
 
@@ -115,6 +144,36 @@ void *dvmHeapSourceAlloc(size_t n);
  */
 void *dvmHeapSourceAllocAndGrow(size_t n);
 
+/*
+ * Allocates <n> bytes of zeroed data from the thread-local allocation
+ * buffer of <self> without taking the heap lock.  <n> must be between 1
+ * and HEAP_TLAB_MAX_SIZE.  Returns NULL if the buffer has no chunk of
+ * the right size left.  The caller must be in THREAD_RUNNING.
+ */
+void *dvmHeapSourceAllocFromTlab(Thread *self, size_t n);
+
+/*
+ * Refills the thread-local allocation buffer of <self> for requests of
+ * <n> bytes and allocates the first chunk of the new run.  Returns NULL
+ * if the heap cannot supply a run without collecting garbage or growing.
+ * The caller must hold the heap lock.
+ */
+void *dvmHeapSourceRefillTlab(Thread *self, size_t n);
+
+/*
+ * Returns the unused chunks of a thread's allocation buffer to the
+ * heap.  The caller must hold the heap lock, and <thread> must be
+ * either the calling thread or suspended.
+ */
+void dvmHeapSourceReleaseTlab(Thread *thread);
+
+/*
+ * Returns the unused chunks of every thread's allocation buffer to the
+ * heap.  The caller must hold the heap lock and have suspended all
+ * other threads.
+ */
+void dvmHeapSourceReleaseAllTlabs(void);
+
 /*
  * Frees the first numPtrs objects in the ptrs list and returns the
  * amount of reclaimed storage.  The list must contain addresses all
@@ -158,6 +217,12 @@ size_t dvmHeapSourceGetIdealFootprint(void);
  */
 void dvmHeapSourceGrowForUtilization(void);
 
+/*
+ * Schedules the next young collection once another youngGenSize bytes
+ * have been allocated.  Called after every collection.
+ */
+void dvmHeapSourceResetYoungStart(void);
+
 /*
  * Walks over the heap source and passes every allocated and
  * free chunk to the callback.
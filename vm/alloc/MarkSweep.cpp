@@ -16,6 +16,7 @@
 
 #include "Dalvik.h"
 #include "alloc/CardTable.h"
+#include "alloc/GcWorkers.h"
 #include "alloc/HeapBitmap.h"
 #include "alloc/HeapBitmapInlines.h"
 #include "alloc/HeapInternal.h"
@@ -25,10 +26,41 @@
 #include <limits.h>     // for ULONG_MAX
 #include <sys/mman.h>   // for madvise(), mmap()
 #include <errno.h>
+#include <sched.h>      // for sched_yield()
 
 typedef unsigned long Word;
 const size_t kWordSize = sizeof(Word);
 
+/*
+ * Number of slots in the local mark stack of a parallel mark worker.
+ * Must be a power of two.
+ */
+#define GC_MARK_DEQUE_SIZE 4096
+
+/*
+ * Number of objects moved at once between a local mark stack and the
+ * shared mark stack.
+ */
+#define GC_MARK_BATCH_SIZE 64
+
+/*
+ * A parallel mark worker.  Each worker owns a bounded work-stealing
+ * deque: the owner pushes and pops at the bottom without locking while
+ * other workers steal from the top with a compare-and-swap.  A worker
+ * that overflows its deque spills into the shared mark stack.
+ */
+struct GcMarkWorker {
+    volatile int32_t top;
+    volatile int32_t bottom;
+    const Object **slots;
+
+    /* The mark context used by this worker while scanning. */
+    GcMarkContext ctx;
+
+    /* Number of objects scanned, for logging. */
+    size_t scanned;
+};
+
 /*
  * Returns true if the given object is marked.
  */
@@ -86,15 +118,180 @@ static const Object *markStackPop(GcMarkStack *stack)
     return *stack->top;
 }
 
-bool dvmHeapBeginMarkStep(bool isPartial)
+/*
+ * Allocates the per-thread state for a parallel mark if more than one
+ * GC worker thread is available.
+ */
+static bool createMarkWorkers(const GcMarkContext *ctx)
 {
-    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
+    GcParallelMark *pm = &gDvm.gcHeap->parallelMark;
+    size_t numWorkers = dvmGcWorkersCount();
+
+    assert(pm->workers == NULL);
+    pm->numWorkers = 0;
+    if (numWorkers <= 1) {
+        return true;
+    }
+    GcMarkWorker *workers =
+        (GcMarkWorker *)calloc(numWorkers, sizeof(GcMarkWorker));
+    if (workers == NULL) {
+        LOGE_HEAP("Can't allocate mark workers");
+        return false;
+    }
+    for (size_t i = 0; i < numWorkers; ++i) {
+        workers[i].slots =
+            (const Object **)malloc(GC_MARK_DEQUE_SIZE * sizeof(Object *));
+        if (workers[i].slots == NULL) {
+            LOGE_HEAP("Can't allocate mark worker stack");
+            while (i-- > 0) {
+                free(workers[i].slots);
+            }
+            free(workers);
+            return false;
+        }
+        workers[i].ctx.bitmap = ctx->bitmap;
+        workers[i].ctx.immuneLimit = ctx->immuneLimit;
+        workers[i].ctx.finger = (void *)ULONG_MAX;
+        workers[i].ctx.worker = &workers[i];
+    }
+    pm->workers = workers;
+    pm->numWorkers = numWorkers;
+    return true;
+}
+
+static void destroyMarkWorkers()
+{
+    GcParallelMark *pm = &gDvm.gcHeap->parallelMark;
+
+    if (pm->workers != NULL) {
+        for (size_t i = 0; i < pm->numWorkers; ++i) {
+            free(pm->workers[i].slots);
+        }
+        free(pm->workers);
+        pm->workers = NULL;
+    }
+    pm->numWorkers = 0;
+}
+
+/*
+ * Returns true if the mark phases should be run by the GC workers.
+ */
+static bool isParallelMark()
+{
+    return gDvm.gcHeap->parallelMark.numWorkers > 1;
+}
+
+/*
+ * Pushes an object on the bottom of the worker's own deque.  Only the
+ * owner may call this.  Returns false if the deque is full.
+ */
+static bool workerPush(GcMarkWorker *worker, const Object *obj)
+{
+    int32_t b = worker->bottom;
+    int32_t t = android_atomic_acquire_load(&worker->top);
+    if (b - t >= GC_MARK_DEQUE_SIZE) {
+        return false;
+    }
+    worker->slots[b & (GC_MARK_DEQUE_SIZE - 1)] = obj;
+    android_atomic_release_store(b + 1, &worker->bottom);
+    return true;
+}
+
+/*
+ * Pops an object from the bottom of the worker's own deque.  Only the
+ * owner may call this.  Returns NULL if the deque is empty.
+ */
+static const Object *workerPop(GcMarkWorker *worker)
+{
+    int32_t b = worker->bottom - 1;
+    worker->bottom = b;
+    ANDROID_MEMBAR_FULL();
+    int32_t t = worker->top;
+    if (t > b) {
+        /* Empty. */
+        worker->bottom = t;
+        return NULL;
+    }
+    const Object *obj = worker->slots[b & (GC_MARK_DEQUE_SIZE - 1)];
+    if (t == b) {
+        /* Last element; race against thieves for it. */
+        if (android_atomic_release_cas(t, t + 1, &worker->top) != 0) {
+            obj = NULL;
+        }
+        worker->bottom = t + 1;
+    }
+    return obj;
+}
+
+/*
+ * Steals an object from the top of another worker's deque.  Returns
+ * NULL if the deque is empty or another thread won the race.
+ */
+static const Object *workerSteal(GcMarkWorker *victim)
+{
+    int32_t t = android_atomic_acquire_load(&victim->top);
+    ANDROID_MEMBAR_FULL();
+    int32_t b = android_atomic_acquire_load(&victim->bottom);
+    if (t >= b) {
+        return NULL;
+    }
+    const Object *obj = victim->slots[t & (GC_MARK_DEQUE_SIZE - 1)];
+    if (android_atomic_release_cas(t, t + 1, &victim->top) != 0) {
+        return NULL;
+    }
+    return obj;
+}
+
+/*
+ * Pushes a newly marked object for a worker.  When the local deque is
+ * full, the object and a batch of the most recently pushed objects are
+ * moved to the shared mark stack.
+ */
+static void workerMarkStackPush(GcMarkWorker *worker, const Object *obj)
+{
+    if (workerPush(worker, obj)) {
+        return;
+    }
+    GcParallelMark *pm = &gDvm.gcHeap->parallelMark;
+    GcMarkStack *shared = &gDvm.gcHeap->markContext.stack;
+    dvmLockMutex(&pm->lock);
+    markStackPush(shared, obj);
+    for (size_t i = 1; i < GC_MARK_BATCH_SIZE; ++i) {
+        const Object *spill = workerPop(worker);
+        if (spill == NULL) {
+            break;
+        }
+        markStackPush(shared, spill);
+    }
+    dvmUnlockMutex(&pm->lock);
+}
+
+bool dvmHeapBeginMarkStep(bool isPartial, bool isYoung)
+{
+    GcHeap *gcHeap = gDvm.gcHeap;
+    GcMarkContext *ctx = &gcHeap->markContext;
 
+    assert(!isYoung || gcHeap->survivorsMarked);
     if (!createMarkStack(&ctx->stack)) {
         return false;
     }
+    if (gcHeap->survivorsMarked) {
+        /* The survivors of the last collection are only kept marked
+         * for a young collection.  Anything else starts from scratch.
+         */
+        if (!isYoung) {
+            dvmHeapSourceZeroMarkBitmap();
+        }
+        gcHeap->survivorsMarked = false;
+    }
     ctx->finger = NULL;
+    ctx->isYoung = isYoung;
     ctx->immuneLimit = (char*)dvmHeapSourceGetImmuneLimit(isPartial);
+    ctx->worker = NULL;
+    if (!createMarkWorkers(ctx)) {
+        destroyMarkStack(&ctx->stack);
+        return false;
+    }
     return true;
 }
 
@@ -113,6 +310,16 @@ static void markObjectNonNull(const Object *obj, GcMarkContext *ctx,
         assert(isMarked(obj, ctx));
         return;
     }
+    if (ctx->worker != NULL) {
+        /* Parallel mark; the finger of a worker is always at the end
+         * of the heap, so newly marked objects are always pushed.
+         */
+        if (!dvmHeapBitmapAtomicSetAndReturnObjectBit(ctx->bitmap, obj) &&
+            checkFinger) {
+            workerMarkStackPush(ctx->worker, obj);
+        }
+        return;
+    }
     if (!setAndReturnMarkBit(ctx, obj)) {
         /* This object was not previously marked.
          */
@@ -154,6 +361,85 @@ static void rootMarkObjectVisitor(void *addr, u4 thread, RootType type,
     }
 }
 
+struct RootScanArgs {
+    Thread **threads;
+    size_t numThreads;
+    volatile int32_t nextThread;
+};
+
+/*
+ * Marks roots on a GC worker.  Every worker claims threads from the
+ * thread list until none are left.
+ */
+static void parallelMarkRootsTask(size_t index, size_t count, void *arg)
+{
+    RootScanArgs *args = (RootScanArgs *)arg;
+    GcMarkContext *ctx = &gDvm.gcHeap->parallelMark.workers[index].ctx;
+    for (;;) {
+        size_t i = android_atomic_inc(&args->nextThread);
+        if (i >= args->numThreads) {
+            break;
+        }
+        dvmVisitThreadRoots(rootMarkObjectVisitor, args->threads[i], ctx);
+    }
+}
+
+/*
+ * Marks the root set with the GC workers, splitting the thread list
+ * among them.  The roots that are not owned by a thread are marked
+ * first, without the thread list lock, since visiting them takes the
+ * JNI and intern table locks.
+ */
+static void parallelMarkRootSet()
+{
+    RootScanArgs args;
+    size_t numThreads = 0;
+
+    dvmVisitGlobalRoots(rootMarkObjectVisitor, &gDvm.gcHeap->markContext);
+
+    dvmLockThreadList(dvmThreadSelf());
+    for (Thread *thread = gDvm.threadList; thread != NULL; thread = thread->next) {
+        ++numThreads;
+    }
+    args.threads = (Thread **)malloc(numThreads * sizeof(Thread *));
+    if (args.threads == NULL) {
+        /* Fall back to a serial scan. */
+        for (Thread *thread = gDvm.threadList; thread != NULL;
+             thread = thread->next) {
+            dvmVisitThreadRoots(rootMarkObjectVisitor, thread,
+                                &gDvm.gcHeap->markContext);
+        }
+        dvmUnlockThreadList();
+        return;
+    }
+    args.numThreads = 0;
+    for (Thread *thread = gDvm.threadList; thread != NULL; thread = thread->next) {
+        dvmPrepareThreadRootsForParallelVisit(thread);
+        args.threads[args.numThreads++] = thread;
+    }
+    args.nextThread = 0;
+    dvmGcWorkersRun(parallelMarkRootsTask, &args);
+    dvmUnlockThreadList();
+    free(args.threads);
+}
+
+static void rootReMarkObjectVisitor(void *addr, u4 thread, RootType type,
+                                    void *arg);
+static void scanGrayObjects(GcMarkContext *ctx);
+
+/*
+ * Marks the roots of a young collection.  Old objects are already
+ * marked, so rather than walking the bitmap afterwards, the roots and
+ * the children of old objects on dirty cards are pushed on the mark
+ * stack directly.  This must run before the card table is cleared.
+ */
+static void markYoungRootSet(GcMarkContext *ctx)
+{
+    ctx->finger = (void *)ULONG_MAX;
+    dvmVisitRoots(rootReMarkObjectVisitor, ctx);
+    scanGrayObjects(ctx);
+}
+
 /* Mark the set of root objects.
  *
  * Things we need to scan:
@@ -182,7 +468,13 @@ void dvmHeapMarkRootSet()
 {
     GcHeap *gcHeap = gDvm.gcHeap;
     dvmMarkImmuneObjects(gcHeap->markContext.immuneLimit);
-    dvmVisitRoots(rootMarkObjectVisitor, &gcHeap->markContext);
+    if (gcHeap->markContext.isYoung) {
+        markYoungRootSet(&gcHeap->markContext);
+    } else if (isParallelMark()) {
+        parallelMarkRootSet();
+    } else {
+        dvmVisitRoots(rootMarkObjectVisitor, &gcHeap->markContext);
+    }
 }
 
 /*
@@ -414,6 +706,10 @@ static void delayReferenceReferent(Object *obj, GcMarkContext *ctx)
     GcHeap *gcHeap = gDvm.gcHeap;
     size_t pendingNextOffset = gDvm.offJavaLangRefReference_pendingNext;
     size_t referentOffset = gDvm.offJavaLangRefReference_referent;
+    if (ctx->worker != NULL) {
+        /* The reference lists are shared by all of the mark workers. */
+        dvmLockMutex(&gcHeap->parallelMark.lock);
+    }
     Object *pending = dvmGetFieldObject(obj, pendingNextOffset);
     Object *referent = dvmGetFieldObject(obj, referentOffset);
     if (pending == NULL && referent != NULL && !isMarked(referent, ctx)) {
@@ -430,6 +726,9 @@ static void delayReferenceReferent(Object *obj, GcMarkContext *ctx)
         assert(list != NULL);
         enqueuePendingReference(obj, list);
     }
+    if (ctx->worker != NULL) {
+        dvmUnlockMutex(&gcHeap->parallelMark.lock);
+    }
 }
 
 /*
@@ -464,6 +763,144 @@ static void scanObject(const Object *obj, GcMarkContext *ctx)
     }
 }
 
+/*
+ * Moves a batch of objects from the shared mark stack into the deque
+ * of a worker.  Returns false if the shared stack was empty.
+ */
+static bool refillFromSharedStack(GcMarkWorker *worker)
+{
+    GcParallelMark *pm = &gDvm.gcHeap->parallelMark;
+    GcMarkStack *shared = &gDvm.gcHeap->markContext.stack;
+    size_t moved = 0;
+
+    if (shared->top == shared->base) {
+        return false;
+    }
+    dvmLockMutex(&pm->lock);
+    while (shared->top > shared->base && moved < GC_MARK_BATCH_SIZE) {
+        const Object *obj = markStackPop(shared);
+        /* The deque is empty, so this cannot overflow. */
+        bool pushed = workerPush(worker, obj);
+        assert(pushed);
+        (void)pushed;
+        ++moved;
+    }
+    dvmUnlockMutex(&pm->lock);
+    return moved > 0;
+}
+
+/*
+ * Tries to take work from the other workers, starting with the one
+ * after this worker.  Returns NULL if nothing could be stolen.
+ */
+static const Object *stealWork(size_t index)
+{
+    GcParallelMark *pm = &gDvm.gcHeap->parallelMark;
+    for (size_t i = 1; i < pm->numWorkers; ++i) {
+        GcMarkWorker *victim = &pm->workers[(index + i) % pm->numWorkers];
+        const Object *obj = workerSteal(victim);
+        if (obj != NULL) {
+            return obj;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Returns true if any object remains to be scanned by some worker.
+ * The answer may be stale by the time the caller sees it.
+ */
+static bool hasVisibleWork()
+{
+    GcParallelMark *pm = &gDvm.gcHeap->parallelMark;
+    GcMarkStack *shared = &gDvm.gcHeap->markContext.stack;
+    if (shared->top > shared->base) {
+        return true;
+    }
+    for (size_t i = 0; i < pm->numWorkers; ++i) {
+        GcMarkWorker *worker = &pm->workers[i];
+        if (android_atomic_acquire_load(&worker->bottom) >
+            android_atomic_acquire_load(&worker->top)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Called by a worker that has run out of work.  Returns true if more
+ * work became visible, or false once every worker is out of work and
+ * the mark is complete.  A worker only leaves the idle count before it
+ * tries to take work, so the count can only reach numWorkers when no
+ * worker holds an unscanned object.
+ */
+static bool waitForWork()
+{
+    GcParallelMark *pm = &gDvm.gcHeap->parallelMark;
+    android_atomic_inc(&pm->idleWorkers);
+    for (;;) {
+        if (hasVisibleWork()) {
+            android_atomic_dec(&pm->idleWorkers);
+            return true;
+        }
+        if (android_atomic_acquire_load(&pm->idleWorkers) ==
+            (int32_t)pm->numWorkers) {
+            return false;
+        }
+        sched_yield();
+    }
+}
+
+/*
+ * Drains the shared mark stack with one of the GC workers.
+ */
+static void parallelMarkTask(size_t index, size_t count, void *arg)
+{
+    GcMarkWorker *self = &gDvm.gcHeap->parallelMark.workers[index];
+    for (;;) {
+        const Object *obj;
+        while ((obj = workerPop(self)) != NULL) {
+            scanObject(obj, &self->ctx);
+            ++self->scanned;
+        }
+        if (refillFromSharedStack(self)) {
+            continue;
+        }
+        obj = stealWork(index);
+        if (obj != NULL) {
+            scanObject(obj, &self->ctx);
+            ++self->scanned;
+            continue;
+        }
+        if (!waitForWork()) {
+            break;
+        }
+    }
+}
+
+/*
+ * Scans everything reachable from the shared mark stack using all of
+ * the GC workers.
+ */
+static void parallelProcessMarkStack(GcMarkContext *ctx)
+{
+    GcParallelMark *pm = &gDvm.gcHeap->parallelMark;
+    assert(ctx == &gDvm.gcHeap->markContext);
+    for (size_t i = 0; i < pm->numWorkers; ++i) {
+        pm->workers[i].top = 0;
+        pm->workers[i].bottom = 0;
+        pm->workers[i].scanned = 0;
+    }
+    pm->idleWorkers = 0;
+    ANDROID_MEMBAR_FULL();
+    dvmGcWorkersRun(parallelMarkTask, NULL);
+    assert(ctx->stack.top == ctx->stack.base);
+    for (size_t i = 0; i < pm->numWorkers; ++i) {
+        LOGV_HEAP("Mark worker %zd scanned %zd objects", i,
+                  pm->workers[i].scanned);
+    }
+}
+
 /*
  * Scan anything that's on the mark stack.  We can't use the bitmaps
  * anymore, so use a finger that points past the end of them.
@@ -473,6 +910,10 @@ static void processMarkStack(GcMarkContext *ctx)
     assert(ctx != NULL);
     assert(ctx->finger == (void *)ULONG_MAX);
     assert(ctx->stack.top >= ctx->stack.base);
+    if (isParallelMark()) {
+        parallelProcessMarkStack(ctx);
+        return;
+    }
     GcMarkStack *stack = &ctx->stack;
     while (stack->top > stack->base) {
         const Object *obj = markStackPop(stack);
@@ -511,6 +952,44 @@ static Object *nextGrayObject(const u1 *base, const u1 *limit,
     return NULL;
 }
 
+/*
+ * Stores into object arrays dirty the cards of the elements rather
+ * than the card of the header, so a dirty card may begin in the middle
+ * of an array.  If a marked object array spans the start of the card,
+ * scans its elements on this and any later dirty cards it covers, and
+ * returns the address just past the array.  Otherwise returns NULL.
+ */
+static const u1 *scanSpanningArray(const u1 *card, GcMarkContext *ctx)
+{
+    const u1 *addr = (const u1 *)dvmAddrFromCard(card);
+    const HeapBitmap *liveBits = dvmHeapSourceGetLiveBits();
+    const Object *obj = dvmHeapBitmapFindPrevObject(liveBits, addr);
+    if (obj == NULL || obj->clazz == NULL ||
+        !IS_CLASS_FLAG_SET(obj->clazz, CLASS_ISOBJECTARRAY) ||
+        !isMarked(obj, ctx)) {
+        return NULL;
+    }
+    const ArrayObject *array = (const ArrayObject *)obj;
+    const u1 *objEnd = (const u1 *)obj + dvmArrayObjectSize(array);
+    if (objEnd <= addr) {
+        return NULL;
+    }
+    const Object **contents = (const Object **)(void *)array->contents;
+    const Object **elemEnd = contents + array->length;
+    for (; addr < objEnd; addr += GC_CARD_SIZE, ++card) {
+        if (*card != GC_CARD_DIRTY) {
+            continue;
+        }
+        const Object **elem = MAX(contents, (const Object **)addr);
+        const Object **limit = MIN(elemEnd,
+                                   (const Object **)(addr + GC_CARD_SIZE));
+        for (; elem < limit; ++elem) {
+            markObject(*elem, ctx);
+        }
+    }
+    return (const u1 *)ALIGN_UP(objEnd, HB_OBJECT_ALIGNMENT);
+}
+
 /*
  * Scans range of dirty cards between start and end.  A range of dirty
  * cards is composed consecutively dirty cards or dirty cards spanned
@@ -526,6 +1005,13 @@ const u1 *scanDirtyCards(const u1 *start, const u1 *end,
         if (*card != GC_CARD_DIRTY) {
             return card;
         }
+        if (prevAddr == NULL) {
+            prevAddr = scanSpanningArray(card, ctx);
+            if (prevAddr != NULL) {
+                card = dvmCardFromAddr(prevAddr);
+                continue;
+            }
+        }
         const u1 *ptr = prevAddr ? prevAddr : (u1*)dvmAddrFromCard(card);
         const u1 *limit = ptr + GC_CARD_SIZE;
         while (ptr < limit) {
@@ -590,6 +1076,16 @@ static void scanBitmapCallback(Object *obj, void *finger, void *arg)
     scanObject(obj, ctx);
 }
 
+/*
+ * Callback for seeding the shared mark stack with every object marked
+ * by the root scan.
+ */
+static void pushMarkedObjectCallback(Object *obj, void *arg)
+{
+    GcMarkContext *ctx = (GcMarkContext *)arg;
+    markStackPush(&ctx->stack, obj);
+}
+
 /* Given bitmaps with the root set marked, find and mark all
  * reachable objects.  When this returns, the entire set of
  * live objects will be marked and the mark stack will be empty.
@@ -598,8 +1094,26 @@ void dvmHeapScanMarkedObjects(void)
 {
     GcMarkContext *ctx = &gDvm.gcHeap->markContext;
 
+    if (ctx->isYoung) {
+        /* Everything left to scan is already on the mark stack. */
+        assert(ctx->finger == (void *)ULONG_MAX);
+        processMarkStack(ctx);
+        return;
+    }
+
     assert(ctx->finger == NULL);
 
+    if (isParallelMark()) {
+        /* A finger scan is inherently serial.  Instead, push every
+         * root onto the shared mark stack and let the workers drain
+         * it.
+         */
+        ctx->finger = (void *)ULONG_MAX;
+        dvmHeapBitmapWalk(ctx->bitmap, pushMarkedObjectCallback, ctx);
+        processMarkStack(ctx);
+        return;
+    }
+
     /* The bitmaps currently have bits set for the root set.
      * Walk across the bitmaps and scan each object.
      */
@@ -842,15 +1356,28 @@ void dvmEnqueueClearedReferences(Object **cleared)
 
 void dvmHeapFinishMarkStep()
 {
-    GcMarkContext *ctx = &gDvm.gcHeap->markContext;
-
-    /* The mark bits are now not needed.
-     */
-    dvmHeapSourceZeroMarkBitmap();
+    GcHeap *gcHeap = gDvm.gcHeap;
+    GcMarkContext *ctx = &gcHeap->markContext;
+
+    if (gDvm.generationalGc) {
+        /* Keep the survivors marked, so that the next young
+         * collection can skip them.  The sweep has already cleared
+         * the garbage out of the mark bits, which held the live set
+         * from before the collection, leaving exactly the objects
+         * marked by it.  Objects allocated since the threads were
+         * resumed only have live bits, so they stay young.
+         */
+        gcHeap->survivorsMarked = true;
+    } else {
+        /* The mark bits are now not needed.
+         */
+        dvmHeapSourceZeroMarkBitmap();
+    }
 
     /* Clean up everything else associated with the marking process.
      */
     destroyMarkStack(&ctx->stack);
+    destroyMarkWorkers();
 
     ctx->finger = NULL;
 }
@@ -906,6 +1433,175 @@ void dvmHeapSweepSystemWeaks()
     dvmGcDetachDeadInternedStrings(isUnmarkedObject);
     dvmSweepMonitorList(&gDvm.monitorList, isUnmarkedObject);
     sweepWeakJniGlobals();
+    dvmSweepJniUtfCache(isUnmarkedObject);
+}
+
+/*
+ * Number of address ranges handed to each worker during a parallel
+ * sweep, to even out the work between dense and sparse parts of the
+ * heap.
+ */
+#define GC_SWEEP_RANGES_PER_WORKER 8
+
+/*
+ * Number of garbage objects a sweep worker collects before freeing
+ * them in one batch.
+ */
+#define GC_SWEEP_BATCH_SIZE 1024
+
+/*
+ * An address range of a single heap, [base, max].  Range boundaries
+ * fall on bitmap word boundaries so that no two ranges share a word.
+ */
+struct SweepRange {
+    uintptr_t base;
+    uintptr_t max;
+};
+
+struct ParallelSweepContext {
+    SweepRange *ranges;
+    size_t numRanges;
+    volatile int32_t nextRange;
+    HeapBitmap *prevLive;
+    const HeapBitmap *prevMark;
+    bool isConcurrent;
+
+    /* Serializes frees when the collector holds the heap lock. */
+    pthread_mutex_t freeLock;
+
+    /* Totals, guarded by whichever lock serializes the frees. */
+    size_t numObjects;
+    size_t numBytes;
+};
+
+struct SweepWorker {
+    ParallelSweepContext *ctx;
+    size_t numPtrs;
+    void *ptrs[GC_SWEEP_BATCH_SIZE];
+};
+
+/*
+ * Frees the objects collected by a sweep worker.  The heap source is
+ * not thread safe; when sweeping concurrently the frees are serialized
+ * by the heap lock, otherwise the collector already holds the heap
+ * lock and the workers serialize among themselves.
+ */
+static void flushSweepWorker(SweepWorker *worker)
+{
+    ParallelSweepContext *ctx = worker->ctx;
+    if (worker->numPtrs == 0) {
+        return;
+    }
+    if (ctx->isConcurrent) {
+        if (dvmThreadSelf() != NULL) {
+            dvmLockHeap();
+        } else {
+            /* Helper threads are not VM threads and are never suspended. */
+            dvmLockMutex(&gDvm.gcHeapLock);
+        }
+    } else {
+        dvmLockMutex(&ctx->freeLock);
+    }
+    ctx->numBytes += dvmHeapSourceFreeList(worker->numPtrs, worker->ptrs);
+    ctx->numObjects += worker->numPtrs;
+    if (ctx->isConcurrent) {
+        dvmUnlockHeap();
+    } else {
+        dvmUnlockMutex(&ctx->freeLock);
+    }
+    worker->numPtrs = 0;
+}
+
+static void parallelSweepCallback(size_t numPtrs, void **ptrs, void *arg)
+{
+    SweepWorker *worker = (SweepWorker *)arg;
+    if (worker->numPtrs + numPtrs > NELEM(worker->ptrs)) {
+        flushSweepWorker(worker);
+    }
+    assert(numPtrs <= NELEM(worker->ptrs));
+    memcpy(&worker->ptrs[worker->numPtrs], ptrs, numPtrs * sizeof(*ptrs));
+    worker->numPtrs += numPtrs;
+}
+
+/*
+ * Sweeps address ranges on a GC worker until none are left.  Each
+ * range lies within a single heap, so a batch never mixes objects
+ * from different mspaces.
+ */
+static void parallelSweepTask(size_t index, size_t count, void *arg)
+{
+    ParallelSweepContext *ctx = (ParallelSweepContext *)arg;
+    SweepWorker worker;
+    worker.ctx = ctx;
+    worker.numPtrs = 0;
+    for (;;) {
+        size_t i = android_atomic_inc(&ctx->nextRange);
+        if (i >= ctx->numRanges) {
+            break;
+        }
+        dvmHeapBitmapSweepWalk(ctx->prevLive, ctx->prevMark,
+                               ctx->ranges[i].base, ctx->ranges[i].max,
+                               parallelSweepCallback, &worker);
+        flushSweepWorker(&worker);
+    }
+}
+
+/*
+ * Splits the heaps to be swept into ranges and sweeps them with the
+ * GC workers.  Returns false if the ranges could not be allocated, in
+ * which case nothing has been swept.
+ */
+static bool parallelSweep(const uintptr_t *base, const uintptr_t *max,
+                          size_t numSweepHeaps, bool isConcurrent,
+                          size_t *numObjects, size_t *numBytes)
+{
+    const uintptr_t kWordSpan = HB_INDEX_TO_OFFSET(1);
+    size_t numWorkers = dvmGcWorkersCount();
+    size_t maxRanges =
+        numSweepHeaps * (numWorkers * GC_SWEEP_RANGES_PER_WORKER + 1);
+    ParallelSweepContext ctx;
+
+    ctx.ranges = (SweepRange *)malloc(maxRanges * sizeof(SweepRange));
+    if (ctx.ranges == NULL) {
+        return false;
+    }
+    ctx.numRanges = 0;
+    for (size_t i = 0; i < numSweepHeaps; ++i) {
+        if (max[i] < base[i]) {
+            /* Nothing was ever allocated in this heap. */
+            continue;
+        }
+        uintptr_t span = max[i] - base[i] + 1;
+        uintptr_t step = span / (numWorkers * GC_SWEEP_RANGES_PER_WORKER);
+        step = ALIGN_UP(MAX(step, kWordSpan), kWordSpan);
+        /* Heaps are page aligned, so every range starts on a word. */
+        assert((base[i] - dvmHeapSourceGetLiveBits()->base) % kWordSpan == 0);
+        for (uintptr_t start = base[i]; start <= max[i]; ) {
+            uintptr_t next = start + step;
+            assert(ctx.numRanges < maxRanges);
+            ctx.ranges[ctx.numRanges].base = start;
+            if (next <= start || next - 1 >= max[i]) {
+                ctx.ranges[ctx.numRanges++].max = max[i];
+                break;
+            }
+            ctx.ranges[ctx.numRanges++].max = next - 1;
+            start = next;
+        }
+    }
+    ctx.nextRange = 0;
+    ctx.prevLive = dvmHeapSourceGetMarkBits();
+    ctx.prevMark = dvmHeapSourceGetLiveBits();
+    ctx.isConcurrent = isConcurrent;
+    ctx.numObjects = 0;
+    ctx.numBytes = 0;
+    dvmInitMutex(&ctx.freeLock);
+    ANDROID_MEMBAR_FULL();
+    dvmGcWorkersRun(parallelSweepTask, &ctx);
+    dvmDestroyMutex(&ctx.freeLock);
+    free(ctx.ranges);
+    *numObjects = ctx.numObjects;
+    *numBytes = ctx.numBytes;
+    return true;
 }
 
 /*
@@ -931,11 +1627,15 @@ void dvmHeapSweepUnmarkedObjects(bool isPartial, bool isConcurrent,
     }
     ctx.numObjects = ctx.numBytes = 0;
     ctx.isConcurrent = isConcurrent;
-    prevLive = dvmHeapSourceGetMarkBits();
-    prevMark = dvmHeapSourceGetLiveBits();
-    for (size_t i = 0; i < numSweepHeaps; ++i) {
-        dvmHeapBitmapSweepWalk(prevLive, prevMark, base[i], max[i],
-                               sweepBitmapCallback, &ctx);
+    if (dvmGcWorkersCount() <= 1 ||
+        !parallelSweep(base, max, numSweepHeaps, isConcurrent,
+                       &ctx.numObjects, &ctx.numBytes)) {
+        prevLive = dvmHeapSourceGetMarkBits();
+        prevMark = dvmHeapSourceGetLiveBits();
+        for (size_t i = 0; i < numSweepHeaps; ++i) {
+            dvmHeapBitmapSweepWalk(prevLive, prevMark, base[i], max[i],
+                                   sweepBitmapCallback, &ctx);
+        }
     }
     *numObjects = ctx.numObjects;
     *numBytes = ctx.numBytes;
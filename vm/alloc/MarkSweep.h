@@ -37,6 +37,10 @@ struct GcMarkStack {
     size_t length;
 };
 
+/* Per-thread state of a parallel mark worker.  Private to MarkSweep.cpp.
+ */
+struct GcMarkWorker;
+
 /* This is declared publicly so that it can be included in gDvm.gcHeap.
  */
 struct GcMarkContext {
@@ -44,9 +48,31 @@ struct GcMarkContext {
     GcMarkStack stack;
     const char *immuneLimit;
     const void *finger;   // only used while scanning/recursing.
+    GcMarkWorker *worker; // non-NULL only in a parallel mark worker.
+    bool isYoung;         // only objects allocated since the last GC
+};
+
+/* State shared by the workers of a parallel mark.  The mark stack of
+ * gDvm.gcHeap->markContext is used to seed the workers and to absorb
+ * their overflow.
+ */
+struct GcParallelMark {
+    /* One entry per GC worker thread, or NULL when marking serially.
+     */
+    GcMarkWorker *workers;
+    size_t numWorkers;
+
+    /* Guards the shared mark stack and the reference lists.
+     */
+    pthread_mutex_t lock;
+
+    /* Number of workers that have run out of work.  Marking is
+     * finished when this reaches numWorkers.
+     */
+    volatile int32_t idleWorkers;
 };
 
-bool dvmHeapBeginMarkStep(bool isPartial);
+bool dvmHeapBeginMarkStep(bool isPartial, bool isYoung);
 void dvmHeapMarkRootSet(void);
 void dvmHeapReMarkRootSet(void);
 void dvmHeapScanMarkedObjects(void);
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Dalvik.h"
+#include "alloc/SlabAlloc.h"
+
+/*
+ * The header at the start of every run.  Slots follow the header and
+ * are handed out from the free list first, then from the untouched
+ * tail of the run.  Free slots are linked through their first word.
+ */
+struct SlabRun {
+    SlabRun *prev;
+    SlabRun *next;
+    void *freeList;
+    char *top;
+    char *end;
+    u2 classIndex;
+    u2 numAllocated;
+};
+
+#define SLAB_HEADER_SIZE \
+    ((sizeof(SlabRun) + HB_OBJECT_ALIGNMENT - 1) & ~(HB_OBJECT_ALIGNMENT - 1))
+
+static size_t slabClassIndex(size_t n)
+{
+    assert(n > 0 && n <= SLAB_MAX_SIZE);
+    return (n - 1) / HB_OBJECT_ALIGNMENT;
+}
+
+static size_t slabSlotSize(size_t classIndex)
+{
+    return (classIndex + 1) * HB_OBJECT_ALIGNMENT;
+}
+
+static SlabRun *runOf(const void *ptr)
+{
+    return (SlabRun *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_RUN_SIZE - 1));
+}
+
+static u1 *mapEntry(const SlabRunMap *map, const void *run)
+{
+    assert(((uintptr_t)run & (SLAB_RUN_SIZE - 1)) == 0);
+    assert((uintptr_t)run - map->base < map->length);
+    return &map->classes[((uintptr_t)run - map->base) / SLAB_RUN_SIZE];
+}
+
+static bool isFull(const SlabRun *run)
+{
+    return run->freeList == NULL && run->top == run->end;
+}
+
+static void linkRun(SlabSpace *space, SlabRun *run)
+{
+    SlabRun **head = &space->partial[run->classIndex];
+    run->prev = NULL;
+    run->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = run;
+    }
+    *head = run;
+}
+
+static void unlinkRun(SlabSpace *space, SlabRun *run)
+{
+    if (run->prev != NULL) {
+        run->prev->next = run->next;
+    } else {
+        assert(space->partial[run->classIndex] == run);
+        space->partial[run->classIndex] = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+    run->prev = run->next = NULL;
+}
+
+/*
+ * Carves a new run for the given size class out of the mspace and puts
+ * it at the head of the partial list.
+ */
+static SlabRun *newRun(SlabSpace *space, size_t classIndex)
+{
+    void *mem = mspace_memalign(space->msp, SLAB_RUN_SIZE, SLAB_RUN_SIZE);
+    if (mem == NULL) {
+        return NULL;
+    }
+    size_t slotSize = slabSlotSize(classIndex);
+    size_t numSlots = (SLAB_RUN_SIZE - SLAB_HEADER_SIZE) / slotSize;
+    SlabRun *run = (SlabRun *)mem;
+    char *first = (char *)mem + SLAB_HEADER_SIZE;
+    memset(first, 0, numSlots * slotSize);
+    run->freeList = NULL;
+    run->top = first;
+    run->end = first + numSlots * slotSize;
+    run->classIndex = classIndex;
+    run->numAllocated = 0;
+    *mapEntry(space->map, run) = classIndex + 1;
+    linkRun(space, run);
+    return run;
+}
+
+/*
+ * Takes one slot from a run that is known to have a free one.  The run
+ * stays on the partial list; the caller unlinks it once it is full.
+ */
+static void *takeSlot(SlabRun *run, size_t slotSize)
+{
+    void *ptr;
+    if (run->freeList != NULL) {
+        ptr = run->freeList;
+        run->freeList = *(void **)ptr;
+        memset(ptr, 0, slotSize);
+    } else {
+        assert(run->top < run->end);
+        ptr = run->top;
+        run->top += slotSize;
+    }
+    run->numAllocated++;
+    return ptr;
+}
+
+bool dvmSlabRunMapInit(SlabRunMap *map, const void *base, size_t length)
+{
+    assert(((uintptr_t)base & (SLAB_RUN_SIZE - 1)) == 0);
+    map->base = (uintptr_t)base;
+    map->length = length;
+    map->classes = (u1 *)calloc(length / SLAB_RUN_SIZE + 1, 1);
+    return map->classes != NULL;
+}
+
+void dvmSlabRunMapDelete(SlabRunMap *map)
+{
+    free(map->classes);
+    memset(map, 0, sizeof(*map));
+}
+
+void dvmSlabInitSpace(SlabSpace *space, mspace msp, SlabRunMap *map)
+{
+    memset(space, 0, sizeof(*space));
+    space->msp = msp;
+    space->map = map;
+}
+
+void *dvmSlabAlloc(SlabSpace *space, size_t n)
+{
+    size_t classIndex = slabClassIndex(n);
+    SlabRun *run = space->partial[classIndex];
+    if (run == NULL) {
+        run = newRun(space, classIndex);
+        if (run == NULL) {
+            return NULL;
+        }
+    }
+    void *ptr = takeSlot(run, slabSlotSize(classIndex));
+    if (isFull(run)) {
+        unlinkRun(space, run);
+    }
+    return ptr;
+}
+
+size_t dvmSlabAllocBatch(SlabSpace *space, size_t n, size_t maxCount,
+                         void **ptrs)
+{
+    size_t classIndex = slabClassIndex(n);
+    size_t slotSize = slabSlotSize(classIndex);
+    size_t count = 0;
+    while (count < maxCount) {
+        SlabRun *run = space->partial[classIndex];
+        if (run == NULL) {
+            if (count > 0) {
+                break;
+            }
+            run = newRun(space, classIndex);
+            if (run == NULL) {
+                break;
+            }
+        }
+        while (count < maxCount && !isFull(run)) {
+            ptrs[count++] = takeSlot(run, slotSize);
+        }
+        if (isFull(run)) {
+            unlinkRun(space, run);
+        }
+    }
+    return count;
+}
+
+void dvmSlabFree(SlabSpace *space, void *ptr)
+{
+    SlabRun *run = runOf(ptr);
+    assert(*mapEntry(space->map, run) == run->classIndex + 1);
+    assert((char *)ptr >= (char *)run + SLAB_HEADER_SIZE && (char *)ptr < run->top);
+    assert(run->numAllocated > 0);
+
+    bool wasFull = isFull(run);
+    *(void **)ptr = run->freeList;
+    run->freeList = ptr;
+    run->numAllocated--;
+    if (wasFull) {
+        linkRun(space, run);
+    }
+    if (run->numAllocated == 0 &&
+        (space->partial[run->classIndex] != run || run->next != NULL)) {
+        /* Keep the last partial run of a class around, so that a
+         * class that is allocated and freed in lockstep does not go
+         * back to dlmalloc every time.
+         */
+        unlinkRun(space, run);
+        *mapEntry(space->map, run) = 0;
+        mspace_free(space->msp, run);
+    }
+}
+
+size_t dvmSlabChunkSize(const SlabRunMap *map, const void *ptr)
+{
+    uintptr_t offset = (uintptr_t)ptr - map->base;
+    if (map->classes == NULL || offset >= map->length) {
+        return 0;
+    }
+    u1 entry = map->classes[offset / SLAB_RUN_SIZE];
+    return entry != 0 ? slabSlotSize(entry - 1) : 0;
+}
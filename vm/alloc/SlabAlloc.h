@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A size-segregated allocator for small objects, layered on an mspace.
+ *
+ * Objects are carved out of page-sized, page-aligned "runs" that each
+ * hold slots of a single size class.  Slots carry no per-object header,
+ * and objects of the same size end up packed next to each other.  The
+ * runs themselves are ordinary mspace chunks, so everything larger than
+ * SLAB_MAX_SIZE keeps coming straight from dlmalloc.
+ *
+ * None of these functions are thread-safe; the heap source calls them
+ * with the heap lock held.
+ */
+
+#ifndef DALVIK_ALLOC_SLAB_ALLOC_H_
+#define DALVIK_ALLOC_SLAB_ALLOC_H_
+
+#include "alloc/DlMalloc.h"
+#include "alloc/HeapBitmap.h"
+
+/* Size and alignment of a run. */
+#define SLAB_RUN_SIZE SYSTEM_PAGE_SIZE
+
+/* Largest request, in bytes, that is served from a run. */
+#define SLAB_MAX_SIZE 128
+
+/* One size class per object alignment step. */
+#define SLAB_NUM_CLASSES (SLAB_MAX_SIZE / HB_OBJECT_ALIGNMENT)
+
+struct SlabRun;
+
+/*
+ * Records which run-sized pages of a region are runs, and of which size
+ * class, so that a pointer can be mapped to its slot size without
+ * touching the object.
+ */
+struct SlabRunMap {
+    uintptr_t base;
+    size_t length;
+
+    /* One entry per page; zero, or the size class index plus one. */
+    u1 *classes;
+};
+
+/*
+ * The runs of a single mspace.  Only runs with at least one free slot
+ * are kept on the per-class lists.
+ */
+struct SlabSpace {
+    mspace msp;
+    SlabRunMap *map;
+    SlabRun *partial[SLAB_NUM_CLASSES];
+};
+
+/*
+ * Sets up a run map covering [base, base + length).
+ */
+bool dvmSlabRunMapInit(SlabRunMap *map, const void *base, size_t length);
+
+/*
+ * Frees the storage of a run map.
+ */
+void dvmSlabRunMapDelete(SlabRunMap *map);
+
+/*
+ * Initializes an empty slab space on top of <msp>.  All runs are
+ * recorded in <map>, which must cover the whole mspace.
+ */
+void dvmSlabInitSpace(SlabSpace *space, mspace msp, SlabRunMap *map);
+
+/*
+ * Allocates a zeroed slot big enough for <n> bytes, where <n> is between
+ * 1 and SLAB_MAX_SIZE.  Returns NULL if a new run was needed and the
+ * mspace could not supply one.
+ */
+void *dvmSlabAlloc(SlabSpace *space, size_t n);
+
+/*
+ * Allocates up to <maxCount> zeroed slots big enough for <n> bytes and
+ * stores them in <ptrs>.  Returns the number of slots allocated, which is
+ * zero only if the mspace could not supply a new run.
+ */
+size_t dvmSlabAllocBatch(SlabSpace *space, size_t n, size_t maxCount,
+                         void **ptrs);
+
+/*
+ * Returns a slot to its run.  Runs that become empty are given back to
+ * the mspace, except for the last partial run of each size class.
+ */
+void dvmSlabFree(SlabSpace *space, void *ptr);
+
+/*
+ * Returns the slot size of <ptr> if it lies in a run recorded in <map>,
+ * and zero otherwise.
+ */
+size_t dvmSlabChunkSize(const SlabRunMap *map, const void *ptr);
+
+#endif  // DALVIK_ALLOC_SLAB_ALLOC_H_
@@ -62,6 +62,22 @@ static void visitReferenceTable(RootVisitor *visitor, ReferenceTable *table,
     }
 }
 
+/*
+ * Visits each distinct object in the pin table once.
+ */
+static void visitPinTable(RootVisitor *visitor, PinTable *table,
+                          RootType type, void *arg)
+{
+    assert(visitor != NULL);
+    assert(table != NULL);
+    for (u4 i = 0; i < table->capacity; ++i) {
+        PinTableEntry *entry = &table->entries[i];
+        if (entry->obj != NULL) {
+            (*visitor)(&entry->obj, 0, type, arg);
+        }
+    }
+}
+
 /*
  * Visits all entries in the indirect reference table.
  */
@@ -173,9 +189,35 @@ static void visitThread(RootVisitor *visitor, Thread *thread, void *arg)
     if (thread->jniMonitorRefTable.table != NULL) {
         visitReferenceTable(visitor, &thread->jniMonitorRefTable, threadId, ROOT_JNI_MONITOR, arg);
     }
+    /* Arrays held in critical regions are pinned rather than waited for */
+    if (thread->jniCriticalRefCount != 0) {
+        for (int i = 0; i < thread->jniCriticalRefCount; ++i) {
+            (*visitor)(&thread->jniCriticalRefs[i], threadId, ROOT_NATIVE_STACK, arg);
+        }
+    }
     visitThreadStack(visitor, thread, arg);
 }
 
+void dvmVisitThreadRoots(RootVisitor *visitor, Thread *thread, void *arg)
+{
+    visitThread(visitor, thread, arg);
+}
+
+void dvmPrepareThreadRootsForParallelVisit(Thread *thread)
+{
+    assert(thread != NULL);
+    const StackSaveArea *saveArea;
+    for (u4 *fp = (u4 *)thread->interpSave.curFrame;
+         fp != NULL;
+         fp = (u4 *)saveArea->prevFrame) {
+        saveArea = SAVEAREA_FROM_FP(fp);
+        Method *method = (Method *)saveArea->method;
+        if (method != NULL && !dvmIsNativeMethod(method)) {
+            dvmGetExpandedRegisterMap(method);
+        }
+    }
+}
+
 /*
  * Visits all threads on the thread list.
  */
@@ -207,9 +249,9 @@ static void visitPrimitiveTypes(RootVisitor *visitor, void *arg)
 }
 
 /*
- * Visits roots.  TODO: visit cached global references.
+ * Visits roots not associated with a thread.
  */
-void dvmVisitRoots(RootVisitor *visitor, void *arg)
+void dvmVisitGlobalRoots(RootVisitor *visitor, void *arg)
 {
     assert(visitor != NULL);
     visitHashTable(visitor, gDvm.loadedClasses, ROOT_STICKY_CLASS, arg);
@@ -217,17 +259,28 @@ void dvmVisitRoots(RootVisitor *visitor, void *arg)
     if (gDvm.dbgRegistry != NULL) {
         visitHashTable(visitor, gDvm.dbgRegistry, ROOT_DEBUGGER, arg);
     }
-    if (gDvm.literalStrings != NULL) {
-        visitHashTable(visitor, gDvm.literalStrings, ROOT_INTERNED_STRING, arg);
+    for (int i = 0; i < INTERN_TABLE_STRIPES; ++i) {
+        HashTable *literals = gDvm.internTable[i].literalStrings;
+        if (literals != NULL) {
+            visitHashTable(visitor, literals, ROOT_INTERNED_STRING, arg);
+        }
     }
-    dvmLockMutex(&gDvm.jniGlobalRefLock);
+    /* globals change without a lock, but only from running threads */
     visitIndirectRefTable(visitor, &gDvm.jniGlobalRefTable, 0, ROOT_JNI_GLOBAL, arg);
-    dvmUnlockMutex(&gDvm.jniGlobalRefLock);
     dvmLockMutex(&gDvm.jniPinRefLock);
-    visitReferenceTable(visitor, &gDvm.jniPinRefTable, 0, ROOT_VM_INTERNAL, arg);
+    visitPinTable(visitor, &gDvm.jniPinTable, ROOT_VM_INTERNAL, arg);
     dvmUnlockMutex(&gDvm.jniPinRefLock);
-    visitThreads(visitor, arg);
     (*visitor)(&gDvm.outOfMemoryObj, 0, ROOT_VM_INTERNAL, arg);
     (*visitor)(&gDvm.internalErrorObj, 0, ROOT_VM_INTERNAL, arg);
     (*visitor)(&gDvm.noClassDefFoundErrorObj, 0, ROOT_VM_INTERNAL, arg);
 }
+
+/*
+ * Visits roots.  TODO: visit cached global references.
+ */
+void dvmVisitRoots(RootVisitor *visitor, void *arg)
+{
+    assert(visitor != NULL);
+    dvmVisitGlobalRoots(visitor, arg);
+    visitThreads(visitor, arg);
+}
@@ -58,4 +58,23 @@ void dvmVisitObject(Visitor *visitor, Object *obj, void *arg);
  */
 void dvmVisitRoots(RootVisitor *visitor, void *arg);
 
+/*
+ * Visits the references in the root set that are not owned by a
+ * thread.  Together with dvmVisitThreadRoots() applied to every thread
+ * on the thread list, this covers the same roots as dvmVisitRoots().
+ */
+void dvmVisitGlobalRoots(RootVisitor *visitor, void *arg);
+
+/*
+ * Visits the references in the root set owned by a single thread.
+ */
+void dvmVisitThreadRoots(RootVisitor *visitor, Thread *thread, void *arg);
+
+/*
+ * Expands the register maps of every method on the stack of a thread.
+ * Expansion is not synchronized, so this must be called serially for
+ * every thread before the threads are visited in parallel.
+ */
+void dvmPrepareThreadRootsForParallelVisit(Thread *thread);
+
 #endif  // DALVIK_ALLOC_VISIT_H_
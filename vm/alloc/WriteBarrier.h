@@ -42,12 +42,16 @@ INLINE void dvmWriteBarrierObject(const Object *obj)
 /*
  * Some or perhaps all of the array indexes in the Array, greater than
  * or equal to start and strictly less than end, have been written,
- * and perhaps changed.
+ * and perhaps changed.  Only the cards holding those elements are
+ * dirtied; the collector finds the array from an element card.
  */
 INLINE void dvmWriteBarrierArray(const ArrayObject *obj,
                                  size_t start, size_t end)
 {
-    dvmMarkCard((Object *)obj);
+    if (start < end) {
+        const Object **contents = (const Object **)(void *)obj->contents;
+        dvmMarkCardRange(contents + start, contents + end);
+    }
 }
 
 #endif  // DALVIK_ALLOC_WRITEBARRIER_H_
@@ -453,6 +453,7 @@ bool dvmOptimizeDexFile(int fd, off_t dexOffset, long dexLength,
             flags |= DEXOPT_IS_BOOTSTRAP;
         if (gDvm.generateRegisterMaps)
             flags |= DEXOPT_GEN_REGISTER_MAPS;
+        flags |= gDvm.dexOptThreads << DEXOPT_THREADS_SHIFT;
         sprintf(values[9], "%d", flags);
         argv[curArg++] = values[9];
 
@@ -993,6 +994,215 @@ static bool loadAllClasses(DvmDex* pDvmDex)
     return true;
 }
 
+/*
+ * One class for the verify/optimize worker threads.
+ */
+struct ClassWorkItem {
+    ClassObject*        clazz;
+    const DexClassDef*  pClassDef;
+    int                 firstChild;     /* first subclass in this DEX */
+    int                 nextSibling;    /* next subclass of our superclass */
+};
+
+/*
+ * Work shared by the verify/optimize worker threads.  A class becomes
+ * ready once its superclass, if that's defined in the same DEX file, is
+ * done.
+ */
+struct ClassWorkQueue {
+    DexFile*        pDexFile;
+    bool            doVerify;
+    bool            doOpt;
+
+    ClassWorkItem*  items;
+    int*            ready;
+    int             readyHead;
+    int             readyTail;
+    int             remaining;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+};
+
+/*
+ * Take ready classes off the queue and verify/optimize them until every
+ * class is done.
+ *
+ * The queue lock is only taken in VMWAIT, so a thread waiting for it
+ * never holds up a GC.
+ */
+static void processClassWork(ClassWorkQueue* queue)
+{
+    Thread* self = dvmThreadSelf();
+
+    while (true) {
+        ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+        dvmLockMutex(&queue->lock);
+        while (queue->readyHead == queue->readyTail && queue->remaining > 0)
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        if (queue->remaining == 0) {
+            dvmUnlockMutex(&queue->lock);
+            dvmChangeStatus(self, oldStatus);
+            break;
+        }
+        int idx = queue->ready[queue->readyHead++];
+        dvmUnlockMutex(&queue->lock);
+        dvmChangeStatus(self, oldStatus);
+
+        ClassWorkItem* item = &queue->items[idx];
+        verifyAndOptimizeClass(queue->pDexFile, item->clazz, item->pClassDef,
+            queue->doVerify, queue->doOpt);
+
+        oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+        dvmLockMutex(&queue->lock);
+        for (int child = item->firstChild; child >= 0;
+             child = queue->items[child].nextSibling)
+        {
+            queue->ready[queue->readyTail++] = child;
+        }
+        queue->remaining--;
+        pthread_cond_broadcast(&queue->cond);
+        dvmUnlockMutex(&queue->lock);
+        dvmChangeStatus(self, oldStatus);
+    }
+}
+
+/*
+ * Find the work item of the superclass of item "idx", if the superclass
+ * was loaded from the same DEX file.  Returns -1 if there's none.
+ */
+static int findSuperclassWork(const ClassWorkQueue* queue, int idx)
+{
+    const ClassObject* clazz = queue->items[idx].clazz;
+    if (clazz == NULL || clazz->super == NULL)
+        return -1;
+
+    const ClassObject* super = clazz->super;
+    if (super->pDvmDex == NULL || super->pDvmDex->pDexFile != queue->pDexFile)
+        return -1;
+    const DexClassDef* pSuperDef =
+        dexFindClass(queue->pDexFile, super->descriptor);
+    if (pSuperDef == NULL)
+        return -1;
+    int superIdx = pSuperDef - dexGetClassDef(queue->pDexFile, 0);
+    if (queue->items[superIdx].clazz != super)
+        return -1;
+    return superIdx;
+}
+
+static void* classWorkerThreadStart(void* arg)
+{
+    ClassWorkQueue* queue = (ClassWorkQueue*) arg;
+
+    if (!dvmAttachOptimizerThread()) {
+        ALOGW("DexOpt: unable to attach worker thread");
+        return NULL;
+    }
+    processClassWork(queue);
+    dvmDetachOptimizerThread();
+    return NULL;
+}
+
+/*
+ * Verify and/or optimize the loaded classes on "numThreads" threads,
+ * including this one.
+ *
+ * Each class only touches its own code and its own DexClassDef, but
+ * resolution looks at the superclass chain, so subclasses wait for
+ * superclasses in the same DEX file.  That's the order the serial loop
+ * sees them in, since superclasses come first in a DEX file, so the
+ * output is the same.
+ *
+ * Returns "false" if the work couldn't be set up; nothing has been
+ * verified or optimized in that case.
+ */
+static bool verifyAndOptimizeClassesParallel(DexFile* pDexFile,
+    bool doVerify, bool doOpt, int numThreads)
+{
+    int count = pDexFile->pHeader->classDefsSize;
+    ClassWorkQueue queue;
+    pthread_t handles[DEXOPT_MAX_THREADS];
+    int started = 0;
+
+    memset(&queue, 0, sizeof(queue));
+    queue.pDexFile = pDexFile;
+    queue.doVerify = doVerify;
+    queue.doOpt = doOpt;
+    queue.items = (ClassWorkItem*) calloc(count, sizeof(ClassWorkItem));
+    queue.ready = (int*) calloc(count, sizeof(int));
+    if (queue.items == NULL || queue.ready == NULL) {
+        free(queue.items);
+        free(queue.ready);
+        return false;
+    }
+
+    for (int idx = 0; idx < count; idx++) {
+        ClassWorkItem* item = &queue.items[idx];
+        item->pClassDef = dexGetClassDef(pDexFile, idx);
+        item->firstChild = item->nextSibling = -1;
+
+        /* all classes are loaded into the bootstrap class loader */
+        const char* classDescriptor =
+            dexStringByTypeIdx(pDexFile, item->pClassDef->classIdx);
+        item->clazz = dvmLookupClass(classDescriptor, NULL, false);
+        if (item->clazz == NULL) {
+            ALOGV("DexOpt: not optimizing unavailable class '%s'",
+                classDescriptor);
+        } else {
+            queue.remaining++;
+        }
+    }
+
+    /*
+     * Hang each class off its superclass if that's ours, and make the
+     * rest ready.  Children are linked in reverse so they're made ready
+     * in DEX order.
+     */
+    for (int idx = count - 1; idx >= 0; idx--) {
+        int superIdx = findSuperclassWork(&queue, idx);
+        if (superIdx >= 0) {
+            queue.items[idx].nextSibling = queue.items[superIdx].firstChild;
+            queue.items[superIdx].firstChild = idx;
+        }
+    }
+    for (int idx = 0; idx < count; idx++) {
+        if (queue.items[idx].clazz != NULL &&
+            findSuperclassWork(&queue, idx) < 0)
+        {
+            queue.ready[queue.readyTail++] = idx;
+        }
+    }
+
+    dvmInitMutex(&queue.lock);
+    pthread_cond_init(&queue.cond, NULL);
+
+    for (int i = 0; i < numThreads - 1; i++) {
+        int cc = pthread_create(&handles[started], NULL,
+                    classWorkerThreadStart, &queue);
+        if (cc != 0) {
+            ALOGW("DexOpt: unable to start worker thread: %s", strerror(cc));
+            break;
+        }
+        started++;
+    }
+
+    processClassWork(&queue);
+
+    ThreadStatus oldStatus = dvmChangeStatus(dvmThreadSelf(), THREAD_VMWAIT);
+    for (int i = 0; i < started; i++)
+        pthread_join(handles[i], NULL);
+    dvmChangeStatus(dvmThreadSelf(), oldStatus);
+
+    ALOGV("DexOpt: verified/optimized %d classes on %d threads",
+        count, started + 1);
+
+    pthread_cond_destroy(&queue.cond);
+    dvmDestroyMutex(&queue.lock);
+    free(queue.items);
+    free(queue.ready);
+    return true;
+}
+
 /*
  * Verify and/or optimize all classes that were successfully loaded from
  * this DEX file.
@@ -1003,6 +1213,17 @@ static void verifyAndOptimizeClasses(DexFile* pDexFile, bool doVerify,
     u4 count = pDexFile->pHeader->classDefsSize;
     u4 idx;
 
+    /*
+     * Worker threads are only safe in the dexopt process.  If they did
+     * the work, the serial loop below has nothing to do.
+     */
+    if (gDvm.optimizing && gDvm.dexOptThreads > 1 &&
+        verifyAndOptimizeClassesParallel(pDexFile, doVerify, doOpt,
+            gDvm.dexOptThreads))
+    {
+        count = 0;
+    }
+
     for (idx = 0; idx < count; idx++) {
         const DexClassDef* pClassDef;
         const char* classDescriptor;
@@ -1509,15 +1730,38 @@ static bool writeOptData(int fd, const DexClassLookup* pClassLookup,
 /*
  * Compute a checksum on a piece of an open file.
  *
+ * The area is mapped and summed in one go if possible; if the map fails
+ * we read it through a buffer instead.
+ *
  * File will be positioned at end of checksummed area.
  *
  * Returns "true" on success.
  */
 static bool computeFileChecksum(int fd, off_t start, size_t length, u4* pSum)
 {
-    unsigned char readBuf[8192];
+    const size_t kBufSize = 128 * 1024;
+    unsigned char* readBuf = NULL;
     ssize_t actual;
     uLong adler;
+    MemMapping map;
+    bool result = false;
+
+    adler = adler32(0L, Z_NULL, 0);
+
+    if (length != 0 &&
+        sysMapFileSegmentInShmem(fd, start, length, &map) == 0)
+    {
+        adler = adler32(adler, (const Bytef*) map.addr, length);
+        sysReleaseShmem(&map);
+
+        if (lseek(fd, start + length, SEEK_SET) != (off_t) (start + length)) {
+            ALOGE("Unable to seek to end of checksum area (%ld): %s",
+                (long) (start + length), strerror(errno));
+            return false;
+        }
+        *pSum = adler;
+        return true;
+    }
 
     if (lseek(fd, start, SEEK_SET) != start) {
         ALOGE("Unable to seek to start of checksum area (%ld): %s",
@@ -1525,15 +1769,19 @@ static bool computeFileChecksum(int fd, off_t start, size_t length, u4* pSum)
         return false;
     }
 
-    adler = adler32(0L, Z_NULL, 0);
+    readBuf = (unsigned char*) malloc(kBufSize);
+    if (readBuf == NULL) {
+        ALOGE("Unable to allocate checksum buffer");
+        return false;
+    }
 
     while (length != 0) {
-        size_t wanted = (length < sizeof(readBuf)) ? length : sizeof(readBuf);
+        size_t wanted = (length < kBufSize) ? length : kBufSize;
         actual = read(fd, readBuf, wanted);
         if (actual <= 0) {
             ALOGE("Read failed (%d) while computing checksum (len=%zu): %s",
                 (int) actual, length, strerror(errno));
-            return false;
+            goto bail;
         }
 
         adler = adler32(adler, readBuf, actual);
@@ -1542,7 +1790,11 @@ static bool computeFileChecksum(int fd, off_t start, size_t length, u4* pSum)
     }
 
     *pSum = adler;
-    return true;
+    result = true;
+
+bail:
+    free(readBuf);
+    return result;
 }
 
 /*
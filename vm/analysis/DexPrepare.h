@@ -47,6 +47,14 @@ enum DexoptFlags {
     DEXOPT_SMP               = 1 << 7   /* specify SMP target */
 };
 
+/*
+ * The number of threads dexopt verifies and optimizes with is passed in
+ * the flags above these bits.  Zero means one.
+ */
+#define DEXOPT_THREADS_SHIFT    16
+#define DEXOPT_THREADS_MASK     0xff
+#define DEXOPT_MAX_THREADS      16
+
 /*
  * An enumeration of problems that can turn up during verification.
  */
@@ -387,43 +387,6 @@ static inline void updateOpcode(const Method* meth, u2* ptr, Opcode opcode)
     }
 }
 
-/*
- * If "referrer" and "resClass" don't come from the same DEX file, and
- * the DEX we're working on is not destined for the bootstrap class path,
- * tweak the class loader so package-access checks work correctly.
- *
- * Only do this if we're doing pre-verification or optimization.
- */
-static void tweakLoader(ClassObject* referrer, ClassObject* resClass)
-{
-    if (!gDvm.optimizing)
-        return;
-    assert(referrer->classLoader == NULL);
-    assert(resClass->classLoader == NULL);
-
-    if (!gDvm.optimizingBootstrapClass) {
-        /* class loader for an array class comes from element type */
-        if (dvmIsArrayClass(resClass))
-            resClass = resClass->elementClass;
-        if (referrer->pDvmDex != resClass->pDvmDex)
-            resClass->classLoader = (Object*) 0xdead3333;
-    }
-}
-
-/*
- * Undo the effects of tweakLoader.
- */
-static void untweakLoader(ClassObject* referrer, ClassObject* resClass)
-{
-    if (!gDvm.optimizing || gDvm.optimizingBootstrapClass)
-        return;
-
-    if (dvmIsArrayClass(resClass))
-        resClass = resClass->elementClass;
-    resClass->classLoader = NULL;
-}
-
-
 /*
  * Alternate version of dvmResolveClass for use with verification and
  * optimization.  Performs access checks on every resolve, and refuses
@@ -494,9 +457,7 @@ ClassObject* dvmOptResolveClass(ClassObject* referrer, u4 classIdx,
     }
 
     /* access allowed? */
-    tweakLoader(referrer, resClass);
-    bool allowed = dvmCheckClassAccess(referrer, resClass);
-    untweakLoader(referrer, resClass);
+    bool allowed = dvmOptCheckClassAccess(referrer, resClass);
     if (!allowed) {
         ALOGW("DexOpt: resolve class illegal access: %s -> %s",
             referrer->descriptor, resClass->descriptor);
@@ -564,9 +525,7 @@ InstField* dvmOptResolveInstField(ClassObject* referrer, u4 ifieldIdx,
     }
 
     /* access allowed? */
-    tweakLoader(referrer, resField->clazz);
-    bool allowed = dvmCheckFieldAccess(referrer, (Field*)resField);
-    untweakLoader(referrer, resField->clazz);
+    bool allowed = dvmOptCheckFieldAccess(referrer, (Field*)resField);
     if (!allowed) {
         ALOGI("DexOpt: access denied from %s to field %s.%s",
             referrer->descriptor, resField->clazz->descriptor,
@@ -642,9 +601,7 @@ StaticField* dvmOptResolveStaticField(ClassObject* referrer, u4 sfieldIdx,
     }
 
     /* access allowed? */
-    tweakLoader(referrer, resField->clazz);
-    bool allowed = dvmCheckFieldAccess(referrer, (Field*)resField);
-    untweakLoader(referrer, resField->clazz);
+    bool allowed = dvmOptCheckFieldAccess(referrer, (Field*)resField);
     if (!allowed) {
         ALOGI("DexOpt: access denied from %s to field %s.%s",
             referrer->descriptor, resField->clazz->descriptor,
@@ -858,9 +815,7 @@ Method* dvmOptResolveMethod(ClassObject* referrer, u4 methodIdx,
         methodIdx, resMethod->clazz->descriptor, resMethod->name);
 
     /* access allowed? */
-    tweakLoader(referrer, resMethod->clazz);
-    bool allowed = dvmCheckMethodAccess(referrer, resMethod);
-    untweakLoader(referrer, resMethod->clazz);
+    bool allowed = dvmOptCheckMethodAccess(referrer, resMethod);
     if (!allowed) {
         IF_ALOGI() {
             char* desc = dexProtoCopyMethodDescriptor(&resMethod->prototype);
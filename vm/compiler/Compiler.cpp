@@ -34,21 +34,151 @@ static inline bool workQueueLength(void)
     return gDvmJit.compilerQueueLength;
 }
 
+/*
+ * The work queue is a binary heap kept in gDvmJit.compilerWorkQueue with
+ * the most urgent order at index 0.  Profile mode changes go first, then
+ * the hottest traces, then the oldest.  The PC of every queued or
+ * in-flight order is also entered in gDvmJit.compilerWorkSlots, an
+ * open-addressed table with linear probing, so that duplicate requests
+ * are found without scanning the queue.
+ *
+ * All of the following must be called with compilerLock held.
+ */
+static bool workOrderBefore(const CompilerWorkOrder *a,
+                            const CompilerWorkOrder *b)
+{
+    bool aMode = (a->kind == kWorkOrderProfileMode);
+    bool bMode = (b->kind == kWorkOrderProfileMode);
+    if (aMode != bMode)
+        return aMode;
+    if (a->hotness != b->hotness)
+        return a->hotness > b->hotness;
+    return (int) (a->sequence - b->sequence) < 0;
+}
+
+static inline u4 workSlotHash(const u2 *pc)
+{
+    return ((((u4) pc >> 12) ^ (u4) pc) >> 1) & (COMPILER_WORK_HASH_SIZE - 1);
+}
+
+static CompilerWorkSlot *findWorkSlot(const u2 *pc)
+{
+    u4 i = workSlotHash(pc);
+    while (gDvmJit.compilerWorkSlots[i].pc != NULL) {
+        if (gDvmJit.compilerWorkSlots[i].pc == pc)
+            return &gDvmJit.compilerWorkSlots[i];
+        i = (i + 1) & (COMPILER_WORK_HASH_SIZE - 1);
+    }
+    return NULL;
+}
+
+static void addWorkSlot(const u2 *pc, int index)
+{
+    u4 i = workSlotHash(pc);
+    while (gDvmJit.compilerWorkSlots[i].pc != NULL) {
+        i = (i + 1) & (COMPILER_WORK_HASH_SIZE - 1);
+    }
+    gDvmJit.compilerWorkSlots[i].pc = pc;
+    gDvmJit.compilerWorkSlots[i].index = index;
+}
+
+/*
+ * Delete a slot and shift back any later members of its probe sequence
+ * so that lookups never stop at the hole.
+ */
+static void removeWorkSlot(CompilerWorkSlot *slot)
+{
+    const u4 mask = COMPILER_WORK_HASH_SIZE - 1;
+    u4 hole = slot - gDvmJit.compilerWorkSlots;
+    u4 i = hole;
+    for (;;) {
+        i = (i + 1) & mask;
+        const u2 *pc = gDvmJit.compilerWorkSlots[i].pc;
+        if (pc == NULL)
+            break;
+        u4 home = workSlotHash(pc);
+        /* Move the entry unless its home lies cyclically in (hole, i] */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            gDvmJit.compilerWorkSlots[hole] = gDvmJit.compilerWorkSlots[i];
+            hole = i;
+        }
+    }
+    gDvmJit.compilerWorkSlots[hole].pc = NULL;
+}
+
+/* Store a work order at the given heap index and record its new position */
+static void placeWork(int index, const CompilerWorkOrder *work)
+{
+    gDvmJit.compilerWorkQueue[index] = *work;
+    if (work->pc != NULL) {
+        CompilerWorkSlot *slot = findWorkSlot(work->pc);
+        assert(slot != NULL);
+        slot->index = index;
+    }
+}
+
+static void workSiftUp(int index)
+{
+    CompilerWorkOrder work = gDvmJit.compilerWorkQueue[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!workOrderBefore(&work, &gDvmJit.compilerWorkQueue[parent]))
+            break;
+        placeWork(index, &gDvmJit.compilerWorkQueue[parent]);
+        index = parent;
+    }
+    placeWork(index, &work);
+}
+
+static void workSiftDown(int index)
+{
+    int length = gDvmJit.compilerQueueLength;
+    CompilerWorkOrder work = gDvmJit.compilerWorkQueue[index];
+    for (;;) {
+        int child = 2 * index + 1;
+        if (child >= length)
+            break;
+        if (child + 1 < length &&
+            workOrderBefore(&gDvmJit.compilerWorkQueue[child + 1],
+                            &gDvmJit.compilerWorkQueue[child])) {
+            child++;
+        }
+        if (!workOrderBefore(&gDvmJit.compilerWorkQueue[child], &work))
+            break;
+        placeWork(index, &gDvmJit.compilerWorkQueue[child]);
+        index = child;
+    }
+    placeWork(index, &work);
+}
+
+/*
+ * Remove the most urgent work order from the queue.  Its PC stays in the
+ * slot table until workComplete() so that requests made while it is
+ * being compiled are still recognized as duplicates.
+ */
 static CompilerWorkOrder workDequeue(void)
 {
-    assert(gDvmJit.compilerWorkQueue[gDvmJit.compilerWorkDequeueIndex].kind
-           != kWorkOrderInvalid);
-    CompilerWorkOrder work =
-        gDvmJit.compilerWorkQueue[gDvmJit.compilerWorkDequeueIndex];
-    gDvmJit.compilerWorkQueue[gDvmJit.compilerWorkDequeueIndex++].kind =
-        kWorkOrderInvalid;
-    if (gDvmJit.compilerWorkDequeueIndex == COMPILER_WORK_QUEUE_SIZE) {
-        gDvmJit.compilerWorkDequeueIndex = 0;
+    assert(gDvmJit.compilerQueueLength > 0);
+    CompilerWorkOrder work = gDvmJit.compilerWorkQueue[0];
+    assert(work.kind != kWorkOrderInvalid);
+    int last = --gDvmJit.compilerQueueLength;
+    if (last > 0) {
+        placeWork(0, &gDvmJit.compilerWorkQueue[last]);
+        workSiftDown(0);
     }
-    gDvmJit.compilerQueueLength--;
-    if (gDvmJit.compilerQueueLength == 0) {
-        dvmSignalCond(&gDvmJit.compilerQueueEmpty);
+    gDvmJit.compilerWorkQueue[last].kind = kWorkOrderInvalid;
+    if (work.pc != NULL) {
+        CompilerWorkSlot *slot = findWorkSlot(work.pc);
+        assert(slot != NULL);
+        slot->index = COMPILER_WORK_IN_FLIGHT;
     }
+    gDvmJit.compilerWorkInFlight++;
+
+    /*
+     * A segment eviction only invalidates the compilations in flight, so
+     * take the cache version from the time the work is started.
+     */
+    work.result.cacheVersion = gDvmJit.cacheVersion;
 
     /* Remember the high water mark of the queue length */
     if (gDvmJit.compilerQueueLength > gDvmJit.compilerMaxQueued)
@@ -57,6 +187,22 @@ static CompilerWorkOrder workDequeue(void)
     return work;
 }
 
+/* Retire a work order returned by workDequeue() */
+static void workComplete(const CompilerWorkOrder *work)
+{
+    if (work->pc != NULL) {
+        CompilerWorkSlot *slot = findWorkSlot(work->pc);
+        /* The table is cleared when the code cache is reset */
+        if (slot != NULL && slot->index == COMPILER_WORK_IN_FLIGHT)
+            removeWorkSlot(slot);
+    }
+    assert(gDvmJit.compilerWorkInFlight > 0);
+    gDvmJit.compilerWorkInFlight--;
+    if (gDvmJit.compilerQueueLength == 0 && gDvmJit.compilerWorkInFlight == 0) {
+        pthread_cond_broadcast(&gDvmJit.compilerQueueEmpty);
+    }
+}
+
 /*
  * Enqueue a work order - retrying until successful.  If attempt to enqueue
  * is repeatedly unsuccessful, assume the JIT is in a bad state and force a
@@ -87,7 +233,9 @@ void dvmCompilerForceWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
 }
 
 /*
- * Attempt to enqueue a work order, returning true if successful.
+ * Attempt to enqueue a work order, returning true if successful.  A request
+ * for a PC that is already queued or being compiled counts as success; the
+ * new info is freed and a queued order is made hotter instead.
  *
  * NOTE: Make sure that the caller frees the info pointer if the return value
  * is false.
@@ -95,8 +243,6 @@ void dvmCompilerForceWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
 bool dvmCompilerWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
 {
     int cc;
-    int i;
-    int numWork;
     bool result = true;
 
     dvmLockMutex(&gDvmJit.compilerLock);
@@ -110,25 +256,28 @@ bool dvmCompilerWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
         return false;
     }
 
-    for (numWork = gDvmJit.compilerQueueLength,
-           i = gDvmJit.compilerWorkDequeueIndex;
-         numWork > 0;
-         numWork--) {
+    if (pc != NULL) {
+        CompilerWorkSlot *slot = findWorkSlot(pc);
         /* Already enqueued */
-        if (gDvmJit.compilerWorkQueue[i++].pc == pc) {
+        if (slot != NULL) {
+            if (slot->index != COMPILER_WORK_IN_FLIGHT) {
+                gDvmJit.compilerWorkQueue[slot->index].hotness++;
+                workSiftUp(slot->index);
+            }
             dvmUnlockMutex(&gDvmJit.compilerLock);
+            free(info);
             return true;
         }
-        /* Wrap around */
-        if (i == COMPILER_WORK_QUEUE_SIZE)
-            i = 0;
+        addWorkSlot(pc, gDvmJit.compilerQueueLength);
     }
 
     CompilerWorkOrder *newOrder =
-        &gDvmJit.compilerWorkQueue[gDvmJit.compilerWorkEnqueueIndex];
+        &gDvmJit.compilerWorkQueue[gDvmJit.compilerQueueLength];
     newOrder->pc = pc;
     newOrder->kind = kind;
     newOrder->info = info;
+    newOrder->hotness = 0;
+    newOrder->sequence = gDvmJit.compilerWorkSequence++;
     newOrder->result.methodCompilationAborted = NULL;
     newOrder->result.codeAddress = NULL;
     newOrder->result.discardResult =
@@ -136,10 +285,8 @@ bool dvmCompilerWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
     newOrder->result.cacheVersion = gDvmJit.cacheVersion;
     newOrder->result.requestingThread = dvmThreadSelf();
 
-    gDvmJit.compilerWorkEnqueueIndex++;
-    if (gDvmJit.compilerWorkEnqueueIndex == COMPILER_WORK_QUEUE_SIZE)
-        gDvmJit.compilerWorkEnqueueIndex = 0;
     gDvmJit.compilerQueueLength++;
+    workSiftUp(gDvmJit.compilerQueueLength - 1);
     cc = pthread_cond_signal(&gDvmJit.compilerQueueActivity);
     assert(cc == 0);
 
@@ -147,14 +294,49 @@ bool dvmCompilerWorkEnqueue(const u2 *pc, WorkOrderKind kind, void* info)
     return result;
 }
 
-/* Block until the queue length is 0, or there is a pending suspend request */
+/*
+ * Note that a queued trace was requested again while waiting to be
+ * compiled, and move it ahead of colder work.  Called from the
+ * interpreter, so give up rather than wait if the queue is busy.
+ */
+void dvmCompilerBoostWork(const u2 *pc)
+{
+    if (pc == NULL || dvmTryLockMutex(&gDvmJit.compilerLock) != 0)
+        return;
+    CompilerWorkSlot *slot = findWorkSlot(pc);
+    if (slot != NULL && slot->index != COMPILER_WORK_IN_FLIGHT) {
+        gDvmJit.compilerWorkQueue[slot->index].hotness++;
+        workSiftUp(slot->index);
+    }
+    dvmUnlockMutex(&gDvmJit.compilerLock);
+}
+
+/*
+ * Return the index of the calling compiler thread, which selects its
+ * entry in the per-thread compiler state.
+ */
+int dvmCompilerWorkerIndex(void)
+{
+    Thread *self = dvmThreadSelf();
+    for (int i = 0; i < COMPILER_MAX_THREADS; i++) {
+        if (gDvmJit.compilerThreads[i] == self)
+            return i;
+    }
+    assert(!"not a compiler thread");
+    return 0;
+}
+
+/*
+ * Block until the queue is empty and no compilation is in flight, or there
+ * is a pending suspend request.
+ */
 void dvmCompilerDrainQueue(void)
 {
     Thread *self = dvmThreadSelf();
 
     dvmLockMutex(&gDvmJit.compilerLock);
-    while (workQueueLength() != 0 && !gDvmJit.haltCompilerThread &&
-           self->suspendCount == 0) {
+    while ((workQueueLength() != 0 || gDvmJit.compilerWorkInFlight != 0) &&
+           !gDvmJit.haltCompilerThread && self->suspendCount == 0) {
         /*
          * Use timed wait here - more than one mutator threads may be blocked
          * but the compiler thread will only signal once when the queue is
@@ -166,6 +348,106 @@ void dvmCompilerDrainQueue(void)
     dvmUnlockMutex(&gDvmJit.compilerLock);
 }
 
+/*
+ * Split the code cache after the templates into equally sized segments,
+ * all empty, and start filling the first one.
+ */
+static void initCodeCacheSegments(void)
+{
+    unsigned int usable = gDvmJit.codeCacheSize - gDvmJit.templateSize;
+    int numSegments = usable / JIT_CODE_CACHE_MIN_SEGMENT_SIZE;
+
+#if defined(ARCH_IA32)
+    /* The x86 backend emits its code directly into the cache */
+    numSegments = 1;
+#endif
+    if (numSegments > JIT_CODE_CACHE_MAX_SEGMENTS) {
+        numSegments = JIT_CODE_CACHE_MAX_SEGMENTS;
+    } else if (numSegments < 1) {
+        numSegments = 1;
+    }
+    unsigned int segmentSize = (usable / numSegments) & ~7;
+
+    for (int i = 0; i < numSegments; i++) {
+        JitCodeCacheSegment *segment = &gDvmJit.codeCacheSegments[i];
+        segment->start = gDvmJit.templateSize + i * segmentSize;
+        segment->end = (i == numSegments - 1) ?
+            gDvmJit.codeCacheSize : segment->start + segmentSize;
+        segment->top = segment->start;
+        segment->fillSequence = 0;
+    }
+    gDvmJit.numCodeCacheSegments = numSegments;
+    gDvmJit.codeCacheSegment = 0;
+    gDvmJit.codeCacheSegmentFills = 0;
+    gDvmJit.codeCacheEvictPending = false;
+}
+
+/*
+ * Returns the address at which the next translation will be installed.
+ * The address only stays put while compilerLock is held.
+ */
+char *dvmCompilerCodeCacheTop(void)
+{
+    return (char *) gDvmJit.codeCache +
+        gDvmJit.codeCacheSegments[gDvmJit.codeCacheSegment].top;
+}
+
+/*
+ * Make room for a translation of the given size at the top of the code
+ * cache, moving on to an empty segment if the current one is full.  If
+ * there is none, ask for a segment to be evicted at the next safe point,
+ * or for a full reset if there is only one segment, and return false.
+ * Must be called with compilerLock held.
+ */
+bool dvmCompilerCodeCacheReserve(unsigned int size)
+{
+    int numSegments = gDvmJit.numCodeCacheSegments;
+    JitCodeCacheSegment *segment =
+        &gDvmJit.codeCacheSegments[gDvmJit.codeCacheSegment];
+
+    if (segment->top + size <= segment->end) {
+        return true;
+    }
+    for (int i = 1; i < numSegments; i++) {
+        int index = (gDvmJit.codeCacheSegment + i) % numSegments;
+        segment = &gDvmJit.codeCacheSegments[index];
+        if (segment->top == segment->start &&
+            segment->start + size <= segment->end) {
+            gDvmJit.codeCacheSegment = index;
+            segment->fillSequence = ++gDvmJit.codeCacheSegmentFills;
+            return true;
+        }
+    }
+    if (size > gDvmJit.codeCacheSegments[0].end -
+               gDvmJit.codeCacheSegments[0].start) {
+        /* Would not fit anywhere - just drop it */
+        return false;
+    }
+    if (numSegments == 1) {
+        gDvmJit.codeCacheFull = true;
+    } else {
+        gDvmJit.codeCacheEvictPending = true;
+    }
+    return false;
+}
+
+/*
+ * Account for a translation of the given size just installed at the top
+ * of the code cache.  Must be called with compilerLock held.
+ */
+void dvmCompilerCodeCacheCommit(unsigned int size)
+{
+    JitCodeCacheSegment *segment =
+        &gDvmJit.codeCacheSegments[gDvmJit.codeCacheSegment];
+
+    assert(segment->top + size <= segment->end);
+    segment->top += size;
+    /* codeCacheByteUsed covers every segment that has been used */
+    if (segment->top > gDvmJit.codeCacheByteUsed) {
+        gDvmJit.codeCacheByteUsed = segment->top;
+    }
+}
+
 bool dvmCompilerSetupCodeCache(void)
 {
     int fd;
@@ -209,6 +491,7 @@ bool dvmCompilerSetupCodeCache(void)
 
     gDvmJit.templateSize = templateSize;
     gDvmJit.codeCacheByteUsed = templateSize;
+    initCodeCacheSegments();
 
     /* Only flush the part in the code cache that is being used now */
     dvmCompilerCacheFlush((intptr_t) gDvmJit.codeCache,
@@ -229,6 +512,7 @@ bool dvmCompilerSetupCodeCache(void)
     initJIT(NULL, NULL);
     gDvmJit.templateSize = (stream - streamStart);
     gDvmJit.codeCacheByteUsed = (stream - streamStart);
+    initCodeCacheSegments();
     ALOGV("stream = %p after initJIT", stream);
 #endif
 
@@ -315,9 +599,8 @@ static void resetCodeCache(void)
     gDvmJit.cacheVersion++;
 
     /* Drain the work queue to free the work orders */
-    while (workQueueLength()) {
-        CompilerWorkOrder work = workDequeue();
-        free(work.info);
+    for (int i = 0; i < gDvmJit.compilerQueueLength; i++) {
+        free(gDvmJit.compilerWorkQueue[i].info);
     }
 
     /* Reset the JitEntry table contents to the initial unpopulated state */
@@ -340,11 +623,16 @@ static void resetCodeCache(void)
     /* Reset the current mark of used bytes to the end of template code */
     gDvmJit.codeCacheByteUsed = gDvmJit.templateSize;
     gDvmJit.numCompilations = 0;
+    initCodeCacheSegments();
 
-    /* Reset the work queue */
+    /*
+     * Reset the work queue.  Compilations in flight are discarded by the
+     * cache version check and retired by their own threads.
+     */
     memset(gDvmJit.compilerWorkQueue, 0,
            sizeof(CompilerWorkOrder) * COMPILER_WORK_QUEUE_SIZE);
-    gDvmJit.compilerWorkEnqueueIndex = gDvmJit.compilerWorkDequeueIndex = 0;
+    memset(gDvmJit.compilerWorkSlots, 0,
+           sizeof(CompilerWorkSlot) * COMPILER_WORK_HASH_SIZE);
     gDvmJit.compilerQueueLength = 0;
 
     /* Reset the IC patch work queue */
@@ -356,7 +644,7 @@ static void resetCodeCache(void)
      * Reset the inflight compilation address (can only be done in safe points
      * or by the compiler thread when its thread state is RUNNING).
      */
-    gDvmJit.inflightBaseAddr = NULL;
+    memset(gDvmJit.inflightBaseAddr, 0, sizeof(gDvmJit.inflightBaseAddr));
 
     /* All clear now */
     gDvmJit.codeCacheFull = false;
@@ -369,19 +657,226 @@ static void resetCodeCache(void)
          gDvmJit.numCodeCacheResetDelayed);
 }
 
+/*
+ * Clear the return addresses into [low, high) on the Dalvik stack of a
+ * thread, so that returns to evicted code land in the interpreter.
+ */
+static void clearReturnAddrs(Thread *thread, const char *low,
+                             const char *high)
+{
+    void *fp = thread->interpSave.curFrame;
+
+    while (fp != NULL) {
+        StackSaveArea* saveArea = SAVEAREA_FROM_FP(fp);
+        const char *returnAddr = (const char *) saveArea->returnAddr;
+        if (returnAddr >= low && returnAddr < high) {
+            saveArea->returnAddr = NULL;
+        }
+        fp = saveArea->prevFrame;
+    }
+}
+
+/*
+ * Find the code cache segment holding a translation.
+ */
+static int codeCacheSegmentOf(const void *codeAddress)
+{
+    unsigned int offset = (const char *) codeAddress -
+                          (const char *) gDvmJit.codeCache;
+    for (int i = 0; i < gDvmJit.numCodeCacheSegments; i++) {
+        if (offset < gDvmJit.codeCacheSegments[i].end) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool isTranslation(const JitEntry *entry)
+{
+    return entry->dPC != NULL && entry->codeAddress != NULL &&
+           entry->codeAddress != dvmCompilerGetInterpretTemplate();
+}
+
+/*
+ * Choose the segment to evict.  Translations only count their executions
+ * while trace profiling is on; then the victim is the segment whose traces
+ * ran least per segment filled since it was.  Otherwise, and on ties, it is
+ * the segment that was filled first.  The segment being filled is never
+ * chosen.
+ */
+static int pickVictimSegment(void)
+{
+    u8 counts[JIT_CODE_CACHE_MAX_SEGMENTS];
+    int victim = -1;
+
+    memset(counts, 0, sizeof(counts));
+    dvmLockMutex(&gDvmJit.tableLock);
+    for (size_t i = 0; i < gDvmJit.jitTableSize; i++) {
+        JitEntry *entry = &gDvmJit.pJitEntryTable[i];
+        if (isTranslation(entry) && !entry->u.info.isMethodEntry) {
+            JitTraceCounter_t *counter = dvmJitGetTraceCounter(entry);
+            int segment = codeCacheSegmentOf(entry->codeAddress);
+            if (counter != NULL && segment >= 0 && *counter > 0) {
+                counts[segment] += *counter;
+            }
+        }
+    }
+    dvmUnlockMutex(&gDvmJit.tableLock);
+
+    u8 victimAge = 0;
+    for (int i = 0; i < gDvmJit.numCodeCacheSegments; i++) {
+        JitCodeCacheSegment *segment = &gDvmJit.codeCacheSegments[i];
+        if (i == gDvmJit.codeCacheSegment || segment->top == segment->start) {
+            continue;
+        }
+        u8 age = gDvmJit.codeCacheSegmentFills - segment->fillSequence + 1;
+        if (victim < 0 ||
+            counts[i] * victimAge < counts[victim] * age ||
+            (counts[i] * victimAge == counts[victim] * age &&
+             segment->fillSequence <
+             gDvmJit.codeCacheSegments[victim].fillSequence)) {
+            victim = i;
+            victimAge = age;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Evict one segment of the code cache to make room for new translations,
+ * instead of throwing the whole cache away.  Chaining cells and return
+ * addresses that lead into the segment are reset, its translations are
+ * removed from the JitTable so that they can be compiled again, and only
+ * the compilations in flight are discarded.  Must be called at a safe
+ * point.
+ */
+static void evictCodeCacheSegment(void)
+{
+    Thread* thread;
+    u8 startTime = dvmGetRelativeTimeUsec();
+    int inJit = 0;
+    int numEvicted = 0;
+
+    dvmLockMutex(&gDvmJit.compilerLock);
+    int victim = gDvmJit.codeCacheEvictPending ? pickVictimSegment() : -1;
+    if (victim < 0) {
+        dvmUnlockMutex(&gDvmJit.compilerLock);
+        return;
+    }
+    JitCodeCacheSegment *segment = &gDvmJit.codeCacheSegments[victim];
+    char *low = (char *) gDvmJit.codeCache + segment->start;
+    char *high = (char *) gDvmJit.codeCache + segment->top;
+
+    /* If any thread is found stuck in the JIT state, don't evict */
+    dvmLockThreadList(NULL);
+    for (thread = gDvm.threadList; thread != NULL; thread = thread->next) {
+        clearReturnAddrs(thread, low, high);
+        if (thread->inJitCodeCache) {
+            inJit++;
+        }
+    }
+    dvmUnlockThreadList();
+
+    if (inJit) {
+        dvmUnlockMutex(&gDvmJit.compilerLock);
+        ALOGD("JIT code cache eviction delayed (%d/%d)",
+             gDvmJit.numCodeCacheEvictions,
+             ++gDvmJit.numCodeCacheEvictionsDelayed);
+        return;
+    }
+
+    /* Compilations in flight may have been installed in the victim */
+    gDvmJit.cacheVersion++;
+    memset(gDvmJit.inflightBaseAddr, 0, sizeof(gDvmJit.inflightBaseAddr));
+
+    /* Make sure nothing outside the victim branches into it any more */
+    dvmJitUnchainRange(low, high);
+
+    /*
+     * Pending inline cache patches may refer to the victim.  Dropping them
+     * is safe; the cells will ask again.
+     */
+    dvmLockMutex(&gDvmJit.compilerICPatchLock);
+    gDvmJit.compilerICPatchIndex = 0;
+    dvmUnlockMutex(&gDvmJit.compilerICPatchLock);
+
+    /*
+     * Evict the translations, and let every trace without a translation
+     * that is not waiting in the queue be requested again: its work order
+     * may have been dropped for lack of room.
+     */
+    dvmLockMutex(&gDvmJit.tableLock);
+    for (size_t i = 0; i < gDvmJit.jitTableSize; i++) {
+        JitEntry *entry = &gDvmJit.pJitEntryTable[i];
+        /* A busy slot is still being filled in by lookupAndAdd */
+        const u2 *pc = entry->dPC;
+        if (pc == NULL || pc == JIT_ENTRY_BUSY) {
+            continue;
+        }
+        if (isTranslation(entry)) {
+            char *codeAddress = (char *) entry->codeAddress;
+            if (codeAddress < low || codeAddress >= high) {
+                continue;
+            }
+            if (!entry->u.info.isMethodEntry) {
+                JitTraceCounter_t *counter = dvmJitGetTraceCounter(entry);
+                if (counter != NULL) {
+                    dvmJitFreeTraceCounter(counter);
+                }
+            }
+            dvmJitEvictEntry(entry);
+            numEvicted++;
+        } else if (entry->codeAddress == NULL && !entry->u.info.evicted &&
+                   !entry->u.info.isMethodEntry) {
+            CompilerWorkSlot *slot = findWorkSlot(pc);
+            if (slot == NULL || slot->index == COMPILER_WORK_IN_FLIGHT) {
+                dvmJitEvictEntry(entry);
+            }
+        }
+    }
+    dvmUnlockMutex(&gDvmJit.tableLock);
+
+    UNPROTECT_CODE_CACHE(low, high - low);
+    /*
+     * Wipe out the segment to force immediate crashes if stale JIT'ed code
+     * is invoked.
+     */
+    dvmCompilerCacheClear(low, high - low);
+    dvmCompilerCacheFlush((intptr_t) low, (intptr_t) high, 0);
+    PROTECT_CODE_CACHE(low, high - low);
+
+    segment->top = segment->start;
+    gDvmJit.numCompilations -= numEvicted;
+    gDvmJit.codeCacheEvictPending = false;
+    gDvmJit.numCodeCacheEvictions++;
+
+    dvmUnlockMutex(&gDvmJit.compilerLock);
+
+    ALOGD("JIT code cache segment %d evicted in %lld ms (%d bytes, %d traces, "
+         "%d/%d)",
+         victim, (dvmGetRelativeTimeUsec() - startTime) / 1000,
+         (int) (high - low), numEvicted, gDvmJit.numCodeCacheEvictions,
+         gDvmJit.numCodeCacheEvictionsDelayed);
+}
+
 /*
  * Perform actions that are only safe when all threads are suspended. Currently
  * we do:
  * 1) Check if the code cache is full. If so reset it and restart populating it
  *    from scratch.
- * 2) Patch predicted chaining cells by consuming recorded work orders.
+ * 2) Otherwise, evict a code cache segment if one is needed.
+ * 3) Patch predicted chaining cells by consuming recorded work orders.
+ * 4) Free JitTables replaced by earlier resizes.
  */
 void dvmCompilerPerformSafePointChecks(void)
 {
     if (gDvmJit.codeCacheFull) {
         resetCodeCache();
+    } else if (gDvmJit.codeCacheEvictPending) {
+        evictCodeCacheSegment();
     }
     dvmCompilerPatchInlineCache();
+    dvmJitFreeRetiredTables();
 }
 
 static bool compilerThreadStartup(void)
@@ -389,7 +884,6 @@ static bool compilerThreadStartup(void)
     JitEntry *pJitTable = NULL;
     unsigned char *pJitProfTable = NULL;
     JitTraceProfCounters *pJitTraceProfCounters = NULL;
-    unsigned int i;
 
     if (!dvmCompilerArchInit())
         goto fail;
@@ -409,7 +903,7 @@ static bool compilerThreadStartup(void)
     }
 
     /* Cache the thread pointer */
-    gDvmJit.compilerThread = dvmThreadSelf();
+    gDvmJit.compilerThreads[0] = dvmThreadSelf();
 
     dvmLockMutex(&gDvmJit.compilerLock);
 
@@ -430,8 +924,7 @@ static bool compilerThreadStartup(void)
 
     dvmInitMutex(&gDvmJit.tableLock);
     dvmLockMutex(&gDvmJit.tableLock);
-    pJitTable = (JitEntry*)
-                calloc(gDvmJit.jitTableSize, sizeof(*pJitTable));
+    pJitTable = dvmJitAllocTable(gDvmJit.jitTableSize);
     if (!pJitTable) {
         ALOGE("jit table allocation failed");
         dvmUnlockMutex(&gDvmJit.tableLock);
@@ -453,11 +946,6 @@ static bool compilerThreadStartup(void)
         goto fail;
     }
     memset(pJitProfTable, gDvmJit.threshold, JIT_PROF_SIZE);
-    for (i=0; i < gDvmJit.jitTableSize; i++) {
-       pJitTable[i].u.info.chain = gDvmJit.jitTableSize;
-    }
-    /* Is chain field wide enough for termination pattern? */
-    assert(pJitTable[0].u.info.chain == gDvmJit.jitTableSize);
 
     /* Allocate the trace profiling structure */
     pJitTraceProfCounters = (JitTraceProfCounters*)
@@ -593,58 +1081,64 @@ fail:
 
 }
 
-static void *compilerThreadStart(void *arg)
+/*
+ * Resize the JitTable once it is half full, which keeps the linear probe
+ * runs short.  Only one compiler thread may do this at a time, and the
+ * others must not repeat the resize.
+ */
+static void checkJitTableSize(void)
 {
-    dvmChangeStatus(NULL, THREAD_VMWAIT);
+    static pthread_mutex_t resizeLock = PTHREAD_MUTEX_INITIALIZER;
 
-    /*
-     * If we're not running stand-alone, wait a little before
-     * recieving translation requests on the assumption that process start
-     * up code isn't worth compiling.  We'll resume when the framework
-     * signals us that the first screen draw has happened, or the timer
-     * below expires (to catch daemons).
-     *
-     * There is a theoretical race between the callback to
-     * VMRuntime.startJitCompiation and when the compiler thread reaches this
-     * point. In case the callback happens earlier, in order not to permanently
-     * hold the system_server (which is not using the timed wait) in
-     * interpreter-only mode we bypass the delay here.
-     */
-    if (gDvmJit.runningInAndroidFramework &&
-        !gDvmJit.alreadyEnabledViaFramework) {
+    if ((unsigned int) gDvmJit.jitTableEntriesUsed <=
+        gDvmJit.jitTableSize / 2) {
+        return;
+    }
+    dvmLockMutex(&resizeLock);
+    if ((unsigned int) gDvmJit.jitTableEntriesUsed >
+        gDvmJit.jitTableSize / 2) {
+        bool resizeFail =
+            dvmJitResizeJitTable(gDvmJit.jitTableSize * 2);
         /*
-         * If the current VM instance is the system server (detected by having
-         * 0 in gDvm.systemServerPid), we will use the indefinite wait on the
-         * conditional variable to determine whether to start the JIT or not.
-         * If the system server detects that the whole system is booted in
-         * safe mode, the conditional variable will never be signaled and the
-         * system server will remain in the interpreter-only mode. All
-         * subsequent apps will be started with the --enable-safemode flag
-         * explicitly appended.
+         * If the jit table is full, consider it's time to reset
+         * the code cache too.
          */
-        if (gDvm.systemServerPid == 0) {
-            dvmLockMutex(&gDvmJit.compilerLock);
-            pthread_cond_wait(&gDvmJit.compilerQueueActivity,
-                              &gDvmJit.compilerLock);
-            dvmUnlockMutex(&gDvmJit.compilerLock);
-            ALOGD("JIT started for system_server");
-        } else {
-            dvmLockMutex(&gDvmJit.compilerLock);
-            /*
-             * TUNING: experiment with the delay & perhaps make it
-             * target-specific
-             */
-            dvmRelativeCondWait(&gDvmJit.compilerQueueActivity,
-                                 &gDvmJit.compilerLock, 3000, 0);
-            dvmUnlockMutex(&gDvmJit.compilerLock);
-        }
-        if (gDvmJit.haltCompilerThread) {
-             return NULL;
-        }
+        gDvmJit.codeCacheFull |= resizeFail;
     }
+    dvmUnlockMutex(&resizeLock);
+}
 
-    compilerThreadStartup();
+/*
+ * If the code cache is out of room, stop the world and evict a segment now
+ * rather than at the next GC.  If a thread is running translated code, the
+ * eviction is left to the next GC instead of being retried here.
+ */
+static void checkCodeCacheSpace(void)
+{
+    static pthread_mutex_t evictLock = PTHREAD_MUTEX_INITIALIZER;
+    static int lastAttempt = -1;
 
+    if (!gDvmJit.codeCacheEvictPending) {
+        return;
+    }
+    dvmLockMutex(&evictLock);
+    if (gDvmJit.codeCacheEvictPending &&
+        lastAttempt != gDvmJit.numCodeCacheEvictions) {
+        lastAttempt = gDvmJit.numCodeCacheEvictions;
+        dvmSuspendAllThreads(SUSPEND_FOR_CC_RESET);
+        evictCodeCacheSegment();
+        dvmResumeAllThreads(SUSPEND_FOR_CC_RESET);
+    }
+    dvmUnlockMutex(&evictLock);
+}
+
+/*
+ * Take work orders off the queue and compile them until the compiler is
+ * shut down.  Every compiler thread runs this loop; the code cache and the
+ * JitTable are only updated with compilerLock held.
+ */
+static void compilerWorkLoop(void)
+{
     dvmLockMutex(&gDvmJit.compilerLock);
     /*
      * Since the compiler thread will not touch any objects on the heap once
@@ -652,15 +1146,26 @@ static void *compilerThreadStart(void *arg)
      * bit late when there is suspend request pending.
      */
     while (!gDvmJit.haltCompilerThread) {
+        dvmJitTableQuiescent(false);
         if (workQueueLength() == 0) {
-            int cc;
-            cc = pthread_cond_signal(&gDvmJit.compilerQueueEmpty);
-            assert(cc == 0);
+            /* Spend idle time on the traces that were hot last run */
+            if (gDvmJit.hotTraceFile != NULL &&
+                dvmCompilerWorkerIndex() == 0) {
+                dvmUnlockMutex(&gDvmJit.compilerLock);
+                bool fed = dvmCompilerFeedHotTraces();
+                dvmLockMutex(&gDvmJit.compilerLock);
+                if (fed) {
+                    continue;
+                }
+            }
+            dvmJitTableQuiescent(true);
             pthread_cond_wait(&gDvmJit.compilerQueueActivity,
                               &gDvmJit.compilerLock);
             continue;
         } else {
             do {
+                /* Nothing is held over from the previous work order */
+                dvmJitTableQuiescent(false);
                 CompilerWorkOrder work = workDequeue();
                 dvmUnlockMutex(&gDvmJit.compilerLock);
 #if defined(WITH_JIT_TUNING)
@@ -684,22 +1189,17 @@ static void *compilerThreadStart(void *arg)
                 if (!gDvmJit.blockingMode)
                     dvmCheckSuspendPending(dvmThreadSelf());
                 /* Is JitTable filling up? */
-                if (gDvmJit.jitTableEntriesUsed >
-                    (gDvmJit.jitTableSize - gDvmJit.jitTableSize/4)) {
-                    bool resizeFail =
-                        dvmJitResizeJitTable(gDvmJit.jitTableSize * 2);
-                    /*
-                     * If the jit table is full, consider it's time to reset
-                     * the code cache too.
-                     */
-                    gDvmJit.codeCacheFull |= resizeFail;
-                }
+                checkJitTableSize();
+                /* Is the code cache out of room? */
+                checkCodeCacheSpace();
                 if (gDvmJit.haltCompilerThread) {
                     ALOGD("Compiler shutdown in progress - discarding request");
-                } else if (!gDvmJit.codeCacheFull) {
+                } else if (!gDvmJit.codeCacheFull &&
+                           !gDvmJit.codeCacheEvictPending) {
                     jmp_buf jmpBuf;
                     work.bailPtr = &jmpBuf;
                     bool aborted = setjmp(jmpBuf);
+                    bool saveHotTraces = false;
                     if (!aborted) {
                         bool codeCompiled = dvmCompilerDoWork(&work);
                         /*
@@ -717,21 +1217,129 @@ static void *compilerThreadStart(void *arg)
                                               work.result.instructionSet,
                                               false, /* not method entry */
                                               work.result.profileCodeSize);
+                            if (gDvmJit.hotTraceFile != NULL &&
+                                ++gDvmJit.numTracesSinceHotTraceSave >=
+                                JIT_HOT_TRACE_SAVE_INTERVAL) {
+                                gDvmJit.numTracesSinceHotTraceSave = 0;
+                                saveHotTraces = true;
+                            }
                         }
                         dvmUnlockMutex(&gDvmJit.compilerLock);
                     }
                     dvmCompilerArenaReset();
+                    if (saveHotTraces) {
+                        dvmCompilerSaveHotTraces();
+                    }
                 }
                 free(work.info);
 #if defined(WITH_JIT_TUNING)
                 gDvmJit.jitTime += dvmGetRelativeTimeUsec() - startTime;
 #endif
                 dvmLockMutex(&gDvmJit.compilerLock);
-            } while (workQueueLength() != 0);
+                workComplete(&work);
+            } while (workQueueLength() != 0 && !gDvmJit.haltCompilerThread);
         }
     }
-    pthread_cond_signal(&gDvmJit.compilerQueueEmpty);
+    dvmJitTableQuiescent(true);
+    pthread_cond_broadcast(&gDvmJit.compilerQueueEmpty);
     dvmUnlockMutex(&gDvmJit.compilerLock);
+}
+
+/*
+ * Entry point of the additional compiler threads, which are started once
+ * the first one has set up the JIT.
+ */
+static void *compilerHelperThreadStart(void *arg)
+{
+    int index = (int) (intptr_t) arg;
+
+    dvmChangeStatus(NULL, THREAD_VMWAIT);
+    gDvmJit.compilerThreads[index] = dvmThreadSelf();
+    if (dvmCompilerHeapInit()) {
+        compilerWorkLoop();
+    }
+    dvmChangeStatus(NULL, THREAD_RUNNING);
+    return NULL;
+}
+
+/*
+ * Start the rest of the compiler thread pool.  Each thread needs a
+ * Thread of its own, so switch to RUNNING while they are created.
+ */
+static void startCompilerHelperThreads(void)
+{
+    dvmChangeStatus(NULL, THREAD_RUNNING);
+    for (int i = 1; i < gDvmJit.numCompilerThreads; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Compiler %d", i);
+        if (gDvmJit.haltCompilerThread ||
+            !dvmCreateInternalThread(&gDvmJit.compilerHandles[i], name,
+                                     compilerHelperThreadStart,
+                                     (void *) (intptr_t) i)) {
+            break;
+        }
+        /* Only read by dvmCompilerShutdown() after joining this thread */
+        gDvmJit.numCompilerThreadsStarted = i + 1;
+    }
+    dvmChangeStatus(NULL, THREAD_VMWAIT);
+}
+
+static void *compilerThreadStart(void *arg)
+{
+    dvmChangeStatus(NULL, THREAD_VMWAIT);
+
+    /*
+     * If we're not running stand-alone, wait a little before
+     * recieving translation requests on the assumption that process start
+     * up code isn't worth compiling.  We'll resume when the framework
+     * signals us that the first screen draw has happened, or the timer
+     * below expires (to catch daemons).
+     *
+     * There is a theoretical race between the callback to
+     * VMRuntime.startJitCompiation and when the compiler thread reaches this
+     * point. In case the callback happens earlier, in order not to permanently
+     * hold the system_server (which is not using the timed wait) in
+     * interpreter-only mode we bypass the delay here.
+     */
+    if (gDvmJit.runningInAndroidFramework &&
+        !gDvmJit.alreadyEnabledViaFramework) {
+        /*
+         * If the current VM instance is the system server (detected by having
+         * 0 in gDvm.systemServerPid), we will use the indefinite wait on the
+         * conditional variable to determine whether to start the JIT or not.
+         * If the system server detects that the whole system is booted in
+         * safe mode, the conditional variable will never be signaled and the
+         * system server will remain in the interpreter-only mode. All
+         * subsequent apps will be started with the --enable-safemode flag
+         * explicitly appended.
+         */
+        if (gDvm.systemServerPid == 0) {
+            dvmLockMutex(&gDvmJit.compilerLock);
+            pthread_cond_wait(&gDvmJit.compilerQueueActivity,
+                              &gDvmJit.compilerLock);
+            dvmUnlockMutex(&gDvmJit.compilerLock);
+            ALOGD("JIT started for system_server");
+        } else {
+            dvmLockMutex(&gDvmJit.compilerLock);
+            /*
+             * TUNING: experiment with the delay & perhaps make it
+             * target-specific
+             */
+            dvmRelativeCondWait(&gDvmJit.compilerQueueActivity,
+                                 &gDvmJit.compilerLock, 3000, 0);
+            dvmUnlockMutex(&gDvmJit.compilerLock);
+        }
+        if (gDvmJit.haltCompilerThread) {
+             return NULL;
+        }
+    }
+
+    if (compilerThreadStartup()) {
+        startCompilerHelperThreads();
+        dvmCompilerLoadHotTraces();
+    }
+
+    compilerWorkLoop();
 
     /*
      * As part of detaching the thread we need to call into Java code to update
@@ -756,17 +1364,35 @@ bool dvmCompilerStartup(void)
     pthread_cond_init(&gDvmJit.compilerQueueEmpty, NULL);
 
     /* Reset the work queue */
-    gDvmJit.compilerWorkEnqueueIndex = gDvmJit.compilerWorkDequeueIndex = 0;
     gDvmJit.compilerQueueLength = 0;
+    gDvmJit.compilerWorkInFlight = 0;
     dvmUnlockMutex(&gDvmJit.compilerLock);
 
+    /*
+     * Unless configured, use a compiler thread for every other processor.
+     * The x86 code generator keeps its state in globals, so it is limited
+     * to a single thread.
+     */
+    if (gDvmJit.numCompilerThreads == 0) {
+        long numCpus = sysconf(_SC_NPROCESSORS_CONF);
+        gDvmJit.numCompilerThreads =
+            MAX(1, MIN((int) numCpus / 2, COMPILER_MAX_THREADS));
+    }
+#if defined(ARCH_IA32)
+    gDvmJit.numCompilerThreads = 1;
+#endif
+
     /*
      * Defer rest of initialization until we're sure JIT'ng makes sense. Launch
      * the compiler thread, which will do the real initialization if and
-     * when it is signalled to do so.
+     * when it is signalled to do so.  It starts the rest of the pool.
      */
-    return dvmCreateInternalThread(&gDvmJit.compilerHandle, "Compiler",
-                                   compilerThreadStart, NULL);
+    if (!dvmCreateInternalThread(&gDvmJit.compilerHandles[0], "Compiler",
+                                 compilerThreadStart, NULL)) {
+        return false;
+    }
+    gDvmJit.numCompilerThreadsStarted = 1;
+    return true;
 }
 
 void dvmCompilerShutdown(void)
@@ -785,20 +1411,29 @@ void dvmCompilerShutdown(void)
           sleep(5);
     }
 
-    if (gDvmJit.compilerHandle) {
+    if (gDvmJit.numCompilerThreadsStarted != 0) {
 
         gDvmJit.haltCompilerThread = true;
 
         dvmLockMutex(&gDvmJit.compilerLock);
-        pthread_cond_signal(&gDvmJit.compilerQueueActivity);
+        pthread_cond_broadcast(&gDvmJit.compilerQueueActivity);
         dvmUnlockMutex(&gDvmJit.compilerLock);
 
-        if (pthread_join(gDvmJit.compilerHandle, &threadReturn) != 0)
-            ALOGW("Compiler thread join failed");
-        else if (gDvm.verboseShutdown)
-            ALOGD("Compiler thread has shut down");
+        /*
+         * The first thread starts the others, so join it first to be sure
+         * the count of started threads is final.
+         */
+        for (int i = 0; i < gDvmJit.numCompilerThreadsStarted; i++) {
+            if (pthread_join(gDvmJit.compilerHandles[i], &threadReturn) != 0)
+                ALOGW("Compiler thread %d join failed", i);
+        }
+        if (gDvm.verboseShutdown)
+            ALOGD("Compiler threads have shut down");
     }
 
+    /* Remember what was hot for the next run */
+    dvmCompilerSaveHotTraces();
+
     /* Break loops within the translation cache */
     dvmJitUnchainAll();
 
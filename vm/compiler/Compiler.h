@@ -26,9 +26,24 @@
  */
 
 #define COMPILER_WORK_QUEUE_SIZE        100
+#define COMPILER_WORK_HASH_SIZE         256     /* must be power of 2 */
+#define COMPILER_MAX_THREADS            4
 #define COMPILER_IC_PATCH_QUEUE_SIZE    64
 #define COMPILER_PC_OFFSET_SIZE         100
 
+/*
+ * The code cache is split into up to this many segments, none smaller
+ * than the minimum size.  A segment is the unit of eviction.
+ */
+#define JIT_CODE_CACHE_MAX_SEGMENTS     8
+#define JIT_CODE_CACHE_MIN_SEGMENT_SIZE (64 * 1024)
+
+/* The hot traces are saved again after this many new translations */
+#define JIT_HOT_TRACE_SAVE_INTERVAL     512
+
+/* Longest constant-length System.arraycopy() compiled as a direct call */
+#define ARRAYCOPY_INLINE_MAX_LENGTH     32
+
 /* Architectural-independent parameters for predicted chains */
 #define PREDICTED_CHAIN_CLAZZ_INIT       0
 #define PREDICTED_CHAIN_METHOD_INIT      0
@@ -104,8 +119,35 @@ typedef struct CompilerWorkOrder {
     void* info;
     JitTranslationInfo result;
     jmp_buf *bailPtr;
+    int hotness;                // # of requests seen while queued
+    u4 sequence;                // Enqueue order, breaks ties in hotness
 } CompilerWorkOrder;
 
+/* Slot value for a work order that a compiler thread is working on */
+#define COMPILER_WORK_IN_FLIGHT         (-1)
+
+/*
+ * Maps the Dalvik PC of a queued or in-flight work order to its position
+ * in the work queue.  Work orders without a PC are not tracked.
+ */
+typedef struct CompilerWorkSlot {
+    const u2* pc;               // NULL for an empty slot
+    int index;                  // Queue index or COMPILER_WORK_IN_FLIGHT
+} CompilerWorkSlot;
+
+/*
+ * A code cache segment.  Translations are installed at the top of the
+ * current segment until it is full; the others are either full or empty.
+ * Offsets are relative to the start of the code cache.
+ */
+typedef struct JitCodeCacheSegment {
+    unsigned int start;         // First byte
+    unsigned int end;           // One past the last byte
+    unsigned int top;           // First free byte
+    u4 fillSequence;            // Value of codeCacheSegmentFills when the
+                                // segment started filling
+} JitCodeCacheSegment;
+
 /* Chain cell for predicted method invocation */
 typedef struct PredictedChainingCell {
     u4 branch;                  /* Branch to chained destination */
@@ -147,6 +189,7 @@ typedef enum JitMethodAttributes {
     kIsThrowFree,       /* Method doesn't throw */
     kIsGetter,          /* Method fits the getter pattern */
     kIsSetter,          /* Method fits the setter pattern */
+    kIsSimple,          /* Method is small straight-line/forward-branch code */
     kCannotCompile,     /* Method cannot be compiled */
 } JitMethodAttributes;
 
@@ -157,8 +200,16 @@ typedef enum JitMethodAttributes {
 #define METHOD_IS_THROW_FREE    (1 << kIsThrowFree)
 #define METHOD_IS_GETTER        (1 << kIsGetter)
 #define METHOD_IS_SETTER        (1 << kIsSetter)
+#define METHOD_IS_SIMPLE        (1 << kIsSimple)
 #define METHOD_CANNOT_COMPILE   (1 << kCannotCompile)
 
+/*
+ * Largest callee body (in 16-bit code units) that will be copied into a
+ * trace.  A trace ends at its first invoke, so this is also the inlining
+ * budget of the whole trace.
+ */
+#define JIT_MAX_INLINE_SIZE     16
+
 /* Vectors to provide optimization hints */
 typedef enum JitOptimizationHints {
     kJitOptNoLoop = 0,          // Disable loop formation/optimization
@@ -197,6 +248,11 @@ bool dvmCompilerStartup(void);
 void dvmCompilerShutdown(void);
 void dvmCompilerForceWorkEnqueue(const u2* pc, WorkOrderKind kind, void* info);
 bool dvmCompilerWorkEnqueue(const u2* pc, WorkOrderKind kind, void* info);
+void dvmCompilerBoostWork(const u2* pc);
+int dvmCompilerWorkerIndex(void);
+char *dvmCompilerCodeCacheTop(void);
+bool dvmCompilerCodeCacheReserve(unsigned int size);
+void dvmCompilerCodeCacheCommit(unsigned int size);
 void *dvmCheckCodeCache(void *method);
 CompilerMethodStats *dvmCompilerAnalyzeMethodBody(const Method *method,
                                                   bool isCallee);
@@ -208,8 +264,14 @@ bool dvmCompileTrace(JitTraceDescription *trace, int numMaxInsts,
 void dvmCompilerDumpStats(void);
 void dvmCompilerDrainQueue(void);
 void dvmJitUnchainAll(void);
+void dvmJitUnchainRange(const char *low, const char *high);
 void dvmJitScanAllClassPointers(void (*callback)(void *ptr));
 void dvmCompilerSortAndPrintTraceProfiles(void);
+void dvmCompilerLoadHotTraces(void);
+bool dvmCompilerFeedHotTraces(void);
+void dvmCompilerSaveHotTraces(void);
+JitTraceDescription *dvmCompilerRebuildHotTrace(
+    const JitTraceDescription *desc);
 void dvmCompilerPerformSafePointChecks(void);
 void dvmCompilerInlineMIR(struct CompilationUnit *cUnit,
                           JitTranslationInfo *info);
@@ -224,6 +286,8 @@ bool dvmCompilerDoSSAConversion(struct CompilationUnit *cUnit,
                                 struct BasicBlock *bb);
 bool dvmCompilerDoConstantPropagation(struct CompilationUnit *cUnit,
                                       struct BasicBlock *bb);
+bool dvmCompilerFindLocalConstant(const struct MIR *mir, int ssaReg,
+                                  int *value);
 bool dvmCompilerFindInductionVariables(struct CompilationUnit *cUnit,
                                        struct BasicBlock *bb);
 /* Clear the visited flag for each BB */
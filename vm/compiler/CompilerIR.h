@@ -123,6 +123,7 @@ typedef struct CallsiteInfo {
     Object *classLoader;
     const Method *method;
     LIR *misPredBranchOver;
+    struct BasicBlock *inlinedEntry;    // First block of a multi-block inline
 } CallsiteInfo;
 
 typedef struct MIR {
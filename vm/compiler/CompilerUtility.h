@@ -22,6 +22,12 @@
 /* Each arena page has some overhead, so take a few bytes off 8k */
 #define ARENA_DEFAULT_SIZE 8100
 
+/* Blocks double in size during a compilation, up to this */
+#define ARENA_MAX_SIZE (8 * ARENA_DEFAULT_SIZE)
+
+/* Most bytes of free blocks kept around between compilations */
+#define ARENA_POOL_MAX_BYTES (256 * 1024)
+
 /* Allocate the initial memory block for arena-based allocation */
 bool dvmCompilerHeapInit(void);
 
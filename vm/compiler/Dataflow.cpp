@@ -1416,6 +1416,33 @@ bool dvmCompilerDoConstantPropagation(CompilationUnit *cUnit, BasicBlock *bb)
     return true;
 }
 
+/*
+ * Returns true and sets *value if the SSA register is defined by a
+ * const, const/4 or const/16 earlier in the block containing mir.  Works
+ * on traces that have been through SSA conversion but not through
+ * constant propagation.
+ */
+bool dvmCompilerFindLocalConstant(const MIR *mir, int ssaReg, int *value)
+{
+    for (mir = mir->prev; mir != NULL; mir = mir->prev) {
+        const SSARepresentation *ssaRep = mir->ssaRep;
+        if (ssaRep == NULL || ssaRep->numDefs == 0 ||
+            ssaRep->defs[0] != ssaReg) {
+            continue;
+        }
+        switch (mir->dalvikInsn.opcode) {
+            case OP_CONST_4:
+            case OP_CONST_16:
+            case OP_CONST:
+                *value = mir->dalvikInsn.vB;
+                return true;
+            default:
+                return false;
+        }
+    }
+    return false;
+}
+
 bool dvmCompilerFindInductionVariables(struct CompilationUnit *cUnit,
                                        struct BasicBlock *bb)
 {
@@ -198,15 +198,93 @@ static int compareMethod(const CompilerMethodStats *m1,
     return (int) m1->method - (int) m2->method;
 }
 
+/*
+ * Return true if the instruction may appear in a callee that is copied into
+ * the trace block by block.  Only 32-bit computations, loads and forward
+ * branches qualify: nothing that stores to the heap, allocates, calls out, or
+ * could reach a safe point, so the inlined copy never needs a frame of its
+ * own.
+ */
+static bool isSimpleInlineInsn(const DecodedInstruction *dalvikInsn)
+{
+    switch (dalvikInsn->opcode) {
+        case OP_MOVE:
+        case OP_MOVE_FROM16:
+        case OP_MOVE_16:
+        case OP_MOVE_OBJECT:
+        case OP_MOVE_OBJECT_FROM16:
+        case OP_MOVE_OBJECT_16:
+        case OP_RETURN:
+        case OP_RETURN_OBJECT:
+        case OP_CONST_4:
+        case OP_CONST_16:
+        case OP_CONST:
+        case OP_CONST_HIGH16:
+        case OP_ARRAY_LENGTH:
+        case OP_AGET:
+        case OP_AGET_OBJECT:
+        case OP_AGET_BOOLEAN:
+        case OP_AGET_BYTE:
+        case OP_AGET_CHAR:
+        case OP_AGET_SHORT:
+        case OP_IGET:
+        case OP_IGET_OBJECT:
+        case OP_IGET_BOOLEAN:
+        case OP_IGET_BYTE:
+        case OP_IGET_CHAR:
+        case OP_IGET_SHORT:
+        case OP_IGET_QUICK:
+        case OP_IGET_OBJECT_QUICK:
+        case OP_SGET:
+        case OP_SGET_OBJECT:
+        case OP_SGET_BOOLEAN:
+        case OP_SGET_BYTE:
+        case OP_SGET_CHAR:
+        case OP_SGET_SHORT:
+        case OP_NEG_INT:
+        case OP_NOT_INT:
+        case OP_INT_TO_BYTE:
+        case OP_INT_TO_CHAR:
+        case OP_INT_TO_SHORT:
+            return true;
+        /* Backward branches would need a suspend check */
+        case OP_GOTO:
+        case OP_GOTO_16:
+        case OP_GOTO_32:
+            return (int) dalvikInsn->vA > 0;
+        case OP_IF_EQ:
+        case OP_IF_NE:
+        case OP_IF_LT:
+        case OP_IF_GE:
+        case OP_IF_GT:
+        case OP_IF_LE:
+            return (int) dalvikInsn->vC > 0;
+        case OP_IF_EQZ:
+        case OP_IF_NEZ:
+        case OP_IF_LTZ:
+        case OP_IF_GEZ:
+        case OP_IF_GTZ:
+        case OP_IF_LEZ:
+            return (int) dalvikInsn->vB > 0;
+        default:
+            break;
+    }
+    /* add-int through ushr-int in the 23x, 12x, 22s and 22b forms */
+    return (dalvikInsn->opcode >= OP_ADD_INT &&
+            dalvikInsn->opcode <= OP_USHR_INT) ||
+           (dalvikInsn->opcode >= OP_ADD_INT_2ADDR &&
+            dalvikInsn->opcode <= OP_USHR_INT_2ADDR) ||
+           (dalvikInsn->opcode >= OP_ADD_INT_LIT16 &&
+            dalvikInsn->opcode <= OP_USHR_INT_LIT8);
+}
+
 /*
  * Analyze the body of the method to collect high-level information regarding
  * inlining:
  * - is empty method?
  * - is getter/setter?
  * - can throw exception?
- *
- * Currently the inliner only handles getters and setters. When its capability
- * becomes more sophisticated more information will be retrieved here.
+ * - is small enough to be copied into the trace as a whole?
  */
 static int analyzeInlineTarget(DecodedInstruction *dalvikInsn, int attributes,
                                int offset)
@@ -251,13 +329,18 @@ static int analyzeInlineTarget(DecodedInstruction *dalvikInsn, int attributes,
         attributes |= METHOD_IS_EMPTY;
     }
 
+    if (!isSimpleInlineInsn(dalvikInsn)) {
+        attributes &= ~METHOD_IS_SIMPLE;
+    }
+
     /*
      * Check if this opcode is selected for single stepping.
      * If so, don't inline the callee as there is no stack frame for the
      * interpreter to single-step through the instruction.
      */
     if (SINGLE_STEP_OP(dalvikOpcode)) {
-        attributes &= ~(METHOD_IS_GETTER | METHOD_IS_SETTER);
+        attributes &= ~(METHOD_IS_GETTER | METHOD_IS_SETTER |
+                        METHOD_IS_SIMPLE);
     }
 
     return attributes;
@@ -281,6 +364,9 @@ CompilerMethodStats *dvmCompilerAnalyzeMethodBody(const Method *method,
     CompilerMethodStats dummyMethodEntry; // For hash table lookup
     CompilerMethodStats *realMethodEntry; // For hash table storage
 
+    /* The table is shared by all compiler threads */
+    dvmHashTableLock(gDvmJit.methodStatsTable);
+
     /* For lookup only */
     dummyMethodEntry.method = method;
     realMethodEntry = (CompilerMethodStats *)
@@ -302,16 +388,18 @@ CompilerMethodStats *dvmCompilerAnalyzeMethodBody(const Method *method,
                            true);
     }
 
+    int oldAttributes = realMethodEntry->attributes;
+    dvmHashTableUnlock(gDvmJit.methodStatsTable);
+
     /* This method is invoked as a callee and has been analyzed - just return */
-    if ((isCallee == true) && (realMethodEntry->attributes & METHOD_IS_CALLEE))
+    if ((isCallee == true) && (oldAttributes & METHOD_IS_CALLEE))
         return realMethodEntry;
 
     /*
      * Similarly, return if this method has been compiled before as a hot
      * method already.
      */
-    if ((isCallee == false) &&
-        (realMethodEntry->attributes & METHOD_IS_HOT))
+    if ((isCallee == false) && (oldAttributes & METHOD_IS_HOT))
         return realMethodEntry;
 
     int attributes;
@@ -320,7 +408,7 @@ CompilerMethodStats *dvmCompilerAnalyzeMethodBody(const Method *method,
     if (isCallee) {
         /* Aggressively set the attributes until proven otherwise */
         attributes = METHOD_IS_LEAF | METHOD_IS_THROW_FREE | METHOD_IS_CALLEE |
-                     METHOD_IS_GETTER | METHOD_IS_SETTER;
+                     METHOD_IS_GETTER | METHOD_IS_SETTER | METHOD_IS_SIMPLE;
     } else {
         attributes = METHOD_IS_HOT;
     }
@@ -351,8 +439,23 @@ CompilerMethodStats *dvmCompilerAnalyzeMethodBody(const Method *method,
         attributes &= ~(METHOD_IS_GETTER | METHOD_IS_SETTER);
     }
 
+    /*
+     * The simple-callee inliner maps every callee local onto the register
+     * receiving the result, so it can only cope with one.  Empty methods,
+     * getters and setters have cheaper dedicated paths.
+     */
+    if ((attributes & METHOD_IS_SIMPLE) &&
+        ((method->registersSize - method->insSize > 1) ||
+         (attributes & (METHOD_IS_EMPTY | METHOD_IS_GETTER |
+                        METHOD_IS_SETTER)))) {
+        attributes &= ~METHOD_IS_SIMPLE;
+    }
+
+    /* Another compiler thread may be updating the same entry */
+    dvmHashTableLock(gDvmJit.methodStatsTable);
     realMethodEntry->dalvikSize = insnSize * 2;
     realMethodEntry->attributes |= attributes;
+    dvmHashTableUnlock(gDvmJit.methodStatsTable);
 
 #if 0
     /* Uncomment the following to explore various callee patterns */
@@ -455,6 +558,28 @@ bool dvmCompilerCanIncludeThisInstruction(const Method *method,
             }
             return true;
         }
+        case OP_IGET:
+        case OP_IGET_WIDE:
+        case OP_IGET_OBJECT:
+        case OP_IGET_BOOLEAN:
+        case OP_IGET_BYTE:
+        case OP_IGET_CHAR:
+        case OP_IGET_SHORT:
+        case OP_IPUT:
+        case OP_IPUT_WIDE:
+        case OP_IPUT_OBJECT:
+        case OP_IPUT_BOOLEAN:
+        case OP_IPUT_BYTE:
+        case OP_IPUT_CHAR:
+        case OP_IPUT_SHORT: {
+            void *fieldPtr = (void*)
+              (method->clazz->pDvmDex->pResFields[insn->vC]);
+
+            if (fieldPtr == NULL) {
+                return false;
+            }
+            return true;
+        }
         case OP_INVOKE_SUPER:
         case OP_INVOKE_SUPER_RANGE: {
             int mIndex = method->clazz->pDvmDex->
@@ -1587,7 +1712,7 @@ static bool compileLoop(CompilationUnit *cUnit, unsigned int startOffset,
      * as short as possible since it is blocking GC.
      */
     if (cUnit->hasClassLiterals && info->codeAddress) {
-        dvmJitInstallClassObjectPointers(cUnit, (char *) info->codeAddress);
+        dvmJitInstallClassObjectPointers(cUnit, info);
     }
 
     /*
@@ -1647,7 +1772,9 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
     const u2 *startCodePtr = codePtr;
     BasicBlock *curBB, *entryCodeBB;
     int numBlocks = 0;
-    static int compilationId;
+    /* Shared by all compiler threads */
+    static volatile int32_t compilationCount;
+    int compilationId;
     CompilationUnit cUnit;
     GrowableList *blockList;
 #if defined(WITH_JIT_TUNING)
@@ -1669,7 +1796,7 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
         return false;
     }
 
-    compilationId++;
+    compilationId = android_atomic_inc(&compilationCount) + 1;
     memset(&cUnit, 0, sizeof(CompilationUnit));
 
 #if defined(WITH_JIT_TUNING)
@@ -2159,7 +2286,7 @@ bool dvmCompileTrace(JitTraceDescription *desc, int numMaxInsts,
      * as short as possible since it is blocking GC.
      */
     if (cUnit.hasClassLiterals && info->codeAddress) {
-        dvmJitInstallClassObjectPointers(&cUnit, (char *) info->codeAddress);
+        dvmJitInstallClassObjectPointers(&cUnit, info);
     }
 
     /*
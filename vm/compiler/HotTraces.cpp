@@ -0,0 +1,783 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Saving the hot traces of a run, and compiling them early in the next.
+ *
+ * The file given with -Xjittracefile holds the trace description of each
+ * translation in the JitTable.  A trace is identified by the checksum of
+ * the DEX file that defines its method and the method's index there, so
+ * the file stays valid across runs and is ignored for DEX files that have
+ * changed.  Only the code runs of a description are saved; the meta runs
+ * hold pointers and are left out.  They are rebuilt when a record is read
+ * back: the callee of a direct, static or super invoke is resolved again,
+ * while the receiver class and callee of a virtual or interface invoke,
+ * which only the interpreter saw, are left NULL so that the compiler
+ * neither inlines nor predicts them.
+ *
+ * At startup the records are read back and fed to the compiler whenever
+ * its queue runs dry, so they never hold up traces the interpreter asks
+ * for.  A record is only queued once its class has been initialized and
+ * everything its instructions refer to has been resolved, like a trace
+ * selected by the interpreter would be; until then it is retried a few
+ * times.
+ *
+ * Processes that share the file keep the records for DEX files they
+ * have not loaded themselves.
+ */
+
+#include "Dalvik.h"
+#include "libdex/DexClass.h"
+#include "interp/Jit.h"
+#include "CompilerInternals.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define HOT_TRACE_MAGIC         0x4a495454      /* "JITT" */
+#define HOT_TRACE_VERSION       1
+
+/* Upper bound on the number of records in a file */
+#define HOT_TRACE_MAX_RECORDS   8192
+
+/* Upper bound on the size of a file */
+#define HOT_TRACE_MAX_FILE_SIZE (1024 * 1024)
+
+/* Records queued each time the compiler runs out of work */
+#define HOT_TRACE_FEED_BATCH    16
+
+/* Times an unresolved record is retried before it is dropped */
+#define HOT_TRACE_MAX_ATTEMPTS  8
+
+struct HotTraceFileHeader {
+    u4 magic;
+    u4 version;
+    u4 numRecords;
+};
+
+/*
+ * A record is followed by its runs.  Only the last run ends the trace.
+ */
+struct HotTraceRecord {
+    u4 checksum;
+    u4 methodIdx;
+    u2 numRuns;
+    u2 pad;
+};
+
+struct HotTraceRun {
+    u2 startOffset;
+    u1 numInsts;
+    u1 hint;
+};
+
+struct PendingHotTrace {
+    const HotTraceRecord* record;
+    int attempts;
+};
+
+/* A growable buffer of records being written out */
+struct HotTraceBuffer {
+    u1* data;
+    size_t length;
+    size_t capacity;
+    u4 numRecords;
+};
+
+/* Guards everything below, and writes of the file */
+static pthread_mutex_t hotTraceLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Contents of the file read at startup; the pending records point in it */
+static u1* loadedFile;
+static PendingHotTrace* pendingTraces;
+static int numPendingTraces;
+
+static size_t recordSize(const HotTraceRecord* record)
+{
+    return sizeof(HotTraceRecord) + record->numRuns * sizeof(HotTraceRun);
+}
+
+/*
+ * Read the whole file.  Returns NULL if there is no usable file.
+ */
+static u1* readHotTraceFile(const char* fileName, size_t* pLength)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    u1* data = NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(HotTraceFileHeader)
+        && st.st_size <= HOT_TRACE_MAX_FILE_SIZE) {
+        data = (u1*) malloc(st.st_size);
+        if (data != NULL && read(fd, data, st.st_size) != st.st_size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    close(fd);
+    if (data == NULL) {
+        ALOGW("JIT: ignoring unreadable trace file %s", fileName);
+        return NULL;
+    }
+    const HotTraceFileHeader* header = (const HotTraceFileHeader*) data;
+    if (header->magic != HOT_TRACE_MAGIC ||
+        header->version != HOT_TRACE_VERSION) {
+        ALOGW("JIT: ignoring trace file %s with bad header", fileName);
+        free(data);
+        return NULL;
+    }
+    *pLength = st.st_size;
+    return data;
+}
+
+/*
+ * Call <func> on each record of a file read by readHotTraceFile(), up to
+ * the first one that is truncated.
+ */
+static void forEachRecord(const u1* data, size_t length,
+                          void (*func)(const HotTraceRecord*, void*),
+                          void* arg)
+{
+    const HotTraceFileHeader* header = (const HotTraceFileHeader*) data;
+    const u1* ptr = data + sizeof(HotTraceFileHeader);
+    const u1* end = data + length;
+    for (u4 i = 0; i < header->numRecords; i++) {
+        const HotTraceRecord* record = (const HotTraceRecord*) ptr;
+        if (ptr + sizeof(HotTraceRecord) > end ||
+            ptr + recordSize(record) > end || record->numRuns == 0) {
+            break;
+        }
+        (*func)(record, arg);
+        ptr += recordSize(record);
+    }
+}
+
+static int addUserDex(void* data, void* arg)
+{
+    DvmDex*** pNext = (DvmDex***) arg;
+    *(*pNext)++ = dvmGetDexOrJarDex(data);
+    return 0;
+}
+
+/*
+ * Collect the DEX files loaded by the boot and user class loaders.
+ * The caller must hold the lock on gDvm.userDexFiles, so that none of
+ * them goes away.  Returns the number of files; *pDexes must be freed.
+ */
+static int collectDexFiles(DvmDex*** pDexes)
+{
+    int count = dvmHashTableNumEntries(gDvm.userDexFiles);
+    for (const ClassPathEntry* cpe = gDvm.bootClassPath;
+         cpe != NULL && cpe->kind != kCpeLastEntry; cpe++) {
+        count++;
+    }
+    DvmDex** dexes = (DvmDex**) malloc(sizeof(DvmDex*) * (count + 1));
+    if (dexes == NULL) {
+        *pDexes = NULL;
+        return 0;
+    }
+    DvmDex** next = dexes;
+    for (const ClassPathEntry* cpe = gDvm.bootClassPath;
+         cpe != NULL && cpe->kind != kCpeLastEntry; cpe++) {
+        if (cpe->kind == kCpeJar) {
+            *next++ = dvmGetJarFileDex((JarFile*) cpe->ptr);
+        } else if (cpe->kind == kCpeDex) {
+            *next++ = dvmGetRawDexFileDex((RawDexFile*) cpe->ptr);
+        }
+    }
+    dvmHashForeach(gDvm.userDexFiles, addUserDex, &next);
+    *pDexes = dexes;
+    return next - dexes;
+}
+
+static DvmDex* findDex(DvmDex** dexes, int numDexes, u4 checksum)
+{
+    for (int i = 0; i < numDexes; i++) {
+        if (dexes[i] != NULL && dexes[i]->pHeader->checksum == checksum) {
+            return dexes[i];
+        }
+    }
+    return NULL;
+}
+
+static bool isBootDex(const DvmDex* pDvmDex)
+{
+    for (const ClassPathEntry* cpe = gDvm.bootClassPath;
+         cpe != NULL && cpe->kind != kCpeLastEntry; cpe++) {
+        if ((cpe->kind == kCpeJar &&
+             dvmGetJarFileDex((JarFile*) cpe->ptr) == pDvmDex) ||
+            (cpe->kind == kCpeDex &&
+             dvmGetRawDexFileDex((RawDexFile*) cpe->ptr) == pDvmDex)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Find the loaded class with the given descriptor that was defined from
+ * <pDvmDex>.  Classes of a user DEX file are looked up with the loader
+ * of any class from it that has been resolved.
+ */
+static ClassObject* findDefinedClass(DvmDex* pDvmDex, u4 typeIdx)
+{
+    ClassObject* clazz = pDvmDex->pResClasses[typeIdx];
+    if (clazz == NULL) {
+        const char* descriptor =
+            dexStringByTypeIdx(pDvmDex->pDexFile, typeIdx);
+        if (isBootDex(pDvmDex)) {
+            clazz = dvmLookupClass(descriptor, NULL, false);
+        } else {
+            for (u4 i = 0; i < pDvmDex->pHeader->typeIdsSize; i++) {
+                ClassObject* other = pDvmDex->pResClasses[i];
+                if (other != NULL && other->pDvmDex == pDvmDex) {
+                    clazz = dvmLookupClass(descriptor, other->classLoader,
+                                           false);
+                    break;
+                }
+            }
+        }
+    }
+    if (clazz == NULL || clazz->pDvmDex != pDvmDex) {
+        return NULL;
+    }
+    return clazz;
+}
+
+static const Method* findMethod(DvmDex* pDvmDex, u4 methodIdx)
+{
+    if (methodIdx >= pDvmDex->pHeader->methodIdsSize) {
+        return NULL;
+    }
+    const Method* method = pDvmDex->pResMethods[methodIdx];
+    if (method != NULL && method->clazz->pDvmDex == pDvmDex) {
+        return method;
+    }
+    const DexFile* pDexFile = pDvmDex->pDexFile;
+    const DexMethodId* pMethodId = dexGetMethodId(pDexFile, methodIdx);
+    ClassObject* clazz = findDefinedClass(pDvmDex, pMethodId->classIdx);
+    if (clazz == NULL) {
+        return NULL;
+    }
+    const char* name = dexStringById(pDexFile, pMethodId->nameIdx);
+    DexProto proto;
+    dexProtoSetFromMethodId(&proto, pDexFile, pMethodId);
+    method = dvmFindDirectMethod(clazz, name, &proto);
+    if (method == NULL) {
+        method = dvmFindVirtualMethod(clazz, name, &proto);
+    }
+    return method;
+}
+
+/*
+ * Return true if everything an instruction refers to through the
+ * constant pool has been resolved.  The code generators expect this of
+ * the traces they are handed.
+ */
+static bool isResolved(const DvmDex* pDvmDex, const u2* insns)
+{
+    Opcode opcode = dexOpcodeFromCodeUnit(*insns);
+    InstructionIndexType indexType = dexGetIndexTypeFromOpcode(opcode);
+    if (indexType == kIndexNone || indexType == kIndexInlineMethod ||
+        indexType == kIndexVtableOffset || indexType == kIndexFieldOffset) {
+        return true;
+    }
+    DecodedInstruction dec;
+    dexDecodeInstruction(insns, &dec);
+    u4 idx = (dexGetFormatFromOpcode(opcode) == kFmt22c) ? dec.vC : dec.vB;
+    switch (indexType) {
+        case kIndexTypeRef:
+            return pDvmDex->pResClasses[idx] != NULL;
+        case kIndexStringRef:
+            return pDvmDex->pResStrings[idx] != NULL;
+        case kIndexMethodRef:
+            return pDvmDex->pResMethods[idx] != NULL;
+        case kIndexFieldRef:
+            return pDvmDex->pResFields[idx] != NULL;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Find the method a direct, static or super invoke in <method> calls, the
+ * way the interpreter does when it records the trace.  Returns NULL for
+ * other invokes.  Sets *pStale if the call can't be bound.
+ */
+static const Method* findSingletonCallee(const DvmDex* pDvmDex,
+    const Method* method, const u2* insns, bool* pStale)
+{
+    DecodedInstruction dec;
+    dexDecodeInstruction(insns, &dec);
+    const Method* callee = NULL;
+    const ClassObject* super = method->clazz->super;
+    switch (dec.opcode) {
+        case OP_INVOKE_DIRECT:
+        case OP_INVOKE_DIRECT_RANGE:
+        case OP_INVOKE_STATIC:
+        case OP_INVOKE_STATIC_RANGE:
+            callee = pDvmDex->pResMethods[dec.vB];
+            break;
+        case OP_INVOKE_SUPER:
+        case OP_INVOKE_SUPER_RANGE: {
+            const Method* baseMethod = pDvmDex->pResMethods[dec.vB];
+            if (super == NULL ||
+                baseMethod->methodIndex >= super->vtableCount) {
+                *pStale = true;
+                return NULL;
+            }
+            callee = super->vtable[baseMethod->methodIndex];
+            break;
+        }
+        case OP_INVOKE_SUPER_QUICK:
+        case OP_INVOKE_SUPER_QUICK_RANGE:
+            if (super == NULL || dec.vB >= (u4) super->vtableCount) {
+                *pStale = true;
+                return NULL;
+            }
+            callee = super->vtable[dec.vB];
+            break;
+        default:
+            break;
+    }
+    return callee;
+}
+
+/*
+ * Rebuild the trace description of a record.  Returns NULL if the
+ * trace can't be compiled yet, and sets *pStale if it never will be.
+ */
+static JitTraceDescription* buildTraceDescription(
+    const HotTraceRecord* record, DvmDex** dexes, int numDexes, bool* pStale)
+{
+    *pStale = false;
+    DvmDex* pDvmDex = findDex(dexes, numDexes, record->checksum);
+    if (pDvmDex == NULL) {
+        return NULL;
+    }
+    const Method* method = findMethod(pDvmDex, record->methodIdx);
+    if (method == NULL || !dvmIsClassInitialized(method->clazz)) {
+        return NULL;
+    }
+    if (dvmIsNativeMethod(method) || dvmIsAbstractMethod(method)) {
+        *pStale = true;
+        return NULL;
+    }
+
+    /*
+     * As in a trace the interpreter selects, an invoke ends its run and
+     * is followed by JIT_TRACE_CUR_METHOD meta runs, and a trace that
+     * ends in meta runs gets an empty code run to mark its end.
+     */
+    const HotTraceRun* runs = (const HotTraceRun*) (record + 1);
+    u4 insnsSize = dvmGetMethodInsnsSize(method);
+    int numInvokes = 0;
+    for (int i = 0; i < record->numRuns; i++) {
+        u4 offset = runs[i].startOffset;
+        for (int j = 0; j < runs[i].numInsts; j++) {
+            if (offset >= insnsSize) {
+                *pStale = true;
+                return NULL;
+            }
+            if (!isResolved(pDvmDex, method->insns + offset)) {
+                return NULL;
+            }
+            size_t width = dexGetWidthFromInstruction(method->insns + offset);
+            if (width == 0) {
+                *pStale = true;
+                return NULL;
+            }
+            Opcode opcode = dexOpcodeFromCodeUnit(method->insns[offset]);
+            if (dexGetFlagsFromOpcode(opcode) & kInstrInvoke) {
+                if (j != runs[i].numInsts - 1) {
+                    *pStale = true;
+                    return NULL;
+                }
+                numInvokes++;
+            }
+            offset += width;
+        }
+    }
+
+    JitTraceDescription* desc = (JitTraceDescription*)
+        malloc(sizeof(JitTraceDescription) + sizeof(JitTraceRun) *
+               (record->numRuns + numInvokes * JIT_TRACE_CUR_METHOD + 1));
+    if (desc == NULL) {
+        return NULL;
+    }
+    desc->method = method;
+    JitTraceRun* run = desc->trace;
+    for (int i = 0; i < record->numRuns; i++) {
+        memset(run, 0, sizeof(*run));
+        run->isCode = true;
+        run->info.frag.startOffset = runs[i].startOffset;
+        run->info.frag.numInsts = runs[i].numInsts;
+        run->info.frag.hint = (JitHint) runs[i].hint;
+
+        const u2* lastInsn = method->insns + runs[i].startOffset;
+        for (int j = 1; j < runs[i].numInsts; j++) {
+            lastInsn += dexGetWidthFromInstruction(lastInsn);
+        }
+        run++;
+        if (runs[i].numInsts == 0 ||
+            !(dexGetFlagsFromOpcode(dexOpcodeFromCodeUnit(*lastInsn)) &
+              kInstrInvoke)) {
+            continue;
+        }
+        const Method* callee =
+            findSingletonCallee(pDvmDex, method, lastInsn, pStale);
+        if (*pStale) {
+            free(desc);
+            return NULL;
+        }
+        for (int k = JIT_TRACE_CLASS_DESC; k <= JIT_TRACE_CUR_METHOD; k++) {
+            memset(run, 0, sizeof(*run));
+            run->isCode = false;
+            run->info.meta = (k == JIT_TRACE_CUR_METHOD) ? (void*) callee
+                                                         : NULL;
+            run++;
+        }
+    }
+    if (!run[-1].isCode) {
+        memset(run, 0, sizeof(*run));
+        run->isCode = true;
+        run++;
+    }
+    run[-1].info.frag.runEnd = true;
+    return desc;
+}
+
+static void addPendingTrace(const HotTraceRecord* record, void* arg)
+{
+    if (numPendingTraces < HOT_TRACE_MAX_RECORDS) {
+        pendingTraces[numPendingTraces].record = record;
+        pendingTraces[numPendingTraces].attempts = 0;
+        numPendingTraces++;
+    }
+}
+
+void dvmCompilerLoadHotTraces(void)
+{
+    if (gDvmJit.hotTraceFile == NULL) {
+        return;
+    }
+    size_t length;
+    u1* data = readHotTraceFile(gDvmJit.hotTraceFile, &length);
+    if (data == NULL) {
+        return;
+    }
+    dvmLockMutex(&hotTraceLock);
+    assert(loadedFile == NULL);
+    pendingTraces = (PendingHotTrace*)
+        malloc(sizeof(PendingHotTrace) * HOT_TRACE_MAX_RECORDS);
+    if (pendingTraces != NULL) {
+        loadedFile = data;
+        forEachRecord(data, length, addPendingTrace, NULL);
+        ALOGD("JIT: read %d hot traces from %s", numPendingTraces,
+             gDvmJit.hotTraceFile);
+    } else {
+        free(data);
+    }
+    dvmUnlockMutex(&hotTraceLock);
+}
+
+bool dvmCompilerFeedHotTraces(void)
+{
+    int queued = 0;
+
+    dvmLockMutex(&hotTraceLock);
+    if (numPendingTraces == 0) {
+        dvmUnlockMutex(&hotTraceLock);
+        return false;
+    }
+    dvmHashTableLock(gDvm.userDexFiles);
+    DvmDex** dexes;
+    int numDexes = collectDexFiles(&dexes);
+    int kept = 0;
+    for (int i = 0; i < numPendingTraces; i++) {
+        PendingHotTrace pending = pendingTraces[i];
+        if (queued < HOT_TRACE_FEED_BATCH && !gDvmJit.haltCompilerThread) {
+            bool stale;
+            JitTraceDescription* desc =
+                buildTraceDescription(pending.record, dexes, numDexes, &stale);
+            if (desc != NULL) {
+                const u2* dPC =
+                    desc->method->insns + desc->trace[0].info.frag.startOffset;
+                if (!dvmJitRequestTrace(dPC, desc)) {
+                    free(desc);
+                }
+                queued++;
+                continue;
+            }
+            if (stale || ++pending.attempts >= HOT_TRACE_MAX_ATTEMPTS) {
+                continue;
+            }
+        }
+        pendingTraces[kept++] = pending;
+    }
+    numPendingTraces = kept;
+    free(dexes);
+    dvmHashTableUnlock(gDvm.userDexFiles);
+
+    if (numPendingTraces == 0) {
+        free(pendingTraces);
+        pendingTraces = NULL;
+        free(loadedFile);
+        loadedFile = NULL;
+    }
+    dvmUnlockMutex(&hotTraceLock);
+    return queued > 0;
+}
+
+static bool appendBytes(HotTraceBuffer* buf, const void* bytes, size_t n)
+{
+    if (buf->length + n > buf->capacity) {
+        size_t capacity = MAX(buf->capacity * 2, buf->length + n + 4096);
+        u1* data = (u1*) realloc(buf->data, capacity);
+        if (data == NULL) {
+            return false;
+        }
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->length, bytes, n);
+    buf->length += n;
+    return true;
+}
+
+static void appendRecord(const HotTraceRecord* record, HotTraceBuffer* buf)
+{
+    if (buf->numRecords < HOT_TRACE_MAX_RECORDS &&
+        appendBytes(buf, record, recordSize(record))) {
+        buf->numRecords++;
+    }
+}
+
+/*
+ * Find the index of a method in the method_ids of its DEX file.  The
+ * methods of a class are laid out in the order of its class data.
+ */
+static bool getMethodIdx(const Method* method, u4* pMethodIdx)
+{
+    const ClassObject* clazz = method->clazz;
+    const DexFile* pDexFile = clazz->pDvmDex->pDexFile;
+    const DexClassDef* pClassDef = dexFindClass(pDexFile, clazz->descriptor);
+    if (pClassDef == NULL) {
+        return false;
+    }
+    const u1* pEncodedData = dexGetClassData(pDexFile, pClassDef);
+    if (pEncodedData == NULL) {
+        return false;
+    }
+    DexClassData* pClassData = dexReadAndVerifyClassData(&pEncodedData, NULL);
+    if (pClassData == NULL) {
+        return false;
+    }
+    bool found = false;
+    if (method >= clazz->directMethods &&
+        method < clazz->directMethods + clazz->directMethodCount) {
+        u4 i = method - clazz->directMethods;
+        if (i < pClassData->header.directMethodsSize) {
+            *pMethodIdx = pClassData->directMethods[i].methodIdx;
+            found = true;
+        }
+    } else if (method >= clazz->virtualMethods &&
+               method < clazz->virtualMethods + clazz->virtualMethodCount) {
+        u4 i = method - clazz->virtualMethods;
+        if (i < pClassData->header.virtualMethodsSize) {
+            *pMethodIdx = pClassData->virtualMethods[i].methodIdx;
+            found = true;
+        }
+    }
+    free(pClassData);
+    return found;
+}
+
+/*
+ * Add the code runs of a translated trace to the buffer.
+ */
+static void appendTranslation(const JitTraceDescription* desc,
+                              HotTraceBuffer* buf)
+{
+    const Method* method = desc->method;
+    HotTraceRecord record;
+    if (buf->numRecords >= HOT_TRACE_MAX_RECORDS ||
+        method->clazz->pDvmDex == NULL ||
+        !getMethodIdx(method, &record.methodIdx)) {
+        return;
+    }
+    record.checksum = method->clazz->pDvmDex->pHeader->checksum;
+    record.numRuns = 0;
+    record.pad = 0;
+
+    size_t start = buf->length;
+    if (!appendBytes(buf, &record, sizeof(record))) {
+        return;
+    }
+    const JitTraceRun* run = desc->trace;
+    for (;; run++) {
+        if (!run->isCode) {
+            continue;
+        }
+        if (run->info.frag.numInsts != 0) {
+            HotTraceRun out;
+            out.startOffset = run->info.frag.startOffset;
+            out.numInsts = run->info.frag.numInsts;
+            out.hint = run->info.frag.hint;
+            if (!appendBytes(buf, &out, sizeof(out))) {
+                buf->length = start;
+                return;
+            }
+            record.numRuns++;
+        }
+        if (run->info.frag.runEnd) {
+            break;
+        }
+    }
+    if (record.numRuns == 0) {
+        buf->length = start;
+        return;
+    }
+    memcpy(buf->data + start, &record, sizeof(record));
+    buf->numRecords++;
+}
+
+/*
+ * Turn <desc> into a record and back, as a save in one run and a load in
+ * the next would.  Used by the tests.  Returns NULL if the trace can't be
+ * saved or rebuilt; the result must be freed.
+ */
+JitTraceDescription* dvmCompilerRebuildHotTrace(const JitTraceDescription* desc)
+{
+    HotTraceBuffer buf;
+    memset(&buf, 0, sizeof(buf));
+    appendTranslation(desc, &buf);
+    JitTraceDescription* rebuilt = NULL;
+    if (buf.numRecords == 1) {
+        dvmHashTableLock(gDvm.userDexFiles);
+        DvmDex** dexes;
+        int numDexes = collectDexFiles(&dexes);
+        bool stale;
+        rebuilt = buildTraceDescription((const HotTraceRecord*) buf.data,
+                                        dexes, numDexes, &stale);
+        free(dexes);
+        dvmHashTableUnlock(gDvm.userDexFiles);
+    }
+    free(buf.data);
+    return rebuilt;
+}
+
+struct CarryOverArgs {
+    HotTraceBuffer* buf;
+    DvmDex** dexes;
+    int numDexes;
+};
+
+static void carryOverForeignRecord(const HotTraceRecord* record, void* arg)
+{
+    CarryOverArgs* args = (CarryOverArgs*) arg;
+    if (findDex(args->dexes, args->numDexes, record->checksum) == NULL) {
+        appendRecord(record, args->buf);
+    }
+}
+
+void dvmCompilerSaveHotTraces(void)
+{
+    if (gDvmJit.hotTraceFile == NULL || gDvmJit.pJitEntryTable == NULL) {
+        return;
+    }
+    HotTraceBuffer buf;
+    memset(&buf, 0, sizeof(buf));
+    HotTraceFileHeader header;
+    header.magic = HOT_TRACE_MAGIC;
+    header.version = HOT_TRACE_VERSION;
+    header.numRecords = 0;
+    if (!appendBytes(&buf, &header, sizeof(header))) {
+        return;
+    }
+
+    dvmLockMutex(&hotTraceLock);
+
+    /* The translations in the JitTable */
+    dvmLockMutex(&gDvmJit.tableLock);
+    for (unsigned int i = 0; i < gDvmJit.jitTableSize; i++) {
+        const JitEntry* entry = &gDvmJit.pJitEntryTable[i];
+        if (entry->dPC == NULL || entry->codeAddress == NULL ||
+            entry->u.info.isMethodEntry ||
+            entry->codeAddress == dvmCompilerGetInterpretTemplate()) {
+            continue;
+        }
+        JitTraceDescription* desc = dvmCopyTraceDescriptor(NULL, entry);
+        if (desc != NULL) {
+            appendTranslation(desc, &buf);
+            free(desc);
+        }
+    }
+    dvmUnlockMutex(&gDvmJit.tableLock);
+
+    /*
+     * Records read at startup that have not been compiled yet, and
+     * those another process sharing the file left for DEX files this
+     * one doesn't have.
+     */
+    dvmHashTableLock(gDvm.userDexFiles);
+    DvmDex** dexes;
+    int numDexes = collectDexFiles(&dexes);
+    for (int i = 0; i < numPendingTraces; i++) {
+        const HotTraceRecord* record = pendingTraces[i].record;
+        if (findDex(dexes, numDexes, record->checksum) != NULL) {
+            appendRecord(record, &buf);
+        }
+    }
+    size_t length;
+    u1* oldFile = readHotTraceFile(gDvmJit.hotTraceFile, &length);
+    if (oldFile != NULL) {
+        CarryOverArgs args = { &buf, dexes, numDexes };
+        forEachRecord(oldFile, length, carryOverForeignRecord, &args);
+        free(oldFile);
+    }
+    free(dexes);
+    dvmHashTableUnlock(gDvm.userDexFiles);
+
+    if (buf.data != NULL) {
+        ((HotTraceFileHeader*) buf.data)->numRecords = buf.numRecords;
+
+        /* Write a new file and rename it, so readers never see a partial one */
+        char tmpName[PATH_MAX];
+        snprintf(tmpName, sizeof(tmpName), "%s.%d", gDvmJit.hotTraceFile,
+                 getpid());
+        int fd = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            ALOGW("JIT: can't create %s: %s", tmpName, strerror(errno));
+        } else {
+            bool ok = sysWriteFully(fd, buf.data, buf.length, "hot traces")
+                      == 0;
+            close(fd);
+            if (!ok || rename(tmpName, gDvmJit.hotTraceFile) != 0) {
+                ALOGW("JIT: can't write %s", gDvmJit.hotTraceFile);
+                unlink(tmpName);
+            } else {
+                ALOGD("JIT: saved %d hot traces to %s", buf.numRecords,
+                     gDvmJit.hotTraceFile);
+            }
+        }
+    }
+    dvmUnlockMutex(&hotTraceLock);
+    free(buf.data);
+}
@@ -222,6 +222,277 @@ static bool inlineSetter(CompilationUnit *cUnit,
     return true;
 }
 
+/*
+ * Convert a reg id of a simple callee. The single local register (if any)
+ * shares the caller register that receives the result.
+ */
+static inline u4 convertSimpleRegId(const DecodedInstruction *invoke,
+                                    const Method *calleeMethod,
+                                    int calleeRegId, u4 resultReg,
+                                    bool isRange)
+{
+    if (calleeRegId < calleeMethod->registersSize - calleeMethod->insSize) {
+        return resultReg;
+    }
+    return convertRegId(invoke, calleeMethod, calleeRegId, isRange);
+}
+
+/* Relative target of a goto or if-* instruction */
+static int branchOffset(const DecodedInstruction *insn)
+{
+    switch (dexGetFormatFromOpcode(insn->opcode)) {
+        case kFmt21t:
+            return (int) insn->vB;
+        case kFmt22t:
+            return (int) insn->vC;
+        default:
+            return (int) insn->vA;
+    }
+}
+
+static MIR *newCalleeMIR(const Method *calleeMethod, const MIR *invokeMIR,
+                         const DecodedInstruction *insn)
+{
+    MIR *mir = (MIR *)dvmCompilerNew(sizeof(MIR), true);
+
+    mir->dalvikInsn = *insn;
+    mir->width = dexGetWidthFromOpcode(insn->opcode);
+    mir->OptimizationFlags |= MIR_CALLEE;
+    /*
+     * If the instruction is about to raise any exception, punt to the
+     * interpreter and re-execute the invoke.
+     */
+    mir->offset = invokeMIR->offset;
+    mir->meta.calleeMethod = calleeMethod;
+    return mir;
+}
+
+/*
+ * Copy a small callee with forward branches (see METHOD_IS_SIMPLE) into the
+ * trace as a set of new basic blocks. Returns are turned into moves to the
+ * register of the move-result and jump back to the code after it.
+ *
+ * An exception raised by the copy re-executes the invoke in the interpreter,
+ * so the caller's registers must look untouched until the last instruction
+ * that can throw: the callee may not write its arguments, and may not write
+ * its local before anything that can throw.
+ */
+static bool inlineSimpleCallee(CompilationUnit *cUnit,
+                               const Method *calleeMethod,
+                               MIR *invokeMIR,
+                               BasicBlock *invokeBB,
+                               bool isPredicted,
+                               bool isRange)
+{
+    BasicBlock *moveResultBB = invokeBB->fallThrough;
+    MIR *moveResultMIR = moveResultBB->firstMIRInsn;
+    const DecodedInstruction *invokeInsn = &invokeMIR->dalvikInsn;
+    int insnsSize = dvmGetMethodInsnsSize(calleeMethod);
+    int numLocals = calleeMethod->registersSize - calleeMethod->insSize;
+    DecodedInstruction calleeInsns[JIT_MAX_INLINE_SIZE];
+    int calleeOffsets[JIT_MAX_INLINE_SIZE];
+    bool isLeader[JIT_MAX_INLINE_SIZE + 1];
+    BasicBlock *blockAt[JIT_MAX_INLINE_SIZE];
+    bool localWritten = false;
+    int numInsns = 0;
+    int offset;
+    int i;
+
+    if (insnsSize > JIT_MAX_INLINE_SIZE) {
+#if defined(WITH_JIT_TUNING)
+        gDvmJit.invokeInlineTooBig++;
+#endif
+        return false;
+    }
+
+    if ((moveResultMIR == NULL) ||
+        (moveResultMIR->dalvikInsn.opcode != OP_MOVE_RESULT &&
+         moveResultMIR->dalvikInsn.opcode != OP_MOVE_RESULT_OBJECT)) {
+        return false;
+    }
+    u4 resultReg = moveResultMIR->dalvikInsn.vA;
+
+    if (isPredicted && moveResultBB->fallThrough == NULL) {
+        return false;
+    }
+
+    /* The local would clobber an argument that is still needed */
+    for (i = 0; i < (int) invokeInsn->vA; i++) {
+        u4 argReg = isRange ? invokeInsn->vC + i : invokeInsn->arg[i];
+        if (argReg == resultReg) {
+            return false;
+        }
+    }
+
+    memset(isLeader, 0, sizeof(isLeader));
+    memset(blockAt, 0, sizeof(blockAt));
+    isLeader[0] = true;
+
+    /* Decode the callee, rename its registers and find the block leaders */
+    for (offset = 0; offset < insnsSize; ) {
+        const u2 *codePtr = calleeMethod->insns + offset;
+        int width = dexGetWidthFromInstruction(codePtr);
+        DecodedInstruction *insn = &calleeInsns[numInsns];
+
+        /* Terminate when the data section is seen */
+        if (width == 0)
+            break;
+
+        /* Initialize vC to get Valgrind happy (see inlineGetter) */
+        insn->vC = 0;
+        dexDecodeInstruction(codePtr, insn);
+
+        if (!dvmCompilerCanIncludeThisInstruction(calleeMethod, insn))
+            return false;
+
+        int flags = dexGetFlagsFromOpcode(insn->opcode);
+        int dfFlags = dvmCompilerDataFlowAttributes[insn->opcode];
+
+        if ((flags & kInstrCanThrow) && localWritten)
+            return false;
+
+        if (dfFlags & DF_DA) {
+            if ((int) insn->vA >= numLocals)
+                return false;
+            localWritten = true;
+        }
+
+        if (flags & kInstrCanBranch) {
+            int target = offset + branchOffset(insn);
+            if (target <= offset || target >= insnsSize)
+                return false;
+            isLeader[target] = true;
+            isLeader[offset + width] = true;
+        } else if (flags & kInstrCanReturn) {
+            isLeader[offset + width] = true;
+        }
+
+        if (dfFlags & (DF_DA | DF_UA)) {
+            insn->vA = convertSimpleRegId(invokeInsn, calleeMethod, insn->vA,
+                                          resultReg, isRange);
+        }
+        if (dfFlags & DF_UB) {
+            insn->vB = convertSimpleRegId(invokeInsn, calleeMethod, insn->vB,
+                                          resultReg, isRange);
+        }
+        if (dfFlags & DF_UC) {
+            insn->vC = convertSimpleRegId(invokeInsn, calleeMethod, insn->vC,
+                                          resultReg, isRange);
+        }
+
+        calleeOffsets[numInsns++] = offset;
+        offset += width;
+    }
+
+    /*
+     * Create the blocks. Their start offset lies past the invoke so that
+     * branches between them are never mistaken for loops.
+     */
+    for (i = 0; i < numInsns; i++) {
+        offset = calleeOffsets[i];
+        if (isLeader[offset]) {
+            BasicBlock *bb = dvmCompilerNewBB(kDalvikByteCode,
+                                              cUnit->numBlocks++);
+            bb->startOffset = moveResultMIR->offset;
+            dvmInsertGrowableList(&cUnit->blockList, (intptr_t) bb);
+            blockAt[offset] = bb;
+        }
+    }
+
+    /* Predicted returns skip the move-result of the slow path */
+    BasicBlock *joinBB = isPredicted ? moveResultBB->fallThrough :
+                                       moveResultBB;
+    BasicBlock *curBB = NULL;
+
+    for (i = 0; i < numInsns; i++) {
+        DecodedInstruction *insn = &calleeInsns[i];
+        int flags = dexGetFlagsFromOpcode(insn->opcode);
+        int nextOffset;
+
+        offset = calleeOffsets[i];
+        nextOffset = offset + dexGetWidthFromOpcode(insn->opcode);
+        if (isLeader[offset]) {
+            curBB = blockAt[offset];
+        }
+
+        if (flags & kInstrCanReturn) {
+            if (insn->vA != resultReg) {
+                DecodedInstruction moveInsn;
+                memset(&moveInsn, 0, sizeof(moveInsn));
+                moveInsn.opcode = (insn->opcode == OP_RETURN_OBJECT) ?
+                                  OP_MOVE_OBJECT : OP_MOVE;
+                moveInsn.vA = resultReg;
+                moveInsn.vB = insn->vA;
+                dvmCompilerAppendMIR(curBB,
+                                     newCalleeMIR(calleeMethod, invokeMIR,
+                                                  &moveInsn));
+            }
+            curBB->fallThrough = joinBB;
+            curBB->needFallThroughBranch = true;
+            dvmCompilerSetBit(joinBB->predecessors, curBB->id);
+            continue;
+        }
+
+        dvmCompilerAppendMIR(curBB, newCalleeMIR(calleeMethod, invokeMIR,
+                                                 insn));
+
+        if (flags & kInstrCanBranch) {
+            int target = offset + branchOffset(insn);
+            curBB->taken = blockAt[target];
+            dvmCompilerSetBit(curBB->taken->predecessors, curBB->id);
+            if (flags & kInstrCanContinue) {
+                curBB->fallThrough = blockAt[nextOffset];
+                dvmCompilerSetBit(curBB->fallThrough->predecessors,
+                                  curBB->id);
+            }
+        } else if (isLeader[nextOffset]) {
+            /* Falling into a branch target */
+            curBB->fallThrough = blockAt[nextOffset];
+            curBB->needFallThroughBranch = true;
+            dvmCompilerSetBit(curBB->fallThrough->predecessors, curBB->id);
+        }
+    }
+
+    BasicBlock *entryBB = blockAt[0];
+
+    if (isPredicted) {
+        MIR *invokeMIRSlow = (MIR *)dvmCompilerNew(sizeof(MIR), true);
+        *invokeMIRSlow = *invokeMIR;
+        invokeMIR->dalvikInsn.opcode = (Opcode)kMirOpCheckInlinePrediction;
+
+        /* Use vC to denote the first argument (ie this) */
+        if (!isRange) {
+            invokeMIR->dalvikInsn.vC = invokeMIRSlow->dalvikInsn.arg[0];
+        }
+
+        moveResultMIR->OptimizationFlags |= MIR_INLINED_PRED;
+
+        dvmCompilerInsertMIRAfter(invokeBB, invokeMIR, invokeMIRSlow);
+        invokeMIRSlow->OptimizationFlags |= MIR_INLINED_PRED;
+
+        /* The landing pad branches here when the prediction holds */
+        invokeMIR->meta.callsiteInfo->inlinedEntry = entryBB;
+        dvmCompilerSetBit(entryBB->predecessors, invokeBB->id);
+#if defined(WITH_JIT_TUNING)
+        gDvmJit.invokePolySimpleInlined++;
+#endif
+    } else {
+        invokeMIR->OptimizationFlags |= MIR_INLINED;
+        moveResultMIR->OptimizationFlags |= MIR_INLINED;
+
+        /* The invoke becomes no-op - jump into the inlined body instead */
+        dvmCompilerClearBit(moveResultBB->predecessors, invokeBB->id);
+        invokeBB->fallThrough = entryBB;
+        invokeBB->needFallThroughBranch = true;
+        dvmCompilerSetBit(entryBB->predecessors, invokeBB->id);
+#if defined(WITH_JIT_TUNING)
+        gDvmJit.invokeMonoSimpleInlined++;
+#endif
+    }
+
+    return true;
+}
+
 static bool tryInlineSingletonCallsite(CompilationUnit *cUnit,
                                        const Method *calleeMethod,
                                        MIR *invokeMIR,
@@ -252,6 +523,9 @@ static bool tryInlineSingletonCallsite(CompilationUnit *cUnit,
     } else if (methodStats->attributes & METHOD_IS_SETTER) {
         return inlineSetter(cUnit, calleeMethod, invokeMIR, invokeBB, false,
                             isRange);
+    } else if (methodStats->attributes & METHOD_IS_SIMPLE) {
+        return inlineSimpleCallee(cUnit, calleeMethod, invokeMIR, invokeBB,
+                                  false, isRange);
     }
     return false;
 }
@@ -279,6 +553,9 @@ static bool tryInlineVirtualCallsite(CompilationUnit *cUnit,
     /* Not a Java method */
     if (dvmIsNativeMethod(calleeMethod)) return false;
 
+    /* No receiver class recorded to predict on */
+    if (invokeMIR->meta.callsiteInfo->classDescriptor == NULL) return false;
+
     CompilerMethodStats *methodStats =
         dvmCompilerAnalyzeMethodBody(calleeMethod, true);
 
@@ -294,6 +571,9 @@ static bool tryInlineVirtualCallsite(CompilationUnit *cUnit,
     } else if (methodStats->attributes & METHOD_IS_SETTER) {
         return inlineSetter(cUnit, calleeMethod, invokeMIR, invokeBB, true,
                             isRange);
+    } else if (methodStats->attributes & METHOD_IS_SIMPLE) {
+        return inlineSimpleCallee(cUnit, calleeMethod, invokeMIR, invokeBB,
+                                  true, isRange);
     }
     return false;
 }
@@ -17,24 +17,140 @@
 #include "Dalvik.h"
 #include "CompilerInternals.h"
 
-static ArenaMemBlock *arenaHead, *currentArena;
-static int numArenaBlocks;
+/*
+ * Each compiler thread allocates from its own chain of arena blocks, found
+ * through a thread-specific key, and resets the chain after every
+ * compilation.  The first block stays with the thread.  Later blocks
+ * grow geometrically as a compilation gets bigger, so a large method
+ * needs only a handful of them, and go back to a pool shared by all the
+ * compiler threads when the compilation is done.  The pool is capped, so
+ * one unusually big compilation does not pin its peak footprint for the
+ * life of the process.
+ */
+struct CompilerArena {
+    ArenaMemBlock *arenaHead;
+    ArenaMemBlock *currentArena;
+    int numArenaBlocks;
+};
+
+static pthread_key_t arenaKey;
+static pthread_once_t arenaKeyOnce = PTHREAD_ONCE_INIT;
+
+/* Blocks returned by finished compilations, guarded by arenaPoolLock */
+static pthread_mutex_t arenaPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static ArenaMemBlock *arenaPool;
+static size_t arenaPoolBytes;
+
+static ArenaMemBlock *allocArenaBlock(size_t blockSize)
+{
+    ArenaMemBlock *block =
+        (ArenaMemBlock *) malloc(sizeof(ArenaMemBlock) + blockSize);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->blockSize = blockSize;
+    block->bytesAllocated = 0;
+    block->next = NULL;
+    android_atomic_inc(&gDvmJit.arenaBlocks);
+    return block;
+}
+
+static void freeArenaBlock(ArenaMemBlock *block)
+{
+    android_atomic_dec(&gDvmJit.arenaBlocks);
+    free(block);
+}
+
+/*
+ * Find a block of at least "size" bytes, preferring one from the pool.
+ * A pooled block of the full "blockSize" is taken first, so that the
+ * chain keeps growing geometrically; failing that, the largest pooled
+ * block that still holds "size" is better than a new one.
+ */
+static ArenaMemBlock *getArenaBlock(size_t size, size_t blockSize)
+{
+    ArenaMemBlock **bestPrev = NULL;
+
+    dvmLockMutex(&arenaPoolLock);
+    for (ArenaMemBlock **prev = &arenaPool; *prev != NULL;
+         prev = &(*prev)->next) {
+        ArenaMemBlock *block = *prev;
+        if (block->blockSize >= blockSize) {
+            bestPrev = prev;
+            break;
+        }
+        if (block->blockSize >= size &&
+            (bestPrev == NULL || block->blockSize > (*bestPrev)->blockSize)) {
+            bestPrev = prev;
+        }
+    }
+    if (bestPrev != NULL) {
+        ArenaMemBlock *block = *bestPrev;
+        *bestPrev = block->next;
+        arenaPoolBytes -= block->blockSize;
+        gDvmJit.arenaPooledBlocks--;
+        dvmUnlockMutex(&arenaPoolLock);
+        block->bytesAllocated = 0;
+        block->next = NULL;
+        return block;
+    }
+    dvmUnlockMutex(&arenaPoolLock);
+    return allocArenaBlock(blockSize);
+}
+
+/*
+ * Give a chain of blocks back to the pool, freeing whatever would take
+ * the pool past ARENA_POOL_MAX_BYTES.
+ */
+static void putArenaBlocks(ArenaMemBlock *block)
+{
+    dvmLockMutex(&arenaPoolLock);
+    while (block != NULL) {
+        ArenaMemBlock *next = block->next;
+        if (arenaPoolBytes + block->blockSize <= ARENA_POOL_MAX_BYTES) {
+            block->next = arenaPool;
+            arenaPool = block;
+            arenaPoolBytes += block->blockSize;
+            gDvmJit.arenaPooledBlocks++;
+        } else {
+            freeArenaBlock(block);
+        }
+        block = next;
+    }
+    dvmUnlockMutex(&arenaPoolLock);
+}
+
+static void freeArena(void *arg)
+{
+    CompilerArena *arena = (CompilerArena *) arg;
+    putArenaBlocks(arena->arenaHead);
+    free(arena);
+}
+
+static void createArenaKey(void)
+{
+    pthread_key_create(&arenaKey, freeArena);
+}
 
 /* Allocate the initial memory block for arena-based allocation */
 bool dvmCompilerHeapInit(void)
 {
-    assert(arenaHead == NULL);
-    arenaHead =
-        (ArenaMemBlock *) malloc(sizeof(ArenaMemBlock) + ARENA_DEFAULT_SIZE);
-    if (arenaHead == NULL) {
+    pthread_once(&arenaKeyOnce, createArenaKey);
+    assert(pthread_getspecific(arenaKey) == NULL);
+    CompilerArena *arena = (CompilerArena *) calloc(1, sizeof(*arena));
+    if (arena == NULL) {
+        ALOGE("No memory left to create compiler heap memory");
+        return false;
+    }
+    arena->arenaHead = allocArenaBlock(ARENA_DEFAULT_SIZE);
+    if (arena->arenaHead == NULL) {
         ALOGE("No memory left to create compiler heap memory");
+        free(arena);
         return false;
     }
-    arenaHead->blockSize = ARENA_DEFAULT_SIZE;
-    currentArena = arenaHead;
-    currentArena->bytesAllocated = 0;
-    currentArena->next = NULL;
-    numArenaBlocks = 1;
+    arena->currentArena = arena->arenaHead;
+    arena->numArenaBlocks = 1;
+    pthread_setspecific(arenaKey, arena);
 
     return true;
 }
@@ -42,59 +158,66 @@ bool dvmCompilerHeapInit(void)
 /* Arena-based malloc for compilation tasks */
 void * dvmCompilerNew(size_t size, bool zero)
 {
+    CompilerArena *arena = (CompilerArena *) pthread_getspecific(arenaKey);
+    assert(arena != NULL);
     size = (size + 3) & ~3;
-retry:
-    /* Normal case - space is available in the current page */
-    if (size + currentArena->bytesAllocated <= currentArena->blockSize) {
-        void *ptr;
-        ptr = &currentArena->ptr[currentArena->bytesAllocated];
-        currentArena->bytesAllocated += size;
-        if (zero) {
-            memset(ptr, 0, size);
+
+    ArenaMemBlock *current = arena->currentArena;
+    if (size + current->bytesAllocated > current->blockSize) {
+        /* Each new block is twice the last, up to ARENA_MAX_SIZE */
+        size_t blockSize = current->blockSize * 2;
+        if (blockSize > ARENA_MAX_SIZE) {
+            blockSize = ARENA_MAX_SIZE;
         }
-        return ptr;
-    } else {
-        /*
-         * See if there are previously allocated arena blocks before the last
-         * reset
-         */
-        if (currentArena->next) {
-            currentArena = currentArena->next;
-            goto retry;
+        if (blockSize < size) {
+            blockSize = size;
         }
-
-        size_t blockSize = (size < ARENA_DEFAULT_SIZE) ?
-                          ARENA_DEFAULT_SIZE : size;
-        /* Time to allocate a new arena */
-        ArenaMemBlock *newArena = (ArenaMemBlock *)
-            malloc(sizeof(ArenaMemBlock) + blockSize);
-        if (newArena == NULL) {
+        current = getArenaBlock(size, blockSize);
+        if (current == NULL) {
             ALOGE("Arena allocation failure");
             dvmAbort();
         }
-        newArena->blockSize = blockSize;
-        newArena->bytesAllocated = 0;
-        newArena->next = NULL;
-        currentArena->next = newArena;
-        currentArena = newArena;
-        numArenaBlocks++;
-        if (numArenaBlocks > 10)
-            ALOGI("Total arena pages for JIT: %d", numArenaBlocks);
-        goto retry;
+        arena->currentArena->next = current;
+        arena->currentArena = current;
+        arena->numArenaBlocks++;
+    }
+
+    void *ptr = &current->ptr[current->bytesAllocated];
+    current->bytesAllocated += size;
+    if (zero) {
+        memset(ptr, 0, size);
     }
-    /* Should not reach here */
-    dvmAbort();
+    return ptr;
 }
 
-/* Reclaim all the arena blocks allocated so far */
+/*
+ * Reclaim all the arena blocks allocated so far.  Everything past the
+ * first block goes back to the shared pool, and the bytes used are
+ * checked against the high-water mark.
+ */
 void dvmCompilerArenaReset(void)
 {
+    CompilerArena *arena = (CompilerArena *) pthread_getspecific(arenaKey);
     ArenaMemBlock *block;
+    size_t bytesUsed = 0;
 
-    for (block = arenaHead; block; block = block->next) {
-        block->bytesAllocated = 0;
+    for (block = arena->arenaHead; block; block = block->next) {
+        bytesUsed += block->bytesAllocated;
     }
-    currentArena = arenaHead;
+    int32_t highWater;
+    do {
+        highWater = android_atomic_acquire_load(&gDvmJit.arenaHighWater);
+        if ((int32_t) bytesUsed <= highWater) {
+            break;
+        }
+    } while (android_atomic_release_cas(highWater, bytesUsed,
+                                        &gDvmJit.arenaHighWater) != 0);
+
+    putArenaBlocks(arena->arenaHead->next);
+    arena->arenaHead->next = NULL;
+    arena->arenaHead->bytesAllocated = 0;
+    arena->currentArena = arena->arenaHead;
+    arena->numArenaBlocks = 1;
 }
 
 /* Growable List initialization */
@@ -244,8 +367,9 @@ void dvmCompilerDumpStats(void)
          gDvmJit.numCompilations,
          gDvmJit.templateSize,
          gDvmJit.codeCacheByteUsed - gDvmJit.templateSize);
-    ALOGD("Compiler arena uses %d blocks (%d bytes each)",
-         numArenaBlocks, ARENA_DEFAULT_SIZE);
+    ALOGD("Code cache has %d segments, %d evicted (%d delayed)",
+         gDvmJit.numCodeCacheSegments, gDvmJit.numCodeCacheEvictions,
+         gDvmJit.numCodeCacheEvictionsDelayed);
     ALOGD("Compiler work queue length is %d/%d", gDvmJit.compilerQueueLength,
          gDvmJit.compilerMaxQueued);
     dvmJitStats();
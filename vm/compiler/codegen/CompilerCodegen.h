@@ -41,9 +41,12 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo *info);
 /* Perform translation chain operation. */
 extern "C" void* dvmJitChain(void* tgtAddr, u4* branchAddr);
 
-/* Install class objects in the literal pool */
+/*
+ * Install class objects in the literal pool.  Clears info->codeAddress if
+ * the code cache changed under the translation.
+ */
 void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit,
-                                      char *codeAddress);
+                                      JitTranslationInfo *info);
 
 /* Patch inline cache content for polymorphic callsites */
 bool dvmJitPatchInlineCache(void *cellPtr, void *contentPtr);
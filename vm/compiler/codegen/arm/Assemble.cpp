@@ -1271,6 +1271,12 @@ static inline void resetProfileCount(const JitEntry *entry)
     **p = 0;
 }
 
+/* Return the address of a trace's profile counter */
+JitTraceCounter_t *dvmJitGetTraceCounter(const JitEntry *entry)
+{
+    return *(JitTraceCounter_t **) getTraceBase(entry);
+}
+
 /* Get the pointer of the chain cell count */
 static inline ChainCellCounts* getChainCellCountsPointer(const char *base)
 {
@@ -1428,12 +1434,6 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo *info)
 
     cUnit->totalSize = offset;
 
-    if (gDvmJit.codeCacheByteUsed + cUnit->totalSize > gDvmJit.codeCacheSize) {
-        gDvmJit.codeCacheFull = true;
-        info->discardResult = true;
-        return;
-    }
-
     /* Allocate enough space for the code block */
     cUnit->codeBuffer = (unsigned char *)dvmCompilerNew(chainCellOffset, true);
     if (cUnit->codeBuffer == NULL) {
@@ -1446,8 +1446,8 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo *info)
      * Attempt to assemble the trace.  Note that assembleInstructions
      * may rewrite the code sequence and request a retry.
      */
-    cUnit->assemblerStatus = assembleInstructions(cUnit,
-          (intptr_t) gDvmJit.codeCache + gDvmJit.codeCacheByteUsed);
+    intptr_t startAddr = (intptr_t) dvmCompilerCodeCacheTop();
+    cUnit->assemblerStatus = assembleInstructions(cUnit, startAddr);
 
     switch(cUnit->assemblerStatus) {
         case kSuccess:
@@ -1497,8 +1497,35 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo *info)
         return;
     }
 
-    cUnit->baseAddr = (char *) gDvmJit.codeCache + gDvmJit.codeCacheByteUsed;
-    gDvmJit.codeCacheByteUsed += offset;
+    if (!dvmCompilerCodeCacheReserve(offset)) {
+        info->discardResult = true;
+        info->codeAddress = NULL;
+        dvmUnlockMutex(&gDvmJit.compilerLock);
+        return;
+    }
+
+    /*
+     * Another compiler thread may have installed a translation since the
+     * code was assembled, or the cache may have moved on to a new segment.
+     * The encoding depends on the final address, so assemble again in
+     * place while the lock keeps it from moving.
+     */
+    if ((intptr_t) dvmCompilerCodeCacheTop() != startAddr) {
+        cUnit->assemblerStatus = assembleInstructions(cUnit,
+              (intptr_t) dvmCompilerCodeCacheTop());
+        if (cUnit->assemblerStatus != kSuccess) {
+            dvmUnlockMutex(&gDvmJit.compilerLock);
+            if (cUnit->assemblerStatus == kRetryAll &&
+                cUnit->jitMode != kJitMethod) {
+                /* Restore pristine chain cell marker on retry */
+                chainCellOffsetLIR->operands[0] = CHAIN_CELL_OFFSET_TAG;
+            }
+            return;
+        }
+    }
+
+    cUnit->baseAddr = dvmCompilerCodeCacheTop();
+    dvmCompilerCodeCacheCommit(offset);
 
     UNPROTECT_CODE_CACHE(cUnit->baseAddr, offset);
 
@@ -1878,14 +1905,39 @@ void dvmCompilerPatchInlineCache(void)
     dvmUnlockMutex(&gDvmJit.compilerICPatchLock);
 }
 
+/*
+ * Returns true if the chaining cell (or the branch of a predicted chaining
+ * cell) at cellAddr branches to an address in [low, high).  Cells that are
+ * not chained branch into their own translation.
+ */
+static bool isChainedInto(const u4 *cellAddr, const char *low,
+                          const char *high)
+{
+    u4 inst = *cellAddr;
+    int branchOffset;
+
+    if ((inst & 0xf800) == getSkeleton(kThumbBUncond)) {
+        branchOffset = ((int) (inst << 21)) >> 20;
+    } else if ((inst & 0xf800) == getSkeleton(kThumbBl1)) {
+        branchOffset = (((int) (inst << 21)) >> 9) |
+                       (((inst >> 16) & 0x7ff) << 1);
+    } else {
+        return false;
+    }
+    const char *tgtAddr = (const char *) cellAddr + 4 + branchOffset;
+    return tgtAddr >= low && tgtAddr < high;
+}
+
 /*
  * Unchain a trace given the starting address of the translation
  * in the code cache.  Refer to the diagram in dvmCompilerAssembleLIR.
  * Returns the address following the last cell unchained.  Note that
  * the incoming codeAddr is a thumb code address, and therefore has
- * the low bit set.
+ * the low bit set.  If low is not NULL, only the cells chained to code
+ * in [low, high) are reset, which must happen with all threads out of
+ * the code cache.
  */
-static u4* unchainSingle(JitEntry *trace)
+static u4* unchainSingle(JitEntry *trace, const char *low, const char *high)
 {
     const char *base = getTraceBase(trace);
     ChainCellCounts *pChainCellCounts = getChainCellCountsPointer(base);
@@ -1910,6 +1962,10 @@ static u4* unchainSingle(JitEntry *trace)
         }
 
         for (j = 0; j < pChainCellCounts->u.count[i]; j++) {
+            if (low != NULL && !isChainedInto(pChainCells, low, high)) {
+                pChainCells += elemSize;
+                continue;
+            }
             switch(i) {
                 case kChainingCellNormal:
                 case kChainingCellHot:
@@ -1937,6 +1993,15 @@ static u4* unchainSingle(JitEntry *trace)
                      * which serves as the key.
                      */
                     predChainCell->clazz = PREDICTED_CHAIN_CLAZZ_INIT;
+                    if (low != NULL) {
+                        /*
+                         * The target is going away, so the cell must not
+                         * be revived by patching the clazz alone.  With
+                         * no thread in the code cache there is no race.
+                         */
+                        predChainCell->method = PREDICTED_CHAIN_METHOD_INIT;
+                        predChainCell->branch = PREDICTED_CHAIN_BX_PAIR_INIT;
+                    }
                     break;
                 default:
                     ALOGE("Unexpected chaining type: %d", i);
@@ -1968,7 +2033,8 @@ void dvmJitUnchainAll()
                 (gDvmJit.pJitEntryTable[i].codeAddress !=
                  dvmCompilerGetInterpretTemplate())) {
                 u4* lastAddress;
-                lastAddress = unchainSingle(&gDvmJit.pJitEntryTable[i]);
+                lastAddress = unchainSingle(&gDvmJit.pJitEntryTable[i],
+                                            NULL, NULL);
                 if (lowAddress == NULL ||
                       (u4*)gDvmJit.pJitEntryTable[i].codeAddress <
                       lowAddress)
@@ -1988,6 +2054,39 @@ void dvmJitUnchainAll()
     gDvmJit.hasNewChain = false;
 }
 
+/*
+ * Unchain the cells of the translations outside [low, high) that are
+ * chained into it, ahead of evicting that part of the cache.  Must be
+ * called with all threads out of the code cache.
+ */
+void dvmJitUnchainRange(const char *low, const char *high)
+{
+    if (gDvmJit.pJitEntryTable == NULL) {
+        return;
+    }
+    dvmLockMutex(&gDvmJit.tableLock);
+
+    UNPROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+
+    for (size_t i = 0; i < gDvmJit.jitTableSize; i++) {
+        JitEntry *entry = &gDvmJit.pJitEntryTable[i];
+        const char *codeAddress = (const char *) entry->codeAddress;
+        if (entry->dPC && !entry->u.info.isMethodEntry && codeAddress &&
+            codeAddress != dvmCompilerGetInterpretTemplate() &&
+            (codeAddress < low || codeAddress >= high)) {
+            unchainSingle(entry, low, high);
+        }
+    }
+    dvmCompilerCacheFlush((long) gDvmJit.codeCache,
+                          (long) gDvmJit.codeCache + gDvmJit.codeCacheByteUsed,
+                          0);
+    UPDATE_CODE_CACHE_PATCHES();
+
+    PROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
+
+    dvmUnlockMutex(&gDvmJit.tableLock);
+}
+
 typedef struct jitProfileAddrToLine {
     u4 lineNum;
     u4 bytecodeOffset;
@@ -2221,7 +2320,9 @@ static void findClassPointersSingleTrace(char *base, void (*callback)(void *))
     int *classPointerP = (int *) ((char *) desc + descSize);
     int numClassPointers = *classPointerP++;
     for (; numClassPointers; numClassPointers--, classPointerP++) {
-        callback(classPointerP);
+        if (*classPointerP != 0) {
+            callback(classPointerP);
+        }
     }
 }
 
@@ -2234,10 +2335,12 @@ void dvmJitScanAllClassPointers(void (*callback)(void *))
 {
     UNPROTECT_CODE_CACHE(gDvmJit.codeCache, gDvmJit.codeCacheByteUsed);
 
-    /* Handle the inflight compilation first */
-    if (gDvmJit.inflightBaseAddr)
-        findClassPointersSingleTrace((char *) gDvmJit.inflightBaseAddr,
-                                     callback);
+    /* Handle the inflight compilations first */
+    for (int i = 0; i < COMPILER_MAX_THREADS; i++) {
+        if (gDvmJit.inflightBaseAddr[i])
+            findClassPointersSingleTrace((char *) gDvmJit.inflightBaseAddr[i],
+                                         callback);
+    }
 
     if (gDvmJit.pJitEntryTable != NULL) {
         unsigned int traceIdx;
@@ -2263,25 +2366,40 @@ void dvmJitScanAllClassPointers(void (*callback)(void *))
  * Provide the final touch on the class object pointer pool to install the
  * actual pointers. The thread has to be in the running state.
  */
-void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit, char *codeAddress)
+void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit,
+                                      JitTranslationInfo *info)
 {
-    char *base = codeAddress - cUnit->headerSize -
+    char *base = (char *) info->codeAddress - cUnit->headerSize -
                  (cUnit->instructionSet == DALVIK_JIT_ARM ? 0 : 1);
 
-    /* Scan the class pointer pool */
-    JitTraceDescription *desc = getTraceDescriptionPointer(base);
-    int descSize = getTraceDescriptionSize(desc);
-    intptr_t *classPointerP = (int *) ((char *) desc + descSize);
-    int numClassPointers = *(int *)classPointerP++;
-    intptr_t *startClassPointerP = classPointerP;
-
     /*
      * Change the thread state to VM_RUNNING so that GC won't be happening
      * when the assembler looks up the class pointers. May suspend the current
      * thread if there is a pending request before the state is actually
      * changed to RUNNING.
      */
-    dvmChangeStatus(gDvmJit.compilerThread, THREAD_RUNNING);
+    dvmChangeStatus(NULL, THREAD_RUNNING);
+
+    /*
+     * The code cache may have been reset or had a segment evicted since the
+     * code was assembled, and the pool may now lie in someone else's code.
+     * No eviction can start while this thread stays in the running state,
+     * so check once under the lock and keep it until the pool is written.
+     */
+    dvmLockMutex(&gDvmJit.compilerLock);
+    if (info->cacheVersion != gDvmJit.cacheVersion) {
+        dvmUnlockMutex(&gDvmJit.compilerLock);
+        info->codeAddress = NULL;
+        dvmChangeStatus(NULL, THREAD_VMWAIT);
+        return;
+    }
+
+    /* Scan the class pointer pool */
+    JitTraceDescription *desc = getTraceDescriptionPointer(base);
+    int descSize = getTraceDescriptionSize(desc);
+    intptr_t *classPointerP = (int *) ((char *) desc + descSize);
+    int numClassPointers = *(int *)classPointerP++;
+    intptr_t *startClassPointerP = classPointerP;
 
     /*
      * Unprotecting the code cache will need to acquire the code cache
@@ -2299,9 +2417,13 @@ void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit, char *codeAddress)
 #endif
     for (;numClassPointers; numClassPointers--) {
         CallsiteInfo *callsiteInfo = (CallsiteInfo *) *classPointerP;
-        ClassObject *clazz = dvmFindClassNoInit(
-            callsiteInfo->classDescriptor, callsiteInfo->classLoader);
-        assert(!strcmp(clazz->descriptor, callsiteInfo->classDescriptor));
+        ClassObject *clazz = NULL;
+        /* No class recorded - a NULL prediction never matches */
+        if (callsiteInfo->classDescriptor != NULL) {
+            clazz = dvmFindClassNoInit(callsiteInfo->classDescriptor,
+                                       callsiteInfo->classLoader);
+            assert(!strcmp(clazz->descriptor, callsiteInfo->classDescriptor));
+        }
         *classPointerP++ = (intptr_t) clazz;
     }
 
@@ -2311,7 +2433,7 @@ void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit, char *codeAddress)
      * in the JIT table, its content can be patched if class objects are
      * moved.
      */
-    gDvmJit.inflightBaseAddr = base;
+    gDvmJit.inflightBaseAddr[dvmCompilerWorkerIndex()] = base;
 
 #if defined(WITH_JIT_TUNING)
     u8 blockTime = dvmGetRelativeTimeUsec() - startTime;
@@ -2323,9 +2445,10 @@ void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit, char *codeAddress)
     UPDATE_CODE_CACHE_PATCHES();
 
     PROTECT_CODE_CACHE(startClassPointerP, numClassPointers * sizeof(intptr_t));
+    dvmUnlockMutex(&gDvmJit.compilerLock);
 
     /* Change the thread state back to VMWAIT */
-    dvmChangeStatus(gDvmJit.compilerThread, THREAD_VMWAIT);
+    dvmChangeStatus(NULL, THREAD_VMWAIT);
 }
 
 #if defined(WITH_SELF_VERIFICATION)
@@ -2971,6 +2971,13 @@ static void genLandingPadForMispredictedCallee(CompilationUnit *cUnit, MIR *mir,
         assert(fallThrough->firstMIRInsn->OptimizationFlags & MIR_INLINED_PRED);
         fallThrough = fallThrough->fallThrough;
     }
+    /*
+     * A callee inlined as separate blocks is entered here instead; its
+     * returns rejoin after the move-result.
+     */
+    if (mir->meta.callsiteInfo->inlinedEntry != NULL) {
+        fallThrough = mir->meta.callsiteInfo->inlinedEntry;
+    }
     /* Generate a branch over if the predicted inlining is correct */
     genUnconditionalBranch(cUnit, &labelList[fallThrough->id]);
 
@@ -2986,6 +2993,48 @@ static void genLandingPadForMispredictedCallee(CompilationUnit *cUnit, MIR *mir,
     mir->meta.callsiteInfo->misPredBranchOver->target = (LIR *) target;
 }
 
+/*
+ * System.arraycopy() with a short constant length: call dvmArrayCopy()
+ * directly instead of setting up a native frame for the invoke, then
+ * continue at the return chaining cell.  Returns false, generating
+ * nothing, if the length is not such a constant.
+ */
+static bool genInlinedArrayCopy(CompilationUnit *cUnit, MIR *mir,
+                                BasicBlock *bb, ArmLIR *labelList)
+{
+    DecodedInstruction *dInsn = &mir->dalvikInsn;
+    int length;
+    if (dInsn->opcode != OP_INVOKE_STATIC || dInsn->vA != 5 ||
+        mir->ssaRep == NULL ||
+        !dvmCompilerFindLocalConstant(mir, mir->ssaRep->uses[4], &length) ||
+        length < 0 || length > ARRAYCOPY_INLINE_MAX_LENGTH) {
+        return false;
+    }
+    dvmCompilerFlushAllRegs(cUnit);   /* Everything to home location */
+    dvmCompilerClobberCallRegs(cUnit);
+    dvmCompilerClobber(cUnit, r4PC);
+    dvmCompilerClobber(cUnit, r7);
+    /* The length is the fifth argument, passed on the stack */
+    loadConstant(cUnit, r4PC, length);
+    opImm(cUnit, kOpPush, (1<<r4PC) | (1<<r7));
+    LOAD_FUNC_ADDR(cUnit, r4PC, (int) dvmArrayCopy);
+    genExportPC(cUnit, mir);
+    for (int i = 0; i < 4; i++) {
+        loadValueDirect(cUnit, dvmCompilerGetSrc(cUnit, mir, i), i);
+    }
+    opReg(cUnit, kOpBlx, r4PC);
+    opRegImm(cUnit, kOpAdd, r13sp, 8);
+    /* false? */
+    ArmLIR *branchOver = genCmpImmBranch(cUnit, kArmCondNe, r0, 0);
+    loadConstant(cUnit, r0, (int) (cUnit->method->insns + mir->offset));
+    genDispatchToHandler(cUnit, TEMPLATE_THROW_EXCEPTION_COMMON);
+    ArmLIR *target = newLIR0(cUnit, kArmPseudoTargetLabel);
+    target->defMask = ENCODE_ALL;
+    branchOver->generic.target = (LIR *) target;
+    genUnconditionalBranch(cUnit, &labelList[bb->fallThrough->id]);
+    return true;
+}
+
 static bool handleFmt35c_3rc(CompilationUnit *cUnit, MIR *mir,
                              BasicBlock *bb, ArmLIR *labelList)
 {
@@ -3093,6 +3142,11 @@ static bool handleFmt35c_3rc(CompilationUnit *cUnit, MIR *mir,
             assert(calleeMethod ==
                    cUnit->method->clazz->pDvmDex->pResMethods[dInsn->vB]);
 
+            if (calleeMethod == gDvm.methJavaLangSystem_arraycopy &&
+                genInlinedArrayCopy(cUnit, mir, bb, labelList)) {
+                break;
+            }
+
             if (mir->dalvikInsn.opcode == OP_INVOKE_STATIC)
                 genProcessArgsNoRange(cUnit, mir, dInsn,
                                       NULL /* no null check */);
@@ -3691,6 +3745,9 @@ static bool handleExecuteInline(CompilationUnit *cUnit, MIR *mir)
          * TODO: special-case these in the other "invoke" call paths.
          */
         case INLINE_STRING_EQUALS:
+        case INLINE_STRING_INDEXOF_STRING:
+        case INLINE_STRING_STARTSWITH_STRINGI:
+        case INLINE_STRING_HASHCODE:
         case INLINE_MATH_COS:
         case INLINE_MATH_SIN:
         case INLINE_FLOAT_TO_INT_BITS:
@@ -183,7 +183,8 @@ void dvmCompilerAssembleLIR(CompilationUnit *cUnit, JitTranslationInfo* info)
 {
 }
 
-void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit, char *codeAddress)
+void dvmJitInstallClassObjectPointers(CompilationUnit *cUnit,
+                                      JitTranslationInfo *info)
 {
 }
 
@@ -605,6 +606,22 @@ void dvmJitUnchainAll()
     gDvmJit.hasNewChain = false;
 }
 
+/*
+ * The x86 code cache is a single segment and is only ever reset as a
+ * whole, so there is never a range to unchain.
+ */
+void dvmJitUnchainRange(const char *low, const char *high)
+{
+    ALOGE("Code cache eviction not supported for the x86 target");
+    dvmAbort();
+}
+
+/* The x86 translations do not carry a profile counter */
+JitTraceCounter_t *dvmJitGetTraceCounter(const JitEntry *entry)
+{
+    return NULL;
+}
+
 #define P_GPR_1 PhysicalReg_EBX
 /* Add an additional jump instruction, keep jump target 4 bytes aligned.*/
 static void insertJumpHelp()
@@ -62,6 +62,10 @@ static void genLandingPadForMispredictedCallee(MIR* mir) {
         assert(fallThrough->firstMIRInsn->OptimizationFlags & MIR_INLINED_PRED);
         fallThrough = fallThrough->fallThrough;
     }
+    /* Enter a callee that was inlined as separate blocks */
+    if (traceCurrentMIR->meta.callsiteInfo->inlinedEntry != NULL) {
+        fallThrough = traceCurrentMIR->meta.callsiteInfo->inlinedEntry;
+    }
     /* Generate a branch over if the predicted inlining is correct */
     jumpToBasicBlock(stream, fallThrough->id);
     /* Hook up the target to the verification branch */
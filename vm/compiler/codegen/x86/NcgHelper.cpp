@@ -18,6 +18,7 @@
 #include "Dalvik.h"
 #include "NcgHelper.h"
 #include "interp/InterpDefs.h"
+#include "mterp/common/FindInterface.h"
 
 
 /*
@@ -103,11 +104,16 @@ s4 dvmJitHandleSparseSwitch(const s4* keys, u2 size, s4 testVal)
     return 2*3; //bytecode sparse_switch is 6(2*3) bytes long
 }
 /*
- * Look up an interface on a class using the cache.
+ * Look up an interface on a class using the imtable or the cache.
  */
 /*INLINE*/ Method* dvmFindInterfaceMethodInCache2(ClassObject* thisClass,
     u4 methodIdx, const Method* method, DvmDex* methodClassDex)
 {
+    Method* methodToCall =
+        dvmFindInterfaceMethodInImt(thisClass, methodIdx, methodClassDex);
+    if (methodToCall != NULL)
+        return methodToCall;
+
 #define ATOMIC_CACHE_CALC \
     dvmInterpFindInterfaceMethod(thisClass, methodIdx, method, methodClassDex)
 
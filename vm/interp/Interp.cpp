@@ -1288,6 +1288,22 @@ Method* dvmInterpFindInterfaceMethod(ClassObject* thisClass, u4 methodIdx,
     return methodToCall;
 }
 
+/*
+ * Resolve an imtable slot that several interface methods map to.  The
+ * lists are built at link time and are short, so a scan will do.
+ */
+Method* dvmImtFindConflict(const ImtEntry* entry,
+    const Method* interfaceMethod)
+{
+    for (const ImtEntry* conflict = entry->conflicts;
+         conflict->interfaceMethod != NULL; conflict++)
+    {
+        if (conflict->interfaceMethod == interfaceMethod)
+            return conflict->method;
+    }
+    return NULL;
+}
+
 
 
 /*
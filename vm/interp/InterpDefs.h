@@ -74,6 +74,13 @@ extern "C" bool dvmInterpHandleFillArrayData(ArrayObject* arrayObject,
 Method* dvmInterpFindInterfaceMethod(ClassObject* thisClass, u4 methodIdx,
     const Method* method, DvmDex* methodClassDex);
 
+/*
+ * Find the implementation of an interface method in the conflict list of
+ * an imtable slot.  Returns NULL if it isn't there.
+ */
+Method* dvmImtFindConflict(const ImtEntry* entry,
+    const Method* interfaceMethod);
+
 /*
  * Determine if the debugger or profiler is currently active.
  */
@@ -31,6 +31,49 @@
 #include "compiler/CompilerUtility.h"
 #include "compiler/CompilerIR.h"
 #include <errno.h>
+#include <sched.h>
+
+/*
+ * Guards the trace profile counter pool, which the compiler threads draw
+ * from while generating code.
+ */
+static pthread_mutex_t traceCounterLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Each JitTable carries its size in a header just below the entries, so a
+ * thread that loads gDvmJit.pJitEntryTable once always probes with the
+ * matching mask, even while a resize is publishing a larger table.
+ */
+struct JitTableHeader {
+    JitTableHeader*     nextRetired;    /* Next table replaced by a resize */
+    int32_t             retiredEpoch;   /* jitTableEpoch after the resize */
+    unsigned int        size;
+    unsigned int        mask;
+};
+
+/* Compiler thread epoch slot of a thread that holds no JitTable pointer */
+#define JIT_TABLE_EPOCH_IDLE 0x7fffffff
+
+/*
+ * Tables replaced by a resize since the last safe point, and those that
+ * were already retired at it.  Guarded by gDvmJit.tableLock.
+ */
+static JitTableHeader* retiredTables;
+static JitTableHeader* agedTables;
+
+static inline JitTableHeader* tableHeader(const JitEntry* table)
+{
+    return (JitTableHeader*) table - 1;
+}
+
+/*
+ * Load the current JitTable.  A resize publishes the table with a release
+ * store, and every load from it depends on this pointer.
+ */
+static inline JitEntry* currentTable()
+{
+    return *(JitEntry* volatile*) &gDvmJit.pJitEntryTable;
+}
 
 #if defined(WITH_SELF_VERIFICATION)
 /* Allocate space for per-thread ShadowSpace data structures */
@@ -468,30 +511,39 @@ void dvmBumpPunt(int from)
 /* Dumps debugging & tuning stats to the log */
 void dvmJitStats()
 {
-    int i;
-    int hit;
-    int not_hit;
-    int chains;
-    int stubs;
     if (gDvmJit.pJitEntryTable) {
-        for (i=0, stubs=chains=hit=not_hit=0;
-             i < (int) gDvmJit.jitTableSize;
-             i++) {
-            if (gDvmJit.pJitEntryTable[i].dPC != 0) {
-                hit++;
-                if (gDvmJit.pJitEntryTable[i].codeAddress ==
-                      dvmCompilerGetInterpretTemplate())
-                    stubs++;
-            } else
-                not_hit++;
-            if (gDvmJit.pJitEntryTable[i].u.info.chain != gDvmJit.jitTableSize)
-                chains++;
+        JitEntry* table = currentTable();
+        u4 mask = tableHeader(table)->mask;
+        int hit = 0;
+        int stubs = 0;
+        u4 probeTotal = 0;
+        u4 probeMax = 0;
+        for (u4 i = 0; i <= mask; i++) {
+            const u2* pc = table[i].dPC;
+            if (pc == NULL || pc == JIT_ENTRY_BUSY) {
+                continue;
+            }
+            hit++;
+            if (table[i].codeAddress == dvmCompilerGetInterpretTemplate())
+                stubs++;
+            /* #of slots probed past the home slot to reach this entry */
+            u4 probe = (i - dvmJitHashMask(pc, mask)) & mask;
+            probeTotal += probe;
+            if (probe > probeMax)
+                probeMax = probe;
         }
-        ALOGD("JIT: table size is %d, entries used is %d",
-             gDvmJit.jitTableSize,  gDvmJit.jitTableEntriesUsed);
-        ALOGD("JIT: %d traces, %d slots, %d chains, %d thresh, %s",
-             hit, not_hit + hit, chains, gDvmJit.threshold,
+        ALOGD("JIT: table size is %d, entries used is %d (%d%% load), "
+             "%d resizes",
+             mask + 1, gDvmJit.jitTableEntriesUsed,
+             (int) ((u8) hit * 100 / (mask + 1)), gDvmJit.jitTableResizes);
+        ALOGD("JIT: %d traces, %d slots, probe length avg %d.%02d max %d, "
+             "%d thresh, %s",
+             hit, mask + 1, hit == 0 ? 0 : probeTotal / hit,
+             hit == 0 ? 0 : (probeTotal * 100 / hit) % 100, probeMax,
+             gDvmJit.threshold,
              gDvmJit.blockingMode ? "Blocking" : "Non-blocking");
+        ALOGD("JIT: table inserts: %d raced, %d failed",
+             gDvmJit.jitTableInsertRaces, gDvmJit.jitTableInsertsFailed);
 
 #if defined(WITH_JIT_TUNING)
         ALOGD("JIT: Code cache patches: %d", gDvmJit.codeCachePatches);
@@ -520,6 +572,9 @@ void dvmJitStats()
         ALOGD("JIT: Inline: %d mgetter, %d msetter, %d pgetter, %d psetter",
              gDvmJit.invokeMonoGetterInlined, gDvmJit.invokeMonoSetterInlined,
              gDvmJit.invokePolyGetterInlined, gDvmJit.invokePolySetterInlined);
+        ALOGD("JIT: Inline: %d msimple, %d psimple, %d over budget",
+             gDvmJit.invokeMonoSimpleInlined, gDvmJit.invokePolySimpleInlined,
+             gDvmJit.invokeInlineTooBig);
         ALOGD("JIT: Total compilation time: %llu ms", gDvmJit.jitTime / 1000);
         ALOGD("JIT: Avg unit compilation time: %llu us",
              gDvmJit.numCompilations == 0 ? 0 :
@@ -535,6 +590,10 @@ void dvmJitStats()
 
         ALOGD("JIT: %d Translation chains, %d interp stubs",
              gDvmJit.translationChains, stubs);
+        ALOGD("JIT: Compiler arenas: %d blocks (%d pooled), "
+             "high-water %d bytes",
+             gDvmJit.arenaBlocks, gDvmJit.arenaPooledBlocks,
+             gDvmJit.arenaHighWater);
         if (gDvmJit.profileMode == kTraceProfilingContinuous) {
             dvmCompilerSortAndPrintTraceProfiles();
         }
@@ -555,106 +614,76 @@ void dvmJitEndTraceSelect(Thread* self, const u2* dPC)
 }
 
 /*
- * Find an entry in the JitTable, creating if necessary.
- * Returns null if table is full.
+ * Probe "table" for the entry of "dPC".  Returns NULL if an empty slot
+ * ends the probe run first.  Slots still being filled in by their new
+ * owner are passed over.
  */
-static JitEntry *lookupAndAdd(const u2* dPC, bool callerLocked,
-                              bool isMethodEntry)
+static inline JitEntry *probeTable(JitEntry *table, const u2* dPC,
+                                   bool isMethodEntry)
 {
-    u4 chainEndMarker = gDvmJit.jitTableSize;
-    u4 idx = dvmJitHash(dPC);
-
-    /*
-     * Walk the bucket chain to find an exact match for our PC and trace/method
-     * type
-     */
-    while ((gDvmJit.pJitEntryTable[idx].u.info.chain != chainEndMarker) &&
-           ((gDvmJit.pJitEntryTable[idx].dPC != dPC) ||
-            (gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry !=
-             isMethodEntry))) {
-        idx = gDvmJit.pJitEntryTable[idx].u.info.chain;
+    u4 mask = tableHeader(table)->mask;
+    u4 idx = dvmJitHashMask(dPC, mask);
+    for (u4 n = 0; n <= mask; n++) {
+        const u2* pc = table[idx].dPC;
+        if (pc == NULL) {
+            break;
+        }
+        if (pc == dPC && table[idx].u.info.isMethodEntry == isMethodEntry) {
+            return &table[idx];
+        }
+        idx = (idx + 1) & mask;
     }
+    return NULL;
+}
 
-    if (gDvmJit.pJitEntryTable[idx].dPC != dPC ||
-        gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry != isMethodEntry) {
-        /*
-         * No match.  Aquire jitTableLock and find the last
-         * slot in the chain. Possibly continue the chain walk in case
-         * some other thread allocated the slot we were looking
-         * at previuosly (perhaps even the dPC we're trying to enter).
-         */
-        if (!callerLocked)
-            dvmLockMutex(&gDvmJit.tableLock);
-        /*
-         * At this point, if .dPC is NULL, then the slot we're
-         * looking at is the target slot from the primary hash
-         * (the simple, and common case).  Otherwise we're going
-         * to have to find a free slot and chain it.
-         */
-        ANDROID_MEMBAR_FULL(); /* Make sure we reload [].dPC after lock */
-        if (gDvmJit.pJitEntryTable[idx].dPC != NULL) {
-            u4 prev;
-            while (gDvmJit.pJitEntryTable[idx].u.info.chain != chainEndMarker) {
-                if (gDvmJit.pJitEntryTable[idx].dPC == dPC &&
-                    gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry ==
-                        isMethodEntry) {
-                    /* Another thread got there first for this dPC */
-                    if (!callerLocked)
-                        dvmUnlockMutex(&gDvmJit.tableLock);
-                    return &gDvmJit.pJitEntryTable[idx];
-                }
-                idx = gDvmJit.pJitEntryTable[idx].u.info.chain;
-            }
-            /* Here, idx should be pointing to the last cell of an
-             * active chain whose last member contains a valid dPC */
-            assert(gDvmJit.pJitEntryTable[idx].dPC != NULL);
-            /* Linear walk to find a free cell and add it to the end */
-            prev = idx;
-            while (true) {
-                idx++;
-                if (idx == chainEndMarker)
-                    idx = 0;  /* Wraparound */
-                if ((gDvmJit.pJitEntryTable[idx].dPC == NULL) ||
-                    (idx == prev))
-                    break;
-            }
-            if (idx != prev) {
-                JitEntryInfoUnion oldValue;
-                JitEntryInfoUnion newValue;
-                /*
-                 * Although we hold the lock so that noone else will
-                 * be trying to update a chain field, the other fields
-                 * packed into the word may be in use by other threads.
-                 */
-                do {
-                    oldValue = gDvmJit.pJitEntryTable[prev].u;
-                    newValue = oldValue;
-                    newValue.info.chain = idx;
-                } while (android_atomic_release_cas(oldValue.infoWord,
-                        newValue.infoWord,
-                        &gDvmJit.pJitEntryTable[prev].u.infoWord) != 0);
+/*
+ * Find an entry in the JitTable, creating if necessary.
+ * Returns null if table is full.
+ *
+ * No lock is needed.  A new entry takes the first empty slot of the probe
+ * run, claimed by a CAS on its dPC.  The dPC holds JIT_ENTRY_BUSY until
+ * the rest of the entry is set, so a thread adding the same dPC waits for
+ * it rather than claim a second slot further on.
+ */
+static JitEntry *lookupAndAdd(const u2* dPC, bool isMethodEntry)
+{
+    JitEntry *table = currentTable();
+    u4 mask = tableHeader(table)->mask;
+    u4 idx = dvmJitHashMask(dPC, mask);
+
+    for (u4 n = 0; n <= mask; ) {
+        JitEntry *entry = &table[idx];
+        volatile int32_t *pcAddr = (volatile int32_t *)(void *)&entry->dPC;
+        const u2* pc = (const u2*) android_atomic_acquire_load(pcAddr);
+        if (pc == NULL) {
+            if (android_atomic_acquire_cas(0, (int32_t) JIT_ENTRY_BUSY,
+                                           pcAddr) != 0) {
+                /* Another thread took the slot first - look at it again */
+                android_atomic_inc(&gDvmJit.jitTableInsertRaces);
+                continue;
             }
-        }
-        if (gDvmJit.pJitEntryTable[idx].dPC == NULL) {
-            gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry = isMethodEntry;
-            /*
-             * Initialize codeAddress and allocate the slot.  Must
-             * happen in this order (since dPC is set, the entry is live.
-             */
-            android_atomic_release_store((int32_t)dPC,
-                 (volatile int32_t *)(void *)&gDvmJit.pJitEntryTable[idx].dPC);
+            entry->u.info.isMethodEntry = isMethodEntry;
             /* for simulator mode, we need to initialized codeAddress to null */
-            gDvmJit.pJitEntryTable[idx].codeAddress = NULL;
-            gDvmJit.pJitEntryTable[idx].dPC = dPC;
-            gDvmJit.jitTableEntriesUsed++;
-        } else {
-            /* Table is full */
-            idx = chainEndMarker;
+            entry->codeAddress = NULL;
+            /* Make the entry live */
+            android_atomic_release_store((int32_t) dPC, pcAddr);
+            android_atomic_inc(&gDvmJit.jitTableEntriesUsed);
+            return entry;
+        }
+        if (pc == JIT_ENTRY_BUSY) {
+            /* The new owner may be adding this dPC, wait for it */
+            sched_yield();
+            continue;
+        }
+        if (pc == dPC && entry->u.info.isMethodEntry == isMethodEntry) {
+            return entry;
         }
-        if (!callerLocked)
-            dvmUnlockMutex(&gDvmJit.tableLock);
+        idx = (idx + 1) & mask;
+        n++;
     }
-    return (idx == chainEndMarker) ? NULL : &gDvmJit.pJitEntryTable[idx];
+    /* Table is full */
+    android_atomic_inc(&gDvmJit.jitTableInsertsFailed);
+    return NULL;
 }
 
 /* Dump a trace description */
@@ -1000,23 +1029,7 @@ void dvmCheckJit(const u2* pc, Thread* self)
 
 JitEntry *dvmJitFindEntry(const u2* pc, bool isMethodEntry)
 {
-    int idx = dvmJitHash(pc);
-
-    /* Expect a high hit rate on 1st shot */
-    if ((gDvmJit.pJitEntryTable[idx].dPC == pc) &&
-        (gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry == isMethodEntry))
-        return &gDvmJit.pJitEntryTable[idx];
-    else {
-        int chainEndMarker = gDvmJit.jitTableSize;
-        while (gDvmJit.pJitEntryTable[idx].u.info.chain != chainEndMarker) {
-            idx = gDvmJit.pJitEntryTable[idx].u.info.chain;
-            if ((gDvmJit.pJitEntryTable[idx].dPC == pc) &&
-                (gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry ==
-                isMethodEntry))
-                return &gDvmJit.pJitEntryTable[idx];
-        }
-    }
-    return NULL;
+    return probeTable(currentTable(), pc, isMethodEntry);
 }
 
 /*
@@ -1025,41 +1038,16 @@ JitEntry *dvmJitFindEntry(const u2* pc, bool isMethodEntry)
  */
 void* getCodeAddrCommon(const u2* dPC, bool methodEntry)
 {
-    int idx = dvmJitHash(dPC);
-    const u2* pc = gDvmJit.pJitEntryTable[idx].dPC;
-    if (pc != NULL) {
-        bool hideTranslation = dvmJitHideTranslation();
-        if (pc == dPC &&
-            gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry == methodEntry) {
-            int offset = (gDvmJit.profileMode >= kTraceProfilingContinuous) ?
-                 0 : gDvmJit.pJitEntryTable[idx].u.info.profileOffset;
-            intptr_t codeAddress =
-                (intptr_t)gDvmJit.pJitEntryTable[idx].codeAddress;
-#if defined(WITH_JIT_TUNING)
-            gDvmJit.addrLookupsFound++;
-#endif
-            return hideTranslation || !codeAddress ?  NULL :
-                  (void *)(codeAddress + offset);
-        } else {
-            int chainEndMarker = gDvmJit.jitTableSize;
-            while (gDvmJit.pJitEntryTable[idx].u.info.chain != chainEndMarker) {
-                idx = gDvmJit.pJitEntryTable[idx].u.info.chain;
-                if (gDvmJit.pJitEntryTable[idx].dPC == dPC &&
-                    gDvmJit.pJitEntryTable[idx].u.info.isMethodEntry ==
-                        methodEntry) {
-                    int offset = (gDvmJit.profileMode >=
-                        kTraceProfilingContinuous) ? 0 :
-                        gDvmJit.pJitEntryTable[idx].u.info.profileOffset;
-                    intptr_t codeAddress =
-                        (intptr_t)gDvmJit.pJitEntryTable[idx].codeAddress;
+    const JitEntry *entry = probeTable(currentTable(), dPC, methodEntry);
+    if (entry != NULL) {
+        int offset = (gDvmJit.profileMode >= kTraceProfilingContinuous) ?
+             0 : entry->u.info.profileOffset;
+        intptr_t codeAddress = (intptr_t)entry->codeAddress;
 #if defined(WITH_JIT_TUNING)
-                    gDvmJit.addrLookupsFound++;
+        gDvmJit.addrLookupsFound++;
 #endif
-                    return hideTranslation || !codeAddress ? NULL :
-                        (void *)(codeAddress + offset);
-                }
-            }
-        }
+        return dvmJitHideTranslation() || !codeAddress ?  NULL :
+              (void *)(codeAddress + offset);
     }
 #if defined(WITH_JIT_TUNING)
     gDvmJit.addrLookupsNotFound++;
@@ -1117,6 +1105,8 @@ void* dvmJitGetMethodAddrThread(const u2* dPC, Thread* self)
  * template cannot handle a non-zero prefix.
  * NOTE: JitTable must not be in danger of reset while this
  * code is executing. see Issue 4271784 for details.
+ * Holding tableLock keeps a resize from copying the entry while it is
+ * being updated.
  */
 void dvmJitSetCodeAddr(const u2* dPC, void *nPC, JitInstructionSetType set,
                        bool isMethodEntry, int profilePrefixSize)
@@ -1125,13 +1115,16 @@ void dvmJitSetCodeAddr(const u2* dPC, void *nPC, JitInstructionSetType set,
     JitEntryInfoUnion newValue;
     /*
      * Get the JitTable slot for this dPC (or create one if JitTable
-     * has been reset between the time the trace was requested and
-     * now.
+     * has been reset or resized between the time the trace was requested
+     * and now.
      */
-    JitEntry *jitEntry = isMethodEntry ?
-        lookupAndAdd(dPC, false /* caller holds tableLock */, isMethodEntry) :
-                     dvmJitFindEntry(dPC, isMethodEntry);
-    assert(jitEntry);
+    dvmLockMutex(&gDvmJit.tableLock);
+    JitEntry *jitEntry = lookupAndAdd(dPC, isMethodEntry);
+    if (jitEntry == NULL) {
+        /* Table is full - the translation is simply not used */
+        dvmUnlockMutex(&gDvmJit.tableLock);
+        return;
+    }
     /* Note: order of update is important */
     do {
         oldValue = jitEntry->u;
@@ -1143,6 +1136,67 @@ void dvmJitSetCodeAddr(const u2* dPC, void *nPC, JitInstructionSetType set,
              oldValue.infoWord, newValue.infoWord,
              &jitEntry->u.infoWord) != 0);
     jitEntry->codeAddress = nPC;
+    dvmUnlockMutex(&gDvmJit.tableLock);
+}
+
+/*
+ * Set or clear the evicted flag of a JitTable entry.  Like the other
+ * fields packed with it, the flag is updated atomically.
+ */
+static void setEvicted(JitEntry *jitEntry, bool evicted)
+{
+    JitEntryInfoUnion oldValue;
+    JitEntryInfoUnion newValue;
+    do {
+        oldValue = jitEntry->u;
+        newValue = oldValue;
+        newValue.info.evicted = evicted;
+    } while (android_atomic_release_cas(
+             oldValue.infoWord, newValue.infoWord,
+             &jitEntry->u.infoWord) != 0);
+}
+
+/*
+ * Forget the translation of a JitTable entry whose code is being evicted
+ * from the code cache, so that the trace can be selected and compiled
+ * again.  Must only be called at a safe point.
+ */
+void dvmJitEvictEntry(JitEntry *jitEntry)
+{
+    jitEntry->codeAddress = NULL;
+    setEvicted(jitEntry, true);
+}
+
+/*
+ * Queue a trace that was not selected by the interpreter, such as one
+ * read back from a saved profile, creating the JitTable entry that the
+ * translation will be installed in.  Returns false, leaving <desc> to the
+ * caller, if the trace already has an entry in use or the request could
+ * not be queued.
+ */
+bool dvmJitRequestTrace(const u2* dPC, JitTraceDescription* desc)
+{
+    if (gDvmJit.pProfTable == NULL) {
+        return false;
+    }
+    JitEntry *entry = dvmJitFindEntry(dPC, false);
+    if (entry != NULL) {
+        if (!entry->u.info.evicted) {
+            return false;
+        }
+        setEvicted(entry, false);
+    } else {
+        entry = lookupAndAdd(dPC, false /* method entry */);
+        if (entry == NULL) {
+            return false;
+        }
+    }
+    if (!dvmCompilerWorkEnqueue(dPC, kWorkOrderTrace, desc)) {
+        /* Let the interpreter select the trace again */
+        setEvicted(entry, true);
+        return false;
+    }
+    return true;
 }
 
 /*
@@ -1246,23 +1300,27 @@ void dvmJitCheckTraceRequest(Thread* self)
          */
         if (self->jitState == kJitTSelectRequest ||
             self->jitState == kJitTSelectRequestHot) {
-            if (dvmJitFindEntry(self->interpSave.pc, false)) {
-                /* In progress - nothing do do */
-               self->jitState = kJitDone;
+            JitEntry *entry = dvmJitFindEntry(self->interpSave.pc, false);
+            if (entry != NULL && !entry->u.info.evicted) {
+                /*
+                 * In progress - nothing do do, except to note that the
+                 * trace is still hot while it waits to be compiled.
+                 */
+                dvmCompilerBoostWork(self->interpSave.pc);
+                self->jitState = kJitDone;
+            } else if (entry != NULL) {
+                /* Translation was evicted - build the trace again */
+                setEvicted(entry, false);
             } else {
                 JitEntry *slot = lookupAndAdd(self->interpSave.pc,
-                                              false /* lock */,
                                               false /* method entry */);
                 if (slot == NULL) {
                     /*
-                     * Table is full.  This should have been
-                     * detected by the compiler thread and the table
-                     * resized before we run into it here.  Assume bad things
-                     * are afoot and disable profiling.
+                     * Table is full.  The compiler thread grows it long
+                     * before this happens, and resets the code cache once
+                     * it cannot; until then just drop the request.
                      */
                     self->jitState = kJitDone;
-                    ALOGD("JIT: JitTable full, disabling profiling");
-                    dvmJitStopTranslationRequests();
                 }
             }
         }
@@ -1303,19 +1361,38 @@ void dvmJitCheckTraceRequest(Thread* self)
     }
 }
 
+/*
+ * Allocate an empty JitTable of "size" entries, which must be a power of 2.
+ */
+JitEntry *dvmJitAllocTable(unsigned int size)
+{
+    assert(size && !(size & (size - 1)));   /* Is power of 2? */
+
+    JitTableHeader *header = (JitTableHeader*)
+        calloc(1, sizeof(JitTableHeader) + size * sizeof(JitEntry));
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    header->mask = size - 1;
+    return (JitEntry*) (header + 1);
+}
+
 /*
  * Resizes the JitTable.  Must be a power of 2, and returns true on failure.
- * Stops all threads, and thus is a heavyweight operation. May only be called
- * by the compiler thread.
+ * May only be called by one compiler thread at a time.
+ *
+ * The other threads keep running.  The live entries are copied into the
+ * new table under tableLock, which keeps out dvmJitSetCodeAddr and the
+ * other writers of existing entries, and the new table is then published
+ * in one store.  An entry added to the old table during the copy is lost,
+ * which costs no more than a repeated trace request: dvmJitSetCodeAddr
+ * adds the entry back when the translation is installed.  The old table
+ * is freed by dvmJitFreeRetiredTables once the compiler threads have all
+ * moved past the new epoch.
  */
 bool dvmJitResizeJitTable( unsigned int size )
 {
-    JitEntry *pNewTable;
-    JitEntry *pOldTable;
-    JitEntry tempEntry;
-    unsigned int oldSize;
-    unsigned int i;
-
     assert(gDvmJit.pJitEntryTable != NULL);
     assert(size && !(size & (size - 1)));   /* Is power of 2? */
 
@@ -1325,82 +1402,146 @@ bool dvmJitResizeJitTable( unsigned int size )
         return true;
     }
 
-    /* Make sure requested size is compatible with chain field width */
-    tempEntry.u.info.chain = size;
-    if (tempEntry.u.info.chain != size) {
+    if (size > JIT_MAX_ENTRIES) {
         ALOGD("Jit: JitTable request of %d too big", size);
         return true;
     }
 
-    pNewTable = (JitEntry*)calloc(size, sizeof(*pNewTable));
+    JitEntry *pNewTable = dvmJitAllocTable(size);
     if (pNewTable == NULL) {
         return true;
     }
-    for (i=0; i< size; i++) {
-        pNewTable[i].u.info.chain = size;  /* Initialize chain termination */
-    }
-
-    /* Stop all other interpreting/jit'ng threads */
-    dvmSuspendAllThreads(SUSPEND_FOR_TBL_RESIZE);
-
-    pOldTable = gDvmJit.pJitEntryTable;
-    oldSize = gDvmJit.jitTableSize;
 
     dvmLockMutex(&gDvmJit.tableLock);
-    gDvmJit.pJitEntryTable = pNewTable;
-    gDvmJit.jitTableSize = size;
-    gDvmJit.jitTableMask = size - 1;
-    gDvmJit.jitTableEntriesUsed = 0;
 
-    for (i=0; i < oldSize; i++) {
-        if (pOldTable[i].dPC) {
-            JitEntry *p;
-            u2 chain;
-            p = lookupAndAdd(pOldTable[i].dPC, true /* holds tableLock*/,
-                             pOldTable[i].u.info.isMethodEntry);
-            p->codeAddress = pOldTable[i].codeAddress;
-            /* We need to preserve the new chain field, but copy the rest */
-            chain = p->u.info.chain;
-            p->u = pOldTable[i].u;
-            p->u.info.chain = chain;
+    JitEntry *pOldTable = gDvmJit.pJitEntryTable;
+    unsigned int oldSize = tableHeader(pOldTable)->size;
+    unsigned int mask = size - 1;
+    int used = 0;
+
+    for (unsigned int i = 0; i < oldSize; i++) {
+        const u2* pc = pOldTable[i].dPC;
+        if (pc == NULL || pc == JIT_ENTRY_BUSY) {
+            continue;
+        }
+        u4 idx = dvmJitHashMask(pc, mask);
+        while (pNewTable[idx].dPC != NULL) {
+            idx = (idx + 1) & mask;
         }
+        pNewTable[idx].u.infoWord = pOldTable[i].u.infoWord;
+        pNewTable[idx].codeAddress = pOldTable[i].codeAddress;
+        pNewTable[idx].dPC = pc;
+        used++;
     }
 
-    dvmUnlockMutex(&gDvmJit.tableLock);
+    android_atomic_release_store((int32_t) pNewTable,
+        (volatile int32_t *)(void *)&gDvmJit.pJitEntryTable);
+    gDvmJit.jitTableSize = size;
+    gDvmJit.jitTableMask = mask;
+    gDvmJit.jitTableEntriesUsed = used;
+    gDvmJit.jitTableResizes++;
 
-    free(pOldTable);
+    JitTableHeader *oldHeader = tableHeader(pOldTable);
+    oldHeader->retiredEpoch = android_atomic_inc(&gDvmJit.jitTableEpoch) + 1;
+    oldHeader->nextRetired = retiredTables;
+    retiredTables = oldHeader;
 
-    /* Restart the world */
-    dvmResumeAllThreads(SUSPEND_FOR_TBL_RESIZE);
+    dvmUnlockMutex(&gDvmJit.tableLock);
 
     return false;
 }
 
+/*
+ * Record that the calling compiler thread holds no JitTable pointer.  If
+ * "idle" is set it won't look at the table again until the next call;
+ * otherwise it may, but only at the table current now.
+ */
+void dvmJitTableQuiescent(bool idle)
+{
+    int32_t epoch = idle ? JIT_TABLE_EPOCH_IDLE :
+        android_atomic_acquire_load(&gDvmJit.jitTableEpoch);
+
+    android_atomic_release_store(epoch,
+        &gDvmJit.compilerTableEpoch[dvmCompilerWorkerIndex()]);
+    /* Make the slot visible before this thread loads the table again */
+    ANDROID_MEMBAR_FULL();
+}
+
+/*
+ * Free the JitTables that were retired before the previous safe point and
+ * that no compiler thread can still be reading.  A mutator lookup does not
+ * span a safe point, but compiler threads run through them in VMWAIT, so
+ * those are covered by their epoch slots instead.  Tables that are still
+ * in use wait for a later safe point.  Called with all threads suspended.
+ */
+void dvmJitFreeRetiredTables()
+{
+    /* The table and its lock are set up together by the compiler thread */
+    if (gDvmJit.pJitEntryTable == NULL) {
+        return;
+    }
+
+    int32_t oldestEpoch = JIT_TABLE_EPOCH_IDLE;
+    for (int i = 0; i < COMPILER_MAX_THREADS; i++) {
+        if (gDvmJit.compilerThreads[i] != NULL) {
+            int32_t epoch =
+                android_atomic_acquire_load(&gDvmJit.compilerTableEpoch[i]);
+            if (epoch < oldestEpoch) {
+                oldestEpoch = epoch;
+            }
+        }
+    }
+
+    dvmLockMutex(&gDvmJit.tableLock);
+    JitTableHeader *header = agedTables;
+    agedTables = retiredTables;
+    retiredTables = NULL;
+    JitTableHeader *stillUsed = NULL;
+    while (header != NULL) {
+        JitTableHeader *next = header->nextRetired;
+        if (header->retiredEpoch <= oldestEpoch) {
+            free(header);
+        } else {
+            header->nextRetired = stillUsed;
+            stillUsed = header;
+        }
+        header = next;
+    }
+    /* Keep them on the aged list to be tried again next time */
+    while (stillUsed != NULL) {
+        JitTableHeader *next = stillUsed->nextRetired;
+        stillUsed->nextRetired = agedTables;
+        agedTables = stillUsed;
+        stillUsed = next;
+    }
+    dvmUnlockMutex(&gDvmJit.tableLock);
+}
+
 /*
  * Reset the JitTable to the initial clean state.
  */
 void dvmJitResetTable()
 {
-    JitEntry *jitEntry = gDvmJit.pJitEntryTable;
-    unsigned int size = gDvmJit.jitTableSize;
     unsigned int i;
 
     dvmLockMutex(&gDvmJit.tableLock);
 
     /* Note: If need to preserve any existing counts. Do so here. */
     if (gDvmJit.pJitTraceProfCounters) {
+        dvmLockMutex(&traceCounterLock);
         for (i=0; i < JIT_PROF_BLOCK_BUCKETS; i++) {
             if (gDvmJit.pJitTraceProfCounters->buckets[i])
                 memset((void *) gDvmJit.pJitTraceProfCounters->buckets[i],
                        0, sizeof(JitTraceCounter_t) * JIT_PROF_BLOCK_ENTRIES);
         }
         gDvmJit.pJitTraceProfCounters->next = 0;
+        gDvmJit.pJitTraceProfCounters->freeHead = 0;
+        dvmUnlockMutex(&traceCounterLock);
     }
 
-    memset((void *) jitEntry, 0, sizeof(JitEntry) * size);
-    for (i=0; i< size; i++) {
-        jitEntry[i].u.info.chain = size;  /* Initialize chain termination */
-    }
+    JitEntry *jitEntry = gDvmJit.pJitEntryTable;
+    memset((void *) jitEntry, 0,
+           sizeof(JitEntry) * tableHeader(jitEntry)->size);
     gDvmJit.jitTableEntriesUsed = 0;
     dvmUnlockMutex(&gDvmJit.tableLock);
 }
@@ -1408,28 +1549,72 @@ void dvmJitResetTable()
 /*
  * Return the address of the next trace profile counter.  This address
  * will be embedded in the generated code for the trace, and thus cannot
- * change while the trace exists.
+ * change while the trace exists.  Counters of evicted traces are handed
+ * out again first.
  */
 JitTraceCounter_t *dvmJitNextTraceCounter()
 {
-    int idx = gDvmJit.pJitTraceProfCounters->next / JIT_PROF_BLOCK_ENTRIES;
-    int elem = gDvmJit.pJitTraceProfCounters->next % JIT_PROF_BLOCK_ENTRIES;
+    JitTraceProfCounters *counters = gDvmJit.pJitTraceProfCounters;
     JitTraceCounter_t *res;
-    /* Lazily allocate blocks of counters */
-    if (!gDvmJit.pJitTraceProfCounters->buckets[idx]) {
-        JitTraceCounter_t *p =
-              (JitTraceCounter_t*) calloc(JIT_PROF_BLOCK_ENTRIES, sizeof(*p));
-        if (!p) {
-            ALOGE("Failed to allocate block of trace profile counters");
-            dvmAbort();
+
+    dvmLockMutex(&traceCounterLock);
+    if (counters->freeHead != 0) {
+        int next = counters->freeHead - 1;
+        res = &counters->buckets[next / JIT_PROF_BLOCK_ENTRIES]
+                                [next % JIT_PROF_BLOCK_ENTRIES];
+        counters->freeHead = *res;
+        *res = 0;
+    } else if (counters->next < JIT_MAX_ENTRIES) {
+        int idx = counters->next / JIT_PROF_BLOCK_ENTRIES;
+        int elem = counters->next % JIT_PROF_BLOCK_ENTRIES;
+        /* Lazily allocate blocks of counters */
+        if (!counters->buckets[idx]) {
+            JitTraceCounter_t *p =
+                  (JitTraceCounter_t*) calloc(JIT_PROF_BLOCK_ENTRIES,
+                                              sizeof(*p));
+            if (!p) {
+                ALOGE("Failed to allocate block of trace profile counters");
+                dvmAbort();
+            }
+            counters->buckets[idx] = p;
         }
-        gDvmJit.pJitTraceProfCounters->buckets[idx] = p;
+        res = &counters->buckets[idx][elem];
+        counters->next++;
+    } else {
+        /*
+         * Out of counters, which can only happen if a lot of translations
+         * were discarded.  Let the traces share a spare one and reset the
+         * code cache at the next safe point to get them all back.
+         */
+        static JitTraceCounter_t overflowCounter;
+        res = &overflowCounter;
+        gDvmJit.codeCacheFull = true;
     }
-    res = &gDvmJit.pJitTraceProfCounters->buckets[idx][elem];
-    gDvmJit.pJitTraceProfCounters->next++;
+    dvmUnlockMutex(&traceCounterLock);
     return res;
 }
 
+/*
+ * Return the profile counter of an evicted trace to the pool.
+ */
+void dvmJitFreeTraceCounter(JitTraceCounter_t *counter)
+{
+    JitTraceProfCounters *counters = gDvmJit.pJitTraceProfCounters;
+
+    dvmLockMutex(&traceCounterLock);
+    for (int idx = 0; idx < JIT_PROF_BLOCK_BUCKETS; idx++) {
+        JitTraceCounter_t *bucket = counters->buckets[idx];
+        if (bucket != NULL && counter >= bucket &&
+            counter < bucket + JIT_PROF_BLOCK_ENTRIES) {
+            *counter = counters->freeHead;
+            counters->freeHead =
+                idx * JIT_PROF_BLOCK_ENTRIES + (counter - bucket) + 1;
+            break;
+        }
+    }
+    dvmUnlockMutex(&traceCounterLock);
+}
+
 /*
  * Float/double conversion requires clamping to min and max of integer form.  If
  * target doesn't support this normally, use these.
@@ -91,18 +91,13 @@ static inline u4 dvmJitHashMask( const u2* p, u4 mask ) {
     return ((((u4)p>>12)^(u4)p)>>1) & (mask);
 }
 
-static inline u4 dvmJitHash( const u2* p ) {
-    return dvmJitHashMask( p, gDvmJit.jitTableMask );
-}
-
 /*
- * The width of the chain field in JitEntryInfo sets the upper
- * bound on the number of translations.  Be careful if changing
- * the size of JitEntry struct - the Dalvik PC to JitEntry
- * hash functions have built-in knowledge of the size.
+ * Upper bound on the number of JitTable entries, and thus on the number
+ * of translations.  Be careful if changing the size of JitEntry struct -
+ * the Dalvik PC to JitEntry hash functions have built-in knowledge of the
+ * size.
  */
-#define JIT_ENTRY_CHAIN_WIDTH 2
-#define JIT_MAX_ENTRIES (1 << (JIT_ENTRY_CHAIN_WIDTH * 8))
+#define JIT_MAX_ENTRIES (1 << 20)
 
 /*
  * The trace profiling counters are allocated in blocks and individual
@@ -115,6 +110,11 @@ typedef s4 JitTraceCounter_t;
 
 struct JitTraceProfCounters {
     unsigned int           next;
+    /*
+     * Counters of evicted traces, linked through the counters themselves.
+     * Holds the index of the first one plus one, or zero if there are none.
+     */
+    unsigned int           freeHead;
     JitTraceCounter_t      *buckets[JIT_PROF_BLOCK_BUCKETS];
 };
 
@@ -122,6 +122,10 @@ struct JitTraceProfCounters {
  * Entries in the JIT's address lookup hash table.
  * Fields which may be updated by multiple threads packed into a
  * single 32-bit word to allow use of atomic update.
+ *
+ * The table is open-addressed with linear probing.  An entry is claimed
+ * by a CAS on its dPC and never released short of a table reset, so a
+ * lookup may stop at the first slot whose dPC is NULL.
  */
 
 struct JitEntryInfo {
@@ -130,8 +134,8 @@ struct JitEntryInfo {
     unsigned int           profileEnabled:1;
     JitInstructionSetType  instructionSet:3;
     unsigned int           profileOffset:5;
-    unsigned int           unused:5;
-    u2                     chain;                 /* Index of next in chain */
+    unsigned int           evicted:1;     /* Translation evicted, re-request */
+    unsigned int           unused:20;
 };
 
 union JitEntryInfoUnion {
@@ -145,6 +149,9 @@ struct JitEntry {
     void*               codeAddress;    /* Code address of native translation */
 };
 
+/* dPC of a slot whose new owner is still filling in the entry */
+#define JIT_ENTRY_BUSY ((const u2*) 1)
+
 extern "C" {
 void dvmCheckJit(const u2* pc, Thread* self);
 void* dvmJitGetTraceAddr(const u2* dPC);
@@ -159,7 +166,10 @@ void dvmBumpNormal(void);
 void dvmBumpPunt(int from);
 #endif
 void dvmJitStats(void);
+JitEntry *dvmJitAllocTable(unsigned int size);
 bool dvmJitResizeJitTable(unsigned int size);
+void dvmJitFreeRetiredTables(void);
+void dvmJitTableQuiescent(bool idle);
 void dvmJitResetTable(void);
 JitEntry *dvmJitFindEntry(const u2* pc, bool isMethodEntry);
 s8 dvmJitd2l(double d);
@@ -168,6 +178,10 @@ void dvmJitSetCodeAddr(const u2* dPC, void *nPC, JitInstructionSetType set,
                        bool isMethodEntry, int profilePrefixSize);
 void dvmJitEndTraceSelect(Thread* self, const u2* dPC);
 JitTraceCounter_t *dvmJitNextTraceCounter(void);
+void dvmJitFreeTraceCounter(JitTraceCounter_t *counter);
+JitTraceCounter_t *dvmJitGetTraceCounter(const JitEntry *entry);
+void dvmJitEvictEntry(JitEntry *entry);
+bool dvmJitRequestTrace(const u2* dPC, JitTraceDescription* desc);
 void dvmJitTraceProfilingOff(void);
 void dvmJitTraceProfilingOn(void);
 void dvmJitChangeProfileMode(TraceProfilingModes newState);
@@ -775,30 +775,6 @@ bail:
     return retObj;
 }
 
-struct LineNumFromPcContext {
-    u4 address;
-    u4 lineNum;
-};
-
-static int lineNumForPcCb(void *cnxt, u4 address, u4 lineNum)
-{
-    LineNumFromPcContext *pContext = (LineNumFromPcContext *)cnxt;
-
-    // We know that this callback will be called in
-    // ascending address order, so keep going until we find
-    // a match or we've just gone past it.
-
-    if (address > pContext->address) {
-        // The line number from the previous positions callback
-        // wil be the final result.
-        return 1;
-    }
-
-    pContext->lineNum = lineNum;
-
-    return (address == pContext->address) ? 1 : 0;
-}
-
 /*
  * Determine the source file line number based on the program counter.
  * "pc" is an offset, in 16-bit units, from the start of the method's code.
@@ -817,19 +793,7 @@ int dvmLineNumFromPC(const Method* method, u4 relPc)
         return -1;      /* can happen for abstract method stub */
     }
 
-    LineNumFromPcContext context;
-    memset(&context, 0, sizeof(context));
-    context.address = relPc;
-    // A method with no line number info should return -1
-    context.lineNum = -1;
-
-    dexDecodeDebugInfo(method->clazz->pDvmDex->pDexFile, pDexCode,
-            method->clazz->descriptor,
-            method->prototype.protoIdx,
-            method->accessFlags,
-            lineNumForPcCb, NULL, &context);
-
-    return context.lineNum;
+    return dvmLineTableLookup(dvmGetMethodLineTable(method), relPc);
 }
 
 /*
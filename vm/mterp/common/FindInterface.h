@@ -20,7 +20,31 @@
 extern "C" {
 
 /*
- * Look up an interface on a class using the cache.
+ * Look up an interface method in the class' imtable.  This only works
+ * once the method reference has been resolved, and returns NULL when the
+ * reference isn't resolved or the class has no entry for the method, in
+ * which case the caller must take the slow path.
+ */
+INLINE Method* dvmFindInterfaceMethodInImt(ClassObject* thisClass,
+    u4 methodIdx, DvmDex* methodClassDex)
+{
+    const ImtEntry* imtable = thisClass->imtable;
+    if (imtable == NULL)
+        return NULL;
+    Method* absMethod = dvmDexGetResolvedMethod(methodClassDex, methodIdx);
+    if (absMethod == NULL)
+        return NULL;
+
+    const ImtEntry* entry = &imtable[dvmImtSlot(absMethod)];
+    if (entry->interfaceMethod == absMethod)
+        return entry->method;
+    if (entry->conflicts != NULL)
+        return dvmImtFindConflict(entry, absMethod);
+    return NULL;
+}
+
+/*
+ * Look up an interface on a class, trying the imtable and then the cache.
  *
  * This function used to be defined in mterp/c/header.c, but it is now used by
  * the JIT compiler as well so it is separated into its own header file to
@@ -29,6 +53,11 @@ extern "C" {
 INLINE Method* dvmFindInterfaceMethodInCache(ClassObject* thisClass,
     u4 methodIdx, const Method* method, DvmDex* methodClassDex)
 {
+    Method* methodToCall =
+        dvmFindInterfaceMethodInImt(thisClass, methodIdx, methodClassDex);
+    if (methodToCall != NULL)
+        return methodToCall;
+
 #define ATOMIC_CACHE_CALC \
     dvmInterpFindInterfaceMethod(thisClass, methodIdx, method, methodClassDex)
 
@@ -26,6 +26,9 @@ void dvmInternalNativeShutdown(void);
 /* search the internal native set for a match */
 DalvikNativeFunc dvmLookupInternalNativeMethod(const Method* method);
 
+/* the DvmDex of an entry in gDvm.userDexFiles */
+DvmDex* dvmGetDexOrJarDex(void* vptr);
+
 /* exception-throwing stub for abstract methods (DalvikNativeFunc) */
 extern "C" void dvmAbstractMethodStub(const u4* args, JValue* pResult);
 
@@ -61,6 +61,19 @@ void dvmFreeDexOrJar(void* vptr)
     free(pDexOrJar);
 }
 
+/*
+ * Return the DvmDex of an entry in gDvm.userDexFiles.
+ */
+DvmDex* dvmGetDexOrJarDex(void* vptr)
+{
+    DexOrJar* pDexOrJar = (DexOrJar*) vptr;
+
+    if (pDexOrJar->isDex)
+        return dvmGetRawDexFileDex(pDexOrJar->pRawDexFile);
+    else
+        return dvmGetJarFileDex(pDexOrJar->pJarFile);
+}
+
 /*
  * (This is a dvmHashTableLookup compare func.)
  *
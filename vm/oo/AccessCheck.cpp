@@ -35,8 +35,12 @@ static int strcmpCount(const char* str1, const char* str2)
 
 /*
  * Returns "true" if the two classes are in the same runtime package.
+ *
+ * If "splitDex" is set, a non-array class2 from a different DEX file is
+ * treated as if it had a different class loader than class1.
  */
-bool dvmInSamePackage(const ClassObject* class1, const ClassObject* class2)
+static bool inSamePackage(const ClassObject* class1,
+    const ClassObject* class2, bool splitDex)
 {
     /* quick test for intra-class access */
     if (class1 == class2)
@@ -45,6 +49,11 @@ bool dvmInSamePackage(const ClassObject* class1, const ClassObject* class2)
     /* class loaders must match */
     if (class1->classLoader != class2->classLoader)
         return false;
+    if (splitDex && !dvmIsArrayClass(class2) &&
+        class1->pDvmDex != class2->pDvmDex)
+    {
+        return false;
+    }
 
     /*
      * Switch array classes to their element types.  Arrays receive the
@@ -82,11 +91,28 @@ bool dvmInSamePackage(const ClassObject* class1, const ClassObject* class2)
     return true;
 }
 
+/*
+ * Returns "true" if the two classes are in the same runtime package.
+ */
+bool dvmInSamePackage(const ClassObject* class1, const ClassObject* class2)
+{
+    return inSamePackage(class1, class2, false);
+}
+
+/*
+ * Determine whether the optimizer should treat classes from different
+ * DEX files as belonging to different class loaders.
+ */
+static bool optSplitDex()
+{
+    return gDvm.optimizing && !gDvm.optimizingBootstrapClass;
+}
+
 /*
  * Validate method/field access.
  */
 static bool checkAccess(const ClassObject* accessFrom,
-    const ClassObject* accessTo, u4 accessFlags)
+    const ClassObject* accessTo, u4 accessFlags, bool splitDex)
 {
     /* quick accept for public access */
     if (accessFlags & ACC_PUBLIC)
@@ -112,7 +138,7 @@ static bool checkAccess(const ClassObject* accessFrom,
      * Allow protected and private access from other classes in the same
      * package.
      */
-    return dvmInSamePackage(accessFrom, accessTo);
+    return inSamePackage(accessFrom, accessTo, splitDex);
 }
 
 /*
@@ -130,12 +156,27 @@ bool dvmCheckClassAccess(const ClassObject* accessFrom,
     return dvmInSamePackage(accessFrom, clazz);
 }
 
+bool dvmOptCheckClassAccess(const ClassObject* accessFrom,
+    const ClassObject* clazz)
+{
+    if (dvmIsPublicClass(clazz))
+        return true;
+    return inSamePackage(accessFrom, clazz, optSplitDex());
+}
+
 /*
  * Determine whether the "accessFrom" class is allowed to get at "method".
  */
 bool dvmCheckMethodAccess(const ClassObject* accessFrom, const Method* method)
 {
-    return checkAccess(accessFrom, method->clazz, method->accessFlags);
+    return checkAccess(accessFrom, method->clazz, method->accessFlags, false);
+}
+
+bool dvmOptCheckMethodAccess(const ClassObject* accessFrom,
+    const Method* method)
+{
+    return checkAccess(accessFrom, method->clazz, method->accessFlags,
+        optSplitDex());
 }
 
 /*
@@ -146,5 +187,11 @@ bool dvmCheckFieldAccess(const ClassObject* accessFrom, const Field* field)
     //ALOGI("CHECK ACCESS from '%s' to field '%s' (in %s) flags=%#x",
     //    accessFrom->descriptor, field->name,
     //    field->clazz->descriptor, field->accessFlags);
-    return checkAccess(accessFrom, field->clazz, field->accessFlags);
+    return checkAccess(accessFrom, field->clazz, field->accessFlags, false);
+}
+
+bool dvmOptCheckFieldAccess(const ClassObject* accessFrom, const Field* field)
+{
+    return checkAccess(accessFrom, field->clazz, field->accessFlags,
+        optSplitDex());
 }
@@ -40,4 +40,19 @@ bool dvmCheckFieldAccess(const ClassObject* accessFrom, const Field* field);
  */
 bool dvmInSamePackage(const ClassObject* class1, const ClassObject* class2);
 
+/*
+ * Variants of the above for the optimizer and pre-verifier, which load
+ * everything with the bootstrap class loader.  Unless we're optimizing
+ * the bootstrap class path itself, a class in a different DEX file than
+ * "accessFrom" is treated as if it had a different class loader.
+ *
+ * Unlike temporarily changing the class loader of the target, this is
+ * safe to use from several threads at once.
+ */
+bool dvmOptCheckClassAccess(const ClassObject* accessFrom,
+    const ClassObject* clazz);
+bool dvmOptCheckMethodAccess(const ClassObject* accessFrom,
+    const Method* method);
+bool dvmOptCheckFieldAccess(const ClassObject* accessFrom, const Field* field);
+
 #endif  // DALVIK_OO_ACCESSCHECK_H_
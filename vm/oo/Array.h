@@ -126,6 +126,16 @@ bool dvmCopyObjectArray(ArrayObject* dstArray, const ArrayObject* srcArray,
 bool dvmUnboxObjectArray(ArrayObject* dstArray, const ArrayObject* srcArray,
     ClassObject* dstElemClass);
 
+/*
+ * Copy a range of elements between two arrays, with the checks and
+ * exceptions of System.arraycopy().  Called by the native method and
+ * by compiled code for short constant-length copies.
+ *
+ * Returns false with an exception raised on failure.
+ */
+bool dvmArrayCopy(ArrayObject* srcArray, int srcPos, ArrayObject* dstArray,
+    int dstPos, int length);
+
 /*
  * Returns the size of the given array object in bytes.
  */
@@ -188,6 +188,7 @@ static void computeRefOffsets(ClassObject* clazz);
 static void freeMethodInnards(Method* meth);
 static bool createVtable(ClassObject* clazz);
 static bool createIftable(ClassObject* clazz);
+static bool createImtable(ClassObject* clazz);
 static bool insertMethodStubs(ClassObject* clazz);
 static bool computeFieldOffsets(ClassObject* clazz);
 static void throwEarlierClassFailure(ClassObject* clazz);
@@ -416,6 +417,9 @@ bool dvmClassStartup()
 
     gDvm.loadedClasses =
         dvmHashTableCreate(256, (HashFreeFunc) dvmFreeClassInnards);
+    gDvm.classTables = dvmClassTableSetCreate();
+    if (gDvm.classTables == NULL)
+        return false;
 
     gDvm.pBootLoaderAlloc = dvmLinearAllocCreate(NULL);
     if (gDvm.pBootLoaderAlloc == NULL)
@@ -468,6 +472,8 @@ bool dvmClassStartup()
 void dvmClassShutdown()
 {
     /* discard all system-loaded classes */
+    dvmClassTableSetFree(gDvm.classTables);
+    gDvm.classTables = NULL;
     dvmHashTableFree(gDvm.loadedClasses);
     gDvm.loadedClasses = NULL;
 
@@ -931,15 +937,9 @@ bail:
  * ===========================================================================
  */
 
-/* search for these criteria in the Class hash table */
-struct ClassMatchCriteria {
-    const char* descriptor;
-    Object*     loader;
-};
-
 #define kInitLoaderInc  4       /* must be power of 2 */
 
-static InitiatingLoaderList *dvmGetInitiatingLoaderList(ClassObject* clazz)
+InitiatingLoaderList *dvmGetInitiatingLoaderList(ClassObject* clazz)
 {
     assert(clazz->serialNumber >= INITIAL_CLASS_SERIAL_NUMBER);
     int classIndex = clazz->serialNumber-INITIAL_CLASS_SERIAL_NUMBER;
@@ -1048,65 +1048,35 @@ void dvmAddInitiatingLoader(ClassObject* clazz, Object* loader)
 
 bail_unlock:
         dvmHashTableUnlock(gDvm.loadedClasses);
+
+        /*
+         * Make the class visible by name in the loader's own table, so
+         * the next lookup through this loader finds it directly.
+         */
+        dvmClassTableAdd(gDvm.classTables, loader, clazz,
+            dvmComputeUtf8Hash(clazz->descriptor));
     }
 }
 
 /*
  * (This is a dvmHashTableLookup callback.)
  *
- * Entries in the class hash table are stored as { descriptor, d-loader }
- * tuples.  If the hashed class descriptor matches the requested descriptor,
- * and the hashed defining class loader matches the requested class
- * loader, we're good.  If only the descriptor matches, we check to see if the
- * loader is in the hashed class' initiating loader list.  If so, we
- * can return "true" immediately and skip some of the loadClass melodrama.
- *
- * The caller must lock the hash table before calling here.
+ * gDvm.loadedClasses holds every class exactly once; uniqueness on
+ * descriptor and loader is enforced by the per-loader class tables, so
+ * entries here are matched by identity.
  *
  * Returns 0 if a matching entry is found, nonzero otherwise.
  */
-static int hashcmpClassByCrit(const void* vclazz, const void* vcrit)
-{
-    const ClassObject* clazz = (const ClassObject*) vclazz;
-    const ClassMatchCriteria* pCrit = (const ClassMatchCriteria*) vcrit;
-    bool match;
-
-    match = (strcmp(clazz->descriptor, pCrit->descriptor) == 0 &&
-             (clazz->classLoader == pCrit->loader ||
-              (pCrit->loader != NULL &&
-               dvmLoaderInInitiatingList(clazz, pCrit->loader)) ));
-    //if (match)
-    //    ALOGI("+++ %s %p matches existing %s %p",
-    //        pCrit->descriptor, pCrit->loader,
-    //        clazz->descriptor, clazz->classLoader);
-    return !match;
-}
-
-/*
- * Like hashcmpClassByCrit, but passing in a fully-formed ClassObject
- * instead of a ClassMatchCriteria.
- */
 static int hashcmpClassByClass(const void* vclazz, const void* vaddclazz)
 {
-    const ClassObject* clazz = (const ClassObject*) vclazz;
-    const ClassObject* addClazz = (const ClassObject*) vaddclazz;
-    bool match;
-
-    match = (strcmp(clazz->descriptor, addClazz->descriptor) == 0 &&
-             (clazz->classLoader == addClazz->classLoader ||
-              (addClazz->classLoader != NULL &&
-               dvmLoaderInInitiatingList(clazz, addClazz->classLoader)) ));
-    return !match;
+    return vclazz != vaddclazz;
 }
 
 /*
- * Search through the hash table to find an entry with a matching descriptor
- * and an initiating class loader that matches "loader".
+ * Find the class that "loader" sees as "descriptor", either because it
+ * defined it or because it is one of the class' initiating loaders.
  *
- * The table entries are hashed on descriptor only, because they're unique
- * on *defining* class loader, not *initiating* class loader.  This isn't
- * great, because it guarantees we will have to probe when multiple
- * class loaders are used.
+ * This is a probe of the loader's own class table, which takes no lock.
  *
  * Note this does NOT try to load a class; it just finds a class that
  * has already been loaded.
@@ -1121,21 +1091,15 @@ static int hashcmpClassByClass(const void* vclazz, const void* vaddclazz)
 ClassObject* dvmLookupClass(const char* descriptor, Object* loader,
     bool unprepOkay)
 {
-    ClassMatchCriteria crit;
-    void* found;
+    ClassObject* found;
     u4 hash;
 
-    crit.descriptor = descriptor;
-    crit.loader = loader;
     hash = dvmComputeUtf8Hash(descriptor);
 
     LOGVV("threadid=%d: dvmLookupClass searching for '%s' %p",
         dvmThreadSelf()->threadId, descriptor, loader);
 
-    dvmHashTableLock(gDvm.loadedClasses);
-    found = dvmHashTableLookup(gDvm.loadedClasses, hash, &crit,
-                hashcmpClassByCrit, false);
-    dvmHashTableUnlock(gDvm.loadedClasses);
+    found = dvmClassTableLookup(gDvm.classTables, loader, descriptor, hash);
 
     /*
      * The class has been added to the hash table but isn't ready for use.
@@ -1145,47 +1109,53 @@ ClassObject* dvmLookupClass(const char* descriptor, Object* loader,
      * here, but this is an extremely rare case, and it's simpler to have
      * the wait-for-class code centralized.
      */
-    if (found && !unprepOkay && !dvmIsClassLinked((ClassObject*)found)) {
+    if (found && !unprepOkay && !dvmIsClassLinked(found)) {
         ALOGV("Ignoring not-yet-ready %s, using slow path",
-            ((ClassObject*)found)->descriptor);
+            found->descriptor);
         found = NULL;
     }
 
-    return (ClassObject*) found;
+    return found;
 }
 
 /*
  * Add a new class to the hash table.
  *
  * The class is considered "new" if it doesn't match on both the class
- * descriptor and the defining class loader.
- *
- * TODO: we should probably have separate hash tables for each
- * ClassLoader. This could speed up dvmLookupClass and
- * other common operations. It does imply a VM-visible data structure
- * for each ClassLoader object with loaded classes, which we don't
- * have yet.
+ * descriptor and the defining class loader.  New classes go into the
+ * defining loader's class table, which is what lookups use, and into
+ * gDvm.loadedClasses, which keeps them reachable and is what the GC,
+ * the debugger and the dump code walk.
  */
 bool dvmAddClassToHash(ClassObject* clazz)
 {
-    void* found;
+    ClassObject* found;
     u4 hash;
 
     hash = dvmComputeUtf8Hash(clazz->descriptor);
 
-    dvmHashTableLock(gDvm.loadedClasses);
-    found = dvmHashTableLookup(gDvm.loadedClasses, hash, clazz,
-                hashcmpClassByClass, true);
-    dvmHashTableUnlock(gDvm.loadedClasses);
+    found = dvmClassTableAdd(gDvm.classTables, clazz->classLoader, clazz,
+                hash);
+    if (found == clazz) {
+        dvmHashTableLock(gDvm.loadedClasses);
+        void* added = dvmHashTableLookup(gDvm.loadedClasses, hash, clazz,
+                        hashcmpClassByClass, true);
+        dvmHashTableUnlock(gDvm.loadedClasses);
+        if (added == NULL) {
+            dvmClassTableRemove(gDvm.classTables, clazz->classLoader, clazz,
+                hash);
+            found = NULL;
+        }
+    }
 
     ALOGV("+++ dvmAddClassToHash '%s' %p (isnew=%d) --> %p",
         clazz->descriptor, clazz->classLoader,
-        (found == (void*) clazz), clazz);
+        (found == clazz), clazz);
 
     //dvmCheckClassTablePerf();
 
     /* can happen if two threads load the same class simultaneously */
-    return (found == (void*) clazz);
+    return (found == clazz);
 }
 
 #if 0
@@ -1218,6 +1188,8 @@ static void removeClassFromHash(ClassObject* clazz)
 
     u4 hash = dvmComputeUtf8Hash(clazz->descriptor);
 
+    dvmClassTableRemove(gDvm.classTables, clazz->classLoader, clazz, hash);
+
     dvmHashTableLock(gDvm.loadedClasses);
     if (!dvmHashTableRemove(gDvm.loadedClasses, hash, clazz))
         ALOGW("Hash table remove failed on class '%s'", clazz->descriptor);
@@ -2082,6 +2054,8 @@ void dvmFreeClassInnards(ClassObject* clazz)
     clazz->ifviPoolCount = -1;
     NULL_AND_LINEAR_FREE(clazz->ifviPool);
 
+    NULL_AND_LINEAR_FREE(clazz->imtable);
+
     clazz->sfieldCount = -1;
     /* The sfields are attached to the ClassObject, and will be freed
      * with it. */
@@ -2780,6 +2754,8 @@ bool dvmLinkClass(ClassObject* clazz)
      */
     if (!createIftable(clazz))
         goto bail;
+    if (!createImtable(clazz))
+        goto bail;
 
     /*
      * Insert special-purpose "stub" method implementations.
@@ -3455,6 +3431,86 @@ bail:
     return result;
 }
 
+/*
+ * Create and populate "imtable" from "iftable" and the vtable.
+ *
+ * Each abstract method of each interface we implement gets the slot
+ * picked by dvmImtSlot().  Slots that more than one method maps to get a
+ * list of all of them, which is stored after the IMT_SIZE slots in the
+ * same allocation.  If an interface appears twice in "iftable", the first
+ * entry wins, as it does in dvmInterpFindInterfaceMethod().
+ *
+ * Returns "true" on success.
+ */
+static bool createImtable(ClassObject* clazz)
+{
+    if (dvmIsInterfaceClass(clazz) || dvmIsAbstractClass(clazz))
+        return true;
+
+    int slotCounts[IMT_SIZE];
+    int methodCount = 0;
+    memset(slotCounts, 0, sizeof(slotCounts));
+    for (int i = 0; i < clazz->iftableCount; i++) {
+        ClassObject* interface = clazz->iftable[i].clazz;
+        for (int j = 0; j < interface->virtualMethodCount; j++) {
+            slotCounts[dvmImtSlot(&interface->virtualMethods[j])]++;
+            methodCount++;
+        }
+    }
+    if (methodCount == 0)
+        return true;
+
+    int conflictCount = 0;
+    for (int slot = 0; slot < IMT_SIZE; slot++) {
+        if (slotCounts[slot] > 1)
+            conflictCount += slotCounts[slot] + 1;
+    }
+
+    size_t size = sizeof(ImtEntry) * (IMT_SIZE + conflictCount);
+    ImtEntry* imtable = (ImtEntry*) dvmLinearAlloc(clazz->classLoader, size);
+    if (imtable == NULL)
+        return false;
+    memset(imtable, 0x00, size);
+
+    ImtEntry* conflicts = imtable + IMT_SIZE;
+    for (int slot = 0; slot < IMT_SIZE; slot++) {
+        if (slotCounts[slot] > 1) {
+            imtable[slot].conflicts = conflicts;
+            conflicts += slotCounts[slot] + 1;
+        }
+    }
+
+    for (int i = 0; i < clazz->iftableCount; i++) {
+        ClassObject* interface = clazz->iftable[i].clazz;
+        for (int j = 0; j < interface->virtualMethodCount; j++) {
+            const Method* imeth = &interface->virtualMethods[j];
+            int vtableIndex = clazz->iftable[i].methodIndexArray[j];
+            assert(vtableIndex >= 0 && vtableIndex < clazz->vtableCount);
+
+            ImtEntry* entry = &imtable[dvmImtSlot(imeth)];
+            if (entry->conflicts != NULL) {
+                entry = (ImtEntry*) entry->conflicts;
+                while (entry->interfaceMethod != NULL &&
+                       entry->interfaceMethod != imeth)
+                {
+                    entry++;
+                }
+            }
+            if (entry->interfaceMethod == NULL) {
+                entry->interfaceMethod = imeth;
+                entry->method = clazz->vtable[vtableIndex];
+            }
+        }
+    }
+
+    LOGVV("IMT: %s has %d interface methods, %d conflict entries",
+        clazz->descriptor, methodCount, conflictCount);
+
+    clazz->imtable = imtable;
+    dvmLinearReadOnly(clazz->classLoader, clazz->imtable);
+    return true;
+}
+
 
 /*
  * Provide "stub" implementations for methods without them.
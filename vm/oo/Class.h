@@ -145,6 +145,12 @@ bool dvmAddClassToHash(ClassObject* clazz);
 void dvmAddInitiatingLoader(ClassObject* clazz, Object* loader);
 bool dvmLoaderInInitiatingList(const ClassObject* clazz, const Object* loader);
 
+/*
+ * Returns the list of loaders that initiated loading of "clazz".  The
+ * class hash table lock must be held.
+ */
+InitiatingLoaderList* dvmGetInitiatingLoaderList(ClassObject* clazz);
+
 /*
  * Update method's "nativeFunc" and "insns".  If "insns" is NULL, the
  * current method->insns value is not changed.
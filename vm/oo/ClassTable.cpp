@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Per-class-loader class tables.
+ */
+#include "Dalvik.h"
+
+#include <cutils/atomic.h>
+
+/* Initial number of slots in a loader's table; must be power of 2 */
+#define kInitialClassSlots      64
+
+/* Initial number of slots in the loader directory; must be power of 2 */
+#define kInitialLoaderSlots     16
+
+/* Marks the slot of a class that was removed */
+#define CLASS_TOMBSTONE ((ClassObject*) 0xcbcacccd)
+
+struct ClassTableEntry {
+    u4 hash;
+    ClassObject* volatile clazz;
+};
+
+/*
+ * Open-addressed storage for a table.  Storage that has been replaced
+ * is chained through "retired" and freed with the table.
+ */
+struct ClassTableStorage {
+    size_t size;
+    ClassTableStorage* retired;
+    ClassTableEntry entries[1];
+};
+
+struct LoaderClassTable {
+    const Object* loader;
+
+    /* Guards updates; lookups don't take it */
+    pthread_mutex_t lock;
+
+    ClassTableStorage* volatile storage;
+
+    /* Used slots, including tombstones */
+    size_t numUsed;
+};
+
+struct LoaderDirectory {
+    size_t size;
+    LoaderDirectory* retired;
+    LoaderClassTable* volatile tables[1];
+};
+
+struct ClassTableSet {
+    /* Guards adding loaders */
+    pthread_mutex_t lock;
+
+    /* Table of the bootstrap class loader */
+    LoaderClassTable* bootTable;
+
+    LoaderDirectory* volatile loaders;
+    size_t numLoaders;
+};
+
+template <typename T>
+static inline T* loadPointer(T* volatile* addr)
+{
+    return (T*) android_atomic_acquire_load((volatile int32_t*) addr);
+}
+
+template <typename T>
+static inline void storePointer(T* value, T* volatile* addr)
+{
+    android_atomic_release_store((int32_t) value, (volatile int32_t*) addr);
+}
+
+static inline u4 loaderHash(const Object* loader)
+{
+    return ((u4) loader >> 3) * 0x9e3779b1;
+}
+
+static ClassTableStorage* allocStorage(size_t size)
+{
+    ClassTableStorage* storage = (ClassTableStorage*)
+        calloc(1, sizeof(ClassTableStorage) +
+                  (size - 1) * sizeof(ClassTableEntry));
+    if (storage != NULL) {
+        storage->size = size;
+    }
+    return storage;
+}
+
+static LoaderClassTable* createLoaderTable(const Object* loader)
+{
+    LoaderClassTable* table =
+        (LoaderClassTable*) calloc(1, sizeof(LoaderClassTable));
+    if (table == NULL) {
+        return NULL;
+    }
+    table->storage = allocStorage(kInitialClassSlots);
+    if (table->storage == NULL) {
+        free(table);
+        return NULL;
+    }
+    table->loader = loader;
+    dvmInitMutex(&table->lock);
+    return table;
+}
+
+static void freeLoaderTable(LoaderClassTable* table)
+{
+    ClassTableStorage* storage = table->storage;
+    while (storage != NULL) {
+        ClassTableStorage* retired = storage->retired;
+        free(storage);
+        storage = retired;
+    }
+    dvmDestroyMutex(&table->lock);
+    free(table);
+}
+
+static LoaderDirectory* allocDirectory(size_t size)
+{
+    LoaderDirectory* dir = (LoaderDirectory*)
+        calloc(1, sizeof(LoaderDirectory) +
+                  (size - 1) * sizeof(LoaderClassTable*));
+    if (dir != NULL) {
+        dir->size = size;
+    }
+    return dir;
+}
+
+ClassTableSet* dvmClassTableSetCreate()
+{
+    ClassTableSet* set = (ClassTableSet*) calloc(1, sizeof(ClassTableSet));
+    if (set == NULL) {
+        return NULL;
+    }
+    dvmInitMutex(&set->lock);
+    set->bootTable = createLoaderTable(NULL);
+    set->loaders = allocDirectory(kInitialLoaderSlots);
+    if (set->bootTable == NULL || set->loaders == NULL) {
+        dvmClassTableSetFree(set);
+        return NULL;
+    }
+    return set;
+}
+
+void dvmClassTableSetFree(ClassTableSet* set)
+{
+    if (set == NULL) {
+        return;
+    }
+    LoaderDirectory* dir = set->loaders;
+    if (dir != NULL) {
+        for (size_t i = 0; i < dir->size; i++) {
+            if (dir->tables[i] != NULL) {
+                freeLoaderTable(dir->tables[i]);
+            }
+        }
+    }
+    while (dir != NULL) {
+        LoaderDirectory* retired = dir->retired;
+        free(dir);
+        dir = retired;
+    }
+    if (set->bootTable != NULL) {
+        freeLoaderTable(set->bootTable);
+    }
+    dvmDestroyMutex(&set->lock);
+    free(set);
+}
+
+/*
+ * Find the table of a loader without taking any lock.
+ */
+static LoaderClassTable* findLoaderTable(ClassTableSet* set,
+    const Object* loader)
+{
+    if (loader == NULL) {
+        return set->bootTable;
+    }
+    LoaderDirectory* dir = loadPointer(&set->loaders);
+    size_t mask = dir->size - 1;
+    for (size_t i = loaderHash(loader) & mask; ; i = (i + 1) & mask) {
+        LoaderClassTable* table = loadPointer(&dir->tables[i]);
+        if (table == NULL || table->loader == loader) {
+            return table;
+        }
+    }
+}
+
+static void putLoaderTable(LoaderDirectory* dir, LoaderClassTable* table)
+{
+    size_t mask = dir->size - 1;
+    size_t i = loaderHash(table->loader) & mask;
+    while (dir->tables[i] != NULL) {
+        i = (i + 1) & mask;
+    }
+    storePointer(table, &dir->tables[i]);
+}
+
+/*
+ * Find the table of a loader, creating it if need be.
+ */
+static LoaderClassTable* getLoaderTable(ClassTableSet* set,
+    const Object* loader)
+{
+    LoaderClassTable* table = findLoaderTable(set, loader);
+    if (table != NULL) {
+        return table;
+    }
+
+    dvmLockMutex(&set->lock);
+    table = findLoaderTable(set, loader);
+    if (table == NULL) {
+        LoaderDirectory* dir = set->loaders;
+        if ((set->numLoaders + 1) * 2 > dir->size) {
+            LoaderDirectory* bigger = allocDirectory(dir->size * 2);
+            if (bigger == NULL) {
+                goto bail;
+            }
+            for (size_t i = 0; i < dir->size; i++) {
+                if (dir->tables[i] != NULL) {
+                    putLoaderTable(bigger, dir->tables[i]);
+                }
+            }
+            bigger->retired = dir;
+            storePointer(bigger, &set->loaders);
+            dir = bigger;
+        }
+        table = createLoaderTable(loader);
+        if (table != NULL) {
+            putLoaderTable(dir, table);
+            set->numLoaders++;
+        }
+    }
+bail:
+    dvmUnlockMutex(&set->lock);
+    return table;
+}
+
+static bool matches(const ClassTableEntry* entry, const ClassObject* clazz,
+    const char* descriptor, u4 hash)
+{
+    return clazz != CLASS_TOMBSTONE && entry->hash == hash &&
+           strcmp(clazz->descriptor, descriptor) == 0;
+}
+
+ClassObject* dvmClassTableLookup(ClassTableSet* set, const Object* loader,
+    const char* descriptor, u4 hash)
+{
+    LoaderClassTable* table = findLoaderTable(set, loader);
+    if (table == NULL) {
+        return NULL;
+    }
+    ClassTableStorage* storage = loadPointer(&table->storage);
+    size_t mask = storage->size - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        ClassTableEntry* entry = &storage->entries[i];
+        ClassObject* clazz = loadPointer(&entry->clazz);
+        if (clazz == NULL) {
+            return NULL;
+        }
+        if (matches(entry, clazz, descriptor, hash)) {
+            return clazz;
+        }
+    }
+}
+
+static void putClass(ClassTableStorage* storage, ClassObject* clazz, u4 hash)
+{
+    size_t mask = storage->size - 1;
+    size_t i = hash & mask;
+    while (storage->entries[i].clazz != NULL) {
+        i = (i + 1) & mask;
+    }
+    storage->entries[i].hash = hash;
+    storePointer(clazz, &storage->entries[i].clazz);
+}
+
+/*
+ * Replace the storage of a table with one twice the size, leaving the
+ * tombstones behind.  The caller holds the table lock.
+ */
+static bool growTable(LoaderClassTable* table)
+{
+    ClassTableStorage* storage = table->storage;
+    ClassTableStorage* bigger = allocStorage(storage->size * 2);
+    if (bigger == NULL) {
+        return false;
+    }
+    size_t numUsed = 0;
+    for (size_t i = 0; i < storage->size; i++) {
+        ClassObject* clazz = storage->entries[i].clazz;
+        if (clazz != NULL && clazz != CLASS_TOMBSTONE) {
+            putClass(bigger, clazz, storage->entries[i].hash);
+            numUsed++;
+        }
+    }
+    bigger->retired = storage;
+    storePointer(bigger, &table->storage);
+    table->numUsed = numUsed;
+    return true;
+}
+
+ClassObject* dvmClassTableAdd(ClassTableSet* set, Object* loader,
+    ClassObject* clazz, u4 hash)
+{
+    LoaderClassTable* table = getLoaderTable(set, loader);
+    if (table == NULL) {
+        return NULL;
+    }
+
+    dvmLockMutex(&table->lock);
+    ClassObject* result = NULL;
+    ClassTableStorage* storage = table->storage;
+    size_t mask = storage->size - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        ClassTableEntry* entry = &storage->entries[i];
+        if (entry->clazz == NULL) {
+            break;
+        }
+        if (matches(entry, entry->clazz, clazz->descriptor, hash)) {
+            result = entry->clazz;
+            goto bail;
+        }
+    }
+    if ((table->numUsed + 1) * 2 > storage->size && !growTable(table)) {
+        goto bail;
+    }
+    putClass(table->storage, clazz, hash);
+    table->numUsed++;
+    result = clazz;
+
+bail:
+    dvmUnlockMutex(&table->lock);
+    return result;
+}
+
+bool dvmClassTableRemove(ClassTableSet* set, const Object* loader,
+    ClassObject* clazz, u4 hash)
+{
+    LoaderClassTable* table = findLoaderTable(set, loader);
+    if (table == NULL) {
+        return false;
+    }
+
+    bool found = false;
+    dvmLockMutex(&table->lock);
+    ClassTableStorage* storage = table->storage;
+    size_t mask = storage->size - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        ClassTableEntry* entry = &storage->entries[i];
+        if (entry->clazz == NULL) {
+            break;
+        }
+        if (entry->clazz == clazz) {
+            storePointer(CLASS_TOMBSTONE, &entry->clazz);
+            found = true;
+            break;
+        }
+    }
+    dvmUnlockMutex(&table->lock);
+    return found;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Per-class-loader class tables.
+ *
+ * Each class loader gets a table of the classes it can see by name: the
+ * ones it defined and the ones it is an initiating loader for.  Finding
+ * a class for a loader is then a probe on the descriptor alone, with no
+ * walk of initiating loader lists.
+ *
+ * Lookups take no lock.  Classes are only ever added, apart from the
+ * rare removal of a class that failed to load, which leaves a tombstone.
+ * A table that fills up is copied into a bigger one that is then
+ * published; the old storage is kept until the set is freed, because a
+ * reader may still be probing it.
+ *
+ * The tables don't own the classes or the loaders; gDvm.loadedClasses
+ * keeps both reachable.
+ */
+#ifndef DALVIK_OO_CLASS_TABLE_H_
+#define DALVIK_OO_CLASS_TABLE_H_
+
+struct ClassTableSet;
+
+/*
+ * Create and free a set of per-loader class tables.
+ */
+ClassTableSet* dvmClassTableSetCreate(void);
+void dvmClassTableSetFree(ClassTableSet* set);
+
+/*
+ * Find the class visible to <loader> as <descriptor>, whose
+ * dvmComputeUtf8Hash() is <hash>.  Returns NULL if there is none.
+ */
+ClassObject* dvmClassTableLookup(ClassTableSet* set, const Object* loader,
+    const char* descriptor, u4 hash);
+
+/*
+ * Make <clazz> visible to <loader> under its descriptor.  Returns the
+ * class already visible under that name if there is one, and <clazz>
+ * otherwise.  Returns NULL if memory runs out.
+ */
+ClassObject* dvmClassTableAdd(ClassTableSet* set, Object* loader,
+    ClassObject* clazz, u4 hash);
+
+/*
+ * Remove <clazz> from the table of <loader>.  Returns false if it was
+ * not there.
+ */
+bool dvmClassTableRemove(ClassTableSet* set, const Object* loader,
+    ClassObject* clazz, u4 hash);
+
+#endif  // DALVIK_OO_CLASS_TABLE_H_
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Decoded per-method line number and catch handler tables.
+ */
+#include "Dalvik.h"
+#include "libdex/DexCatch.h"
+
+#include <cutils/atomic.h>
+
+/* Shared by every method without positions or try items */
+static const MethodLineTable gEmptyLineTable = { 0 };
+static const MethodCatchTable gEmptyCatchTable = { 0, NULL, NULL };
+
+template <typename T>
+static inline const T* loadTable(const T* const volatile* slot)
+{
+    return (const T*) android_atomic_acquire_load((volatile int32_t*) slot);
+}
+
+/*
+ * Install "table" in "*slot" unless another thread got there first.
+ * Returns whichever table ended up installed.  "emptyTable" is the shared
+ * empty table, which is never freed.
+ */
+template <typename T>
+static const T* publishTable(const Method* method,
+    const T* const volatile* slot, const T* table, const T* emptyTable)
+{
+    ClassObject* clazz = method->clazz;
+    const T* winner = table;
+
+    dvmLinearReadWrite(clazz->classLoader, clazz->virtualMethods);
+    dvmLinearReadWrite(clazz->classLoader, clazz->directMethods);
+    if (android_atomic_release_cas(0, (int32_t) table,
+            (volatile int32_t*) slot) != 0)
+    {
+        winner = loadTable(slot);
+        if (table != emptyTable) {
+            dvmLinearFree(clazz->classLoader, (void*) table);
+        }
+    }
+    dvmLinearReadOnly(clazz->classLoader, clazz->virtualMethods);
+    dvmLinearReadOnly(clazz->classLoader, clazz->directMethods);
+    return winner;
+}
+
+struct LineTableBuilder {
+    LineTableEntry* entries;
+    u4 count;
+};
+
+static int addPositionCb(void* cnxt, u4 address, u4 lineNum)
+{
+    LineTableBuilder* pBuilder = (LineTableBuilder*) cnxt;
+
+    if (pBuilder->entries != NULL) {
+        pBuilder->entries[pBuilder->count].address = address;
+        pBuilder->entries[pBuilder->count].lineNum = lineNum;
+    }
+    pBuilder->count++;
+    return 0;
+}
+
+static void decodePositions(const Method* method, const DexCode* pDexCode,
+    LineTableBuilder* pBuilder)
+{
+    dexDecodeDebugInfo(method->clazz->pDvmDex->pDexFile, pDexCode,
+            method->clazz->descriptor,
+            method->prototype.protoIdx,
+            method->accessFlags,
+            addPositionCb, NULL, pBuilder);
+}
+
+/*
+ * Decode the debug info once to size the table and once more to fill it.
+ */
+static MethodLineTable* buildLineTable(const Method* method)
+{
+    const DexCode* pDexCode = dvmGetMethodCode(method);
+    LineTableBuilder builder;
+
+    builder.entries = NULL;
+    builder.count = 0;
+    decodePositions(method, pDexCode, &builder);
+    if (builder.count == 0) {
+        return (MethodLineTable*) &gEmptyLineTable;
+    }
+
+    u4 count = builder.count;
+    MethodLineTable* pTable = (MethodLineTable*) dvmLinearAlloc(
+            method->clazz->classLoader,
+            offsetof(MethodLineTable, entries) +
+            count * sizeof(LineTableEntry));
+    builder.entries = pTable->entries;
+    builder.count = 0;
+    decodePositions(method, pDexCode, &builder);
+    assert(builder.count == count);
+    pTable->count = count;
+    dvmLinearReadOnly(method->clazz->classLoader, pTable);
+    return pTable;
+}
+
+static MethodCatchTable* buildCatchTable(const Method* method)
+{
+    const DexCode* pCode = dvmGetMethodCode(method);
+    u4 rangeCount = pCode->triesSize;
+
+    if (rangeCount == 0) {
+        return (MethodCatchTable*) &gEmptyCatchTable;
+    }
+
+    const DexTry* pTries = dexGetTries(pCode);
+    DexCatchIterator iterator;
+    u4 handlerCount = 0;
+    for (u4 i = 0; i < rangeCount; i++) {
+        dexCatchIteratorInit(&iterator, pCode, pTries[i].handlerOff);
+        while (dexCatchIteratorNext(&iterator) != NULL) {
+            handlerCount++;
+        }
+    }
+
+    MethodCatchTable* pTable = (MethodCatchTable*) dvmLinearAlloc(
+            method->clazz->classLoader,
+            sizeof(MethodCatchTable) +
+            rangeCount * sizeof(CatchTableRange) +
+            handlerCount * sizeof(CatchTableHandler));
+    CatchTableRange* ranges = (CatchTableRange*) (pTable + 1);
+    CatchTableHandler* handlers = (CatchTableHandler*) (ranges + rangeCount);
+    u4 nextHandler = 0;
+    for (u4 i = 0; i < rangeCount; i++) {
+        ranges[i].startAddr = pTries[i].startAddr;
+        ranges[i].endAddr = pTries[i].startAddr + pTries[i].insnCount;
+        ranges[i].firstHandler = nextHandler;
+
+        dexCatchIteratorInit(&iterator, pCode, pTries[i].handlerOff);
+        for (;;) {
+            DexCatchHandler* handler = dexCatchIteratorNext(&iterator);
+            if (handler == NULL) {
+                break;
+            }
+            handlers[nextHandler].typeIdx = handler->typeIdx;
+            handlers[nextHandler].address = handler->address;
+            nextHandler++;
+        }
+        ranges[i].handlerCount = nextHandler - ranges[i].firstHandler;
+    }
+    assert(nextHandler == handlerCount);
+
+    pTable->rangeCount = rangeCount;
+    pTable->ranges = ranges;
+    pTable->handlers = handlers;
+    dvmLinearReadOnly(method->clazz->classLoader, pTable);
+    return pTable;
+}
+
+/*
+ * Get the line number table, building it on first use.
+ */
+const MethodLineTable* dvmGetMethodLineTable(const Method* method)
+{
+    const MethodLineTable* pTable = loadTable(&method->lineTable);
+
+    if (pTable == NULL) {
+        MethodLineTable* pNewTable = buildLineTable(method);
+        pTable = publishTable(method, &method->lineTable,
+                (const MethodLineTable*) pNewTable, &gEmptyLineTable);
+    }
+    return pTable;
+}
+
+/*
+ * Get the catch table, building it on first use.
+ */
+const MethodCatchTable* dvmGetMethodCatchTable(const Method* method)
+{
+    const MethodCatchTable* pTable = loadTable(&method->catchTable);
+
+    if (pTable == NULL) {
+        MethodCatchTable* pNewTable = buildCatchTable(method);
+        pTable = publishTable(method, &method->catchTable,
+                (const MethodCatchTable*) pNewTable, &gEmptyCatchTable);
+    }
+    return pTable;
+}
+
+/*
+ * Find the line for "relPc".
+ */
+int dvmLineTableLookup(const MethodLineTable* pTable, u4 relPc)
+{
+    const LineTableEntry* entries = pTable->entries;
+    u4 lo = 0;
+    u4 hi = pTable->count;
+
+    /* find the first entry at or after relPc */
+    while (lo < hi) {
+        u4 mid = (lo + hi) / 2;
+        if (entries[mid].address < relPc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < pTable->count && entries[lo].address == relPc) {
+        return entries[lo].lineNum;
+    }
+    if (lo > 0) {
+        return entries[lo - 1].lineNum;
+    }
+    return -1;
+}
+
+/*
+ * Find the try range for "relPc".
+ */
+const CatchTableRange* dvmCatchTableLookup(const MethodCatchTable* pTable,
+    u4 relPc)
+{
+    const CatchTableRange* ranges = pTable->ranges;
+    u4 lo = 0;
+    u4 hi = pTable->rangeCount;
+
+    while (lo < hi) {
+        u4 mid = (lo + hi) / 2;
+        if (relPc < ranges[mid].startAddr) {
+            hi = mid;
+        } else if (relPc >= ranges[mid].endAddr) {
+            lo = mid + 1;
+        } else {
+            return &ranges[mid];
+        }
+    }
+    return NULL;
+}
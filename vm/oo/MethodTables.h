@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Decoded per-method line number and catch handler tables.
+ *
+ * The DEX file stores both as compact streams that have to be decoded
+ * from the start: the debug info is a small state machine, and each
+ * handler list is a run of ULEB128 values.  Stack traces and exception
+ * dispatch would otherwise redo that work for every frame they visit,
+ * so the first lookup for a method decodes the stream into a sorted
+ * array and hangs it off the Method.  Later lookups binary search it.
+ *
+ * Tables are allocated from the LinearAlloc of the method's class loader
+ * and live as long as the class does.  They are built without a lock; if
+ * two threads race, the loser frees its copy and uses the winner's.
+ */
+#ifndef DALVIK_OO_METHOD_TABLES_H_
+#define DALVIK_OO_METHOD_TABLES_H_
+
+/*
+ * One "position" entry from the debug info.  Entries are in ascending
+ * address order; several may share an address.
+ */
+struct LineTableEntry {
+    u4              address;        /* in 16-bit code units */
+    u4              lineNum;
+};
+
+struct MethodLineTable {
+    u4              count;
+    LineTableEntry  entries[1];
+};
+
+/* One handler from a catch handler list */
+struct CatchTableHandler {
+    u4              typeIdx;        /* kDexNoIndex for a catch-all */
+    u4              address;
+};
+
+/*
+ * One try item.  Ranges are sorted by address and don't overlap.  The
+ * handlers are handlers[firstHandler] onward, in the order they appear in
+ * the DEX file, so a catch-all is always the last one.
+ */
+struct CatchTableRange {
+    u4              startAddr;
+    u4              endAddr;        /* exclusive */
+    u4              firstHandler;
+    u4              handlerCount;
+};
+
+struct MethodCatchTable {
+    u4                          rangeCount;
+    const CatchTableRange*      ranges;
+    const CatchTableHandler*    handlers;
+};
+
+/*
+ * Get the line number table of a method with code, building it if this
+ * is the first request.
+ */
+const MethodLineTable* dvmGetMethodLineTable(const Method* method);
+
+/*
+ * Get the catch table of a method with code, building it if this is the
+ * first request.
+ */
+const MethodCatchTable* dvmGetMethodCatchTable(const Method* method);
+
+/*
+ * Look up the source line for "relPc" the same way a full walk of the
+ * debug info would: the first position at exactly "relPc", else the last
+ * one before it.  Returns -1 if there is none.
+ */
+int dvmLineTableLookup(const MethodLineTable* pTable, u4 relPc);
+
+/*
+ * Find the try range covering "relPc".  Returns NULL if there is none.
+ */
+const CatchTableRange* dvmCatchTableLookup(const MethodCatchTable* pTable,
+    u4 relPc);
+
+#endif  // DALVIK_OO_METHOD_TABLES_H_
@@ -191,6 +191,26 @@ struct InterfaceEntry {
     int*            methodIndexArray;
 };
 
+/*
+ * Number of slots in a class' interface method table; must be power of 2.
+ */
+#define IMT_SIZE 32
+
+/*
+ * Used for imtable in ClassObject.
+ *
+ * A slot holds the one interface method that maps to it and the concrete
+ * method that implements it.  When several interface methods map to the
+ * same slot, "interfaceMethod" is NULL and "conflicts" points at a list
+ * of entries for all of them, terminated by one with a NULL
+ * "interfaceMethod".
+ */
+struct ImtEntry {
+    const Method*   interfaceMethod;
+    Method*         method;
+    const ImtEntry* conflicts;
+};
+
 
 
 /*
@@ -448,6 +468,15 @@ struct ClassObject : Object {
     int             ifviPoolCount;
     int*            ifviPool;
 
+    /*
+     * Interface method table (imtable), IMT_SIZE entries mapping the
+     * abstract interface methods this class implements to the concrete
+     * methods, hashed by dvmImtSlot().  This lets invoke-interface find
+     * its target without a walk of "iftable".  Only instantiable classes
+     * that implement interface methods have one; it's NULL otherwise.
+     */
+    ImtEntry*       imtable;
+
     /* instance fields
      *
      * These describe the layout of the contents of a DataObject-compatible
@@ -580,6 +609,14 @@ struct Method {
 
     /* set if method was called during method profiling */
     bool            inProfile;
+
+    /*
+     * Line number and catch handler tables, decoded from the DEX file the
+     * first time they are needed.  Use dvmGetMethodLineTable() and
+     * dvmGetMethodCatchTable() rather than reading these directly.
+     */
+    const struct MethodLineTable* volatile lineTable;
+    const struct MethodCatchTable* volatile catchTable;
 };
 
 
@@ -667,6 +704,16 @@ INLINE int dvmFindFieldOffset(const ClassObject* clazz,
         return pField->byteOffset;
 }
 
+/*
+ * Get the imtable slot of an abstract interface method.  Methods don't
+ * move, and the methods of one interface are laid out next to each other,
+ * so dividing the address by the size spreads them over adjacent slots.
+ */
+INLINE u4 dvmImtSlot(const Method* interfaceMethod)
+{
+    return ((u4) interfaceMethod / sizeof(Method)) & (IMT_SIZE - 1);
+}
+
 /*
  * Helpers.
  */
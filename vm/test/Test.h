@@ -23,5 +23,16 @@
 bool dvmTestHash(void);
 bool dvmTestAtomicSpeed(void);
 bool dvmTestIndirectRefTable(void);
+bool dvmTestSlabAllocSpeed(void);
+bool dvmTestInternTable(void);
+bool dvmTestClassTable(void);
+bool dvmTestMethodTables(void);
+bool dvmTestZipExtract(void);
+bool dvmTestDexOptThreads(void);
+bool dvmTestUtf(void);
+bool dvmTestJniGlobalRefs(void);
+bool dvmTestJniCritical(void);
+bool dvmTestHotTraces(void);
+bool dvmTestStacklessExceptions(void);
 
 #endif  // DALVIK_TEST_TEST_H_
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Load the boot classes through several class loaders, and compare
+ * lookups in per-loader class tables with lookups in a single shared
+ * table hashed on descriptor, which is how gDvm.loadedClasses used to
+ * be searched.
+ */
+#include "Dalvik.h"
+
+#ifndef NDEBUG
+
+#define DBUG_MSG    ALOGI
+
+static const int kMaxClasses = 2048;
+static const int kMaxLoaders = 16;
+static const int kLookupRounds = 20;
+
+/* An entry of the shared table: a class as defined by one loader */
+struct SharedEntry {
+    const char* descriptor;
+    const Object* loader;
+};
+
+struct ClassList {
+    ClassObject* classes[kMaxClasses];
+    u4 hashes[kMaxClasses];
+    int count;
+};
+
+static int collectClass(void* vclazz, void* arg)
+{
+    ClassObject* clazz = (ClassObject*) vclazz;
+    ClassList* list = (ClassList*) arg;
+    if (list->count == kMaxClasses) {
+        return 1;
+    }
+    list->classes[list->count] = clazz;
+    list->hashes[list->count] = dvmComputeUtf8Hash(clazz->descriptor);
+    list->count++;
+    return 0;
+}
+
+/*
+ * The loaders are only used as keys, so any distinct pointers will do.
+ */
+static Object* fakeLoader(int i)
+{
+    return (Object*) (0x1000 + i * 8);
+}
+
+static int sharedEntryCmp(const void* ventry, const void* vcrit)
+{
+    const SharedEntry* entry = (const SharedEntry*) ventry;
+    const SharedEntry* crit = (const SharedEntry*) vcrit;
+    return !(strcmp(entry->descriptor, crit->descriptor) == 0 &&
+             entry->loader == crit->loader);
+}
+
+/*
+ * Make every class visible through <numLoaders> loaders, then look each
+ * one up through every loader, in both kinds of table.
+ */
+static bool runLoaders(const ClassList* list, int numLoaders)
+{
+    bool result = false;
+    int numEntries = list->count * numLoaders;
+    SharedEntry* entries =
+        (SharedEntry*) malloc(numEntries * sizeof(SharedEntry));
+    HashTable* shared = dvmHashTableCreate(256, NULL);
+    ClassTableSet* set = dvmClassTableSetCreate();
+    if (entries == NULL || shared == NULL || set == NULL) {
+        ALOGE("Out of memory for class table test");
+        goto bail;
+    }
+
+    for (int l = 0; l < numLoaders; l++) {
+        for (int i = 0; i < list->count; i++) {
+            SharedEntry* entry = &entries[l * list->count + i];
+            entry->descriptor = list->classes[i]->descriptor;
+            entry->loader = fakeLoader(l);
+            dvmHashTableLookup(shared, list->hashes[i], entry,
+                sharedEntryCmp, true);
+            if (dvmClassTableAdd(set, fakeLoader(l), list->classes[i],
+                    list->hashes[i]) != list->classes[i]) {
+                ALOGE("Adding '%s' failed", entry->descriptor);
+                goto bail;
+            }
+        }
+    }
+
+    {
+        u8 start = dvmGetRelativeTimeUsec();
+        for (int r = 0; r < kLookupRounds; r++) {
+            for (int l = 0; l < numLoaders; l++) {
+                for (int i = 0; i < list->count; i++) {
+                    SharedEntry crit;
+                    crit.descriptor = list->classes[i]->descriptor;
+                    crit.loader = fakeLoader(l);
+                    dvmHashTableLock(shared);
+                    void* found = dvmHashTableLookup(shared, list->hashes[i],
+                                    &crit, sharedEntryCmp, false);
+                    dvmHashTableUnlock(shared);
+                    if (found == NULL) {
+                        ALOGE("Shared lookup of '%s' failed", crit.descriptor);
+                        goto bail;
+                    }
+                }
+            }
+        }
+        u8 sharedTime = dvmGetRelativeTimeUsec() - start;
+
+        start = dvmGetRelativeTimeUsec();
+        for (int r = 0; r < kLookupRounds; r++) {
+            for (int l = 0; l < numLoaders; l++) {
+                for (int i = 0; i < list->count; i++) {
+                    ClassObject* clazz = list->classes[i];
+                    if (dvmClassTableLookup(set, fakeLoader(l),
+                            clazz->descriptor, list->hashes[i]) != clazz) {
+                        ALOGE("Lookup of '%s' failed", clazz->descriptor);
+                        goto bail;
+                    }
+                }
+            }
+        }
+        u8 tableTime = dvmGetRelativeTimeUsec() - start;
+
+        DBUG_MSG("%d loaders, %d lookups: shared %lldus, per-loader %lldus",
+                 numLoaders, numEntries * kLookupRounds, sharedTime,
+                 tableTime);
+    }
+
+    /* a loader that loaded nothing sees nothing */
+    if (dvmClassTableLookup(set, fakeLoader(numLoaders),
+            list->classes[0]->descriptor, list->hashes[0]) != NULL) {
+        ALOGE("Unrelated loader found '%s'", list->classes[0]->descriptor);
+        goto bail;
+    }
+
+    /* removal only affects the one loader */
+    if (!dvmClassTableRemove(set, fakeLoader(0), list->classes[0],
+            list->hashes[0]) ||
+        dvmClassTableLookup(set, fakeLoader(0),
+            list->classes[0]->descriptor, list->hashes[0]) != NULL ||
+        (numLoaders > 1 && dvmClassTableLookup(set, fakeLoader(1),
+            list->classes[0]->descriptor, list->hashes[0]) !=
+                list->classes[0])) {
+        ALOGE("Removal of '%s' failed", list->classes[0]->descriptor);
+        goto bail;
+    }
+
+    result = true;
+
+bail:
+    dvmClassTableSetFree(set);
+    dvmHashTableFree(shared);
+    free(entries);
+    return result;
+}
+
+bool dvmTestClassTable()
+{
+    ClassList* list = (ClassList*) calloc(1, sizeof(ClassList));
+    if (list == NULL) {
+        return false;
+    }
+
+    dvmHashTableLock(gDvm.loadedClasses);
+    dvmHashForeach(gDvm.loadedClasses, collectClass, list);
+    dvmHashTableUnlock(gDvm.loadedClasses);
+
+    bool result = list->count > 0;
+    for (int numLoaders = 1; result && numLoaders <= kMaxLoaders;
+         numLoaders *= 4) {
+        if (!runLoaders(list, numLoaders)) {
+            ALOGE("Class table test failed");
+            result = false;
+        }
+    }
+    free(list);
+    return result;
+}
+
+#endif /*NDEBUG*/
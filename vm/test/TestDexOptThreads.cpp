@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Run dexopt over the same DEX file with one worker thread and with
+ * several, and check that the two odex files are identical.
+ */
+#include "Dalvik.h"
+#include "analysis/DexPrepare.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#ifndef NDEBUG
+
+#define DBUG_MSG    ALOGI
+
+#ifdef HAVE_ANDROID_OS
+# define kTestDir   "/data/local/tmp"
+#else
+# define kTestDir   "/tmp"
+#endif
+
+static const int kNumThreads = 4;
+
+/*
+ * Extract "classes.dex" from <jarName> into a new cache file and optimize
+ * it with <numThreads> threads, like a jar on the boot class path.
+ * Returns the open file, or -1 on failure.
+ */
+static int optimizeJar(const char* jarName, const char* cacheName,
+    int numThreads)
+{
+    ZipArchive archive;
+    if (dexZipOpenArchive(jarName, &archive) != 0) {
+        ALOGE("Unable to open '%s'", jarName);
+        return -1;
+    }
+    ZipEntry entry = dexZipFindEntry(&archive, "classes.dex");
+    if (entry == NULL) {
+        ALOGE("No classes.dex in '%s'", jarName);
+        dexZipCloseArchive(&archive);
+        return -1;
+    }
+
+    unlink(cacheName);
+    bool newFile;
+    u4 modWhen = dexGetZipEntryModTime(&archive, entry);
+    u4 crc = dexGetZipEntryCrc32(&archive, entry);
+    int fd = dvmOpenCachedDexFile(jarName, cacheName, modWhen, crc, true,
+                &newFile, /*createIfMissing=*/true);
+    unlink(cacheName);
+    if (fd < 0 || !newFile) {
+        ALOGE("Unable to create cache file '%s'", cacheName);
+        if (fd >= 0) {
+            close(fd);
+        }
+        dexZipCloseArchive(&archive);
+        return -1;
+    }
+
+    int oldThreads = gDvm.dexOptThreads;
+    gDvm.dexOptThreads = numThreads;
+    off_t dexOffset = lseek(fd, 0, SEEK_CUR);
+    bool result = dexOffset > 0 &&
+        dexZipExtractEntryToFile(&archive, entry, fd) == 0 &&
+        dvmOptimizeDexFile(fd, dexOffset,
+            dexGetZipEntryUncompLen(&archive, entry), jarName, modWhen, crc,
+            true);
+    gDvm.dexOptThreads = oldThreads;
+    dvmUnlockCachedDexFile(fd);
+    dexZipCloseArchive(&archive);
+
+    if (!result) {
+        ALOGE("Unable to optimize '%s' with %d threads", jarName, numThreads);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sameContents(int fd1, int fd2)
+{
+    off_t len1 = lseek(fd1, 0, SEEK_END);
+    off_t len2 = lseek(fd2, 0, SEEK_END);
+    if (len1 <= 0 || len1 != len2) {
+        ALOGE("odex sizes differ: %ld vs %ld", (long) len1, (long) len2);
+        return false;
+    }
+    void* map1 = mmap(NULL, len1, PROT_READ, MAP_SHARED, fd1, 0);
+    void* map2 = mmap(NULL, len2, PROT_READ, MAP_SHARED, fd2, 0);
+    bool same = false;
+    if (map1 == MAP_FAILED || map2 == MAP_FAILED) {
+        ALOGE("Unable to map odex files: %s", strerror(errno));
+    } else {
+        same = memcmp(map1, map2, len1) == 0;
+        if (!same) {
+            const u1* p1 = (const u1*) map1;
+            const u1* p2 = (const u1*) map2;
+            off_t i = 0;
+            while (p1[i] == p2[i]) {
+                i++;
+            }
+            ALOGE("odex files first differ at offset %#lx", (long) i);
+        }
+    }
+    if (map1 != MAP_FAILED) {
+        munmap(map1, len1);
+    }
+    if (map2 != MAP_FAILED) {
+        munmap(map2, len2);
+    }
+    return same;
+}
+
+bool dvmTestDexOptThreads()
+{
+    /* the last jar on the boot class path, since nothing depends on it */
+    const char* jarName = NULL;
+    for (const ClassPathEntry* cpe = gDvm.bootClassPath;
+         cpe != NULL && cpe->kind != kCpeLastEntry; cpe++) {
+        if (cpe->kind == kCpeJar) {
+            jarName = cpe->fileName;
+        }
+    }
+    if (jarName == NULL) {
+        ALOGE("No jar on the boot class path to optimize");
+        return false;
+    }
+
+    char serialName[PATH_MAX];
+    char parallelName[PATH_MAX];
+    snprintf(serialName, sizeof(serialName), "%s/dexoptthreads-%d-1.odex",
+        kTestDir, getpid());
+    snprintf(parallelName, sizeof(parallelName), "%s/dexoptthreads-%d-%d.odex",
+        kTestDir, getpid(), kNumThreads);
+
+    bool result = false;
+    u8 start = dvmGetRelativeTimeUsec();
+    int serialFd = optimizeJar(jarName, serialName, 1);
+    u8 serialTime = dvmGetRelativeTimeUsec() - start;
+    start = dvmGetRelativeTimeUsec();
+    int parallelFd = (serialFd >= 0) ?
+        optimizeJar(jarName, parallelName, kNumThreads) : -1;
+    u8 parallelTime = dvmGetRelativeTimeUsec() - start;
+
+    if (parallelFd >= 0) {
+        result = sameContents(serialFd, parallelFd);
+        DBUG_MSG("dexopt '%s': 1 thread %lldus, %d threads %lldus",
+            jarName, serialTime, kNumThreads, parallelTime);
+    }
+    if (serialFd >= 0) {
+        close(serialFd);
+    }
+    if (parallelFd >= 0) {
+        close(parallelFd);
+    }
+    if (!result) {
+        ALOGE("dexopt thread test failed");
+    }
+    return result;
+}
+
+#endif /*NDEBUG*/
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Save traces that end in an invoke as hot trace records, rebuild them,
+ * and check that the meta runs the compiler reads after the invoke come
+ * back.
+ */
+#include "Dalvik.h"
+#include "compiler/Compiler.h"
+
+#if !defined(NDEBUG) && defined(WITH_JIT)
+
+#define DBUG_MSG    ALOGI
+
+static bool isSingletonInvoke(Opcode opcode)
+{
+    return opcode == OP_INVOKE_STATIC || opcode == OP_INVOKE_STATIC_RANGE ||
+           opcode == OP_INVOKE_DIRECT || opcode == OP_INVOKE_DIRECT_RANGE;
+}
+
+static bool isVirtualInvoke(Opcode opcode)
+{
+    return opcode == OP_INVOKE_VIRTUAL || opcode == OP_INVOKE_VIRTUAL_RANGE ||
+           opcode == OP_INVOKE_INTERFACE ||
+           opcode == OP_INVOKE_INTERFACE_RANGE;
+}
+
+/*
+ * Find an invoke in <clazz> that has been resolved and for which
+ * <match> holds.  Returns the method, and the offset of the invoke in
+ * *pOffset.
+ */
+static const Method* findInvoke(ClassObject* clazz,
+                                bool (*match)(Opcode), u4* pOffset)
+{
+    DvmDex* pDvmDex = clazz->pDvmDex;
+    int numMethods = clazz->directMethodCount + clazz->virtualMethodCount;
+    for (int i = 0; i < numMethods; i++) {
+        const Method* method = (i < clazz->directMethodCount) ?
+            &clazz->directMethods[i] :
+            &clazz->virtualMethods[i - clazz->directMethodCount];
+        if (method->clazz != clazz || method->insns == NULL) {
+            continue;
+        }
+        u4 insnsSize = dvmGetMethodInsnsSize(method);
+        u4 offset = 0;
+        while (offset < insnsSize) {
+            const u2* insns = method->insns + offset;
+            size_t width = dexGetWidthFromInstruction(insns);
+            if (width == 0) {
+                break;
+            }
+            DecodedInstruction dec;
+            dexDecodeInstruction(insns, &dec);
+            if ((*match)(dec.opcode) &&
+                pDvmDex->pResMethods[dec.vB] != NULL) {
+                *pOffset = offset;
+                return method;
+            }
+            offset += width;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Describe a one-instruction trace of the invoke at <offset>, as the
+ * interpreter would, and round-trip it.
+ */
+static bool checkRoundTrip(const Method* method, u4 offset,
+                           const Method* expectedCallee)
+{
+    const int numRuns = 1 + JIT_TRACE_CUR_METHOD + 1;
+    JitTraceDescription* desc = (JitTraceDescription*)
+        calloc(1, sizeof(JitTraceDescription) + sizeof(JitTraceRun) * numRuns);
+    if (desc == NULL) {
+        return false;
+    }
+    desc->method = method;
+    desc->trace[0].isCode = true;
+    desc->trace[0].info.frag.startOffset = offset;
+    desc->trace[0].info.frag.numInsts = 1;
+    desc->trace[JIT_TRACE_CLASS_DESC].info.meta =
+        (void*) method->clazz->descriptor;
+    desc->trace[JIT_TRACE_CLASS_LOADER].info.meta =
+        (void*) method->clazz->classLoader;
+    desc->trace[JIT_TRACE_CUR_METHOD].info.meta =
+        (void*) method->clazz->pDvmDex->pResMethods[0];
+    desc->trace[numRuns - 1].isCode = true;
+    desc->trace[numRuns - 1].info.frag.runEnd = true;
+
+    JitTraceDescription* rebuilt = dvmCompilerRebuildHotTrace(desc);
+    free(desc);
+    if (rebuilt == NULL) {
+        ALOGE("Can't rebuild trace of %s.%s at %#x",
+            method->clazz->descriptor, method->name, offset);
+        return false;
+    }
+
+    bool result = true;
+    const JitTraceRun* runs = rebuilt->trace;
+    if (rebuilt->method != method || !runs[0].isCode ||
+        runs[0].info.frag.startOffset != offset ||
+        runs[0].info.frag.numInsts != 1 || runs[0].info.frag.runEnd) {
+        ALOGE("Code run of %s.%s at %#x not rebuilt",
+            method->clazz->descriptor, method->name, offset);
+        result = false;
+    }
+    for (int i = JIT_TRACE_CLASS_DESC; result && i <= JIT_TRACE_CUR_METHOD;
+         i++) {
+        const void* expected =
+            (i == JIT_TRACE_CUR_METHOD) ? expectedCallee : NULL;
+        if (runs[i].isCode || runs[i].info.meta != expected) {
+            ALOGE("Meta run %d of %s.%s at %#x is %p, expected %p", i,
+                method->clazz->descriptor, method->name, offset,
+                runs[i].isCode ? NULL : runs[i].info.meta, expected);
+            result = false;
+        }
+    }
+    if (result && (!runs[numRuns - 1].isCode ||
+                   runs[numRuns - 1].info.frag.numInsts != 0 ||
+                   !runs[numRuns - 1].info.frag.runEnd)) {
+        ALOGE("Trace of %s.%s at %#x has no end marker",
+            method->clazz->descriptor, method->name, offset);
+        result = false;
+    }
+    free(rebuilt);
+    return result;
+}
+
+bool dvmTestHotTraces()
+{
+    static const char* kClasses[] = {
+        "Ljava/lang/String;", "Ljava/lang/Thread;", "Ljava/lang/Integer;",
+    };
+    bool checkedSingleton = false;
+    bool checkedVirtual = false;
+
+    for (size_t i = 0; i < NELEM(kClasses); i++) {
+        ClassObject* clazz = dvmFindSystemClassNoInit(kClasses[i]);
+        if (clazz == NULL || !dvmIsClassInitialized(clazz)) {
+            dvmClearException(dvmThreadSelf());
+            continue;
+        }
+        u4 offset;
+        const Method* method;
+        if (!checkedSingleton &&
+            (method = findInvoke(clazz, isSingletonInvoke, &offset)) != NULL) {
+            DecodedInstruction dec;
+            dexDecodeInstruction(method->insns + offset, &dec);
+            if (!checkRoundTrip(method, offset,
+                                clazz->pDvmDex->pResMethods[dec.vB])) {
+                return false;
+            }
+            checkedSingleton = true;
+        }
+        if (!checkedVirtual &&
+            (method = findInvoke(clazz, isVirtualInvoke, &offset)) != NULL) {
+            if (!checkRoundTrip(method, offset, NULL)) {
+                return false;
+            }
+            checkedVirtual = true;
+        }
+    }
+    if (!checkedSingleton || !checkedVirtual) {
+        ALOGE("No resolved invokes to round-trip");
+        return false;
+    }
+    DBUG_MSG("Hot trace round trip OK");
+    return true;
+}
+
+#endif /*!NDEBUG && WITH_JIT*/
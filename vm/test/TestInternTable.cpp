@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Intern strings from several threads at once, and check that every
+ * thread gets the same object back for the same string.
+ */
+#include "Dalvik.h"
+
+#include <cutils/atomic.h>
+
+#ifndef NDEBUG
+
+#define DBUG_MSG    ALOGI
+
+static const int kMaxThreads = 8;
+static const int kNumWords = 4096;
+static const int kInternsPerThread = 100000;
+
+/*
+ * The first few words are interned as literals, which are never
+ * collected, so the objects handed out for them can be compared across
+ * threads.
+ */
+static const int kNumLiteralWords = 64;
+static volatile int32_t gLiterals[kNumLiteralWords];
+
+static volatile int32_t gFailed;
+
+struct InternWorkerArgs {
+    u4 seed;
+};
+
+static void* internWorker(void* arg)
+{
+    InternWorkerArgs* args = (InternWorkerArgs*) arg;
+    Thread* self = dvmThreadSelf();
+    u4 seed = args->seed;
+    char buf[32];
+
+    for (int i = 0; i < kInternsPerThread && !gFailed; i++) {
+        seed = seed * 1103515245 + 12345;
+        int word = (seed >> 16) % kNumWords;
+        snprintf(buf, sizeof(buf), "intern-test-%d", word);
+        StringObject* str = dvmCreateStringFromCstr(buf);
+        if (str == NULL) {
+            android_atomic_release_store(1, &gFailed);
+            break;
+        }
+        StringObject* interned;
+        if (word < kNumLiteralWords) {
+            interned = dvmLookupImmortalInternedString(str);
+            int32_t value = (int32_t) interned;
+            if (android_atomic_release_cas(0, value, &gLiterals[word]) != 0 &&
+                android_atomic_acquire_load(&gLiterals[word]) != value) {
+                ALOGE("Literal '%s' interned as two objects", buf);
+                android_atomic_release_store(1, &gFailed);
+            }
+        } else {
+            interned = dvmLookupInternedString(str);
+        }
+        if (interned == NULL || dvmHashcmpStrings(interned, str) != 0) {
+            ALOGE("Bad interned string for '%s'", buf);
+            android_atomic_release_store(1, &gFailed);
+        }
+        dvmReleaseTrackedAlloc((Object*) str, self);
+        if ((i & 255) == 0) {
+            dvmCheckSuspendPending(self);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Runs the workload on <numThreads> threads at once and logs the rate.
+ */
+static bool runThreads(int numThreads)
+{
+    Thread* self = dvmThreadSelf();
+    pthread_t handles[kMaxThreads];
+    InternWorkerArgs args[kMaxThreads];
+    int started = 0;
+
+    u8 start = dvmGetRelativeTimeUsec();
+    for (int i = 0; i < numThreads; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "InternTest %d", i);
+        args[i].seed = i + 1;
+        if (!dvmCreateInternalThread(&handles[i], name, internWorker,
+                                     &args[i])) {
+            ALOGE("Can't create intern test thread");
+            android_atomic_release_store(1, &gFailed);
+            break;
+        }
+        started++;
+    }
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+    for (int i = 0; i < started; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    dvmChangeStatus(self, oldStatus);
+    u8 elapsed = dvmGetRelativeTimeUsec() - start;
+
+    DBUG_MSG("%d threads: %d interns in %lldus (%lld per ms)",
+             numThreads, numThreads * kInternsPerThread, elapsed,
+             (numThreads * kInternsPerThread * 1000LL) / (elapsed + 1));
+    return !gFailed;
+}
+
+bool dvmTestInternTable()
+{
+    memset((void*) gLiterals, 0, sizeof(gLiterals));
+    gFailed = 0;
+    for (int numThreads = 1; numThreads <= kMaxThreads; numThreads *= 2) {
+        if (!runThreads(numThreads)) {
+            ALOGE("Intern table test failed");
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif /*NDEBUG*/
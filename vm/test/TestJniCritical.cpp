@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Get and release several primitive arrays at once through the batched
+ * critical functions, and check that the thread leaves no critical state
+ * behind.
+ */
+#include "Dalvik.h"
+
+#ifndef NDEBUG
+
+/* more than kJniCriticalRefMax, so some arrays use the global pin table */
+static const int kNumArrays = kJniCriticalRefMax + 4;
+static const int kArrayLength = 64;
+
+bool dvmTestJniCritical()
+{
+    Thread* self = dvmThreadSelf();
+    JNIEnv* env = dvmGetThreadJNIEnv(self);
+    jarray arrays[kNumArrays];
+    void* elems[kNumArrays];
+    bool result = false;
+
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_NATIVE);
+    if (env->PushLocalFrame(kNumArrays) != JNI_OK) {
+        ALOGE("Can't push local frame");
+        dvmChangeStatus(self, oldStatus);
+        return false;
+    }
+
+    for (int i = 0; i < kNumArrays; i++) {
+        arrays[i] = env->NewByteArray(kArrayLength);
+        if (arrays[i] == NULL) {
+            ALOGE("Can't allocate test array %d", i);
+            goto bail;
+        }
+    }
+
+    dvmGetPrimitiveArraysCritical(env, kNumArrays, arrays, elems);
+    if (self->jniCriticalDepth != kNumArrays) {
+        ALOGE("Critical depth %d after batch get, expected %d",
+                self->jniCriticalDepth, kNumArrays);
+        goto bail;
+    }
+    for (int i = 0; i < kNumArrays; i++) {
+        memset(elems[i], i, kArrayLength);
+    }
+    dvmReleasePrimitiveArraysCritical(env, kNumArrays, arrays, elems, 0);
+    if (self->jniCriticalDepth != 0 || self->jniCriticalRefCount != 0) {
+        ALOGE("Critical depth %d / %d refs left after batch release",
+                self->jniCriticalDepth, self->jniCriticalRefCount);
+        goto bail;
+    }
+
+    for (int i = 0; i < kNumArrays; i++) {
+        jbyte buf[kArrayLength];
+        env->GetByteArrayRegion((jbyteArray) arrays[i], 0, kArrayLength, buf);
+        if (buf[0] != i || buf[kArrayLength - 1] != i) {
+            ALOGE("Array %d lost its critical writes", i);
+            goto bail;
+        }
+    }
+    result = true;
+
+bail:
+    env->PopLocalFrame(NULL);
+    dvmChangeStatus(self, oldStatus);
+    return result;
+}
+
+#endif /*NDEBUG*/
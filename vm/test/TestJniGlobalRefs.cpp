@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Create and delete JNI global references, and pin and unpin arrays,
+ * from several native threads at once.
+ */
+#include "Dalvik.h"
+
+#include <cutils/atomic.h>
+
+#ifndef NDEBUG
+
+#define DBUG_MSG    ALOGI
+
+static const int kMaxThreads = 8;
+static const int kLoopsPerThread = 100000;
+
+/* #of global references each thread keeps outstanding */
+static const int kHeldRefs = 64;
+
+static volatile int32_t gFailed;
+
+static void* globalRefWorker(void* arg)
+{
+    Thread* self = dvmThreadSelf();
+    JNIEnv* env = dvmGetThreadJNIEnv(self);
+    jobject held[kHeldRefs];
+
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_NATIVE);
+
+    jbyteArray array = env->NewByteArray(256);
+    if (array == NULL) {
+        android_atomic_release_store(1, &gFailed);
+        dvmChangeStatus(self, oldStatus);
+        return NULL;
+    }
+    memset(held, 0, sizeof(held));
+
+    for (int i = 0; i < kLoopsPerThread && !gFailed; i++) {
+        /* replace an outstanding ref, so slots are freed out of order */
+        int which = (i * 17) % kHeldRefs;
+        if (held[which] != NULL) {
+            if (!env->IsSameObject(held[which], array)) {
+                ALOGE("Global ref %p no longer refers to %p",
+                        held[which], array);
+                android_atomic_release_store(1, &gFailed);
+            }
+            env->DeleteGlobalRef(held[which]);
+        }
+        held[which] = env->NewGlobalRef(array);
+
+        jbyte* bytes = (jbyte*) env->GetPrimitiveArrayCritical(array, NULL);
+        bytes[0]++;
+        env->ReleasePrimitiveArrayCritical(array, bytes, 0);
+    }
+
+    for (int i = 0; i < kHeldRefs; i++) {
+        if (held[i] != NULL) {
+            env->DeleteGlobalRef(held[i]);
+        }
+    }
+    env->DeleteLocalRef(array);
+    dvmChangeStatus(self, oldStatus);
+    return NULL;
+}
+
+/*
+ * Runs the workload on <numThreads> threads at once and logs the rate.
+ */
+static bool runThreads(int numThreads)
+{
+    Thread* self = dvmThreadSelf();
+    pthread_t handles[kMaxThreads];
+    int started = 0;
+
+    u8 start = dvmGetRelativeTimeUsec();
+    for (int i = 0; i < numThreads; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "JniRefTest %d", i);
+        if (!dvmCreateInternalThread(&handles[i], name, globalRefWorker,
+                                     NULL)) {
+            ALOGE("Can't create JNI global ref test thread");
+            android_atomic_release_store(1, &gFailed);
+            break;
+        }
+        started++;
+    }
+    ThreadStatus oldStatus = dvmChangeStatus(self, THREAD_VMWAIT);
+    for (int i = 0; i < started; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    dvmChangeStatus(self, oldStatus);
+    u8 elapsed = dvmGetRelativeTimeUsec() - start;
+
+    DBUG_MSG("%d threads: %d global ref and pin cycles in %lldus (%lld per ms)",
+             numThreads, numThreads * kLoopsPerThread, elapsed,
+             (numThreads * kLoopsPerThread * 1000LL) / (elapsed + 1));
+    return !gFailed;
+}
+
+bool dvmTestJniGlobalRefs()
+{
+    gFailed = 0;
+    for (int numThreads = 1; numThreads <= kMaxThreads; numThreads *= 2) {
+        if (!runThreads(numThreads)) {
+            ALOGE("JNI global ref test failed");
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif /*NDEBUG*/
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Check the decoded line number and catch tables of every loaded method
+ * against a direct walk of the DEX data, at every pc.
+ */
+#include "Dalvik.h"
+#include "libdex/DexCatch.h"
+
+#ifndef NDEBUG
+
+#define DBUG_MSG    ALOGI
+
+struct LineContext {
+    u4 address;
+    int lineNum;
+};
+
+/* Stop at the first position at "address", or just past it */
+static int lineCb(void* cnxt, u4 address, u4 lineNum)
+{
+    LineContext* pContext = (LineContext*) cnxt;
+
+    if (address > pContext->address) {
+        return 1;
+    }
+    pContext->lineNum = lineNum;
+    return (address == pContext->address) ? 1 : 0;
+}
+
+static int decodeLine(const Method* method, const DexCode* pCode, u4 relPc)
+{
+    LineContext context;
+    context.address = relPc;
+    context.lineNum = -1;
+    dexDecodeDebugInfo(method->clazz->pDvmDex->pDexFile, pCode,
+            method->clazz->descriptor, method->prototype.protoIdx,
+            method->accessFlags, lineCb, NULL, &context);
+    return context.lineNum;
+}
+
+static bool checkCatch(const Method* method, const DexCode* pCode, u4 relPc)
+{
+    const MethodCatchTable* pTable = dvmGetMethodCatchTable(method);
+    const CatchTableRange* pRange = dvmCatchTableLookup(pTable, relPc);
+    DexCatchIterator iterator;
+
+    if (!dexFindCatchHandler(&iterator, pCode, relPc)) {
+        return pRange == NULL;
+    }
+    if (pRange == NULL) {
+        return false;
+    }
+
+    u4 i = 0;
+    for (;;) {
+        DexCatchHandler* handler = dexCatchIteratorNext(&iterator);
+        if (handler == NULL) {
+            break;
+        }
+        const CatchTableHandler* entry =
+            &pTable->handlers[pRange->firstHandler + i];
+        if (i == pRange->handlerCount ||
+            entry->typeIdx != handler->typeIdx ||
+            entry->address != handler->address) {
+            return false;
+        }
+        i++;
+    }
+    return i == pRange->handlerCount;
+}
+
+static bool checkMethod(const Method* method, int* pNumPcs)
+{
+    const DexCode* pCode = dvmGetMethodCode(method);
+    if (pCode == NULL || method->clazz->pDvmDex == NULL) {
+        return true;
+    }
+
+    const MethodLineTable* pLines = dvmGetMethodLineTable(method);
+    for (u4 relPc = 0; relPc <= pCode->insnsSize; relPc++) {
+        int expected = decodeLine(method, pCode, relPc);
+        int actual = dvmLineTableLookup(pLines, relPc);
+        if (actual != expected) {
+            ALOGE("%s.%s: line %d at pc %#x, expected %d",
+                method->clazz->descriptor, method->name, actual, relPc,
+                expected);
+            return false;
+        }
+        if (!checkCatch(method, pCode, relPc)) {
+            ALOGE("%s.%s: catch handlers differ at pc %#x",
+                method->clazz->descriptor, method->name, relPc);
+            return false;
+        }
+        (*pNumPcs)++;
+    }
+
+    /* built once, then shared */
+    return dvmGetMethodLineTable(method) == pLines;
+}
+
+struct CheckState {
+    int numMethods;
+    int numPcs;
+    bool failed;
+};
+
+static int checkClass(void* vclazz, void* arg)
+{
+    ClassObject* clazz = (ClassObject*) vclazz;
+    CheckState* pState = (CheckState*) arg;
+
+    for (int i = 0; i < clazz->directMethodCount; i++) {
+        pState->numMethods++;
+        if (!checkMethod(&clazz->directMethods[i], &pState->numPcs)) {
+            pState->failed = true;
+            return 1;
+        }
+    }
+    for (int i = 0; i < clazz->virtualMethodCount; i++) {
+        pState->numMethods++;
+        if (!checkMethod(&clazz->virtualMethods[i], &pState->numPcs)) {
+            pState->failed = true;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool dvmTestMethodTables()
+{
+    CheckState state;
+    memset(&state, 0, sizeof(state));
+
+    dvmHashTableLock(gDvm.loadedClasses);
+    dvmHashForeach(gDvm.loadedClasses, checkClass, &state);
+    dvmHashTableUnlock(gDvm.loadedClasses);
+
+    if (state.failed) {
+        ALOGE("Method table test failed");
+        return false;
+    }
+    DBUG_MSG("Checked %d pcs in %d methods", state.numPcs, state.numMethods);
+    return true;
+}
+
+#endif /*NDEBUG*/
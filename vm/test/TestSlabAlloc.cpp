@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compare the slab allocator with plain mspace allocation for a stream
+ * of small objects.  Both run on a private mspace, so this can be used
+ * whichever allocator the heap itself has been configured with.
+ */
+#include "Dalvik.h"
+#include "alloc/HeapSource.h"
+#include "alloc/SlabAlloc.h"
+
+#include <sys/mman.h>
+
+#ifndef NDEBUG
+
+#define DBUG_MSG    ALOGI
+
+/* Large enough that the workload never asks the mspace for morecore. */
+static const size_t kRegionSize = 16 * 1024 * 1024;
+static const int kNumObjects = 100000;
+
+/*
+ * Object sizes roughly follow what a running app allocates: mostly
+ * strings, boxed values and small collections nodes.
+ */
+static size_t objectSize(u4 *seed)
+{
+    static const u1 kSizes[] = {
+        8, 12, 16, 16, 16, 20, 24, 24, 24, 28, 32, 32, 40, 48, 64, 96, 128
+    };
+    *seed = *seed * 1103515245 + 12345;
+    return kSizes[(*seed >> 16) % NELEM(kSizes)];
+}
+
+static void addChunk(void* start, void* end, size_t usedBytes, void* arg)
+{
+    if (start != NULL && usedBytes != 0) {
+        *(size_t *)arg += usedBytes + HEAP_SOURCE_CHUNK_OVERHEAD;
+    }
+}
+
+/*
+ * Returns the number of bytes held by allocated chunks in the mspace.
+ */
+static size_t usedBytes(mspace msp)
+{
+    size_t total = 0;
+    mspace_inspect_all(msp, addChunk, &total);
+    return total;
+}
+
+static int compareAddresses(const void *a, const void *b)
+{
+    uintptr_t pa = *(const uintptr_t *)a;
+    uintptr_t pb = *(const uintptr_t *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+static bool isZeroed(const void *ptr, size_t n)
+{
+    const u1 *p = (const u1 *)ptr;
+    for (size_t i = 0; i < n; ++i) {
+        if (p[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Allocates kNumObjects objects, frees every other one in address order
+ * the way the sweeper would, then allocates the freed half again.
+ */
+static bool runWorkload(bool useSlab, void **ptrs, size_t *sizes)
+{
+    void *base = dvmAllocRegion(kRegionSize, PROT_READ | PROT_WRITE,
+                                "dalvik-test-slab");
+    if (base == NULL) {
+        return false;
+    }
+    mspace msp = create_mspace_with_base(base, kRegionSize, false);
+    SlabRunMap map;
+    SlabSpace space;
+    bool result = false;
+    if (msp == NULL || !dvmSlabRunMapInit(&map, base, kRegionSize)) {
+        ALOGE("Can't create test mspace");
+        munmap(base, kRegionSize);
+        return false;
+    }
+    dvmSlabInitSpace(&space, msp, &map);
+
+    u4 seed = 1;
+    size_t requested = 0;
+    u8 start = dvmGetRelativeTimeUsec();
+    for (int i = 0; i < kNumObjects; ++i) {
+        sizes[i] = objectSize(&seed);
+        requested += sizes[i];
+        ptrs[i] = useSlab ? dvmSlabAlloc(&space, sizes[i])
+                          : mspace_calloc(msp, 1, sizes[i]);
+    }
+    u8 allocTime = dvmGetRelativeTimeUsec() - start;
+
+    for (int i = 0; i < kNumObjects; ++i) {
+        if (ptrs[i] == NULL || !isZeroed(ptrs[i], sizes[i])) {
+            ALOGE("Bad allocation %d (%zd bytes)", i, sizes[i]);
+            goto bail;
+        }
+        if (useSlab && dvmSlabChunkSize(&map, ptrs[i]) < sizes[i]) {
+            ALOGE("Slab slot too small for %zd bytes", sizes[i]);
+            goto bail;
+        }
+        memset(ptrs[i], 0xa5, sizes[i]);
+    }
+    size_t fullBytes;
+    fullBytes = usedBytes(msp);
+
+    /* Free every other object in increasing address order. */
+    qsort(ptrs, kNumObjects, sizeof(ptrs[0]), compareAddresses);
+    start = dvmGetRelativeTimeUsec();
+    for (int i = 0; i < kNumObjects; i += 2) {
+        if (useSlab && dvmSlabChunkSize(&map, ptrs[i]) != 0) {
+            dvmSlabFree(&space, ptrs[i]);
+        } else {
+            mspace_free(msp, ptrs[i]);
+        }
+    }
+    u8 freeTime;
+    freeTime = dvmGetRelativeTimeUsec() - start;
+
+    /* Fill the holes again with a fresh stream of sizes. */
+    start = dvmGetRelativeTimeUsec();
+    for (int i = 0; i < kNumObjects; i += 2) {
+        size_t n = objectSize(&seed);
+        ptrs[i] = useSlab ? dvmSlabAlloc(&space, n)
+                          : mspace_calloc(msp, 1, n);
+        if (ptrs[i] == NULL || !isZeroed(ptrs[i], n)) {
+            ALOGE("Bad reallocation %d (%zd bytes)", i, n);
+            goto bail;
+        }
+    }
+    u8 reallocTime;
+    reallocTime = dvmGetRelativeTimeUsec() - start;
+
+    DBUG_MSG("%s: %d objects (%zd bytes requested) in %zd bytes, "
+             "alloc %lldus, free half %lldus, refill half %lldus, "
+             "after refill %zd bytes",
+             useSlab ? "slab" : "mspace", kNumObjects, requested, fullBytes,
+             allocTime, freeTime, reallocTime, usedBytes(msp));
+    result = true;
+
+bail:
+    destroy_mspace(msp);
+    dvmSlabRunMapDelete(&map);
+    munmap(base, kRegionSize);
+    return result;
+}
+
+/*
+ * Runs the same allocation workload against both allocators and logs
+ * footprint and timing for each.
+ */
+bool dvmTestSlabAllocSpeed()
+{
+    void **ptrs = (void **)malloc(kNumObjects * sizeof(void *));
+    size_t *sizes = (size_t *)malloc(kNumObjects * sizeof(size_t));
+    bool result = ptrs != NULL && sizes != NULL &&
+            runWorkload(false, ptrs, sizes) &&
+            runWorkload(true, ptrs, sizes);
+    free(ptrs);
+    free(sizes);
+    if (!result) {
+        ALOGE("Slab allocator test failed");
+    }
+    return result;
+}
+
+#endif /*NDEBUG*/
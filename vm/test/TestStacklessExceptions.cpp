@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throw exceptions from Java code with -Xstacklessexceptions naming
+ * IllegalArgumentException, and check which ones get a stack trace: the
+ * class itself and its subclasses shouldn't, others should.
+ */
+#include "Dalvik.h"
+
+#ifndef NDEBUG
+
+static char kStacklessClass[] = "Ljava/lang/IllegalArgumentException;";
+
+/*
+ * Call a method that is expected to throw <descriptor>, and report
+ * whether the exception recorded any stack frames.  Returns false if
+ * something else happened.
+ */
+static bool callAndCheck(Thread* self, const Method* method, Object* obj,
+    const char* descriptor, bool expectStackless, ...)
+{
+    JValue unused;
+    va_list args;
+    va_start(args, expectStackless);
+    dvmCallMethodV(self, method, obj, false, &unused, args);
+    va_end(args);
+
+    Object* exception = dvmGetException(self);
+    if (exception == NULL) {
+        ALOGE("%s.%s didn't throw", method->clazz->descriptor, method->name);
+        return false;
+    }
+    bool result = true;
+    if (strcmp(exception->clazz->descriptor, descriptor) != 0) {
+        ALOGE("%s.%s threw %s, expected %s", method->clazz->descriptor,
+            method->name, exception->clazz->descriptor, descriptor);
+        result = false;
+    } else {
+        const ArrayObject* stackData = (const ArrayObject*) dvmGetFieldObject(
+            exception, gDvm.offJavaLangThrowable_stackState);
+        bool stackless = stackData == NULL || stackData->length == 0;
+        if (stackless != expectStackless) {
+            ALOGE("%s %s a stack trace", descriptor,
+                expectStackless ? "has" : "has no");
+            result = false;
+        }
+    }
+    dvmClearException(self);
+    return result;
+}
+
+bool dvmTestStacklessExceptions()
+{
+    Thread* self = dvmThreadSelf();
+    char* stackless[] = { kStacklessClass };
+    char** oldStackless = gDvm.stacklessExceptions;
+    size_t oldNumStackless = gDvm.numStacklessExceptions;
+    bool result = false;
+
+    ClassObject* arrayListClass =
+        dvmFindSystemClass("Ljava/util/ArrayList;");
+    ClassObject* integerClass = dvmFindSystemClass("Ljava/lang/Integer;");
+    if (arrayListClass == NULL || integerClass == NULL) {
+        dvmClearException(self);
+        ALOGE("Can't find test classes");
+        return false;
+    }
+    const Method* arrayListInit = dvmFindDirectMethodByDescriptor(
+        arrayListClass, "<init>", "(I)V");
+    const Method* parseInt = dvmFindDirectMethodByDescriptor(
+        integerClass, "parseInt", "(Ljava/lang/String;)I");
+    const Method* substring = dvmFindVirtualMethodHierByDescriptor(
+        gDvm.classJavaLangString, "substring", "(I)Ljava/lang/String;");
+    if (arrayListInit == NULL || parseInt == NULL || substring == NULL) {
+        ALOGE("Can't find test methods");
+        return false;
+    }
+
+    Object* list = dvmAllocObject(arrayListClass, ALLOC_DEFAULT);
+    StringObject* str = dvmCreateStringFromCstr("abc");
+    if (list == NULL || str == NULL) {
+        dvmReleaseTrackedAlloc(list, self);
+        dvmReleaseTrackedAlloc((Object*) str, self);
+        return false;
+    }
+
+    gDvm.stacklessExceptions = stackless;
+    gDvm.numStacklessExceptions = 1;
+
+    /* new ArrayList(-1) throws the class itself */
+    if (!callAndCheck(self, arrayListInit, list,
+            "Ljava/lang/IllegalArgumentException;", true, -1)) {
+        goto bail;
+    }
+    /* Integer.parseInt("abc") throws a subclass */
+    if (!callAndCheck(self, parseInt, NULL,
+            "Ljava/lang/NumberFormatException;", true, str)) {
+        goto bail;
+    }
+    /* "abc".substring(5) throws an unrelated exception */
+    if (!callAndCheck(self, substring, (Object*) str,
+            "Ljava/lang/StringIndexOutOfBoundsException;", false, 5)) {
+        goto bail;
+    }
+    result = true;
+
+bail:
+    gDvm.stacklessExceptions = oldStackless;
+    gDvm.numStacklessExceptions = oldNumStackless;
+    dvmReleaseTrackedAlloc(list, self);
+    dvmReleaseTrackedAlloc((Object*) str, self);
+    return result;
+}
+
+#endif /*NDEBUG*/
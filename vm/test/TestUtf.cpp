@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Check the UTF-8 and UTF-16 conversion and hashing functions against
+ * plain one-char-at-a-time versions on random strings, then time both.
+ */
+#include "Dalvik.h"
+
+#ifndef NDEBUG
+
+#define DBUG_MSG    ALOGI
+
+static const int kFuzzRounds = 20000;
+static const int kMaxChars = 300;
+static const int kBenchRounds = 20000;
+static const int kBenchChars = 64;
+
+/*
+ * Reference versions, one char at a time.
+ */
+static u4 refUtf8Hash(const char* utf8Str)
+{
+    u4 hash = 1;
+    while (*utf8Str != '\0')
+        hash = hash * 31 + *utf8Str++;
+    return hash;
+}
+
+static size_t refUtf8Len(const char* utf8Str)
+{
+    size_t len = 0;
+    int ic;
+    while ((ic = *utf8Str++) != '\0') {
+        len++;
+        if ((ic & 0x80) != 0) {
+            utf8Str++;
+            if ((ic & 0x20) != 0)
+                utf8Str++;
+        }
+    }
+    return len;
+}
+
+static void refUtf8ToUtf16(u2* utf16Str, const char* utf8Str)
+{
+    while (*utf8Str != '\0')
+        *utf16Str++ = dexGetUtf16FromUtf8(&utf8Str);
+}
+
+static int refUtf8ByteLen(const u2* utf16Str, int len)
+{
+    int utf8Len = 0;
+    while (len--) {
+        unsigned int uic = *utf16Str++;
+        if (uic == 0 || uic > 0x7f)
+            utf8Len += (uic > 0x07ff) ? 3 : 2;
+        else
+            utf8Len++;
+    }
+    return utf8Len;
+}
+
+static void refUtf16ToUtf8(char* utf8Str, const u2* utf16Str, int len)
+{
+    while (len--) {
+        unsigned int uic = *utf16Str++;
+        if (uic == 0 || uic > 0x7f) {
+            if (uic > 0x07ff) {
+                *utf8Str++ = (uic >> 12) | 0xe0;
+                *utf8Str++ = ((uic >> 6) & 0x3f) | 0x80;
+                *utf8Str++ = (uic & 0x3f) | 0x80;
+            } else {
+                *utf8Str++ = (uic >> 6) | 0xc0;
+                *utf8Str++ = (uic & 0x3f) | 0x80;
+            }
+        } else {
+            *utf8Str++ = uic;
+        }
+    }
+    *utf8Str = '\0';
+}
+
+static u4 refUtf16Hash(const u2* utf16Str, size_t len)
+{
+    u4 hash = 0;
+    while (len--)
+        hash = hash * 31 + *utf16Str++;
+    return hash;
+}
+
+static u4 nextRandom(u4* pSeed)
+{
+    *pSeed = *pSeed * 1103515245 + 12345;
+    return *pSeed >> 8;
+}
+
+/*
+ * Make a random string, mostly ASCII, with an occasional char from one
+ * of the other size classes or right on a boundary between them.
+ */
+static void makeChars(u2* chars, int len, u4* pSeed, int nonAsciiOdds)
+{
+    static const u2 kEdges[] = {
+        0x0000, 0x0001, 0x007f, 0x0080, 0x07ff, 0x0800, 0xd800, 0xffff
+    };
+
+    for (int i = 0; i < len; i++) {
+        u4 r = nextRandom(pSeed);
+        if (nonAsciiOdds == 0 || r % nonAsciiOdds != 0) {
+            chars[i] = 0x20 + (r >> 8) % 0x5f;
+        } else if ((r & 0x100) != 0) {
+            chars[i] = kEdges[(r >> 9) % NELEM(kEdges)];
+        } else {
+            chars[i] = (u2) (r >> 8);
+        }
+    }
+}
+
+static bool fuzzOne(const u2* chars, int len, char* utf8Buf, u2* utf16Buf,
+    int align)
+{
+    char* utf8 = utf8Buf + align;
+    char refUtf8[kMaxChars * 3 + 1];
+
+    int byteLen = dvmUtf16Utf8ByteLen(chars, len);
+    if (byteLen != refUtf8ByteLen(chars, len)) {
+        ALOGE("Utf16Utf8ByteLen: %d vs %d", byteLen,
+            refUtf8ByteLen(chars, len));
+        return false;
+    }
+
+    dvmConvertUtf16ToUtf8(utf8, chars, len);
+    refUtf16ToUtf8(refUtf8, chars, len);
+    if (memcmp(utf8, refUtf8, byteLen + 1) != 0) {
+        ALOGE("ConvertUtf16ToUtf8 differs (len=%d)", len);
+        return false;
+    }
+
+    if (dvmUtf8Len(utf8) != refUtf8Len(utf8) ||
+        dvmUtf8Len(utf8) != (size_t) len)
+    {
+        ALOGE("Utf8Len: %zd vs %d", dvmUtf8Len(utf8), len);
+        return false;
+    }
+
+    dvmConvertUtf8ToUtf16(utf16Buf, utf8);
+    if (memcmp(utf16Buf, chars, len * sizeof(u2)) != 0) {
+        ALOGE("ConvertUtf8ToUtf16 differs (len=%d)", len);
+        return false;
+    }
+
+    if (dvmComputeUtf8Hash(utf8) != refUtf8Hash(utf8)) {
+        ALOGE("ComputeUtf8Hash differs (len=%d)", len);
+        return false;
+    }
+    if (dvmComputeUtf16Hash(chars, len) != refUtf16Hash(chars, len)) {
+        ALOGE("ComputeUtf16Hash differs (len=%d)", len);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Random strings at every alignment, with everything from no non-ASCII
+ * chars to nothing but.
+ */
+static bool fuzz(char* utf8Buf, u2* utf16Buf)
+{
+    static const int kOdds[] = { 0, 200, 20, 3, 1 };
+    u2 chars[kMaxChars];
+    u4 seed = 1;
+
+    for (int i = 0; i < kFuzzRounds; i++) {
+        int len = nextRandom(&seed) % kMaxChars;
+        int odds = kOdds[i % NELEM(kOdds)];
+        makeChars(chars, len, &seed, odds);
+        if (!fuzzOne(chars, len, utf8Buf, utf16Buf, i % 32)) {
+            ALOGE("UTF fuzz failed in round %d (odds=%d)", i, odds);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void benchmark(const char* label, int nonAsciiOdds, char* utf8,
+    u2* utf16Buf)
+{
+    u2 chars[kBenchChars];
+    u4 seed = 7;
+    makeChars(chars, kBenchChars, &seed, nonAsciiOdds);
+    refUtf16ToUtf8(utf8, chars, kBenchChars);
+
+    /* keep the compiler from dropping the calls */
+    u4 sink = 0;
+
+    u8 start = dvmGetRelativeTimeUsec();
+    for (int i = 0; i < kBenchRounds; i++) {
+        sink += refUtf8Len(utf8);
+        refUtf8ToUtf16(utf16Buf, utf8);
+        sink += refUtf8ByteLen(chars, kBenchChars);
+        refUtf16ToUtf8(utf8, chars, kBenchChars);
+        sink += refUtf8Hash(utf8) + refUtf16Hash(chars, kBenchChars);
+    }
+    u8 refTime = dvmGetRelativeTimeUsec() - start;
+
+    start = dvmGetRelativeTimeUsec();
+    for (int i = 0; i < kBenchRounds; i++) {
+        sink += dvmUtf8Len(utf8);
+        dvmConvertUtf8ToUtf16(utf16Buf, utf8);
+        sink += dvmUtf16Utf8ByteLen(chars, kBenchChars);
+        dvmConvertUtf16ToUtf8(utf8, chars, kBenchChars);
+        sink += dvmComputeUtf8Hash(utf8) +
+                dvmComputeUtf16Hash(chars, kBenchChars);
+    }
+    u8 newTime = dvmGetRelativeTimeUsec() - start;
+
+    DBUG_MSG("UTF %s, %d x %d chars: char at a time %lldus, now %lldus (%x)",
+        label, kBenchRounds, kBenchChars, refTime, newTime, sink);
+}
+
+bool dvmTestUtf()
+{
+    char* utf8Alloc = (char*) malloc(kMaxChars * 3 + 64);
+    u2* utf16Buf = (u2*) malloc(kMaxChars * sizeof(u2));
+    bool result = false;
+
+    /* 16-byte aligned, so the alignment in fuzz() is the real one */
+    char* utf8Buf = (char*) (((uintptr_t) utf8Alloc + 15) & ~15);
+    if (utf8Alloc != NULL && utf16Buf != NULL && fuzz(utf8Buf, utf16Buf)) {
+        benchmark("ASCII", 0, utf8Buf, utf16Buf);
+        benchmark("mixed", 8, utf8Buf, utf16Buf);
+        result = true;
+    }
+
+    free(utf8Alloc);
+    free(utf16Buf);
+    return result;
+}
+
+#endif /*NDEBUG*/
@@ -0,0 +1,504 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Build an archive holding large, DEX-sized entries, and time extracting
+ * them: one entry with its checksum computed by reading the output back
+ * versus computed while streaming, and several entries on one thread
+ * versus several.  Also extract entries whose last full output buffer is
+ * written after all of the compressed data has been read.
+ */
+#include "Dalvik.h"
+#include "Bits.h"
+
+#include <zlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#ifndef NDEBUG
+
+#define DBUG_MSG    ALOGI
+
+#ifdef HAVE_ANDROID_OS
+# define kTestDir   "/data/local/tmp"
+#else
+# define kTestDir   "/tmp"
+#endif
+
+static const size_t kEntrySize = 8 * 1024 * 1024;
+static const int kNumEntries = 4;
+static const int kNumThreads = 4;
+
+/* DEX header bytes not covered by its checksum */
+static const size_t kDexChecksumSkip = 12;
+
+/* Size of the output buffer used by the extraction code */
+static const size_t kExtractBufSize = 256 * 1024;
+static const int kNumBoundaryEntries = 4;
+
+/*
+ * Fill a buffer with something that compresses about as well as a DEX
+ * file: runs of repeated records broken up by noise.
+ */
+static void fillEntry(u1* buf, size_t len, u4 seed)
+{
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        if ((i & 0x3f) < 40) {
+            buf[i] = (u1) ((i >> 6) ^ (i & 0x0f));
+        } else {
+            buf[i] = (u1) (seed >> 16);
+        }
+    }
+}
+
+/*
+ * Write one deflated entry, and its central directory record into "cd".
+ * Returns false on failure.
+ */
+static bool writeEntry(int fd, const char* name, const u1* data, size_t len,
+    u1* cd, size_t* pCdLen)
+{
+    bool result = false;
+    size_t nameLen = strlen(name);
+    off_t localOffset = lseek(fd, 0, SEEK_CUR);
+    u4 crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, data, len);
+
+    z_stream zstream;
+    memset(&zstream, 0, sizeof(zstream));
+    if (deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+            8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    size_t bound = deflateBound(&zstream, len);
+    u1* comp = (u1*) malloc(bound);
+    if (comp == NULL) {
+        deflateEnd(&zstream);
+        return false;
+    }
+    zstream.next_in = (Bytef*) data;
+    zstream.avail_in = len;
+    zstream.next_out = comp;
+    zstream.avail_out = bound;
+    if (deflate(&zstream, Z_FINISH) != Z_STREAM_END) {
+        ALOGE("deflate of '%s' failed", name);
+        goto bail;
+    }
+
+    {
+        size_t compLen = zstream.total_out;
+        u1 lfh[30];
+        memset(lfh, 0, sizeof(lfh));
+        set4LE(lfh, 0x04034b50);
+        set2LE(lfh + 4, 20);
+        set2LE(lfh + 8, kCompressDeflated);
+        set4LE(lfh + 14, crc);
+        set4LE(lfh + 18, compLen);
+        set4LE(lfh + 22, len);
+        set2LE(lfh + 26, nameLen);
+        if (sysWriteFully(fd, lfh, sizeof(lfh), "zip test") != 0 ||
+            sysWriteFully(fd, name, nameLen, "zip test") != 0 ||
+            sysWriteFully(fd, comp, compLen, "zip test") != 0)
+        {
+            goto bail;
+        }
+
+        u1* cde = cd + *pCdLen;
+        memset(cde, 0, 46);
+        set4LE(cde, 0x02014b50);
+        set2LE(cde + 4, 20);
+        set2LE(cde + 6, 20);
+        set2LE(cde + 10, kCompressDeflated);
+        set4LE(cde + 16, crc);
+        set4LE(cde + 20, compLen);
+        set4LE(cde + 24, len);
+        set2LE(cde + 28, nameLen);
+        set4LE(cde + 42, localOffset);
+        memcpy(cde + 46, name, nameLen);
+        *pCdLen += 46 + nameLen;
+    }
+    result = true;
+
+bail:
+    deflateEnd(&zstream);
+    free(comp);
+    return result;
+}
+
+/*
+ * Write the central directory and its end record.
+ */
+static bool writeCentralDirectory(int fd, const u1* cd, size_t cdLen,
+    int numEntries)
+{
+    off_t cdOffset = lseek(fd, 0, SEEK_CUR);
+    u1 eocd[22];
+    memset(eocd, 0, sizeof(eocd));
+    set4LE(eocd, 0x06054b50);
+    set2LE(eocd + 8, numEntries);
+    set2LE(eocd + 10, numEntries);
+    set4LE(eocd + 12, cdLen);
+    set4LE(eocd + 16, cdOffset);
+    return sysWriteFully(fd, cd, cdLen, "zip test") == 0 &&
+        sysWriteFully(fd, eocd, sizeof(eocd), "zip test") == 0;
+}
+
+/*
+ * Create the archive, with "classes.dex", "classes2.dex" and so on.
+ */
+static bool writeArchive(const char* fileName, u1* data)
+{
+    bool result = false;
+    u1 cd[kNumEntries * 64];
+    size_t cdLen = 0;
+    int fd = open(fileName, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        ALOGE("Unable to create '%s': %s", fileName, strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < kNumEntries; i++) {
+        char name[32];
+        if (i == 0) {
+            strcpy(name, "classes.dex");
+        } else {
+            sprintf(name, "classes%d.dex", i + 1);
+        }
+        fillEntry(data, kEntrySize, i);
+        if (!writeEntry(fd, name, data, kEntrySize, cd, &cdLen)) {
+            goto bail;
+        }
+    }
+
+    result = writeCentralDirectory(fd, cd, cdLen, kNumEntries);
+
+bail:
+    close(fd);
+    return result;
+}
+
+/*
+ * Fill entry "i" of the boundary archive, and return its size.  The
+ * compressed form of a run of zeroes is used up while inflate still
+ * holds output that didn't fit in the buffer, so zero-filled entries a
+ * little longer than a whole number of buffers make the last full flush
+ * land on the buffer boundary with the input already exhausted.
+ */
+static size_t fillBoundaryEntry(u1* buf, int i)
+{
+    static const size_t kSizes[kNumBoundaryEntries] = {
+        kExtractBufSize, kExtractBufSize + 100,
+        2 * kExtractBufSize, 2 * kExtractBufSize + 100,
+    };
+    size_t len = kSizes[i];
+    if (i == 2) {
+        fillEntry(buf, len, i);
+    } else {
+        memset(buf, 0, len);
+    }
+    return len;
+}
+
+/*
+ * Create an archive with "boundary0.dex", "boundary1.dex" and so on.
+ */
+static bool writeBoundaryArchive(const char* fileName, u1* data)
+{
+    bool result = false;
+    u1 cd[kNumBoundaryEntries * 64];
+    size_t cdLen = 0;
+    int fd = open(fileName, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        ALOGE("Unable to create '%s': %s", fileName, strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < kNumBoundaryEntries; i++) {
+        char name[32];
+        sprintf(name, "boundary%d.dex", i);
+        size_t len = fillBoundaryEntry(data, i);
+        if (!writeEntry(fd, name, data, len, cd, &cdLen)) {
+            goto bail;
+        }
+    }
+
+    result = writeCentralDirectory(fd, cd, cdLen, kNumBoundaryEntries);
+
+bail:
+    close(fd);
+    return result;
+}
+
+/*
+ * Read back "len" bytes from the start of a file and sum them the way
+ * the extraction path used to.
+ */
+static bool readBackChecksum(int fd, size_t len, u4* pAdler)
+{
+    u1 buf[8192];
+    uLong adler = adler32(0L, Z_NULL, 0);
+    size_t skip = kDexChecksumSkip;
+
+    if (lseek(fd, 0, SEEK_SET) != 0) {
+        return false;
+    }
+    while (len != 0) {
+        size_t wanted = (len < sizeof(buf)) ? len : sizeof(buf);
+        ssize_t actual = read(fd, buf, wanted);
+        if (actual <= 0) {
+            return false;
+        }
+        adler = adler32(adler, buf + skip, actual - skip);
+        skip = 0;
+        len -= actual;
+    }
+    *pAdler = adler;
+    return true;
+}
+
+static int openOutput(const char* dir, int i)
+{
+    char fileName[PATH_MAX];
+    snprintf(fileName, sizeof(fileName), "%s/zipextract-%d-%d.dex", dir,
+        getpid(), i);
+    int fd = open(fileName, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd < 0) {
+        ALOGE("Unable to create '%s': %s", fileName, strerror(errno));
+    } else {
+        unlink(fileName);
+    }
+    return fd;
+}
+
+static bool resetOutputs(const int* fds)
+{
+    for (int i = 0; i < kNumEntries; i++) {
+        if (ftruncate(fds[i], 0) != 0 || lseek(fds[i], 0, SEEK_SET) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool testExtract(ZipArchive* pArchive)
+{
+    bool result = false;
+    ZipEntry entries[kNumEntries];
+    int fds[kNumEntries];
+    u1* check = (u1*) malloc(kEntrySize);
+
+    for (int i = 0; i < kNumEntries; i++) {
+        fds[i] = -1;
+    }
+    if (check == NULL) {
+        goto bail;
+    }
+    for (int i = 0; i < kNumEntries; i++) {
+        char name[32];
+        if (i == 0) {
+            strcpy(name, "classes.dex");
+        } else {
+            sprintf(name, "classes%d.dex", i + 1);
+        }
+        entries[i] = dexZipFindEntry(pArchive, name);
+        fds[i] = openOutput(kTestDir, i);
+        if (entries[i] == NULL || fds[i] < 0) {
+            ALOGE("Zip test setup failed for '%s'", name);
+            goto bail;
+        }
+    }
+
+    /*
+     * One large entry: extract and read back for the checksum, versus
+     * checksum while extracting.
+     */
+    {
+        u8 start = dvmGetRelativeTimeUsec();
+        u4 readBackSum;
+        if (dexZipExtractEntryToFile(pArchive, entries[0], fds[0]) != 0 ||
+            !readBackChecksum(fds[0], kEntrySize, &readBackSum))
+        {
+            ALOGE("Extract and read back failed");
+            goto bail;
+        }
+        u8 readBackTime = dvmGetRelativeTimeUsec() - start;
+
+        if (!resetOutputs(fds)) {
+            goto bail;
+        }
+        start = dvmGetRelativeTimeUsec();
+        ZipExtractSums sums;
+        sums.adlerSkip = kDexChecksumSkip;
+        if (dexZipExtractEntryToFileWithSums(pArchive, entries[0], fds[0],
+                &sums) != 0)
+        {
+            ALOGE("Streaming extract failed");
+            goto bail;
+        }
+        u8 streamTime = dvmGetRelativeTimeUsec() - start;
+
+        if (sums.adler32 != readBackSum) {
+            ALOGE("Streaming checksum %08x, read back %08x",
+                sums.adler32, readBackSum);
+            goto bail;
+        }
+        if (lseek(fds[0], 0, SEEK_CUR) != (off_t) kEntrySize) {
+            ALOGE("Output not positioned at end of entry");
+            goto bail;
+        }
+
+        DBUG_MSG("Extract %zdKB: read back %lldus, streaming %lldus",
+            kEntrySize / 1024, readBackTime, streamTime);
+    }
+
+    /*
+     * All the entries, one thread versus several.
+     */
+    for (int numThreads = 1; numThreads <= kNumThreads; numThreads *= 2) {
+        if (!resetOutputs(fds)) {
+            goto bail;
+        }
+        u8 start = dvmGetRelativeTimeUsec();
+        if (dexZipExtractEntriesToFiles(pArchive, entries, fds, kNumEntries,
+                numThreads) != 0)
+        {
+            ALOGE("Extract on %d threads failed", numThreads);
+            goto bail;
+        }
+        u8 elapsed = dvmGetRelativeTimeUsec() - start;
+        DBUG_MSG("Extract %d x %zdKB on %d threads: %lldus",
+            kNumEntries, kEntrySize / 1024, numThreads, elapsed);
+    }
+
+    /* the last round's output had better be right */
+    for (int i = 0; i < kNumEntries; i++) {
+        fillEntry(check, kEntrySize, i);
+        u1* out = (u1*) mmap(NULL, kEntrySize, PROT_READ, MAP_SHARED,
+                        fds[i], 0);
+        if (out == MAP_FAILED) {
+            ALOGE("Unable to map output %d: %s", i, strerror(errno));
+            goto bail;
+        }
+        bool same = memcmp(out, check, kEntrySize) == 0;
+        munmap(out, kEntrySize);
+        if (!same) {
+            ALOGE("Extracted entry %d is wrong", i);
+            goto bail;
+        }
+    }
+
+    result = true;
+
+bail:
+    for (int i = 0; i < kNumEntries; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    free(check);
+    return result;
+}
+
+/*
+ * Extract the entries of the boundary archive and check them.
+ */
+static bool testBoundaryExtract(ZipArchive* pArchive, u1* check)
+{
+    for (int i = 0; i < kNumBoundaryEntries; i++) {
+        char name[32];
+        sprintf(name, "boundary%d.dex", i);
+        ZipEntry entry = dexZipFindEntry(pArchive, name);
+        int fd = openOutput(kTestDir, i);
+        if (entry == NULL || fd < 0) {
+            ALOGE("Zip test setup failed for '%s'", name);
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+
+        size_t len = fillBoundaryEntry(check, i);
+        bool same = false;
+        if (dexZipExtractEntryToFile(pArchive, entry, fd) != 0) {
+            ALOGE("Extract of '%s' failed", name);
+        } else {
+            u1* out = (u1*) mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+            if (out == MAP_FAILED) {
+                ALOGE("Unable to map '%s': %s", name, strerror(errno));
+            } else {
+                same = lseek(fd, 0, SEEK_CUR) == (off_t) len &&
+                    memcmp(out, check, len) == 0;
+                munmap(out, len);
+                if (!same) {
+                    ALOGE("Extracted '%s' is wrong", name);
+                }
+            }
+        }
+        close(fd);
+        if (!same) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool dvmTestZipExtract()
+{
+    char fileName[PATH_MAX];
+    snprintf(fileName, sizeof(fileName), "%s/zipextract-%d.zip", kTestDir,
+        getpid());
+
+    u1* data = (u1*) malloc(kEntrySize);
+    if (data == NULL) {
+        return false;
+    }
+    bool result = writeArchive(fileName, data);
+
+    if (result) {
+        ZipArchive archive;
+        if (dexZipOpenArchive(fileName, &archive) != 0) {
+            ALOGE("Unable to open test archive '%s'", fileName);
+            result = false;
+        } else {
+            result = testExtract(&archive);
+            dexZipCloseArchive(&archive);
+        }
+    }
+
+    if (result) {
+        result = writeBoundaryArchive(fileName, data);
+    }
+    if (result) {
+        ZipArchive archive;
+        if (dexZipOpenArchive(fileName, &archive) != 0) {
+            ALOGE("Unable to open test archive '%s'", fileName);
+            result = false;
+        } else {
+            result = testBoundaryExtract(&archive, data);
+            dexZipCloseArchive(&archive);
+        }
+    }
+    free(data);
+    unlink(fileName);
+
+    if (!result) {
+        ALOGE("Zip extract test failed");
+    }
+    return result;
+}
+
+#endif /*NDEBUG*/